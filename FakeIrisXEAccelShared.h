@@ -14,19 +14,15 @@ enum {
     kAccelSel_Flush = 4,
     kAccelSel_DestroyContext = 5,
     kAccelSel_BindSurface = 6,
+    kAccelSel_CreateRing = 7,       // size the shared ring before mapping it
+    kAccelSel_GetStats = 8,         // out: XEAccelStats; scalar[0] != 0 resets after reading
     kAccelSel_InjectTest = 10,      // debug
-};
-
-
-struct XECtx {
-    uint32_t ctxId;
-    bool alive;
-    uintptr_t surf_vaddr;   // kernel-side pointer (mapped via clientMemory / IOConnectMapMemory64)
-    size_t surf_bytes;
-    uint32_t surf_rowbytes; // bytes per row in source
-    uint32_t surf_w;
-    uint32_t surf_h;
-    // optional: more flags
+    kAccelSel_BOCreate = 11,        // scalar in: size, flags (0); scalar out: handle, size
+    kAccelSel_BOClose = 12,         // scalar in: handle
+    kAccelSel_BOGetSize = 13,       // scalar in: handle; scalar out: size
+    kAccelSel_BindSurfaceBO = 14,   // in: XEBindSurfaceBOIn; out: XEBindSurfaceOut
+    kAccelSel_VMBind = 15,          // scalar in: ctxId, handle, align (0: a page); scalar out: GPU address
+    kAccelSel_VMUnbind = 16,        // scalar in: ctxId, GPU address
 };
 
 
@@ -35,12 +31,70 @@ struct XECtx {
 // ===== Capability struct =====
 //
 struct XEAccelCaps {
-    uint32_t version;          // = 1
+    uint32_t version;          // XE_VERSION
     uint32_t metalSupported;   // 0 or 1
-    uint32_t reserved0;
+    uint32_t scanoutCount;     // buffers usable with XE_CMD_FLIP
     uint32_t reserved1;
 };
 
+//
+// ===== clientMemoryForType types =====
+//
+enum : uint32_t {
+    kAccelMem_Ring    = 1,      // XEHdr + command ring
+    kAccelMem_Scanout = 0x10,   // + index: scanout buffer, index < XEAccelCaps.scanoutCount
+    kAccelMem_BO      = 0x100000,   // and up: a buffer object; the type is its handle
+};
+
+//
+// ===== Buffer objects =====
+//
+// Kernel-allocated, page-rounded, wired memory named by a handle that is
+// only valid on the connection that created it. Map one by passing its
+// handle as the clientMemoryForType type; handles are never below
+// kAccelMem_BO. Closing a handle doesn't pull the pages from under
+// mappings or bound surfaces, they keep their own references.
+//
+static constexpr uint64_t XE_BO_MAX_BYTES        = 256ull << 20;   // one object
+static constexpr uint64_t XE_BO_CLIENT_MAX_BYTES = 1ull << 30;     // all of a connection's objects
+static constexpr uint32_t XE_BO_MAX_HANDLES      = 4096;           // per connection
+
+//
+// ===== Per-context address space =====
+//
+// Every context has its own GPU address space (a PPGTT). kAccelSel_VMBind
+// maps a whole buffer object into it and returns the address, never 0;
+// the mapping holds the object's memory until kAccelSel_VMUnbind or the
+// context is destroyed, whatever happens to the handle.
+//
+
+//
+// ===== Statistics (kAccelSel_GetStats) =====
+//
+static constexpr uint32_t XE_STATS_OPCODES = 16;   // opcodes past the end land in the last slot
+static constexpr uint32_t XE_STATS_BUCKETS = 8;    // bucket i: < 4^i us; the last one is open-ended
+
+struct XEOpStats {
+    uint64_t count;
+    uint64_t totalNs;      // execution time, summed over all slices of a resumable command
+    uint64_t maxNs;
+    uint64_t hist[XE_STATS_BUCKETS];
+};
+
+struct XEAccelStats {
+    uint32_t numOpcodes;       // XE_STATS_OPCODES
+    uint32_t numBuckets;       // XE_STATS_BUCKETS
+    uint64_t ticksWork;        // drains that found commands
+    uint64_t ticksIdle;        // drains that found the ring empty
+    uint64_t cmdsRetired;
+    uint64_t maxCmdsPerTick;
+    uint64_t ringHighWater;    // most bytes ever queued (head - tail)
+    uint64_t presentBytes;     // framebuffer bytes written by PRESENT
+    uint64_t presentRects;     // copies PRESENT made, after damage merging
+    XEOpStats op[XE_STATS_OPCODES];
+    uint64_t cmdsRejected;     // malformed records and payloads, dropped without running
+};
+
 //
 // ===== Context Create =====
 //
@@ -63,9 +117,31 @@ struct XESubmitIn {
     uint32_t numBytes;
 };
 
+//
+// ===== Ring Create =====
+// Must be called before the ring is mapped (clientMemoryForType type 1).
+// ringBytes is rounded up to a power of two and clamped to
+// [XE_RING_MIN_BYTES, XE_RING_MAX_BYTES]; 0 selects the default.
+//
+struct XECreateRingIn {
+    uint32_t ringBytes;
+    uint32_t flags;       // reserved, 0
+};
+
+struct XECreateRingOut {
+    uint32_t capacity;    // ring bytes actually allocated (== XEHdr.capacity)
+    uint32_t mapBytes;    // total size of the type-1 mapping (header + ring)
+};
+
 //
 // ===== Surface Bind =====
 //
+// The client's pages are wired for as long as the surface is bound. A
+// surface whose cpuPtr is page aligned and whose size and bytesPerRow
+// match the display, in XE_SURF_FORMAT_SCANOUT, is also mapped into the
+// GGTT; PRESENT then points the plane at it instead of copying.
+static constexpr uint32_t XE_SURF_FORMAT_SCANOUT = 0x42475241;   // 'BGRA': little-endian 0xAARRGGBB words
+
 struct XEBindSurfaceIn {
   uint32_t ctxId;
   uint32_t ioSurfaceID;
@@ -80,18 +156,43 @@ struct XEBindSurfaceIn {
 };
 
 
+// PRESENT copies the context's bound surface to the framebuffer 1:1.
+// Only the damaged rectangles are copied: (x, y, w, h) plus numRects
+// XEDamageRect entries following the payload. w == 0 or h == 0, or no
+// payload at all, means the whole frame. Overlapping and nearby rects are
+// merged in the kernel, down to at most XE_PRESENT_MAX_RECTS copies.
+static constexpr uint32_t XE_PRESENT_MAX_RECTS = 16;
+
+struct XEDamageRect {
+    uint32_t x, y;
+    uint32_t w, h;
+};
+
 struct XEPresentPayload {
     uint32_t ioSurfaceID;   // IOSurface ID created in userspace
     uint32_t x;             // dest x in fb
     uint32_t y;             // dest y in fb
     uint32_t w;             // width
     uint32_t h;             // height
+    uint32_t numRects;      // extra XEDamageRect entries after this struct
 };
 
 
 
+// Same as XEBindSurfaceIn, with the pixels in a buffer object instead of
+// client memory. offset is where the first pixel lies in the object.
+struct XEBindSurfaceBOIn {
+    uint32_t ctxId;
+    uint32_t handle;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytesPerRow;
+    uint32_t pixelFormat;
+    uint64_t offset;
+};
+
 struct XEBindSurfaceOut {
-    uint64_t gpuAddr;      // not used
+    uint64_t gpuAddr;      // GGTT offset if scanned out directly, else 0
     uint32_t status;
     uint32_t reserved;
 };
@@ -105,7 +206,12 @@ enum : uint32_t {
     XE_CMD_RECT   = 2,    // payload: XERectPayload
     XE_CMD_COPY   = 3,    // payload: XECopyPayload
     XE_CMD_FLUSH  = 4,    // no payload
-    XE_CMD_PRESENT = 5    // (future use)
+    XE_CMD_PRESENT = 5,   // payload: XEPresentPayload (optional) + numRects * XEDamageRect
+    XE_CMD_BLEND  = 6,    // payload: XEBlendPayload
+    XE_CMD_RECT_LIST = 7, // payload: XERectListHeader + count * XERectPayload
+    XE_CMD_FLIP   = 8,    // payload: XEFlipPayload
+
+    XE_CMD_WRAP   = 0xFFFFFFFFu  // padding to the end of the ring, see xe_ring_reserve()
 };
 
 //
@@ -117,24 +223,72 @@ struct XERectPayload {
     uint32_t colorARGB;
 };
 
+// Show scanout buffer `buffer` from the next vblank on. 2D commands after
+// it draw into (buffer + 1) % scanoutCount, which by then holds a copy of
+// `buffer`; before the first FLIP they draw into buffer 0, which is on
+// screen.
+struct XEFlipPayload {
+    uint32_t buffer;
+    uint32_t reserved;
+};
+
+// Many fills in one record: one header and one trip through the ring
+// instead of one per rectangle.
+struct XERectListHeader {
+    uint32_t count;
+    uint32_t reserved;
+};
+
 struct XECopyPayload {
     uint32_t sx, sy;
     uint32_t dx, dy;
     uint32_t w, h;
 };
 
+// Premultiplied src-over onto the framebuffer rect (x, y, w, h).
+// Source is colorARGB, or with XE_BLEND_SURFACE the surface bound to the
+// command's context, starting at (srcX, srcY).
+enum : uint32_t {
+    XE_BLEND_SURFACE = 1u << 0,
+};
+
+struct XEBlendPayload {
+    uint32_t x, y;
+    uint32_t w, h;
+    uint32_t colorARGB;
+    uint32_t flags;        // XE_BLEND_*
+    uint32_t srcX, srcY;
+};
+
+//
+// ===== Ring Header (single-producer / single-consumer) =====
 //
-// ===== Ring Header (simple linear ring) =====
+// head and tail are free-running byte counters, never reduced modulo the
+// capacity: used = head - tail (mod 2^32), so "full" (used == capacity)
+// and "empty" (used == 0) can't be confused. The byte offset in the ring
+// is idx & (capacity - 1), which is why capacity must be a power of two.
 //
-struct __attribute__((packed)) XEHdr {
+// Each index lives on its own cache line so the producer's stores to head
+// don't bounce the line the consumer is writing tail into.
+//
+static constexpr uint32_t XE_CACHELINE = 64;
+
+struct XEHdr {
+    // read-only after creation
     uint32_t magic;       // XE_MAGIC
     uint32_t version;     // XE_VERSION
-    uint32_t capacity;    // usable payload size (bytes)
-    uint32_t head;        // producer offset (user)
-    uint32_t tail;        // consumer offset (kernel)
-    uint32_t reserved[3];
+    uint32_t capacity;    // ring size in bytes (power of two)
+    uint32_t flags;       // reserved, 0
+
+    // producer line: written by user space only
+    alignas(XE_CACHELINE) uint32_t head;
+
+    // consumer line: written by the kernel only
+    alignas(XE_CACHELINE) uint32_t tail;
 };
 
+static_assert(sizeof(XEHdr) == 3 * XE_CACHELINE, "XEHdr layout is ABI");
+
 //
 // ===== Command Header =====
 //
@@ -147,29 +301,128 @@ struct __attribute__((packed)) XECmd {
 
 struct XEClearPayload { uint32_t color; };
 
-struct XEContext {
-    void*     surfCPU;      // mapped CPU pointer from IOSurfaceInKernelMemory
-    uint32_t  surfWidth;
-    uint32_t  surfHeight;
-    uint32_t  surfRowBytes;
-};
-
 
 
 //
 // ===== Constants =====
 //
 static constexpr uint32_t XE_MAGIC   = 0x53524558u;  // 'XERS'
-static constexpr uint32_t XE_VERSION = 1;
+static constexpr uint32_t XE_VERSION = 3;            // 3: contiguous 16-byte aligned records + WRAP
 static constexpr uint32_t XE_PAGE    = 4096;
 
+// ring sizes (bytes of command space, header not included)
+static constexpr uint32_t XE_RING_MIN_BYTES     = 64u * 1024u;
+static constexpr uint32_t XE_RING_MAX_BYTES     = 8u * 1024u * 1024u;
+static constexpr uint32_t XE_RING_DEFAULT_BYTES = XE_RING_MIN_BYTES;
+
+// Records are padded to a multiple of sizeof(XECmd), so whatever is left
+// before the end of the ring always has room for a WRAP header.
+static constexpr uint32_t XE_CMD_ALIGN = 16;
+static_assert(sizeof(XECmd) == XE_CMD_ALIGN, "XECmd must be one alignment unit");
+
 static inline uint32_t xe_align(uint32_t v) {
-    return (v + 3u) & ~3u;   // 4-byte align
-    
-    
-    
-    
-    
+    return (v + (XE_CMD_ALIGN - 1u)) & ~(XE_CMD_ALIGN - 1u);
+}
+
+//
+// ===== Ring index helpers =====
+//
+// Producer: read tail with acquire (the consumer is done with those bytes),
+// write the record, then publish head with release.
+// Consumer: read head with acquire (the record bytes are visible), process,
+// then publish tail with release.
+//
+static inline uint32_t xe_load_acquire(const uint32_t* p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void xe_store_release(uint32_t* p, uint32_t v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t xe_ring_off(uint32_t idx, uint32_t cap) {
+    return idx & (cap - 1u);
+}
+
+static inline bool xe_is_pow2(uint32_t v) {
+    return v && !(v & (v - 1u));
+}
+
+// Producer side: find room for one record of `total` (xe_align()ed) bytes.
+// Records never straddle the end of the ring, so the consumer can decode
+// them in place: if the record doesn't fit before the end, a WRAP header
+// is written there and the record goes to offset 0.
+// Returns the ring offset to write the record at and sets *nextHead to the
+// head value to publish (with xe_store_release) once the record is written,
+// or returns UINT32_MAX if there isn't enough free space yet.
+// Records over xe_ring_max_record() always fail: one that has to wrap
+// needs its padding free as well, up to total - XE_CMD_ALIGN bytes, so a
+// larger one might never fit even in an empty ring.
+static inline uint32_t xe_ring_max_record(uint32_t cap) {
+    return cap / 2;
+}
+
+static inline uint32_t xe_ring_reserve(uint8_t* ring, uint32_t cap,
+                                       uint32_t head, uint32_t tail,
+                                       uint32_t total, uint32_t* nextHead) {
+    uint32_t off  = xe_ring_off(head, cap);
+    uint32_t pad  = (cap - off < total) ? cap - off : 0;
+    uint32_t free = cap - (head - tail);
+    if (total > xe_ring_max_record(cap) || pad + total > free) return UINT32_MAX;
+    if (pad) {
+        XECmd* wrap = reinterpret_cast<XECmd*>(ring + off);
+        wrap->opcode   = XE_CMD_WRAP;
+        wrap->bytes    = 0;
+        wrap->ctxId    = 0;
+        wrap->reserved = 0;
+        off = 0;
+    }
+    *nextHead = head + pad + total;
+    return off;
+}
+
+// Consumer side: decode what's at tail, given the producer's head
+// (tail != head, head - tail <= cap). The header is copied into *cmd,
+// since user space can rewrite the ring under us; every bound is checked
+// against that copy. *advance is what to add to tail once it's handled:
+// the record, or the WRAP padding up to the end of the ring.
+// XE_RING_BAD means nothing the producer could have written is there (a
+// misaligned tail, padding or a record running past head or the end of
+// the ring): drop the queue rather than spin on it.
+enum XERingNext : uint32_t {
+    XE_RING_RECORD,     // record header at xe_ring_off(tail), payload right after
+    XE_RING_WRAP,       // padding, skip it
+    XE_RING_BAD,
+};
+
+static inline XERingNext xe_ring_next(const uint8_t* ring, uint32_t cap,
+                                      uint32_t tail, uint32_t head,
+                                      XECmd* cmd, uint32_t* advance) {
+    uint32_t off   = xe_ring_off(tail, cap);
+    uint32_t avail = head - tail;
+    // tail only moves by whole records, but a resync to a bad head can
+    // leave it anywhere
+    if ((off & (XE_CMD_ALIGN - 1u)) || off > cap - (uint32_t)sizeof(XECmd)) return XE_RING_BAD;
+
+    __builtin_memcpy(cmd, ring + off, sizeof(XECmd));
+    if (cmd->opcode == XE_CMD_WRAP) {
+        *advance = cap - off;
+        return *advance <= avail ? XE_RING_WRAP : XE_RING_BAD;
+    }
+
+    if (cmd->bytes > cap - off - (uint32_t)sizeof(XECmd)) return XE_RING_BAD;
+    *advance = xe_align((uint32_t)sizeof(XECmd) + cmd->bytes);
+    return *advance <= avail ? XE_RING_RECORD : XE_RING_BAD;
+}
+
+// round a requested ring size to what kAccelSel_CreateRing will allocate
+static inline uint32_t xe_ring_round(uint32_t bytes) {
+    if (bytes == 0) return XE_RING_DEFAULT_BYTES;
+    if (bytes <= XE_RING_MIN_BYTES) return XE_RING_MIN_BYTES;
+    if (bytes >= XE_RING_MAX_BYTES) return XE_RING_MAX_BYTES;
+    uint32_t v = XE_RING_MIN_BYTES;
+    while (v < bytes) v <<= 1;
+    return v;
 }
 
 #endif
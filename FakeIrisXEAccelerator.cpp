@@ -1,10 +1,12 @@
 #include "FakeIrisXEAccelerator.hpp"
 #include "FakeIrisXEAccelShared.h"
 #include "FakeIrisXEFramebuffer.hpp"
+#include "FakeIrisXEBlit.hpp"
+#include "FakeIrisXEBufferObject.hpp"
+#include "FakeIrisXEPPGTT.hpp"
 #include <IOKit/IOLib.h>
 #include <IOKit/IOTimerEventSource.h>
-#include <IOKit/IOLib.h>
-#include <IOKit/IOLib.h>
+#include <kern/clock.h>
 
 
 
@@ -25,36 +27,45 @@ extern "C" void IOSurfaceRelease(IOSurfaceRef);
 
 #define LOG(fmt, ...) IOLog("(FakeIrisXEFramebuffer) [Accel] " fmt "\n", ##__VA_ARGS__)
 
-OSDefineMetaClassAndStructors(FakeIrisXEAccelerator, IOService)
-
+// Per-command logging. IOLog costs far more than drawing a small rect, so
+// it stays compiled out unless you're debugging the ring itself.
+#ifndef XE_TRACE_COMMANDS
+#define XE_TRACE_COMMANDS 0
+#endif
+#define TRACE(fmt, ...) do { if (XE_TRACE_COMMANDS) LOG(fmt, ##__VA_ARGS__); } while (0)
+
+#define TICK_BUDGET_US 2000   // per drain pass; doorbell re-fires if more is queued
+#define IDLE_POLL_MS 250      // safety net only, submit rings the doorbell
+#define HW_POLL_US 500        // re-check interval while a job waits on the display
+#define FLIP_TIMEOUT_MS 100   // give up on a vblank after this long
+#define DAMAGE_SLACK_PX 4096  // merge boxes if the union copies at most this many extra pixels
+#define BAND_MIN_BYTES (512 * 1024)   // smaller copies aren't worth waking workers for
+#define BAND_MIN_ROWS  32
+#define SURFACE_MAX_BYTES (256u * 1024 * 1024)   // largest client range we'll wire
 
-// Add near other helpers in FakeIrisXEAccelerator.cpp
-
-static inline uint8_t clamp_u8(int v) { return (v < 0) ? 0 : (v > 255 ? 255 : (uint8_t)v); }
+OSDefineMetaClassAndStructors(FakeIrisXEAccelerator, IOService)
 
-// srcArgb over dstArgb -> result ARGB8888
-static inline uint32_t blend_src_over_dst_argb8888(uint32_t src, uint32_t dst) {
-    // little-endian layout: 0xAABBGGRR as stored
-    uint8_t sa = (src >> 24) & 0xFF;
-    if (sa == 0xFF) return src;           // fully opaque -> fast path
-    if (sa == 0x00) return dst;           // fully transparent
-    uint8_t sr = (src) & 0xFF;
-    uint8_t sg = (src >> 8) & 0xFF;
-    uint8_t sb = (src >> 16) & 0xFF;
 
-    uint8_t dr = (dst) & 0xFF;
-    uint8_t dg = (dst >> 8) & 0xFF;
-    uint8_t db = (dst >> 16) & 0xFF;
-    uint8_t da = (dst >> 24) & 0xFF;
+// Stats are updated by drainRing() on the workloop and zeroed by a
+// GetStats reset from any user thread. Every update is a single atomic
+// read-modify-write, so a reset in between loses nothing but what it
+// reported; relaxed is enough, nothing else is ordered against them.
+static inline void stat_add(uint64_t* p, uint64_t v) { __atomic_fetch_add(p, v, __ATOMIC_RELAXED); }
+static inline void stat_max(uint64_t* p, uint64_t v)
+{
+    // A plain load and store could put back a maximum the reset just cleared
+    uint64_t cur = __atomic_load_n(p, __ATOMIC_RELAXED);
+    while (v > cur && !__atomic_compare_exchange_n(p, &cur, v, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
 
-    // alpha blending: out = src + (1 - sa) * dst
-    int invA = 255 - sa;
-    uint8_t outR = clamp_u8((sr * sa + dr * invA) / 255);
-    uint8_t outG = clamp_u8((sg * sa + dg * invA) / 255);
-    uint8_t outB = clamp_u8((sb * sa + db * invA) / 255);
-    uint8_t outA = clamp_u8((sa * 1 + da * invA / 255)); // coarse alpha combine
+// Clip a COPY to the framebuffer on both ends. Returns false if nothing is left.
+static bool clip_copy(const XECopyPayload& p, uint32_t fbW, uint32_t fbH, uint32_t& w, uint32_t& h)
+{
+    if (p.sx >= fbW || p.dx >= fbW || p.sy >= fbH || p.dy >= fbH) return false;
 
-    return (uint32_t(outA) << 24) | (uint32_t(outB) << 16) | (uint32_t(outG) << 8) | (uint32_t(outR));
+    w = MIN(p.w, MIN(fbW - p.sx, fbW - p.dx));
+    h = MIN(p.h, MIN(fbH - p.sy, fbH - p.dy));
+    return w && h;
 }
 
 
@@ -72,9 +83,12 @@ bool FakeIrisXEAccelerator::init(OSDictionary* dict) {
     fPixels    = nullptr;
     fWL        = nullptr;
     fTimer     = nullptr;
-    fContexts  = OSArray::withCapacity(8);
+    fDoorbell  = nullptr;
     fCtxLock   = IOLockAlloc();
-    fNextCtxId = 1;
+
+    if (!fCtxSlab.init(sizeof(XEContext), "contexts") ||
+        !fSurfSlab.init(sizeof(XESurface), "surfaces"))
+        return false;
 
     return true;
 }
@@ -111,6 +125,22 @@ bool FakeIrisXEAccelerator::start(IOService* provider) {
     fH      = fFB->getHeight();
     fStride = fFB->getStride();
     fPixels = fFB->getFramebufferKernelPtr();
+    fDrawBuffer = 0;   // scanout buffer 0 is framebufferMemory
+
+    // Only buffer 0, on screen, holds the desktop so far
+    fFront = 0;
+    for (uint32_t i = 1; i < kMaxScanout; ++i)
+        fStale[i] = { 0, 0, fW, fH };
+
+    // Band workers for large presents; with none, presents run on the workloop alone
+    fNumBandWorkers = 0;
+    for (uint32_t i = 0; i < kMaxBandWorkers; ++i) {
+        fBands[i].owner = this;
+        fBands[i].call = thread_call_allocate_with_priority(&FakeIrisXEAccelerator::bandEntry,
+                                                            &fBands[i], THREAD_CALL_PRIORITY_KERNEL);
+        if (!fBands[i].call) break;
+        ++fNumBandWorkers;
+    }
 
     
     
@@ -151,6 +181,27 @@ void FakeIrisXEAccelerator::stop(IOService* provider) {
         fTimer = nullptr;
     }
 
+    if (fDoorbell) {
+        fDoorbell->disable();
+        if (fWL) fWL->removeEventSource(fDoorbell);
+    }
+
+    // Nothing dispatches bands now. Running ones still read the job's
+    // surface and ring the doorbell, so wait for them before freeing either.
+    freeBandWorkers();
+    OSSafeReleaseNULL(fDoorbell);
+
+    endJob();
+
+    // Put our own buffer back on the plane before the client surface goes
+    if (fScanoutSurf && fFB) {
+        fFB->flipTo(fDrawBuffer);
+        for (uint32_t ms = 0; ms < FLIP_TIMEOUT_MS && fFB->flipPending(); ++ms)
+            IOSleep(1);
+    }
+    releaseSurface(fScanoutSurf);
+    fScanoutSurf = nullptr;
+
     if (fWL) {
         fWL->release();
         fWL = nullptr;
@@ -161,10 +212,21 @@ void FakeIrisXEAccelerator::stop(IOService* provider) {
         fSharedMem = nullptr;
         fHdr = nullptr;
         fRingBase = nullptr;
+        fRingCap = 0;
     }
 
-    if (fContexts) { fContexts->release(); fContexts = nullptr; }
-    if (fCtxLock) { IOLockFree(fCtxLock); fCtxLock = nullptr; }
+    if (fCtxLock) {
+        IOLockLock(fCtxLock);
+        fContexts.forEach([this](uint32_t, XEContext* ctx) { releaseContext(ctx); });
+        fContexts.reset();
+        IOLockUnlock(fCtxLock);
+        IOLockFree(fCtxLock);
+        fCtxLock = nullptr;
+    }
+
+    // Last users of both: the contexts above, and the job and plane before
+    fCtxSlab.destroy();
+    fSurfSlab.destroy();
 
     fFB = nullptr;
     IOService::stop(provider);
@@ -177,665 +239,1424 @@ void FakeIrisXEAccelerator::stop(IOService* provider) {
 bool FakeIrisXEAccelerator::attachShared(IOBufferMemoryDescriptor* page) {
     if (!page) return false;
 
-    if (fSharedMem) { fSharedMem->release(); }
-
-    page->retain();
-    fSharedMem = page;
-
-    void* base = fSharedMem->getBytesNoCopy();
+    void* base = page->getBytesNoCopy();
     if (!base) {
         LOG("attachShared: null base");
         return false;
     }
 
-    volatile XEHdr* hdr = reinterpret_cast<volatile XEHdr*>(base);
+    XEHdr* hdr = reinterpret_cast<XEHdr*>(base);
     if (hdr->magic != XE_MAGIC || hdr->version != XE_VERSION) {
         LOG("attachShared: BAD HEADER (magic=0x%08x ver=%u)", hdr->magic, hdr->version);
         return false;
     }
 
-    fHdr = hdr;
-    fRingBase = reinterpret_cast<uint8_t*>(base) + sizeof(XEHdr);
+    // Index math relies on a power-of-two ring that fits in the buffer
+    // and holds at least one record header
+    if (!xe_is_pow2(hdr->capacity) || hdr->capacity < sizeof(XECmd) ||
+        sizeof(XEHdr) + (uint64_t)hdr->capacity > page->getLength()) {
+        LOG("attachShared: BAD CAPACITY %u (buffer %llu bytes)",
+            hdr->capacity, (unsigned long long)page->getLength());
+        return false;
+    }
+
+    // drainRing() runs on fWL: swap the ring under its gate, so the
+    // consumer never sees a half-attached ring or a buffer we released
+    if (!fWL) return swapShared(page, hdr->capacity) == kIOReturnSuccess;
+    return fWL->runAction(OSMemberFunctionCast(IOWorkLoop::Action, this, &FakeIrisXEAccelerator::swapShared),
+                          this, page, (void*)(uintptr_t)hdr->capacity) == kIOReturnSuccess;
+}
+
+IOReturn FakeIrisXEAccelerator::swapShared(IOBufferMemoryDescriptor* page, uintptr_t cap)
+{
+    // Mapping the same ring again: keep the live indices and any job
+    if (page == fSharedMem) return kIOReturnSuccess;
+
+    endJob();   // any half-finished job belonged to the old ring
+
+    page->retain();
+    OSSafeReleaseNULL(fSharedMem);
+    fSharedMem = page;
 
-    LOG("attachShared: OK (magic=0x%08x cap=%u)", hdr->magic, hdr->capacity);
+    // cap was validated from this header; the client can rewrite it since
+    fHdr = reinterpret_cast<XEHdr*>(page->getBytesNoCopy());
+    fRingBase = reinterpret_cast<uint8_t*>(fHdr) + sizeof(XEHdr);
+    fRingCap = (uint32_t)cap;
+    // The consumer index is ours from here on: start from an empty ring
+    // rather than trusting whatever the header says
+    fTail = 0;
+    xe_store_release(&fHdr->tail, 0u);
 
-    // accelerate polling to 5ms once ring is live
-    if (fTimer) fTimer->setTimeoutMS(5);
+    LOG("attachShared: OK (magic=0x%08x cap=%u)", fHdr->magic, fRingCap);
 
-    return true;
+    // drain anything the client queued before the ring went live
+    ringDoorbell();
+
+    return kIOReturnSuccess;
 }
 
 #pragma mark - Contexts
 
+//
+// Lifetime: fContexts holds one reference. Readers on the command path
+// never take fCtxLock; they look the handle up inside a read section and
+// take their own reference before leaving it (acquireContext). Destroy
+// removes the handle, waits out readers that may have seen the old
+// pointer (ctxSynchronize), then drops the table's reference. Whoever
+// drops the last reference frees the context.
+//
+
 FakeIrisXEAccelerator::XEContext* FakeIrisXEAccelerator::lookupContext(uint32_t ctxId)
 {
-    if (!fContexts) return nullptr;
+    return fContexts.lookup(ctxId);
+}
+
+uint32_t FakeIrisXEAccelerator::ctxReadLock()
+{
+    for (;;) {
+        uint32_t e = __atomic_load_n(&fCtxEpoch, __ATOMIC_SEQ_CST) & 1;
+        __atomic_fetch_add(&fCtxReaders[e], 1, __ATOMIC_SEQ_CST);
+
+        // If a writer flipped the epoch in between, it may already have
+        // checked this counter; go again on the new side.
+        if ((__atomic_load_n(&fCtxEpoch, __ATOMIC_SEQ_CST) & 1) == e)
+            return e;
+        __atomic_fetch_sub(&fCtxReaders[e], 1, __ATOMIC_RELEASE);
+    }
+}
+
+void FakeIrisXEAccelerator::ctxReadUnlock(uint32_t e)
+{
+    __atomic_fetch_sub(&fCtxReaders[e], 1, __ATOMIC_RELEASE);
+}
+
+void FakeIrisXEAccelerator::ctxSynchronize()
+{
+    // Readers that started before the flip are counted on the old side;
+    // read sections are a lookup and a CAS, so this wait is short.
+    uint32_t old = __atomic_fetch_add(&fCtxEpoch, 1, __ATOMIC_SEQ_CST) & 1;
+    while (__atomic_load_n(&fCtxReaders[old], __ATOMIC_SEQ_CST) != 0)
+        IODelay(1);
+}
+
+FakeIrisXEAccelerator::XEContext* FakeIrisXEAccelerator::acquireContext(uint32_t ctxId)
+{
+    uint32_t e = ctxReadLock();
+
+    XEContext* ctx = fContexts.lookup(ctxId);
+    if (ctx) {
+        // Only a live (refs > 0) context may be revived
+        uint32_t r = __atomic_load_n(&ctx->refs, __ATOMIC_RELAXED);
+        do {
+            if (r == 0) { ctx = nullptr; break; }
+        } while (!__atomic_compare_exchange_n(&ctx->refs, &r, r + 1, true,
+                                              __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+    }
+
+    ctxReadUnlock(e);
+    return ctx;
+}
+
+FakeIrisXEAccelerator::XEContext* FakeIrisXEAccelerator::acquireContext(uint32_t ctxId,
+                                                                        const FakeIrisXEAcceleratorUserClient* owner)
+{
+    // owner is set before the context is published and never changes
+    XEContext* ctx = acquireContext(ctxId);
+    if (ctx && ctx->owner != owner) {
+        releaseContext(ctx);
+        return nullptr;
+    }
+    return ctx;
+}
+
+void FakeIrisXEAccelerator::releaseContext(XEContext* ctx)
+{
+    if (ctx && __atomic_sub_fetch(&ctx->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        releaseSurface(ctx->surface);
+        OSSafeReleaseNULL(ctx->vm);   // and with it, whatever is still bound
+        fCtxSlab.free(ctx);
+    }
+}
+
+//
+// Surfaces follow the same scheme one level down: the context holds a
+// reference, readers take theirs inside a read section, and a rebind
+// waits out those readers (ctxSynchronize) before dropping the old one.
+//
+
+FakeIrisXEAccelerator::XESurface* FakeIrisXEAccelerator::acquireSurface(XEContext* ctx)
+{
+    if (!ctx) return nullptr;
+
+    // The context's reference can't go before the read section ends,
+    // so refs is never 0 here
+    uint32_t e = ctxReadLock();
+    XESurface* surf = __atomic_load_n(&ctx->surface, __ATOMIC_ACQUIRE);
+    if (surf) __atomic_fetch_add(&surf->refs, 1, __ATOMIC_RELAXED);
+    ctxReadUnlock(e);
+    return surf;
+}
+
+void FakeIrisXEAccelerator::releaseSurface(XESurface* surf)
+{
+    if (!surf || __atomic_sub_fetch(&surf->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+
+    // Last reference, so it's off the plane: the plane holds one while it's up
+    if (surf->inGGTT && fFB && fFB->getGGTT()) fFB->getGGTT()->unbind(surf->ggtt);
+    OSSafeReleaseNULL(surf->map);
+    if (surf->md) {
+        if (surf->wired) surf->md->complete();
+        surf->md->release();
+    }
+    fSurfSlab.free(surf);
+}
+
+IOReturn FakeIrisXEAccelerator::createSurface(const XEBindSurfaceIn& in, task_t task, XESurface*& out)
+{
+    uint64_t bytes = (uint64_t)in.bytesPerRow * in.height;
+    if (!task || !in.cpuPtr || !in.width || !in.height ||
+        in.bytesPerRow < (uint64_t)in.width * 4 || bytes > SURFACE_MAX_BYTES)
+        return kIOReturnBadArgument;
+
+    mach_vm_address_t addr = (mach_vm_address_t)(uintptr_t)in.cpuPtr;
+    mach_vm_address_t page = trunc_page_64(addr);
+    uint32_t pageOff = (uint32_t)(addr - page);
+
+    XESurface* surf = (XESurface*)fSurfSlab.alloc();
+    if (!surf) return kIOReturnNoMemory;
+    surf->refs = 1;
+    surf->width = in.width;
+    surf->height = in.height;
+    surf->rowBytes = in.bytesPerRow;
+    surf->pixelFormat = in.pixelFormat;
+
+    // Wire the client's pages so the copy path and the display can use
+    // them from any context, and map them for the CPU side
+    surf->md = IOMemoryDescriptor::withAddressRange(page, round_page_64(bytes + pageOff),
+                                                    kIODirectionInOut, task);
+    IOReturn ret = surf->md ? surf->md->prepare() : kIOReturnNoMemory;
+    surf->wired = ret == kIOReturnSuccess;
+    if (surf->wired) {
+        surf->map = surf->md->createMappingInTask(kernel_task, 0, kIOMapAnywhere);
+        if (!surf->map) ret = kIOReturnNoMemory;
+    }
+    if (ret != kIOReturnSuccess) {
+        releaseSurface(surf);
+        return ret;
+    }
+    surf->cpu = (uint8_t*)surf->map->getVirtualAddress() + pageOff;
+
+    if (pageOff == 0) bindSurfaceForScanout(surf);
+
+    out = surf;
+    return kIOReturnSuccess;
+}
+
+IOReturn FakeIrisXEAccelerator::createSurfaceFromBO(FakeIrisXEBufferObject* bo, const XEBindSurfaceBOIn& in,
+                                                    XESurface*& out)
+{
+    uint64_t bytes = (uint64_t)in.bytesPerRow * in.height;
+    if (!bo || !in.width || !in.height || in.bytesPerRow < (uint64_t)in.width * 4 ||
+        (in.offset & 3) || in.offset > bo->getSize() || bytes > bo->getSize() - in.offset)
+        return kIOReturnBadArgument;
+
+    XESurface* surf = (XESurface*)fSurfSlab.alloc();
+    if (!surf) return kIOReturnNoMemory;
+    surf->refs = 1;
+    surf->width = in.width;
+    surf->height = in.height;
+    surf->rowBytes = in.bytesPerRow;
+    surf->pixelFormat = in.pixelFormat;
+
+    // Already wired and mapped; holding the memory keeps it that way
+    // after the client closes the handle
+    surf->md = bo->getMemory();
+    surf->md->retain();
+    surf->cpu = bo->getBytes() + in.offset;
+
+    if (in.offset == 0) bindSurfaceForScanout(surf);
+
+    out = surf;
+    return kIOReturnSuccess;
+}
+
+void FakeIrisXEAccelerator::bindSurfaceForScanout(XESurface* surf)
+{
+    // Exactly what the plane is programmed for. If the GGTT is full it
+    // still works, through the copy path.
+    FakeIrisXEGGTT* ggtt = fFB ? fFB->getGGTT() : nullptr;
+    uint64_t off = 0;
+    if (ggtt && surf->width == fW && surf->height == fH &&
+        surf->rowBytes == fStride && surf->pixelFormat == XE_SURF_FORMAT_SCANOUT &&
+        ggtt->bind(surf->md, FakeIrisXEGGTT::kScanoutAlign, &off,
+                   FakeIrisXEGGTT::kScanoutGuard) == kIOReturnSuccess) {
+        surf->ggtt = (uint32_t)off;
+        surf->inGGTT = true;
+    }
+}
+
+uint32_t FakeIrisXEAccelerator::createContext(uint64_t sharedPtr, uint32_t flags,
+                                              const FakeIrisXEAcceleratorUserClient* owner)
+{
+    if (!fCtxLock) return 0;
 
-    for (unsigned i = 0; i < fContexts->getCount(); ++i)
-    {
-        OSData* d = OSDynamicCast(OSData, fContexts->getObject(i));
-        if (!d) continue;
+    XEContext* ctx = (XEContext*)fCtxSlab.alloc();
+    if (!ctx) return 0;
+    ctx->refs = 1;   // fContexts' reference
+    ctx->active = true;
+    ctx->sharedGPUPtr = sharedPtr;
+    ctx->owner = owner;
+
+    IOLockLock(fCtxLock);
+    ctx->ctxId = fContexts.insert(ctx);
+    IOLockUnlock(fCtxLock);
 
-        XEContext* ctx = (XEContext*)d->getBytesNoCopy();
-        if (ctx && ctx->ctxId == ctxId)
-            return ctx;
+    if (!ctx->ctxId) {
+        fCtxSlab.free(ctx);
+        return 0;
     }
-    return nullptr;
+
+    LOG("createContext ctxId=0x%08x", ctx->ctxId);
+    return ctx->ctxId;
 }
 
+bool FakeIrisXEAccelerator::destroyContext(uint32_t ctxId, const FakeIrisXEAcceleratorUserClient* owner)
+{
+    if (!fCtxLock) return false;
+
+    IOLockLock(fCtxLock);
+    XEContext* ctx = lookupContext(ctxId);
+    if (ctx && ctx->owner == owner) {
+        fContexts.remove(ctxId);
+        ctxSynchronize();   // nobody can still be about to retain it
+    } else {
+        ctx = nullptr;
+    }
+    IOLockUnlock(fCtxLock);
+
+    if (!ctx) return false;
 
-uint32_t FakeIrisXEAccelerator::createContext(uint64_t sharedPtr, uint32_t flags)
+    // In-flight commands holding a reference keep it alive until they retire
+    releaseContext(ctx);
+    LOG("destroyContext 0x%08x", ctxId);
+    return true;
+}
+
+void FakeIrisXEAccelerator::destroyContexts(const FakeIrisXEAcceleratorUserClient* owner)
 {
-    XEContext ctx{};
-    ctx.ctxId = fNextCtxId++;
-    ctx.active = true;
-    ctx.sharedGPUPtr = sharedPtr;
+    if (!fCtxLock) return;
 
-    // Wrap context struct in OSData
-    OSData* data = OSData::withBytes(&ctx, sizeof(ctx));
-    if (!data) return 0;
+    // Unlink them all, then one grace period for the lot
+    XEContext* dead = nullptr;
+    uint32_t n = 0;
 
-    fContexts->setObject(data);
-    data->release(); // OSArray retains it
+    IOLockLock(fCtxLock);
+    fContexts.forEach([&](uint32_t h, XEContext* ctx) {
+        if (ctx->owner != owner) return;
+        fContexts.remove(h);
+        ctx->nextDead = dead;
+        dead = ctx;
+        ++n;
+    });
+    if (dead) ctxSynchronize();
+    IOLockUnlock(fCtxLock);
 
-    LOG("createContext ctxId=%u", ctx.ctxId);
-    return ctx.ctxId;
+    while (dead) {
+        XEContext* ctx = dead;
+        dead = ctx->nextDead;
+        releaseContext(ctx);
+    }
+    if (n) LOG("destroyContexts: %u left by a closed connection", n);
 }
 
 
 
 #pragma mark - Poll Ring
 
-// in FakeIrisXEAccelerator.cpp
-#define MAX_PROC_PER_TICK 4   // small, safe
-#define POLL_MS 16
+void FakeIrisXEAccelerator::ringDoorbell()
+{
+    // interruptOccurred() only bumps a counter and signals the workloop,
+    // so this is cheap enough for every submit.
+    if (fDoorbell) fDoorbell->interruptOccurred(nullptr, nullptr, 0);
+}
+
+void FakeIrisXEAccelerator::doorbellFired(IOInterruptEventSource* sender, int count)
+{
+    // budget exhausted with commands still queued: go around again
+    // instead of leaving them for the idle timer
+    if (drainRing()) scheduleMore();
+}
 
 void FakeIrisXEAccelerator::pollRing(IOTimerEventSource* sender)
+{
+    // Normal submission goes through the doorbell; this only catches
+    // producers that wrote the ring without calling kAccelSel_Submit.
+    if (sender) sender->setTimeoutMS(IDLE_POLL_MS);
+    if (drainRing()) scheduleMore();
+}
+
+void FakeIrisXEAccelerator::scheduleMore()
+{
+    // A job waiting for vblank can't make progress by spinning the
+    // workloop; check back on the timer instead.
+    if (fJob.active && fJob.waitHW) {
+        if (fTimer) fTimer->setTimeoutUS(HW_POLL_US);
+    } else {
+        ringDoorbell();
+    }
+}
+
+bool FakeIrisXEAccelerator::drainRing()
 {
     if (!fHdr || !fRingBase) {
-        if (sender) sender->setTimeoutMS(250);
-        return;
+        return false;
     }
 
-    // Reentrancy guard: if already processing, just reschedule and return.
-    if (OSCompareAndSwap(false, true, (volatile int*)&fPollActive) == false) {
-        // couldn't swap (already true) -> someone else processing
-        if (sender) sender->setTimeoutMS(POLL_MS);
-        return;
+    // Reentrancy guard: if already processing, the owner will re-check.
+    // Exchange the flag alone; a word-wide CAS would take in fNeedFlush
+    // next to it and fail for good once a draw had set that.
+    if (__atomic_exchange_n(&fPollActive, true, __ATOMIC_ACQUIRE)) {
+        return false;
     }
 
-    // Snapshot head/tail/cap quickly
-    uint32_t head = fHdr->head;
-    uint32_t tail = fHdr->tail;
-    uint32_t cap  = fHdr->capacity;
+    // Snapshot head/tail/cap quickly. tail is ours (fTail, never the user
+    // writable header copy); head is the producer's.
+    uint32_t cap  = fRingCap;
+    uint32_t tail = fTail;
+    uint32_t head = xe_load_acquire(&fHdr->head);
 
     // Nothing to do
     if (head == tail) {
-        fPollActive = false;
-        if (sender) sender->setTimeoutMS(POLL_MS);
-        return;
+        stat_add(&fStats.ticksIdle, 1);
+        __atomic_store_n(&fPollActive, false, __ATOMIC_RELEASE);
+        return false;
     }
 
-    IOLog("(FakeIrisXEFramebuffer) [Accel] pollRing(): head=%u tail=%u cap=%u\n", head, tail, cap);
+    if (head - tail > cap) {
+        IOLog("(FakeIrisXEFramebuffer) [Accel] pollRing: corrupt indices head=%u tail=%u cap=%u\n", head, tail, cap);
+        // Resync like a malformed record: drop the queue, including any
+        // command still in progress, and carry on from the producer's head
+        if (fJob.active) endJob();
+        publishTail(head);
+        __atomic_store_n(&fPollActive, false, __ATOMIC_RELEASE);
+        return false;
+    }
 
-    uint32_t processed = 0;
-    while (tail != head && processed < MAX_PROC_PER_TICK) {
-        // read header safely (handle wrap)
-        XECmd cmd;
-        uint32_t hdr_off = tail;
-        if (hdr_off + sizeof(cmd) <= cap) {
-            memcpy(&cmd, fRingBase + hdr_off, sizeof(cmd));
-        } else {
-            uint32_t first = cap - hdr_off;
-            memcpy(&cmd, fRingBase + hdr_off, first);
-            memcpy(((uint8_t*)&cmd) + first, fRingBase, sizeof(cmd) - first);
-        }
+    TRACE("pollRing(): head=%u tail=%u cap=%u", head, tail, cap);
 
-        if (cmd.bytes > cap) {
-            IOLog("(FakeIrisXEFramebuffer) [Accel] pollRing: invalid cmd.bytes=%u > cap\n", cmd.bytes);
-            break;
-        }
+    stat_add(&fStats.ticksWork, 1);
+    stat_max(&fStats.ringHighWater, head - tail);
+    uint64_t retired = 0;
 
-        uint32_t total = xe_align(sizeof(XECmd) + cmd.bytes);
-        uint32_t payload_off = (tail + sizeof(XECmd)) % cap;
+    uint64_t deadline = 0;
+    clock_interval_to_deadline(TICK_BUDGET_US, kMicrosecondScale, &deadline);
 
-        // small local buffer to copy payload (prevents reading ring while userspace writes)
-        uint8_t payloadBuf[256]; // ensure your protocol limits < sizeof(payloadBuf)
-        if (cmd.bytes > sizeof(payloadBuf)) {
-            IOLog("(FakeIrisXEFramebuffer) [Accel] pollRing: cmd too large %u\n", cmd.bytes);
-            break;
-        }
+    while (tail != head) {
+        if (!fJob.active) {
+            // Records are contiguous (see xe_ring_reserve), so decode in place.
+            XECmd cmd {};
+            uint32_t total = 0;
+            XERingNext next = xe_ring_next(fRingBase, cap, tail, head, &cmd, &total);
 
-        if (payload_off + cmd.bytes <= cap) {
-            memcpy(payloadBuf, fRingBase + payload_off, cmd.bytes);
-        } else {
-            uint32_t first = cap - payload_off;
-            memcpy(payloadBuf, fRingBase + payload_off, first);
-            memcpy(payloadBuf + first, fRingBase, cmd.bytes - first);
+            if (next == XE_RING_WRAP) {
+                tail += total;
+                publishTail(tail);
+                continue;
+            }
+            if (next == XE_RING_BAD) {
+                IOLog("(FakeIrisXEFramebuffer) [Accel] pollRing: bad record at tail=%u "
+                      "(off %u cap %u avail %u opcode 0x%x bytes %u)\n",
+                      tail, xe_ring_off(tail, cap), cap, head - tail, cmd.opcode, cmd.bytes);
+                stat_add(&fStats.cmdsRejected, 1);
+                tail = head;   // drop the queue rather than spin on it
+                publishTail(tail);
+                break;
+            }
+            const XECmd* rec = reinterpret_cast<const XECmd*>(fRingBase + xe_ring_off(tail, cap));
+
+            // Minimal logging (do NOT hex-dump the whole payload here)
+            TRACE("pollRing: opcode=%u bytes=%u ctx=%u", cmd.opcode, cmd.bytes, cmd.ctxId);
+
+            // Payload is handed over in place; handlers copy out the fixed-size
+            // struct they need before using any field. Long commands arm fJob.
+            uint64_t t0 = mach_absolute_time();
+            processCommand(cmd, rec + 1, cmd.bytes);
+            uint64_t spent = mach_absolute_time() - t0;
+
+            if (fJob.active) {
+                fJob.recordBytes = total;
+                fJob.busyAbs = spent;
+            } else {
+                recordCommand(cmd.opcode, spent);
+                ++retired;
+
+                // advance tail and publish (release: we're done reading those bytes)
+                tail += total;
+                publishTail(tail);
+            }
         }
 
-        // Minimal logging (do NOT hex-dump the whole payload here)
-        IOLog("(FakeIrisXEFramebuffer) [Accel] pollRing: opcode=%u bytes=%u ctx=%u\n",
-              cmd.opcode, cmd.bytes, cmd.ctxId);
+        if (fJob.active) {
+            uint64_t t0 = mach_absolute_time();
+            bool done = stepJob(deadline);
+            fJob.busyAbs += mach_absolute_time() - t0;
 
-        // Call processor but avoid heavy/blocking ops here
-        // processCommand should be lightweight (see next section)
-        processCommand(cmd, payloadBuf, cmd.bytes);
+            if (!done)
+                break;  // out of budget; the record stays at tail until we finish
 
-        // advance tail and publish
-        tail = (tail + total) % cap;
-        fHdr->tail = tail;
-        OSSynchronizeIO();
+            recordCommand(fJob.opcode, fJob.busyAbs);
+            ++retired;
 
-        ++processed;
-    }
+            tail += fJob.recordBytes;
+            endJob();
+            publishTail(tail);
+        }
 
-    // If more work remains, reschedule quickly; otherwise use normal poll interval
-    head = fHdr->head;
-    if (tail != head) {
-        if (sender) sender->setTimeoutMS(POLL_MS);
-    } else {
-        if (sender) sender->setTimeoutMS(50);
+        if (mach_absolute_time() >= deadline)
+            break;
     }
 
-    fPollActive = false; // release guard
+    stat_add(&fStats.cmdsRetired, retired);
+    stat_max(&fStats.maxCmdsPerTick, retired);
+
+    // Report whether the producer has queued more behind us
+    head = xe_load_acquire(&fHdr->head);
+    __atomic_store_n(&fPollActive, false, __ATOMIC_RELEASE);   // release guard
+
+    return tail != head;
 }
 
 
 
 
+#pragma mark - Command dispatch
+
+//
+// One entry per XE_CMD_* opcode, indexed by opcode. Payload bounds are
+// checked here before any handler runs; fixed-size payloads are copied
+// out of the (user-writable) ring into a typed local by opFixed().
+// Adding an opcode = one handler + one line below.
+//
+constexpr FakeIrisXEAccelerator::OpDesc FakeIrisXEAccelerator::kOpTable[] = {
+    /* XE_CMD_NOP       */ { "NOP",       0, 0, nullptr },
+    /* XE_CMD_CLEAR     */ fixedOp<XEClearPayload, &FakeIrisXEAccelerator::opClear>("CLEAR"),
+    /* XE_CMD_RECT      */ fixedOp<XERectPayload,  &FakeIrisXEAccelerator::opRect>("RECT"),
+    /* XE_CMD_COPY      */ fixedOp<XECopyPayload,  &FakeIrisXEAccelerator::opCopy>("COPY"),
+    /* XE_CMD_FLUSH     */ { "FLUSH",     0, 0, &FakeIrisXEAccelerator::opFlush },
+    /* XE_CMD_PRESENT   */ { "PRESENT",   0, UINT32_MAX, &FakeIrisXEAccelerator::opPresent },
+    /* XE_CMD_BLEND     */ fixedOp<XEBlendPayload, &FakeIrisXEAccelerator::opBlend>("BLEND"),
+    /* XE_CMD_RECT_LIST */ { "RECT_LIST", (uint32_t)sizeof(XERectListHeader), UINT32_MAX,
+                             &FakeIrisXEAccelerator::opRectList },
+    /* XE_CMD_FLIP      */ fixedOp<XEFlipPayload,  &FakeIrisXEAccelerator::opFlip>("FLIP"),
+};
+
+constexpr uint32_t FakeIrisXEAccelerator::kOpCount = sizeof(kOpTable) / sizeof(kOpTable[0]);
+
+template <typename P, void (FakeIrisXEAccelerator::*H)(const XECmd&, const P&)>
+void FakeIrisXEAccelerator::opFixed(const XECmd& cmd, const void* payload, uint32_t)
+{
+    P p;
+    memcpy(&p, payload, sizeof(p));
+    (this->*H)(cmd, p);
+}
+
 void FakeIrisXEAccelerator::processCommand(const XECmd &cmd, const void* payload, uint32_t payloadBytes)
 {
-    IOLog("(FakeIrisXEFramebuffer) [Accel] processCommand: opcode=%u bytes=%u ctx=%u\n",
-          cmd.opcode, payloadBytes, cmd.ctxId);
+    static_assert(kOpCount == XE_CMD_FLIP + 1,
+                  "kOpTable must have exactly one entry per XE_CMD_* opcode");
+    static_assert(kOpCount <= XE_STATS_OPCODES, "opcodes must fit in XEAccelStats");
 
-    switch (cmd.opcode) {
-        
-        
-        case XE_CMD_CLEAR:
-            if (payloadBytes >= 4) {
-                uint32_t color;
-                memcpy(&color, payload, 4);
-                // perform only memory writes here (fast)
-                if (fPixels && fStride) {
-                    // Simplified: fill first pixel block (keep cheap)
-                    uint32_t *pix = reinterpret_cast<uint32_t*>(fPixels);
-                    for (size_t i=0; i < (fW * fH) && i < 4096; ++i) pix[i] = color;
-                }
-                // Mark that a flush is required; let the framebuffer do actual flush on its workloop
-                fNeedFlush = true;
-            }
-            break;
-        
-            
-            
-        
-        case XE_CMD_RECT:
-            if (payloadBytes < sizeof(XERectPayload)) {
-                IOLog("(FakeIrisXEFramebuffer) [Accel] RECT: invalid payload (%u bytes)\n",
-                      payloadBytes);
-                break;
-            }
+    TRACE("processCommand: opcode=%u bytes=%u ctx=%u", cmd.opcode, payloadBytes, cmd.ctxId);
 
-            {
-                XERectPayload p = {};
-                memcpy(&p, payload, sizeof(p));
-
-                // Clamp region safely
-                uint32_t x0 = MIN(p.x, fW);
-                uint32_t y0 = MIN(p.y, fH);
-                uint32_t x1 = MIN(p.x + p.w, fW);
-                uint32_t y1 = MIN(p.y + p.h, fH);
-                uint32_t width  = (x1 > x0) ? (x1 - x0) : 0;
-                uint32_t height = (y1 > y0) ? (y1 - y0) : 0;
-
-                IOLog("(FakeIrisXEFramebuffer) [Accel] RECT %u x %u at (%u,%u)\n",
-                      width, height, x0, y0);
-
-                if (width == 0 || height == 0 || !fPixels || fStride == 0)
-                    break;
-
-                // Write only a SAFE amount of pixels per timer tick.
-                // Avoid touching entire screen → no freezes.
-                const size_t MAX_PER_TICK = 250000; // ~1MB, safe
-                size_t count = 0;
-
-                for (uint32_t yy = y0; yy < y1; ++yy) {
-                    uint32_t* row = reinterpret_cast<uint32_t*>(
-                        reinterpret_cast<uint8_t*>(fPixels) + yy * fStride
-                    );
-                    for (uint32_t xx = x0; xx < x1; ++xx) {
-                        row[xx] = p.colorARGB;
-
-                        if (++count >= MAX_PER_TICK) {
-                            // Don’t freeze system — stop early
-                            yy = y1;
-                            xx = x1;
-                            break;
-                        }
-                    }
-                }
+    if (cmd.opcode >= kOpCount) {
+        IOLog("(FakeIrisXEFramebuffer) [Accel] unknown opcode %u\n", cmd.opcode);
+        stat_add(&fStats.cmdsRejected, 1);
+        return;
+    }
 
-                // request flush later
-                fNeedFlush = true;
-            }
-            break;
-            
-            
-        case XE_CMD_PRESENT:
-        {
-            IOLockLock(fCtxLock);
-            XEContext* ctx = lookupContext(cmd.ctxId);
-
-            if (!ctx) {
-                IOLockUnlock(fCtxLock);
-                IOLog("(FakeIrisXEFramebuffer) [Accel] PRESENT: ctx %u not found\n", cmd.ctxId);
-                break;
-            }
+    const OpDesc& op = kOpTable[cmd.opcode];
+    if (payloadBytes < op.minBytes || payloadBytes > op.maxBytes) {
+        IOLog("(FakeIrisXEFramebuffer) [Accel] %s: invalid payload (%u bytes, want %u..%u)\n",
+              op.name, payloadBytes, op.minBytes, op.maxBytes);
+        stat_add(&fStats.cmdsRejected, 1);
+        return;
+    }
 
-            if (!ctx->surfCPU || ctx->surfRowBytes == 0 ||
-                ctx->surfWidth == 0 || ctx->surfHeight == 0)
-            {
-                IOLockUnlock(fCtxLock);
-                IOLog("(FakeIrisXEFramebuffer) [Accel] PRESENT: invalid surface for ctx %u\n", cmd.ctxId);
-                break;
-            }
+    if (op.handler)
+        (this->*op.handler)(cmd, payload, payloadBytes);
+}
+
+void FakeIrisXEAccelerator::opClear(const XECmd&, const XEClearPayload& p)
+{
+    // whole screen, executed in slices by stepJob()
+    if (fPixels && fStride)
+        startFill(XE_CMD_CLEAR, 0, 0, fW, fH, p.color);
+}
 
-            uint8_t* srcBase = (uint8_t*)ctx->surfCPU;
-            uint32_t srcRB   = ctx->surfRowBytes;
-            uint32_t srcW    = ctx->surfWidth;
-            uint32_t srcH    = ctx->surfHeight;
+void FakeIrisXEAccelerator::opRect(const XECmd&, const XERectPayload& p)
+{
+    // Clamp region safely (64-bit so x + w can't wrap)
+    uint32_t x0 = MIN(p.x, fW);
+    uint32_t y0 = MIN(p.y, fH);
+    uint32_t x1 = (uint32_t)MIN((uint64_t)p.x + p.w, (uint64_t)fW);
+    uint32_t y1 = (uint32_t)MIN((uint64_t)p.y + p.h, (uint64_t)fH);
+    uint32_t width  = (x1 > x0) ? (x1 - x0) : 0;
+    uint32_t height = (y1 > y0) ? (y1 - y0) : 0;
 
-            IOLockUnlock(fCtxLock);
+    TRACE("RECT %u x %u at (%u,%u)", width, height, x0, y0);
 
-            if (!fPixels || !fStride) {
-                IOLog("(FakeIrisXEFramebuffer) [Accel] PRESENT: framebuffer pixels missing\n");
-                break;
-            }
+    if (width == 0 || height == 0 || !fPixels || fStride == 0)
+        return;
 
-            // Clip copy area to framebuffer bounds
-            uint32_t copyW = MIN(fW, srcW);
-            uint32_t copyH = MIN(fH, srcH);
+    // Large rects are split across ticks by stepJob()
+    startFill(XE_CMD_RECT, x0, y0, x1, y1, p.colorARGB);
+}
 
-            uint8_t* dstBase = (uint8_t*)fPixels;
-            uint32_t dstRB   = fStride;
+void FakeIrisXEAccelerator::opFlush(const XECmd&, const void*, uint32_t)
+{
+    // Request a flush, but do NOT block in timer thread
+    fNeedFlush = true;
+}
 
-            // ARGB8888 fast memcpy per row
-            for (uint32_t y = 0; y < copyH; ++y) {
-                memcpy(dstBase + y * dstRB,
-                       srcBase + y * srcRB,
-                       copyW * 4 /* bytes per pixel */);
-            }
+void FakeIrisXEAccelerator::opPresent(const XECmd& cmd, const void* payload, uint32_t payloadBytes)
+{
+    // Older clients send the payload without numRects, or none at all;
+    // missing fields read as zero, i.e. one full-frame rect.
+    XEPresentPayload p {};
+    memcpy(&p, payload, MIN(payloadBytes, (uint32_t)sizeof(p)));
+    if (payloadBytes < sizeof(p)) p.numRects = 0;
+
+    if (p.numRects &&
+        (uint64_t)p.numRects * sizeof(XEDamageRect) > payloadBytes - sizeof(p)) {
+        IOLog("(FakeIrisXEFramebuffer) [Accel] PRESENT: invalid payload (%u bytes, %u rects)\n",
+              payloadBytes, p.numRects);
+        stat_add(&fStats.cmdsRejected, 1);
+        return;
+    }
 
-            // Request a flush, but do NOT block in timer thread
-            fNeedFlush = true;
+    // Lock-free lookups; the surface reference is handed to the job
+    XEContext* ctx = acquireContext(cmd.ctxId);
+    XESurface* surf = acquireSurface(ctx);
+    releaseContext(ctx);
 
-            IOLog("(FakeIrisXEFramebuffer) [Accel] PRESENT OK ctx=%u (%ux%u)\n",
-                  cmd.ctxId, copyW, copyH);
-            break;
-        }
+    if (!surf) {
+        IOLog("(FakeIrisXEFramebuffer) [Accel] PRESENT: no surface for ctx %u\n", cmd.ctxId);
+        return;
+    }
 
-            
-            
-        default:
-            IOLog("(FakeIrisXEFramebuffer) [Accel] unknown opcode %u\n", cmd.opcode);
+    if (!fPixels || !fStride) {
+        releaseSurface(surf);
+        IOLog("(FakeIrisXEFramebuffer) [Accel] PRESENT: framebuffer pixels missing\n");
+        return;
+    }
+
+    // Full-screen and plane-compatible: scan it out as it is, no copy
+    if (surf->inGGTT && fFB) {
+        startFill(XE_CMD_PRESENT, 0, 0, 0, 0, 0);
+        fJob.surf = surf;
+        fJob.flip = true;
+        clock_interval_to_deadline(FLIP_TIMEOUT_MS, kMillisecondScale, &fJob.waitUntil);
+        TRACE("PRESENT ctx=%u direct scanout at GGTT 0x%x", cmd.ctxId, surf->ggtt);
+        return;
     }
-    
-}
 
+    // Clip copy area to framebuffer bounds
+    uint32_t copyW = MIN(fW, surf->width);
+    uint32_t copyH = MIN(fH, surf->height);
 
+    // Coming back from direct scanout the draw buffer is stale everywhere
+    fDamageCount = 0;
+    if (p.w == 0 || p.h == 0 || fScanoutSurf) {
+        addDamage(0, 0, copyW, copyH);
+    } else {
+        const XEDamageRect* extra = (const XEDamageRect*)((const uint8_t*)payload + sizeof(p));
 
+        for (uint32_t i = 0; i <= p.numRects; ++i) {
+            XEDamageRect r = { p.x, p.y, p.w, p.h };
+            if (i > 0) memcpy(&r, &extra[i - 1], sizeof(r));
 
-#pragma mark - Primitive ops
+            uint32_t x0 = MIN(r.x, copyW);
+            uint32_t y0 = MIN(r.y, copyH);
+            uint32_t x1 = (uint32_t)MIN((uint64_t)r.x + r.w, (uint64_t)copyW);
+            uint32_t y1 = (uint32_t)MIN((uint64_t)r.y + r.h, (uint64_t)copyH);
+            if (x1 > x0 && y1 > y0) addDamage(x0, y0, x1, y1);
+        }
+    }
 
-void FakeIrisXEAccelerator::cmdClear(uint32_t argb) {
-    uint8_t* base = (uint8_t*)fPixels;
-    for (uint32_t y = 0; y < fH; ++y) {
-        uint32_t* row = (uint32_t*)(base + y * fStride);
-        for (uint32_t x = 0; x < fW; ++x) row[x] = argb;
+    uint64_t bytes = 0;
+    for (uint32_t i = 0; i < fDamageCount; ++i) {
+        const XEBox& b = fDamage[i];
+        bytes += (uint64_t)(b.x1 - b.x0) * (b.y1 - b.y0) * 4;
     }
-}
+    stat_add(&fStats.presentBytes, bytes);
+    stat_add(&fStats.presentRects, fDamageCount);
 
+    TRACE("PRESENT ctx=%u %u rect(s) -> %u copies, %llu bytes",
+          cmd.ctxId, p.numRects + 1, fDamageCount, (unsigned long long)bytes);
 
+    if (fDamageCount == 0) {
+        releaseSurface(surf);
+        return;
+    }
+
+    // Copied in slices by stepJob(), one damage box after another. If a
+    // client surface is on the plane, the draw buffer goes back up after.
+    startFill(XE_CMD_PRESENT, 0, 0, 0, 0, 0);
+    fJob.surf  = surf;
+    fJob.count = fDamageCount;
+    for (uint32_t i = 0; i < fDamageCount; ++i)
+        markDrawn(fDamage[i].x0, fDamage[i].y0, fDamage[i].x1, fDamage[i].y1);
+    fJob.flip  = fScanoutSurf != nullptr;
+}
 
-void FakeIrisXEAccelerator::cmdRect(const XERectPayload& p) {
-    uint32_t x0 = (p.x < fW ? p.x : fW);
-    uint32_t y0 = (p.y < fH ? p.y : fH);
-    uint32_t x1 = (x0 + p.w > fW ? fW : x0 + p.w);
-    uint32_t y1 = (y0 + p.h > fH ? fH : y0 + p.h);
+void FakeIrisXEAccelerator::addDamage(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+{
+    // Each box costs a pass over its rows, so glyph- or cursor-sized boxes
+    // close together are cheaper as one. Merging can make the new box touch
+    // others, so it is re-added until nothing more merges; the list only
+    // shrinks meanwhile, so this terminates.
+    for (;;) {
+        uint32_t best = fDamageCount;
+        int64_t  bestWaste = INT64_MAX;
+
+        for (uint32_t i = 0; i < fDamageCount; ++i) {
+            const XEBox& b = fDamage[i];
+            uint32_t ux0 = MIN(b.x0, x0), uy0 = MIN(b.y0, y0);
+            uint32_t ux1 = MAX(b.x1, x1), uy1 = MAX(b.y1, y1);
+
+            // negative when the two overlap
+            int64_t waste = (int64_t)(ux1 - ux0) * (uy1 - uy0)
+                          - (int64_t)(b.x1 - b.x0) * (b.y1 - b.y0)
+                          - (int64_t)(x1 - x0) * (y1 - y0);
+            if (waste < bestWaste) {
+                bestWaste = waste;
+                best = i;
+            }
+        }
 
-    uint8_t* base = (uint8_t*)fPixels + y0 * fStride + x0 * 4;
-    for (uint32_t row = 0; row < (y1 - y0); ++row) {
-        uint32_t* r = (uint32_t*)(base + row * fStride);
-        for (uint32_t x = 0; x < (x1 - x0); ++x) r[x] = p.colorARGB;
+        if (best == fDamageCount ||
+            (bestWaste > DAMAGE_SLACK_PX && fDamageCount < XE_PRESENT_MAX_RECTS)) {
+            fDamage[fDamageCount++] = { x0, y0, x1, y1 };
+            return;
+        }
+
+        const XEBox b = fDamage[best];
+        fDamage[best] = fDamage[--fDamageCount];
+        x0 = MIN(b.x0, x0); y0 = MIN(b.y0, y0);
+        x1 = MAX(b.x1, x1); y1 = MAX(b.y1, y1);
     }
 }
 
+void FakeIrisXEAccelerator::opRectList(const XECmd&, const void* payload, uint32_t payloadBytes)
+{
+    // Table guarantees the header; the entry count is checked here
+    XERectListHeader lh;
+    memcpy(&lh, payload, sizeof(lh));
+
+    if ((uint64_t)lh.count * sizeof(XERectPayload) > payloadBytes - sizeof(lh)) {
+        IOLog("(FakeIrisXEFramebuffer) [Accel] RECT_LIST: invalid payload (%u bytes, count %u)\n",
+              payloadBytes, lh.count);
+        stat_add(&fStats.cmdsRejected, 1);
+        return;
+    }
 
+    TRACE("RECT_LIST count=%u", lh.count);
 
-void FakeIrisXEAccelerator::cmdCopy(const XECopyPayload& p) {
-    uint32_t w = p.w, h = p.h;
+    if (lh.count == 0 || !fPixels || fStride == 0) return;
 
-    if (p.sx + w > fW) w = fW - p.sx;
-    if (p.sy + h > fH) h = fH - p.sy;
-    if (p.dx + w > fW) w = fW - p.dx;
-    if (p.dy + h > fH) h = fH - p.dy;
+    // Entries are read from the ring record as they're executed; it
+    // stays at the tail until the job retires.
+    startFill(XE_CMD_RECT_LIST, 0, 0, 0, 0, 0);
+    fJob.src   = (const uint8_t*)payload + sizeof(lh);
+    fJob.count = lh.count;
+}
 
-    uint8_t* base = (uint8_t*)fPixels;
-    for (uint32_t row = 0; row < h; ++row) {
-        uint8_t* src = base + (p.sy + row) * fStride + p.sx * 4;
-        uint8_t* dst = base + (p.dy + row) * fStride + p.dx * 4;
-        bcopy(src, dst, w * 4);
+void FakeIrisXEAccelerator::opFlip(const XECmd&, const XEFlipPayload& p)
+{
+    if (!fFB || p.buffer >= fFB->getScanoutCount()) {
+        IOLog("(FakeIrisXEFramebuffer) [Accel] FLIP: bad buffer %u (have %u)\n",
+              p.buffer, fFB ? fFB->getScanoutCount() : 0);
+        return;
     }
+
+    // Executed by stepJob so waiting for vblank doesn't block the workloop
+    startFill(XE_CMD_FLIP, 0, 0, 0, 0, 0);
+    fJob.index = p.buffer;
+    clock_interval_to_deadline(FLIP_TIMEOUT_MS, kMillisecondScale, &fJob.waitUntil);
 }
 
+void FakeIrisXEAccelerator::setDrawBuffer(uint32_t index)
+{
+    void* px = fFB ? fFB->getScanoutKernelPtr(index) : nullptr;
+    if (!px) return;
+    fDrawBuffer = index;
+    fPixels = px;
+}
 
-// Replace current bindSurface implementation with this (in FakeIrisXEAccelerator.cpp)
-IOReturn FakeIrisXEAccelerator::bindSurface(uint32_t ctxId, const XEBindSurfaceIn& in, XEBindSurfaceOut& out)
+void FakeIrisXEAccelerator::markDrawn(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
 {
-    if (!fCtxLock) return kIOReturnNoResources;
+    static_assert(kMaxScanout >= FakeIrisXEFramebuffer::kMaxScanout, "fStale must cover every scanout buffer");
 
-    IOLockLock(fCtxLock);
-    XEContext* ctx = lookupContext(ctxId);
-    if (!ctx) {
-        IOLockUnlock(fCtxLock);
-        return kIOReturnNotFound;
+    const XEBox b = { x0, y0, x1, y1 };
+    if (b.empty() || fDrawBuffer >= kMaxScanout) return;
+
+    if (fDrawBuffer != fFront) {
+        fStale[fDrawBuffer].add(b);
+        return;
     }
 
-    // Store metadata reported by user-space
-    ctx->hasSurface       = true;
-    ctx->surfWidth        = in.width;
-    ctx->surfHeight       = in.height;
-    ctx->surfRowBytes     = in.bytesPerRow;
-    ctx->surfPixelFormat  = in.pixelFormat;
-    ctx->surfIOSurfaceID  = in.ioSurfaceID;
-    ctx->surfID           = in.surfaceID;
-
-    // IMPORTANT: user-space must pass a pointer that's already mapped into the client task
-    // (for testing we accept that pointer value and store it).
-    // We save as void* kernel-side, but it points into the client's address space.
-    ctx->surfCPU = reinterpret_cast<void*>( (uintptr_t) in.cpuPtr );
+    // Drawing on screen (before the first FLIP): the front itself changes,
+    // so every other buffer falls behind instead
+    for (uint32_t i = 0; i < kMaxScanout; ++i)
+        if (i != fFront) fStale[i].add(b);
+}
 
-    IOLockUnlock(fCtxLock);
+void FakeIrisXEAccelerator::opCopy(const XECmd&, const XECopyPayload& p)
+{
+    uint32_t w, h;
+    if (!fPixels || fStride == 0 || !clip_copy(p, fW, fH, w, h)) return;
 
-    out.gpuAddr = 0; // fake
-    out.status  = kIOReturnSuccess;
+    startCopy(p.sx, p.sy, p.dx, p.dy, w, h);
+}
 
-    IOLog("(FakeIrisXEFramebuffer) [Accel] BindSurface: ctx=%u iosurf=%u cpuPtr=%p %ux%u stride=%u fmt=0x%08x\n",
-          ctxId, in.ioSurfaceID, ctx->surfCPU, in.width, in.height, in.bytesPerRow, in.pixelFormat);
+void FakeIrisXEAccelerator::opBlend(const XECmd& cmd, const XEBlendPayload& p)
+{
+    if (!fPixels || fStride == 0) return;
 
-    return kIOReturnSuccess;
-}
+    uint32_t x0 = MIN(p.x, fW);
+    uint32_t y0 = MIN(p.y, fH);
+    uint32_t x1 = (uint32_t)MIN((uint64_t)p.x + p.w, (uint64_t)fW);
+    uint32_t y1 = (uint32_t)MIN((uint64_t)p.y + p.h, (uint64_t)fH);
 
+    const uint8_t* src = nullptr;
+    uint32_t srcRB = 0;
 
-// Start worker loop / timer (idempotent)
-void FakeIrisXEAccelerator::startWorkerLoop()
-{
-    if (!fWL) {
-        fWL = getWorkLoop();
-        if (!fWL) fWL = IOWorkLoop::workLoop();
-        if (!fWL) {
-            IOLog("(FakeIrisXEFramebuffer) [Accel] startWorkerLoop: no workloop\n");
+    XESurface* surf = nullptr;
+
+    if (p.flags & XE_BLEND_SURFACE) {
+        XEContext* ctx = acquireContext(cmd.ctxId);
+        surf = acquireSurface(ctx);
+        releaseContext(ctx);
+
+        if (surf && p.srcX < surf->width && p.srcY < surf->height) {
+            // clip the destination to what the surface can supply
+            x1 = (uint32_t)MIN((uint64_t)x1, (uint64_t)x0 + (surf->width  - p.srcX));
+            y1 = (uint32_t)MIN((uint64_t)y1, (uint64_t)y0 + (surf->height - p.srcY));
+            srcRB = surf->rowBytes;
+            src = (const uint8_t*)surf->cpu + (size_t)p.srcY * srcRB + (size_t)p.srcX * 4;
+        }
+
+        if (!src) {
+            releaseSurface(surf);
+            IOLog("(FakeIrisXEFramebuffer) [Accel] BLEND: no usable surface for ctx %u\n", cmd.ctxId);
             return;
         }
-        fWL->retain();
     }
 
-    if (!createAndArmTimer(this, fWL, fTimer, 16)) {
-        IOLog("(FakeIrisXEFramebuffer) [Accel] startWorkerLoop: failed to create/arm timer\n");
+    if (x1 <= x0 || y1 <= y0) {
+        releaseSurface(surf);
         return;
     }
 
-    IOLog("(FakeIrisXEFramebuffer) [Accel] startWorkerLoop: timer armed\n");
+    // The job owns the reference until it retires (endJob)
+    startBlend(x0, y0, x1, y1, p.colorARGB, src, srcRB);
+    fJob.surf = surf;
 }
 
 
 
+#pragma mark - Statistics
 
+void FakeIrisXEAccelerator::recordCommand(uint32_t opcode, uint64_t busyAbs)
+{
+    uint64_t ns = 0;
+    absolutetime_to_nanoseconds(busyAbs, &ns);
 
+    XEOpStats& op = fStats.op[MIN(opcode, XE_STATS_OPCODES - 1)];
 
+    // bucket i holds [4^(i-1), 4^i) us
+    uint64_t us = ns / 1000;
+    uint32_t b = 0;
+    while (b < XE_STATS_BUCKETS - 1 && us >= (1ull << (2 * b))) ++b;
 
-// Fill capabilities
-void FakeIrisXEAccelerator::getCaps(XEAccelCaps& out)
+    stat_add(&op.count, 1);
+    stat_add(&op.totalNs, ns);
+    stat_max(&op.maxNs, ns);
+    stat_add(&op.hist[b], 1);
+}
+
+void FakeIrisXEAccelerator::getStats(XEAccelStats& out, bool reset)
 {
-    bzero(&out, sizeof(out));
-    out.version = XE_VERSION;
-    out.metalSupported = 0; // flip to 1 if you wire Metal later
-    out.reserved0 = out.reserved1 = 0;
+    // Field-by-field so each counter is read atomically; the snapshot as a
+    // whole may straddle a command, which is fine for statistics.
+    const uint64_t* src = &fStats.ticksWork;
+    uint64_t*       dst = &out.ticksWork;
+    size_t n = (sizeof(XEAccelStats) - offsetof(XEAccelStats, ticksWork)) / sizeof(uint64_t);
+
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = reset ? __atomic_exchange_n((uint64_t*)&src[i], 0, __ATOMIC_RELAXED)
+                       : __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+    out.numOpcodes = XE_STATS_OPCODES;
+    out.numBuckets = XE_STATS_BUCKETS;
 }
 
-// Flush -> call FB flush if present
-IOReturn FakeIrisXEAccelerator::flush(uint32_t ctxId)
+
+
+#pragma mark - Resumable jobs
+
+void FakeIrisXEAccelerator::endJob()
 {
-    if (fFB) {
-        fFB->flushDisplay();
-        return kIOReturnSuccess;
+    // An abandoned PRESENT may still have bands reading its surface
+    while (__atomic_load_n(&fBandsPending, __ATOMIC_ACQUIRE))
+        IOSleep(1);
+
+    releaseSurface(fJob.surf);
+    fJob = XEJob{};
+}
+
+void FakeIrisXEAccelerator::startFill(uint32_t opcode, uint32_t x0, uint32_t y0,
+                                      uint32_t x1, uint32_t y1, uint32_t color)
+{
+    fJob.active = true;
+    fJob.opcode = opcode;
+    fJob.x0 = x0; fJob.y0 = y0;
+    fJob.x1 = x1; fJob.y1 = y1;
+    fJob.row = y0;
+    fJob.color = color;
+    markDrawn(x0, y0, x1, y1);
+    fJob.src = nullptr;
+    fJob.srcRowBytes = 0;
+    fJob.reverse = false;
+    fJob.index = 0;
+    fJob.count = 0;
+    fJob.waitHW = false;
+    fJob.flip = false;
+    fJob.flipArmed = false;
+    fJob.sync = false;
+}
+
+bool FakeIrisXEAccelerator::fillJobRows(uint64_t deadline)
+{
+    uint8_t* base = (uint8_t*)fPixels;
+    uint32_t w = fJob.x1 - fJob.x0;
+    bool stream = (size_t)w * (fJob.y1 - fJob.y0) * 4 >= XE_STREAM_MIN_BYTES;
+
+    // Check the clock once per row: a 1080p row is ~8 KB, so the
+    // overshoot past the deadline is negligible.
+    while (fJob.row < fJob.y1) {
+        uint32_t* row = (uint32_t*)(base + (size_t)fJob.row * fStride);
+        xe_fill_row32(row + fJob.x0, fJob.color, w, stream);
+        ++fJob.row;
+
+        if (fJob.row < fJob.y1 && mach_absolute_time() >= deadline) {
+            // streamed rows must be visible before tail moves
+            if (stream) xe_stream_fence();
+            return false;
+        }
     }
-    return kIOReturnNotReady;
+    if (stream) xe_stream_fence();
+    return true;
 }
 
-// Bind an IOSurface id to a context (simple bookkeeping)
-IOReturn FakeIrisXEAccelerator::bindSurfaceToContext(uint32_t ctxId, uint32_t surfID)
+uint32_t FakeIrisXEAccelerator::dispatchBands()
 {
-    if (!fCtxLock) return kIOReturnNoResources;
-    IOLockLock(fCtxLock);
-    XEContext* ctx = lookupContext(ctxId);
-    if (!ctx) {
-        IOLockUnlock(fCtxLock);
-        IOLog("(FakeIrisXEFramebuffer) [Accel] bindSurfaceToContext: ctx %u not found\n", ctxId);
-        return kIOReturnNotFound;
+    uint32_t rows  = fJob.y1 - fJob.y0;
+    uint32_t width = fJob.x1 - fJob.x0;
+
+    uint32_t n = 1;
+    if ((size_t)width * rows * 4 >= BAND_MIN_BYTES)
+        n = MIN(fNumBandWorkers + 1, rows / BAND_MIN_ROWS);
+    if (n <= 1) return fJob.y1;
+
+    // Set before any band can finish, so the count never touches 0 early
+    __atomic_store_n(&fBandsPending, n - 1, __ATOMIC_RELAXED);
+
+    for (uint32_t i = 1; i < n; ++i) {
+        uint32_t r0 = fJob.y0 + (uint32_t)((uint64_t)rows * i / n);
+        uint32_t r1 = fJob.y0 + (uint32_t)((uint64_t)rows * (i + 1) / n);
+
+        XEBand& b = fBands[i - 1];
+        b.dst = (uint8_t*)fPixels + (size_t)r0 * fStride + (size_t)fJob.x0 * 4;
+        b.src = fJob.src + (size_t)(r0 - fJob.y0) * fJob.srcRowBytes;
+        b.dstStride = fStride;
+        b.srcStride = fJob.srcRowBytes;
+        b.width = width;
+        b.rows  = r1 - r0;
+        thread_call_enter(b.call);
     }
-    ctx->surfID = surfID;
-    // leave surfCPU / mapping to a later IOSurface path
-    ctx->hasSurface = true;
-    IOLockUnlock(fCtxLock);
-    IOLog("(FakeIrisXEFramebuffer) [Accel] bindSurfaceToContext: ctx=%u iosurf=%u\n", ctxId, surfID);
-    return kIOReturnSuccess;
+    return fJob.y0 + rows / n;
 }
 
+void FakeIrisXEAccelerator::bandEntry(thread_call_param_t band, thread_call_param_t)
+{
+    XEBand* b = (XEBand*)band;
+
+    for (uint32_t r = 0; r < b->rows; ++r)
+        xe_copy_row32((uint32_t*)(b->dst + (size_t)r * b->dstStride),
+                      (const uint32_t*)(b->src + (size_t)r * b->srcStride), b->width);
 
+    // acq_rel: our rows are visible to whoever sees the count reach 0
+    FakeIrisXEAccelerator* owner = b->owner;
+    if (__atomic_sub_fetch(&owner->fBandsPending, 1, __ATOMIC_ACQ_REL) == 0)
+        owner->ringDoorbell();
+}
 
-// --------- Helpers: init/free contexts ----------
-bool FakeIrisXEAccelerator::initContexts()
+void FakeIrisXEAccelerator::freeBandWorkers()
 {
-    contextsLock = IOLockAlloc();
-    if (!contextsLock) return false;
-    contexts = OSArray::withCapacity(8);
-    if (!contexts) {
-        IOLockFree(contextsLock);
-        contextsLock = nullptr;
-        return false;
+    for (uint32_t i = 0; i < fNumBandWorkers; ++i) {
+        thread_call_cancel_wait(fBands[i].call);
+        thread_call_free(fBands[i].call);
+        fBands[i].call = nullptr;
+    }
+    fNumBandWorkers = 0;
+    __atomic_store_n(&fBandsPending, 0, __ATOMIC_RELAXED);
+}
+
+bool FakeIrisXEAccelerator::copyJobRows(uint64_t deadline)
+{
+    uint8_t* base = (uint8_t*)fPixels;
+    uint32_t w = fJob.x1 - fJob.x0;
+
+    while (fJob.row < fJob.y1) {
+        uint32_t* d = (uint32_t*)(base + (size_t)fJob.row * fStride) + fJob.x0;
+        const uint32_t* s = (const uint32_t*)(fJob.src +
+                            (size_t)(fJob.row - fJob.y0) * fJob.srcRowBytes);
+        xe_copy_row32(d, s, w);
+        ++fJob.row;
+
+        if (fJob.row < fJob.y1 && mach_absolute_time() >= deadline)
+            return false;
     }
-    nextCtxId = 1;
     return true;
 }
 
-void FakeIrisXEAccelerator::freeContexts()
+void FakeIrisXEAccelerator::startBlend(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1,
+                                       uint32_t color, const uint8_t* src, uint32_t srcRowBytes)
 {
-    if (!contexts) return;
-    IOLockLock(contextsLock);
-    unsigned count = contexts->getCount();
-    for (unsigned i = 0; i < count; ++i) {
-        OSData *d = OSDynamicCast(OSData, contexts->getObject(i));
-        if (!d) continue;
-        XECtx *c = (XECtx*)d->getBytesNoCopy();
-        if (c) {
-            IOFree(c, sizeof(XECtx));
-        }
+    startFill(XE_CMD_BLEND, x0, y0, x1, y1, color);
+    fJob.src = src;
+    fJob.srcRowBytes = srcRowBytes;
+}
+
+void FakeIrisXEAccelerator::startCopy(uint32_t sx, uint32_t sy, uint32_t dx, uint32_t dy,
+                                      uint32_t w, uint32_t h)
+{
+    startFill(XE_CMD_COPY, dx, dy, dx + w, dy + h, 0);
+    fJob.src = (const uint8_t*)fPixels + (size_t)sy * fStride + (size_t)sx * 4;
+    fJob.srcRowBytes = fStride;
+
+    // Moving down over itself: walk rows bottom-up so no source row is
+    // overwritten before it has been read
+    if (dy > sy) {
+        fJob.reverse = true;
+        fJob.row = fJob.y1;
     }
-    contexts->flushCollection();
-    IOLockUnlock(contextsLock);
-    contexts->release();
-    contexts = nullptr;
-    if (contextsLock) {
-        IOLockFree(contextsLock);
-        contextsLock = nullptr;
-    }
-}
-
-// call initContexts() from your start() after basic init
-// call freeContexts() from stop()
-
-// ---------- create / destroy / find ----------
-uint32_t FakeIrisXEAccelerator::createContext()
-{
-    if (!contexts) return 0;
-    XECtx *c = (XECtx*)IOMallocZero(sizeof(XECtx));
-    if (!c) return 0;
-    IOLockLock(contextsLock);
-    c->ctxId = nextCtxId++;
-    c->alive = true;
-    c->surf_vaddr = 0;
-    c->surf_bytes = 0;
-    c->surf_rowbytes = 0;
-    c->surf_w = 0;
-    c->surf_h = 0;
-    OSData *d = OSData::withBytesNoCopy(c, sizeof(XECtx)); // contexts will own pointer
-    if (d) {
-        contexts->setObject(d);
-        d->release();
-    } else {
-        IOFree(c, sizeof(XECtx));
-        IOLockUnlock(contextsLock);
-        return 0;
+}
+
+bool FakeIrisXEAccelerator::stepJob(uint64_t deadline)
+{
+    if (!fJob.active) return true;
+
+    if (!fPixels || !fStride) {
+        // framebuffer went away; nothing left to write
+        return true;
     }
-    IOLockUnlock(contextsLock);
-    IOLog("(FakeIrisXEFramebuffer) [Accel] createContext -> %u\n", c->ctxId);
-    return c->ctxId;
-}
-
-bool FakeIrisXEAccelerator::destroyContext(uint32_t ctxId)
-{
-    if (!contexts) return false;
-    IOLockLock(contextsLock);
-    for (unsigned i = 0; i < contexts->getCount(); ++i) {
-        OSData *d = OSDynamicCast(OSData, contexts->getObject(i));
-        if (!d) continue;
-        XECtx *c = (XECtx*)d->getBytesNoCopy();
-        if (c && c->ctxId == ctxId) {
-            // clear any bound mapping info but don't free user memory
-            c->surf_vaddr = 0;
-            c->surf_bytes = 0;
-            c->surf_rowbytes = 0;
-            c->surf_w = 0;
-            c->surf_h = 0;
-            contexts->removeObject(i);
-            IOFree(c, sizeof(XECtx));
-            IOLockUnlock(contextsLock);
-            IOLog("(FakeIrisXEFramebuffer) [Accel] destroyContext %u\n", ctxId);
+
+    uint8_t* base = (uint8_t*)fPixels;
+
+    switch (fJob.opcode) {
+        case XE_CMD_CLEAR:
+        case XE_CMD_RECT:
+            if (!fillJobRows(deadline)) return false;
+            // Mark that a flush is required; let the framebuffer do actual flush on its workloop
+            fNeedFlush = true;
+            return true;
+
+        case XE_CMD_RECT_LIST: {
+            // Framebuffer bounds are loaded once for the whole list
+            const uint32_t fbW = fW, fbH = fH;
+
+            for (;;) {
+                if (fJob.row < fJob.y1 && !fillJobRows(deadline)) return false;
+                if (fJob.index >= fJob.count) break;
+
+                XERectPayload r;
+                memcpy(&r, fJob.src + (size_t)fJob.index * sizeof(r), sizeof(r));
+                ++fJob.index;
+
+                fJob.x0 = MIN(r.x, fbW);
+                fJob.y0 = MIN(r.y, fbH);
+                fJob.x1 = (uint32_t)MIN((uint64_t)r.x + r.w, (uint64_t)fbW);
+                fJob.y1 = (uint32_t)MIN((uint64_t)r.y + r.h, (uint64_t)fbH);
+                fJob.color = r.colorARGB;
+                fJob.row = (fJob.x1 > fJob.x0) ? fJob.y0 : fJob.y1;   // empty -> skip
+                markDrawn(fJob.x0, fJob.y0, fJob.x1, fJob.y1);
+
+                if (fJob.index < fJob.count && mach_absolute_time() >= deadline)
+                    return false;
+            }
+            fNeedFlush = true;
             return true;
         }
-    }
-    IOLockUnlock(contextsLock);
-    return false;
-}
 
-XECtx* FakeIrisXEAccelerator::findCtx(uint32_t ctxId)
-{
-    if (!contexts) return nullptr;
-    XECtx *res = nullptr;
-    IOLockLock(contextsLock);
-    for (unsigned i = 0; i < contexts->getCount(); ++i) {
-        OSData *d = OSDynamicCast(OSData, contexts->getObject(i));
-        if (!d) continue;
-        XECtx *c = (XECtx*)d->getBytesNoCopy();
-        if (c && c->ctxId == ctxId && c->alive) {
-            res = c;
-            break;
+        case XE_CMD_FLIP:
+            return stepFlip(deadline);
+
+        case XE_CMD_COPY: {
+            uint32_t w = fJob.x1 - fJob.x0;
+
+            if (fJob.reverse) {
+                // fJob.row is one past the next row to copy
+                while (fJob.row > fJob.y0) {
+                    --fJob.row;
+                    uint32_t* d = (uint32_t*)(base + (size_t)fJob.row * fStride) + fJob.x0;
+                    const uint32_t* s = (const uint32_t*)(fJob.src +
+                                        (size_t)(fJob.row - fJob.y0) * fJob.srcRowBytes);
+                    xe_copy_row32(d, s, w);
+
+                    if (fJob.row > fJob.y0 && mach_absolute_time() >= deadline)
+                        return false;
+                }
+            } else if (!copyJobRows(deadline)) {
+                return false;
+            }
+            fNeedFlush = true;
+            return true;
+        }
+
+        case XE_CMD_PRESENT: {
+            // Direct scanout has no boxes and drops straight through to the flip
+            for (;;) {
+                if (fJob.row < fJob.y1 && !copyJobRows(deadline)) return false;
+
+                // Our band is done; the box is done when the workers' are too
+                fJob.waitHW = __atomic_load_n(&fBandsPending, __ATOMIC_ACQUIRE) != 0;
+                if (fJob.waitHW) return false;
+
+                if (fJob.index >= fJob.count) break;
+
+                const XEBox& b = fDamage[fJob.index++];
+                fJob.x0 = b.x0; fJob.y0 = b.y0;
+                fJob.x1 = b.x1; fJob.y1 = b.y1;
+                fJob.row = b.y0;
+                fJob.srcRowBytes = fJob.surf->rowBytes;
+                fJob.src = (const uint8_t*)fJob.surf->cpu + (size_t)b.y0 * fJob.srcRowBytes + (size_t)b.x0 * 4;
+                fJob.y1 = dispatchBands();
+            }
+            fNeedFlush = true;
+            if (!fJob.flip) return true;
+
+            // Copied while a client surface is on the plane: put the draw
+            // buffer back up. The source surface isn't needed any more.
+            if (fJob.count && !fJob.flipArmed && fJob.surf) {
+                releaseSurface(fJob.surf);
+                fJob.surf  = nullptr;
+                fJob.count = 0;              // boxes done; index is the flip target now
+                fJob.index = fDrawBuffer;
+                clock_interval_to_deadline(FLIP_TIMEOUT_MS, kMillisecondScale, &fJob.waitUntil);
+            }
+            return stepFlip(deadline);
+        }
+
+        case XE_CMD_BLEND: {
+            uint32_t w = fJob.x1 - fJob.x0;
+
+            while (fJob.row < fJob.y1) {
+                uint32_t* row = (uint32_t*)(base + (size_t)fJob.row * fStride) + fJob.x0;
+                if (fJob.src) {
+                    const uint32_t* s = (const uint32_t*)(fJob.src +
+                                        (size_t)(fJob.row - fJob.y0) * fJob.srcRowBytes);
+                    xe_blend_row32(row, s, w);
+                } else {
+                    xe_blend_solid_row32(row, fJob.color, w);
+                }
+                ++fJob.row;
+
+                if (fJob.row < fJob.y1 && mach_absolute_time() >= deadline)
+                    return false;
+            }
+            fNeedFlush = true;
+            return true;
         }
+
+        default:
+            return true;
     }
-    IOLockUnlock(contextsLock);
-    return res;
 }
 
-// ---------- bind surface: user mapped fallback ----------
-bool FakeIrisXEAccelerator::bindSurface_UserMapped(uint32_t ctxId,
-                                                   const void* userPtr,
-                                                   size_t bytes,
-                                                   uint32_t rowbytes,
-                                                   uint32_t w,
-                                                   uint32_t h)
+
+
+bool FakeIrisXEAccelerator::stepFlip(uint64_t deadline)
 {
-    XECtx *c = findCtx(ctxId);
-    if (!c) { IOLog("(FakeIrisXEFramebuffer) [Accel] bindSurface: no ctx %u\n", ctxId); return false; }
+    if (!fFB) return true;
+    fJob.waitHW = false;
+    bool timedOut = mach_absolute_time() >= fJob.waitUntil;
+
+    if (!fJob.flipArmed) {
+        // The new draw buffer may be the one the previous flip is
+        // moving away from; don't touch it until that has latched
+        if (fFB->flipPending() && !timedOut) {
+            fJob.waitHW = true;
+            return false;
+        }
 
-    // The user must have already mapped the memory into kernel addressable memory via clientMemory mapping.
-    // We accept the userPtr as kernel-visible pointer. Validate basic fields.
-    if (!userPtr || bytes == 0 || rowbytes == 0 || w == 0 || h == 0) {
-        IOLog("(FakeIrisXEFramebuffer) [Accel] bindSurface: bad args\n");
+        IOReturn ret = fJob.surf ? fFB->flipToGGTT(fJob.surf->ggtt) : fFB->flipTo(fJob.index);
+        if (ret != kIOReturnSuccess) {
+            IOLog("(FakeIrisXEFramebuffer) [Accel] FLIP: display not ready\n");
+            return true;
+        }
+        if (!fJob.surf && fJob.index < kMaxScanout) {
+            // The new front is the old one plus what was drawn into it, so
+            // every other buffer now lags by that much as well
+            const XEBox drawn = fStale[fJob.index];
+            for (uint32_t i = 0; i < kMaxScanout; ++i)
+                if (i != fJob.index) fStale[i].add(drawn);
+            fStale[fJob.index] = {};
+            fFront = fJob.index;
+            setDrawBuffer((fJob.index + 1) % fFB->getScanoutCount());
+        }
+
+        // The plane takes over the job's reference; the job keeps the
+        // outgoing surface's until the display has let go of it
+        XESurface* prev = fScanoutSurf;
+        fScanoutSurf = fJob.surf;
+        fJob.surf = prev;
+        fJob.flipArmed = true;
+    }
+
+    // Double-buffered, the new draw buffer is still on screen until vblank;
+    // a client surface being left may be unwired as soon as we return
+    if ((fJob.surf || fFB->getScanoutCount() < 3) && fFB->flipPending() && !timedOut) {
+        fJob.waitHW = true;
         return false;
     }
 
-    // store mapping
-    c->surf_vaddr = (uintptr_t)userPtr;
-    c->surf_bytes = bytes;
-    c->surf_rowbytes = rowbytes;
-    c->surf_w = w;
-    c->surf_h = h;
+    if (!fJob.sync) {
+        if (timedOut)
+            IOLog("(FakeIrisXEFramebuffer) [Accel] FLIP: no vblank after %u ms\n", FLIP_TIMEOUT_MS);
 
-    IOLog("(FakeIrisXEFramebuffer) [Accel] bindSurface_UserMapped ctx=%u vaddr=%p bytes=%zu rowbytes=%u %ux%u\n",
-          ctxId, (void*)c->surf_vaddr, c->surf_bytes, c->surf_rowbytes, c->surf_w, c->surf_h);
+        // Commands after the flip draw over the frame now on screen: copy
+        // what the new draw buffer missed from the front, in slices
+        const XEBox& b = fStale[fDrawBuffer];
+        const uint8_t* front = (const uint8_t*)fFB->getScanoutKernelPtr(fFront);
+        if (fScanoutSurf || fDrawBuffer == fFront || fDrawBuffer >= kMaxScanout || b.empty() || !front)
+            return true;
 
+        fJob.sync = true;
+        fJob.x0 = b.x0; fJob.y0 = b.y0;
+        fJob.x1 = b.x1; fJob.y1 = b.y1;
+        fJob.row = b.y0;
+        fJob.srcRowBytes = fStride;
+        fJob.src = front + (size_t)b.y0 * fStride + (size_t)b.x0 * 4;
+    }
+
+    if (!copyJobRows(deadline)) return false;
+    fStale[fDrawBuffer] = {};
     return true;
 }
 
-// ---------- present: copy into framebuffer and schedule flush ----------
-bool FakeIrisXEAccelerator::presentContext(uint32_t ctxId)
+
+
+IOReturn FakeIrisXEAccelerator::bindSurface(uint32_t ctxId, const XEBindSurfaceIn& in, XEBindSurfaceOut& out,
+                                            task_t task, const FakeIrisXEAcceleratorUserClient* owner)
 {
-    XECtx *c = findCtx(ctxId);
-    if (!c) { IOLog("(FakeIrisXEFramebuffer) [Accel] present: no ctx %u\n", ctxId); return false; }
+    if (!fCtxLock) return kIOReturnNoResources;
 
-    if (!c->surf_vaddr || c->surf_bytes == 0) {
-        IOLog("(FakeIrisXEFramebuffer) [Accel] present: no surface bound for ctx %u\n", ctxId);
-        return false;
-    }
+    // Wiring can fault pages in; do it before taking the lock
+    XESurface* surf = nullptr;
+    IOReturn ret = createSurface(in, task, surf);
+    if (ret != kIOReturnSuccess) return ret;
 
-    // validate we have framebuffer pointers available
-    if (!fPixels || fStride == 0 || fW == 0 || fH == 0) {
-        IOLog("(FakeIrisXEFramebuffer) [Accel] present: framebuffer not ready\n");
-        return false;
+    // Once published, a concurrent bind or destroy on the context may
+    // drop the last reference to surf: take what we report first
+    uint32_t ggtt = surf->ggtt;
+
+    ret = publishSurface(ctxId, owner, surf, in.ioSurfaceID, in.surfaceID);
+    if (ret != kIOReturnSuccess) return ret;
+
+    out.gpuAddr = ggtt;
+    out.status  = kIOReturnSuccess;
+
+    IOLog("(FakeIrisXEFramebuffer) [Accel] BindSurface: ctx=%u iosurf=%u cpuPtr=0x%llx %ux%u stride=%u fmt=0x%08x ggtt=0x%x\n",
+          ctxId, in.ioSurfaceID, (unsigned long long)(uintptr_t)in.cpuPtr, in.width, in.height,
+          in.bytesPerRow, in.pixelFormat, ggtt);
+
+    return kIOReturnSuccess;
+}
+
+IOReturn FakeIrisXEAccelerator::bindSurfaceBO(uint32_t ctxId, FakeIrisXEBufferObject* bo,
+                                              const XEBindSurfaceBOIn& in, XEBindSurfaceOut& out,
+                                              const FakeIrisXEAcceleratorUserClient* owner)
+{
+    if (!fCtxLock) return kIOReturnNoResources;
+
+    XESurface* surf = nullptr;
+    IOReturn ret = createSurfaceFromBO(bo, in, surf);
+    if (ret != kIOReturnSuccess) return ret;
+
+    // As in bindSurface(): surf may be gone once published
+    uint32_t ggtt = surf->ggtt;
+
+    ret = publishSurface(ctxId, owner, surf, 0, 0);
+    if (ret != kIOReturnSuccess) return ret;
+
+    out.gpuAddr = ggtt;
+    out.status  = kIOReturnSuccess;
+
+    LOG("BindSurfaceBO: ctx=%u bo=0x%08x+0x%llx %ux%u stride=%u fmt=0x%08x ggtt=0x%x",
+        ctxId, in.handle, (unsigned long long)in.offset, in.width, in.height,
+        in.bytesPerRow, in.pixelFormat, ggtt);
+
+    return kIOReturnSuccess;
+}
+
+IOReturn FakeIrisXEAccelerator::vmBind(uint32_t ctxId, FakeIrisXEBufferObject* bo,
+                                       uint64_t align, uint64_t* gpuAddr,
+                                       const FakeIrisXEAcceleratorUserClient* owner)
+{
+    if (!fCtxLock) return kIOReturnNoResources;
+    if (!bo || !gpuAddr) return kIOReturnBadArgument;
+
+    XEContext* ctx = acquireContext(ctxId, owner);
+    if (!ctx) return kIOReturnNotFound;
+
+    // Most contexts never bind anything: the address space, and its
+    // wired table pages, come with the first bind. Racing binds both
+    // build one; the loser drops its own.
+    FakeIrisXEPPGTT* vm = __atomic_load_n(&ctx->vm, __ATOMIC_ACQUIRE);
+    if (!vm) {
+        FakeIrisXEPPGTT* fresh = FakeIrisXEPPGTT::withSize(FakeIrisXEPPGTT::kMaxBytes);
+        if (!fresh) {
+            releaseContext(ctx);
+            return kIOReturnNoMemory;
+        }
+        if (__atomic_compare_exchange_n(&ctx->vm, &vm, fresh, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            vm = fresh;
+        } else {
+            fresh->release();
+        }
     }
 
-    // Perform safe line-by-line copy (clamped)
-    const uint8_t *srcBase = (const uint8_t*)(uintptr_t)c->surf_vaddr;
-    uint8_t *dstBase = (uint8_t*)fPixels;
+    IOReturn ret = vm->bind(bo->getMemory(), align ? align : FakeIrisXEPPGTT::kPageSize, gpuAddr);
+    releaseContext(ctx);
+
+    if (ret == kIOReturnSuccess)
+        LOG("VMBind: ctx=0x%08x %llu KB at 0x%llx", ctxId,
+            (unsigned long long)(bo->getSize() >> 10), (unsigned long long)*gpuAddr);
+    return ret;
+}
+
+IOReturn FakeIrisXEAccelerator::vmUnbind(uint32_t ctxId, uint64_t gpuAddr,
+                                         const FakeIrisXEAcceleratorUserClient* owner)
+{
+    if (!fCtxLock) return kIOReturnNoResources;
 
-    uint32_t copy_w = (c->surf_w < fW) ? c->surf_w : fW;
-    uint32_t copy_h = (c->surf_h < fH) ? c->surf_h : fH;
+    XEContext* ctx = acquireContext(ctxId, owner);
+    if (!ctx) return kIOReturnNotFound;
 
-    // protect against overflow: ensure rowbytes * copy_h <= surf_bytes
-    uint64_t required = (uint64_t)c->surf_rowbytes * (uint64_t)copy_h;
-    if (required > c->surf_bytes) {
-        IOLog("(FakeIrisXEFramebuffer) [Accel] present: surface size mismatch (need %llu bytes have %zu)\n",
-              (unsigned long long)required, c->surf_bytes);
-        // clamp height to available rows
-        uint32_t max_h = (uint32_t)(c->surf_bytes / c->surf_rowbytes);
-        if (max_h < copy_h) copy_h = max_h;
+    FakeIrisXEPPGTT* vm = __atomic_load_n(&ctx->vm, __ATOMIC_ACQUIRE);
+    IOReturn ret = vm ? vm->unbind(gpuAddr) : kIOReturnNotFound;
+
+    // No engine walks a context's PPGTT yet (commands run on the CPU), so
+    // no TLB holds its old translations and the generation retires at
+    // once. Submission takes this over when contexts run on the GPU.
+    if (ret == kIOReturnSuccess) vm->retireTLB(vm->getTLBGeneration());
+    releaseContext(ctx);
+    return ret;
+}
+
+IOReturn FakeIrisXEAccelerator::publishSurface(uint32_t ctxId, const FakeIrisXEAcceleratorUserClient* owner,
+                                               XESurface* surf, uint32_t ioSurfaceID, uint32_t surfaceID)
+{
+    IOLockLock(fCtxLock);
+    XEContext* ctx = lookupContext(ctxId);
+    if (!ctx || ctx->owner != owner) {
+        IOLockUnlock(fCtxLock);
+        releaseSurface(surf);
+        return kIOReturnNotFound;
     }
 
-    // Copy each row - assume 4 bytes/pixel (ARGB8888) — adjust if you support other formats
-    for (uint32_t y = 0; y < copy_h; ++y) {
-        const uint8_t *src = srcBase + (size_t)y * c->surf_rowbytes;
-        uint8_t *dst = dstBase + (size_t)y * fStride;
-        // copy copy_w * 4 bytes, but ensure not to exceed row sizes:
-        size_t bytes_to_copy = (size_t)copy_w * 4;
-        // clamp to the minimum of src row and dst row
-        if (bytes_to_copy > c->surf_rowbytes) bytes_to_copy = c->surf_rowbytes;
-        if (bytes_to_copy > fStride) bytes_to_copy = fStride;
-        memcpy(dst, src, bytes_to_copy);        // NOTE: some kext environments / sandbox may require memory barriers; memcpy is usually fine
+    ctx->hasSurface       = true;
+    ctx->surfIOSurfaceID  = ioSurfaceID;
+    ctx->surfID           = surfaceID;
+
+    XESurface* old = ctx->surface;
+    __atomic_store_n(&ctx->surface, surf, __ATOMIC_RELEASE);
+    if (old) ctxSynchronize();   // nobody can still be about to retain it
+    IOLockUnlock(fCtxLock);
+
+    // Commands still using it, or the plane, keep it alive until they're done
+    releaseSurface(old);
+    return kIOReturnSuccess;
+}
+
+
+// Start worker loop / timer (idempotent)
+void FakeIrisXEAccelerator::startWorkerLoop()
+{
+    if (!fWL) {
+        fWL = getWorkLoop();
+        if (!fWL) fWL = IOWorkLoop::workLoop();
+        if (!fWL) {
+            IOLog("(FakeIrisXEFramebuffer) [Accel] startWorkerLoop: no workloop\n");
+            return;
+        }
+        fWL->retain();
     }
 
-    // mark flush required and request framebuffer schedule
-    fNeedFlush = true;
+    if (!fDoorbell) {
+        fDoorbell = IOInterruptEventSource::interruptEventSource(
+            this,
+            OSMemberFunctionCast(IOInterruptEventSource::Action, this, &FakeIrisXEAccelerator::doorbellFired)
+        );
+        if (!fDoorbell || fWL->addEventSource(fDoorbell) != kIOReturnSuccess) {
+            IOLog("(FakeIrisXEFramebuffer) [Accel] startWorkerLoop: failed to create doorbell\n");
+            OSSafeReleaseNULL(fDoorbell);
+            return;
+        }
+        fDoorbell->enable();
+    }
 
-    // marshal flush to framebuffer workloop via command gate (non-blocking)
-    if (fFB && fFB->commandGate) {
-        fFB->commandGate->runAction(&FakeIrisXEFramebuffer::staticFlushAction);
-    } else {
-        if (fFB) fFB->flushDisplay();
+    if (!createAndArmTimer(this, fWL, fTimer, IDLE_POLL_MS)) {
+        IOLog("(FakeIrisXEFramebuffer) [Accel] startWorkerLoop: failed to create/arm timer\n");
+        return;
     }
 
+    // pick up anything submitted before the event sources existed
+    ringDoorbell();
 
-    IOLog("(FakeIrisXEFramebuffer) [Accel] presentContext ctx=%u copied %u x %u, scheduled flush\n", ctxId, copy_w, copy_h);
-    return true;
+    IOLog("(FakeIrisXEFramebuffer) [Accel] startWorkerLoop: doorbell + idle timer armed\n");
 }
+
+
+
+
+
+
+
+IOBufferMemoryDescriptor* FakeIrisXEAccelerator::getScanoutMemory(uint32_t index) const
+{
+    return fFB ? fFB->getScanoutMemory(index) : nullptr;
+}
+
+// Fill capabilities
+void FakeIrisXEAccelerator::getCaps(XEAccelCaps& out)
+{
+    bzero(&out, sizeof(out));
+    out.version = XE_VERSION;
+    out.metalSupported = 0; // flip to 1 if you wire Metal later
+    out.scanoutCount = fFB ? fFB->getScanoutCount() : 0;
+    out.reserved1 = 0;
+}
+
+// Flush -> call FB flush if present
+IOReturn FakeIrisXEAccelerator::flush(uint32_t ctxId)
+{
+    if (fFB) {
+        fFB->flushDisplay();
+        return kIOReturnSuccess;
+    }
+    return kIOReturnNotReady;
+}
+
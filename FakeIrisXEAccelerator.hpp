@@ -6,41 +6,76 @@
 #include <IOKit/IOUserClient.h>
 #include <IOKit/IOLib.h>
 #include <IOKit/IOTimerEventSource.h>
+#include <IOKit/IOInterruptEventSource.h>
 #include <IOKit/IOWorkLoop.h>
+#include <kern/thread_call.h>
 
 // Forward-declare the framebuffer class
 class FakeIrisXEFramebuffer;
+class FakeIrisXEBufferObject;
+class FakeIrisXEPPGTT;
 
 // Include the shared structures used in public methods
 #include "FakeIrisXEAccelShared.h"
+#include "FakeIrisXEHandleTable.hpp"
+#include "FakeIrisXESlab.hpp"
 
 class FakeIrisXEAccelerator : public IOService {
     OSDeclareDefaultStructors(FakeIrisXEAccelerator)
 
+    friend struct XEAccelTest;   // tests/test_accel.cpp: draws without a framebuffer
+
 public:
     
     typedef IOService super;
 
     
+    /**
+     * @struct XESurface
+     * @brief A client surface bound with kAccelSel_BindSurface (the task's
+     * pages wired and mapped into the kernel) or kAccelSel_BindSurfaceBO (a
+     * buffer object's memory), and mapped into the GGTT as well when the
+     * plane can scan it out as it is. Reference counted;
+     * a rebind publishes a new one and the old one lives until its last
+     * user (a job, or the plane) lets go.
+     */
+    struct XESurface {
+        uint32_t refs{0};
+        IOMemoryDescriptor* md{nullptr};   // the client's range
+        bool     wired{false};             // md->prepare() succeeded; buffer objects come wired
+        IOMemoryMap* map{nullptr};         // kernel mapping of md, unless it has one already
+        void*    cpu{nullptr};             // first pixel, kernel VA
+        uint32_t width{0}, height{0};
+        uint32_t rowBytes{0};
+        uint32_t pixelFormat{0};
+        uint32_t ggtt{0};                  // GGTT offset, if inGGTT
+        bool     inGGTT{false};            // scanout-capable and bound in the GGTT
+    };
+
     /**
      * @struct XEContext
      * @brief Stores per-context state, including its bound surface.
-     * This structure is stored inside an OSData wrapper within the fContexts array.
+     * Allocated from fCtxSlab; ctxId is its fContexts handle. Reference
+     * counted: fContexts holds one, and so does any command using it
+     * (see acquireContext()). Surface fields are written under fCtxLock
+     * and read without it on the command path. Only the connection that
+     * created a context may bind to or destroy it, and closing that
+     * connection destroys it.
      */
     struct XEContext {
+        uint32_t refs{0};
         uint32_t ctxId{0};
         bool     active{false};
         uint64_t sharedGPUPtr{0}; // Shared data pointer from client
+        const FakeIrisXEAcceleratorUserClient* owner{nullptr}; // creating connection, compared only
+        XEContext* nextDead{nullptr}; // destroyContexts() batch, under fCtxLock
+        FakeIrisXEPPGTT* vm{nullptr}; // private GPU address space, made by the first VMBind; then for the context's life
 
         // Surface data
         bool     hasSurface{false};
-        uint32_t surfWidth{0};
-        uint32_t surfHeight{0};
-        uint32_t surfRowBytes{0};
-        uint32_t surfPixelFormat{0};
         uint32_t surfIOSurfaceID{0};
         uint32_t surfID{0};
-        void* surfCPU{nullptr}; // user-space mapped CPU pointer
+        XESurface* surface{nullptr}; // reference held; replaced under fCtxLock, see acquireSurface()
     };
 
     // --- IOService Overrides ---
@@ -62,47 +97,134 @@ public:
      * @brief Creates a new accelerator context.
      * @param sharedPtr Client-space pointer to shared data.
      * @param flags Creation flags.
+     * @param owner The connection creating it; the other calls below
+     * fail with kIOReturnNotFound for contexts owner didn't create.
      * @return A non-zero context ID on success, 0 on failure.
      */
-    uint32_t createContext(uint64_t sharedPtr, uint32_t flags);
+    uint32_t createContext(uint64_t sharedPtr, uint32_t flags, const FakeIrisXEAcceleratorUserClient* owner);
 
     /**
      * @brief Destroys an accelerator context.
      * @param ctxId The ID of the context to destroy.
-     * @return kIOReturnSuccess.
+     * @return true if ctxId named a live context of owner's.
      */
-    bool destroyContext(uint32_t ctxId);
+    bool destroyContext(uint32_t ctxId, const FakeIrisXEAcceleratorUserClient* owner);
 
     /**
-     * @brief Binds a surface's metadata to a context.
+     * @brief Destroys every context owner created (connection closing).
+     */
+    void destroyContexts(const FakeIrisXEAcceleratorUserClient* owner);
+
+    /**
+     * @brief Wires a client surface and binds it to a context.
      * @param ctxId The context ID.
      * @param in Input parameters (size, format, CPU pointer, etc.).
-     * @param out Output parameters (e.g., status).
+     * @param out Output parameters (GGTT offset if it can be scanned out directly).
+     * @param task The task whose address space in.cpuPtr refers to.
      * @return kIOReturnSuccess on success, or an error code.
      */
-    IOReturn bindSurface(uint32_t ctxId, const XEBindSurfaceIn& in, XEBindSurfaceOut& out);
+    IOReturn bindSurface(uint32_t ctxId, const XEBindSurfaceIn& in, XEBindSurfaceOut& out, task_t task,
+                         const FakeIrisXEAcceleratorUserClient* owner);
+
+    /**
+     * @brief Binds a surface whose pixels live in a buffer object.
+     * @param bo The object the client's in.handle named; the surface keeps its memory alive.
+     * @return kIOReturnSuccess on success, or an error code.
+     */
+    IOReturn bindSurfaceBO(uint32_t ctxId, FakeIrisXEBufferObject* bo,
+                           const XEBindSurfaceBOIn& in, XEBindSurfaceOut& out, const FakeIrisXEAcceleratorUserClient* owner);
+
+    /**
+     * @brief Maps bo into ctxId's address space.
+     * @param align Power of two; 0 means a page.
+     * @param gpuAddr Out: where it was mapped.
+     * @return kIOReturnSuccess on success, or an error code.
+     */
+    IOReturn vmBind(uint32_t ctxId, FakeIrisXEBufferObject* bo, uint64_t align, uint64_t* gpuAddr,
+                    const FakeIrisXEAcceleratorUserClient* owner);
+
+    /**
+     * @brief Unmaps what vmBind() mapped at gpuAddr in ctxId's address space.
+     */
+    IOReturn vmUnbind(uint32_t ctxId, uint64_t gpuAddr, const FakeIrisXEAcceleratorUserClient* owner);
 
     
     // Ensure these are declared in the public section of the class
     void startWorkerLoop();                                          // start worker timer/workloop (idempotent)
     void getCaps(XEAccelCaps& out);                                  // fill caps struct
     IOReturn flush(uint32_t ctxId = 0);                              // flush (called by UC)
-    IOReturn bindSurfaceToContext(uint32_t ctxId, uint32_t surfID);  // bind IOSurface to ctx
     IOBufferMemoryDescriptor* getSharedMD() const { return fSharedMem; } // expose shared MD if needed
+    void getStats(XEAccelStats& out, bool reset);                    // snapshot counters (kAccelSel_GetStats)
 
     
     // Shared Ring Buffer
     IOBufferMemoryDescriptor* fSharedMem {nullptr};
-    volatile XEHdr* fHdr       {nullptr};
+    XEHdr* fHdr       {nullptr};   // indices accessed via xe_load_acquire/xe_store_release
     uint8_t* fRingBase  {nullptr}; // Points after the XEHdr
+    uint32_t fRingCap   {0};       // capacity validated at attach (user can rewrite the header copy)
+    uint32_t fTail      {0};       // consumer index; only ever stored to fHdr->tail, never read back
+
+    // Advance the consumer index and publish it (release: done with those bytes)
+    void publishTail(uint32_t tail) { fTail = tail; xe_store_release(&fHdr->tail, tail); }
 
     
     
     static void timerCallback(OSObject* owner, IOTimerEventSource* sender);
 
    
+    // Idle safety-net timer; the doorbell is the normal wakeup path.
     void pollRing(IOTimerEventSource* sender);
 
+    /**
+     * @brief Doorbell from the user client (kAccelSel_Submit).
+     * Wakes the ring consumer on the workloop immediately instead of
+     * waiting for the next pollRing() tick. Safe to call from any thread.
+     */
+    void ringDoorbell();
+
+    // attachShared() second half, on fWL: makes page the live ring
+    IOReturn swapShared(IOBufferMemoryDescriptor* page, uintptr_t cap);
+
+    // Doorbell event source action (runs on fWL)
+    void doorbellFired(IOInterruptEventSource* sender, int count);
+
+    // Drain commands for up to TICK_BUDGET_US. Returns true if work remains.
+    bool drainRing();
+
+    // drainRing() left work behind: re-run it now, or shortly if fJob is waiting on hardware
+    void scheduleMore();
+
+    // Scanout buffer index < XEAccelCaps.scanoutCount, for kAccelMem_Scanout mappings
+    IOBufferMemoryDescriptor* getScanoutMemory(uint32_t index) const;
+
+    /**
+     * @struct XEJob
+     * @brief Continuation for a command that takes more than one tick.
+     * The command's record stays at the ring tail until the job retires,
+     * so the producer can't reuse it and ordering is preserved.
+     */
+    struct XEJob {
+        bool     active{false};
+        uint32_t opcode{0};
+        uint32_t recordBytes{0};       // ring bytes to retire when finished
+        uint32_t x0{0}, y0{0};         // clipped destination rectangle
+        uint32_t x1{0}, y1{0};
+        uint32_t row{0};               // next row to execute
+        uint32_t color{0};
+        const uint8_t* src{nullptr};   // BLEND: source pixel at (x0, y0), or null for solid
+        uint32_t srcRowBytes{0};
+        bool     reverse{false};       // COPY: rows run bottom-up, row counts down to y0
+        uint32_t index{0}, count{0};   // RECT_LIST: next entry / entries at src; PRESENT: fDamage
+        uint64_t busyAbs{0};           // execution time so far, mach absolute units
+        XESurface* surf{nullptr};      // reference held until the job retires (source, or flip target)
+        bool     waitHW{false};        // blocked outside the workloop (display, band workers), poll don't spin
+        uint64_t waitUntil{0};         // FLIP: stop waiting for vblank at this deadline
+        bool     flip{false};          // PRESENT: finish with a flip (see stepFlip())
+        bool     flipArmed{false};     // PLANE_SURF written, waiting for it to latch
+        bool     sync{false};          // FLIP: copying the front buffer into the new draw buffer
+    };
+    XEJob fJob;
+
     // Create the timer and add it to the workloop. Return true on success.
     static bool createAndArmTimer(FakeIrisXEAccelerator* self, IOWorkLoop* wl, IOTimerEventSource*& timerOut, uint32_t ms)
     {
@@ -146,6 +268,7 @@ public:
     // Workloop & Timer
     IOWorkLoop* fWL {nullptr};
     IOTimerEventSource* fTimer {nullptr};
+    IOInterruptEventSource* fDoorbell {nullptr};
     
     
     volatile bool fPollActive { false };
@@ -154,27 +277,8 @@ public:
     
     
     
-  //  IOSurfaceRef fPresentSurf = nullptr;
-    uint32_t fPresentX, fPresentY, fPresentW, fPresentH;
-    uint32_t fPresentRow = 0;
-    bool     fPresentInProgress = false;
 
 
-    IOLock *contextsLock;    // protects contexts array
-        OSArray *contexts;       // stores OSData wrappers containing XECtx*
-        uint32_t nextCtxId;
-
-        // helper methods
-        uint32_t createContext();
-        XECtx* findCtx(uint32_t ctxId);
-
-        bool bindSurface_UserMapped(uint32_t ctxId, const void* userPtr, size_t bytes, uint32_t rowbytes, uint32_t w, uint32_t h);
-        bool presentContext(uint32_t ctxId);
-
-
-        // init/teardown helpers
-        bool initContexts();
-        void freeContexts();
     
     
     
@@ -183,6 +287,133 @@ private:
   
     void processCommand(const XECmd &cmd, const void* payload, uint32_t payloadBytes);
 
+    // --- Command dispatch (table in the .cpp) ---
+
+    using OpHandler = void (FakeIrisXEAccelerator::*)(const XECmd& cmd, const void* payload, uint32_t bytes);
+
+    /**
+     * @struct OpDesc
+     * @brief Registry entry for one XE_CMD_* opcode.
+     */
+    struct OpDesc {
+        const char* name;
+        uint32_t    minBytes;      // payload bounds, enforced before the handler runs
+        uint32_t    maxBytes;
+        OpHandler   handler;       // null: accepted, nothing to do
+    };
+
+    static const OpDesc   kOpTable[];   // indexed by opcode
+    static const uint32_t kOpCount;
+
+    /**
+     * @brief Copies a fixed-size payload P out of the ring and calls H with it.
+     */
+    template <typename P, void (FakeIrisXEAccelerator::*H)(const XECmd&, const P&)>
+    void opFixed(const XECmd& cmd, const void* payload, uint32_t bytes);
+
+    /**
+     * @brief Table entry for an opcode whose payload is exactly one P.
+     */
+    template <typename P, void (FakeIrisXEAccelerator::*H)(const XECmd&, const P&)>
+    static constexpr OpDesc fixedOp(const char* name)
+    {
+        return { name, (uint32_t)sizeof(P), (uint32_t)sizeof(P), &FakeIrisXEAccelerator::opFixed<P, H> };
+    }
+
+    void opClear(const XECmd& cmd, const XEClearPayload& p);
+    void opRect(const XECmd& cmd, const XERectPayload& p);
+    void opCopy(const XECmd& cmd, const XECopyPayload& p);
+    void opBlend(const XECmd& cmd, const XEBlendPayload& p);
+    void opFlush(const XECmd& cmd, const void* payload, uint32_t bytes);
+    void opPresent(const XECmd& cmd, const void* payload, uint32_t bytes);
+    void opRectList(const XECmd& cmd, const void* payload, uint32_t bytes);
+    void opFlip(const XECmd& cmd, const XEFlipPayload& p);
+
+    /**
+     * @brief Adds [x0,x1) x [y0,y1) to fDamage, merging it into an existing
+     * box when that wastes little, or always once the list is full.
+     */
+    void addDamage(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1);
+
+    /**
+     * @brief Points 2D rendering (fPixels) at scanout buffer index.
+     */
+    void setDrawBuffer(uint32_t index);
+
+    /**
+     * @brief Records that [x0,x1) x [y0,y1) of the draw buffer is about to
+     * be rewritten, in fStale.
+     */
+    void markDrawn(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1);
+
+    /**
+     * @brief Drops fJob, releasing anything it holds.
+     */
+    void endJob();
+
+    /**
+     * @brief Arms fJob to fill [x0,x1) x [y0,y1) with color.
+     */
+    void startFill(uint32_t opcode, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, uint32_t color);
+
+    /**
+     * @brief Arms fJob to composite src (or color if src is null) over [x0,x1) x [y0,y1).
+     */
+    void startBlend(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1,
+                    uint32_t color, const uint8_t* src, uint32_t srcRowBytes);
+
+    /**
+     * @brief Arms fJob to copy a clipped w x h block within the framebuffer.
+     */
+    void startCopy(uint32_t sx, uint32_t sy, uint32_t dx, uint32_t dy, uint32_t w, uint32_t h);
+
+    /**
+     * @brief Splits fJob's rectangle into row bands and hands all but the
+     * first to the band workers; fBandsPending counts the ones in flight.
+     * @return End row (exclusive) of the first band, which the caller copies.
+     */
+    uint32_t dispatchBands();
+
+    /**
+     * @brief thread_call entry: copies one XEBand, and the last band to
+     * finish rings the doorbell.
+     */
+    static void bandEntry(thread_call_param_t band, thread_call_param_t unused);
+
+    /**
+     * @brief Waits for in-flight bands and frees the worker thread calls.
+     */
+    void freeBandWorkers();
+
+    /**
+     * @brief Fills fJob's current rectangle from fJob.row until done or past deadline.
+     * @return true when the rectangle is complete.
+     */
+    bool fillJobRows(uint64_t deadline);
+
+    /**
+     * @brief Flips the plane to fJob.surf, or to scanout buffer fJob.index
+     * if that is null, then waits for the flip to latch where the buffer
+     * being left must not be touched before, and brings the new draw
+     * buffer up to date with the one now on screen. Never blocks.
+     * @return true when done.
+     */
+    bool stepFlip(uint64_t deadline);
+
+    /**
+     * @brief Copies fJob's current rectangle from fJob.src, top-down, from
+     * fJob.row until done or past deadline.
+     * @return true when the rectangle is complete.
+     */
+    bool copyJobRows(uint64_t deadline);
+
+    /**
+     * @brief Runs fJob until it finishes or the deadline passes.
+     * At least one row is executed per call so progress is guaranteed.
+     * @return true when the job has finished.
+     */
+    bool stepJob(uint64_t deadline);
+
     // --- Context Management ---
     
     /**
@@ -191,35 +422,133 @@ private:
      */
     XEContext* lookupContext(uint32_t ctxId);
 
-    // --- 2D Primitive Operations ---
-    
     /**
-     * @brief Handles the XE_CMD_CLEAR command.
+     * @brief Looks up ctxId without taking fCtxLock and returns it with a
+     * reference held, or null. Pair with releaseContext().
      */
-    void cmdClear(uint32_t argb);
-    
+    XEContext* acquireContext(uint32_t ctxId);
+
+    // As above, but null unless owner created the context
+    XEContext* acquireContext(uint32_t ctxId, const FakeIrisXEAcceleratorUserClient* owner);
+
     /**
-     * @brief Handles the XE_CMD_RECT command.
+     * @brief Drops a reference; frees the context on the last one. Null is ignored.
      */
-    void cmdRect(const XERectPayload& p);
-    
+    void releaseContext(XEContext* ctx);
+
+    /**
+     * @brief Returns ctx's bound surface with a reference held, or null.
+     * Lock-free, like acquireContext(). Pair with releaseSurface().
+     */
+    XESurface* acquireSurface(XEContext* ctx);
+
+    /**
+     * @brief Drops a reference; unmaps and unwires the surface on the last one.
+     */
+    void releaseSurface(XESurface* surf);
+
+    /**
+     * @brief Wires in's range of task and maps it, into the GGTT too if scanout-capable.
+     */
+    IOReturn createSurface(const XEBindSurfaceIn& in, task_t task, XESurface*& out);
+
+    /**
+     * @brief Wraps a range of bo as a surface, mapped into the GGTT if scanout-capable.
+     */
+    IOReturn createSurfaceFromBO(FakeIrisXEBufferObject* bo, const XEBindSurfaceBOIn& in, XESurface*& out);
+
+    /**
+     * @brief Maps a page-aligned surface into the GGTT if the plane can
+     * scan it out as it is; leaves it on the copy path otherwise.
+     */
+    void bindSurfaceForScanout(XESurface* surf);
+
+    /**
+     * @brief Makes surf ctxId's surface, taking over the reference, and
+     * drops the one it replaces. Releases surf if ctxId is gone or not
+     * owner's.
+     */
+    IOReturn publishSurface(uint32_t ctxId, const FakeIrisXEAcceleratorUserClient* owner, XESurface* surf,
+                            uint32_t ioSurfaceID, uint32_t surfaceID);
+
+    // Read section for lock-free fContexts lookups (two-counter epoch)
+    uint32_t ctxReadLock();
+    void ctxReadUnlock(uint32_t epoch);
+
+    /**
+     * @brief Waits until every read section that began before the call has ended.
+     * @note Called with fCtxLock held, which serialises writers.
+     */
+    void ctxSynchronize();
+
     /**
-     * @brief Handles the XE_CMD_COPY command.
+     * @brief Accounts one retired command in fStats.
+     * @param busyAbs Execution time in mach absolute units.
      */
-    void cmdCopy(const XECopyPayload& p);
+    void recordCommand(uint32_t opcode, uint64_t busyAbs);
 
     // --- Member Variables ---
 
     // Framebuffer
     FakeIrisXEFramebuffer* fFB {nullptr};
-    void* fPixels{nullptr};   // Kernel-mapped FB pointer
+    void* fPixels{nullptr};   // Kernel-mapped draw buffer (scanout buffer fDrawBuffer)
+    uint32_t fDrawBuffer{0};
+    XESurface* fScanoutSurf{nullptr};   // client surface on the plane, reference held
     uint32_t                  fW{0}, fH{0}, fStride{0};
 
 
-    // Context Management
-    OSArray* fContexts {nullptr};
+    // Damage for the PRESENT job, merged; [x0,x1) x [y0,y1)
+    struct XEBox {
+        uint32_t x0, y0, x1, y1;
+
+        bool empty() const { return x1 <= x0 || y1 <= y0; }
+
+        // Grow to cover o too
+        void add(const XEBox& o) {
+            if (o.empty()) return;
+            if (empty()) { *this = o; return; }
+            if (o.x0 < x0) x0 = o.x0;
+            if (o.y0 < y0) y0 = o.y0;
+            if (o.x1 > x1) x1 = o.x1;
+            if (o.y1 > y1) y1 = o.y1;
+        }
+    };
+    XEBox    fDamage[XE_PRESENT_MAX_RECTS];
+    uint32_t fDamageCount{0};
+
+    // Per scanout buffer, a box covering everything where it may differ
+    // from buffer fFront, the last one we put on screen. A FLIP copies the
+    // new draw buffer's box from the front, so drawing after it starts
+    // from the frame on screen rather than one from flips ago.
+    static constexpr uint32_t kMaxScanout = 3;   // FakeIrisXEFramebuffer::kMaxScanout
+    XEBox    fStale[kMaxScanout] {};
+    uint32_t fFront{0};
+
+    // Row bands of a large PRESENT copy, run on thread calls next to the
+    // workloop's own band. A band is only rewritten once fBandsPending is 0.
+    struct XEBand {
+        FakeIrisXEAccelerator* owner;
+        thread_call_t  call;
+        uint8_t*       dst;
+        const uint8_t* src;
+        uint32_t       dstStride, srcStride;
+        uint32_t       width, rows;
+    };
+    static constexpr uint32_t kMaxBandWorkers = 3;
+    XEBand   fBands[kMaxBandWorkers] {};
+    uint32_t fNumBandWorkers{0};
+    uint32_t fBandsPending{0};
+
+    // Counters; updated by drainRing() on the workloop, read and reset by the UC (see stat_max()).
+    XEAccelStats fStats {};
+
+    // Context Management. fCtxLock serialises writers; see acquireContext() for readers.
+    XEHandleTable<XEContext, 4096> fContexts;
     IOLock* fCtxLock {nullptr};
-    uint32_t                  fNextCtxId {1};
+    XESlabCache fCtxSlab;    // XEContext
+    XESlabCache fSurfSlab;   // XESurface
+    uint32_t fCtxEpoch {0};
+    uint32_t fCtxReaders[2] {};
 };
 
 
@@ -1,11 +1,16 @@
 #include "FakeIrisXEAcceleratorUserClient.hpp"
 #include "FakeIrisXEAccelerator.hpp"
 #include "FakeIrisXEAccelShared.h"
+#include "FakeIrisXEBufferObject.hpp"
 
 #include <IOKit/IOLib.h>
 
 OSDefineMetaClassAndStructors(FakeIrisXEAcceleratorUserClient, IOUserClient);
 
+// A BO's handle doubles as its clientMemoryForType type
+static_assert((1u << XEHandleTable<FakeIrisXEBufferObject, XE_BO_MAX_HANDLES>::kIndexBits) >= kAccelMem_BO,
+              "BO handles must not collide with the fixed memory types");
+
 // initWithTask - kernel correct signature
 bool FakeIrisXEAcceleratorUserClient::initWithTask(task_t owningTask, void* securityID, UInt32 type)
 {
@@ -27,26 +32,50 @@ bool FakeIrisXEAcceleratorUserClient::start(IOService* provider)
 
     IOLog("(FakeIrisXEFramebuffer) [AccelUC] started\n");
 
-    // Only allocate page, do NOT attach yet
-    fSharedMem = IOBufferMemoryDescriptor::inTaskWithOptions(
+    fBOLock = IOLockAlloc();
+    if (!fBOLock) return false;
+
+    // Only allocate the default ring, do NOT attach yet.
+    // The client may resize it with kAccelSel_CreateRing before mapping.
+    if (allocRing(XE_RING_DEFAULT_BYTES) != kIOReturnSuccess) return false;
+
+    return true;
+}
+
+
+
+IOReturn FakeIrisXEAcceleratorUserClient::allocRing(uint32_t ringBytes)
+{
+    if (!xe_is_pow2(ringBytes)) return kIOReturnBadArgument;
+
+    // header + ring, rounded up to whole pages
+    vm_size_t bytes = (sizeof(XEHdr) + ringBytes + XE_PAGE - 1) & ~(vm_size_t)(XE_PAGE - 1);
+
+    IOBufferMemoryDescriptor* md = IOBufferMemoryDescriptor::inTaskWithOptions(
         kernel_task,
         kIODirectionInOut | kIOMemoryKernelUserShared,
+        bytes,
         XE_PAGE);
 
-    if (!fSharedMem) return false;
+    if (!md) return kIOReturnNoMemory;
 
-    bzero(fSharedMem->getBytesNoCopy(), XE_PAGE);
-    fSharedHdr = (volatile XEHdr*)fSharedMem->getBytesNoCopy();
+    bzero(md->getBytesNoCopy(), md->getLength());
 
-    fSharedHdr->magic    = XE_MAGIC;
-    fSharedHdr->version  = XE_VERSION;
-    fSharedHdr->capacity = XE_PAGE - sizeof(XEHdr);
-    fSharedHdr->head     = 0;
-    fSharedHdr->tail     = 0;
+    XEHdr* hdr = (XEHdr*)md->getBytesNoCopy();
+    hdr->magic    = XE_MAGIC;
+    hdr->version  = XE_VERSION;
+    hdr->capacity = ringBytes;
+    hdr->head     = 0;
+    hdr->tail     = 0;
 
-    fRingBase = ((uint8_t*)fSharedHdr) + sizeof(XEHdr);
+    if (fSharedMem) fSharedMem->release();
+    fSharedMem = md;
+    fSharedHdr = hdr;
+    fRingBase  = ((uint8_t*)hdr) + sizeof(XEHdr);
 
-    return true;
+    IOLog("(FakeIrisXEFramebuffer) [AccelUC] ring allocated: cap=%u map=%llu\n",
+          ringBytes, (unsigned long long)md->getLength());
+    return kIOReturnSuccess;
 }
 
 
@@ -69,6 +98,14 @@ void FakeIrisXEAcceleratorUserClient::stop(IOService* provider)
         fRingBase = nullptr;
     }
 
+    if (fOwner) fOwner->destroyContexts(this);
+
+    if (fBOLock) {
+        releaseAllBOs();
+        IOLockFree(fBOLock);
+        fBOLock = nullptr;
+    }
+
     fOwner = nullptr;
 
     IOUserClient::stop(provider);
@@ -82,9 +119,73 @@ void FakeIrisXEAcceleratorUserClient::stop(IOService* provider)
 
 IOReturn FakeIrisXEAcceleratorUserClient::clientClose()
 {
+    // Contexts and handles die with the connection; mappings keep their own references
+    if (fOwner) fOwner->destroyContexts(this);
+    if (fBOLock) releaseAllBOs();
+    return kIOReturnSuccess;
+}
+
+
+
+IOReturn FakeIrisXEAcceleratorUserClient::createBO(uint64_t size, uint32_t flags,
+                                                   uint32_t* handle, uint64_t* outSize)
+{
+    if (size == 0 || size > XE_BO_MAX_BYTES) return kIOReturnBadArgument;
+
+    // Allocate outside the lock; the budget is checked again under it
+    FakeIrisXEBufferObject* bo = FakeIrisXEBufferObject::withSize(size, flags);
+    if (!bo) return flags ? kIOReturnBadArgument : kIOReturnNoMemory;
+
+    IOLockLock(fBOLock);
+    uint32_t h = XEHandleTable<FakeIrisXEBufferObject, XE_BO_MAX_HANDLES>::kInvalid;
+    if (fBOBytes + bo->getSize() <= XE_BO_CLIENT_MAX_BYTES) {
+        h = fBOs.insert(bo);
+        if (h) fBOBytes += bo->getSize();
+    }
+    IOLockUnlock(fBOLock);
+
+    if (!h) {
+        bo->release();
+        return kIOReturnNoResources;
+    }
+
+    *handle = h;
+    *outSize = bo->getSize();
     return kIOReturnSuccess;
 }
 
+IOReturn FakeIrisXEAcceleratorUserClient::closeBO(uint32_t handle)
+{
+    IOLockLock(fBOLock);
+    FakeIrisXEBufferObject* bo = fBOs.remove(handle);
+    if (bo) fBOBytes -= bo->getSize();
+    IOLockUnlock(fBOLock);
+
+    if (!bo) return kIOReturnNotFound;
+    bo->release();
+    return kIOReturnSuccess;
+}
+
+FakeIrisXEBufferObject* FakeIrisXEAcceleratorUserClient::lookupBO(uint32_t handle)
+{
+    if (!fBOLock) return nullptr;
+
+    IOLockLock(fBOLock);
+    FakeIrisXEBufferObject* bo = fBOs.lookup(handle);
+    if (bo) bo->retain();
+    IOLockUnlock(fBOLock);
+    return bo;
+}
+
+void FakeIrisXEAcceleratorUserClient::releaseAllBOs()
+{
+    IOLockLock(fBOLock);
+    fBOs.forEach([](uint32_t, FakeIrisXEBufferObject* bo) { bo->release(); });
+    fBOs.reset();
+    fBOBytes = 0;
+    IOLockUnlock(fBOLock);
+}
+
 
 IOReturn FakeIrisXEAcceleratorUserClient::externalMethod(uint32_t selector,
                                                          IOExternalMethodArguments* args,
@@ -113,14 +214,16 @@ IOReturn FakeIrisXEAcceleratorUserClient::externalMethod(uint32_t selector,
             {
                 const XECreateCtxIn* in = reinterpret_cast<const XECreateCtxIn*>(args->structureInput);
                 XECreateCtxOut out{};
-                out.ctxId = fOwner->createContext(in->sharedGPUPtr, in->flags);
+                out.ctxId = fOwner->createContext(in->sharedGPUPtr, in->flags, this);
                 if (!args->structureOutput || args->structureOutputSize < sizeof(out)) return kIOReturnMessageTooLarge;
                 bcopy(&out, args->structureOutput, sizeof(out));
                 args->structureOutputSize = sizeof(out);
                 return kIOReturnSuccess;
             }
         case kAccelSel_Submit:
-            // For your current test harness we can treat submit as a stub that returns success.
+            // Doorbell: the commands are already in the shared ring, just wake the consumer.
+            if (!fOwner->fHdr) return kIOReturnNotReady;
+            fOwner->ringDoorbell();
             return kIOReturnSuccess;
         case kAccelSel_Flush:
             // optional: call accelerator flush( ctx )
@@ -129,9 +232,134 @@ IOReturn FakeIrisXEAcceleratorUserClient::externalMethod(uint32_t selector,
                 return fOwner->flush(ctxId);
             }
             return fOwner->flush(0);
+        case kAccelSel_CreateRing:
+            if (!args || !args->structureInput || args->structureInputSize < sizeof(XECreateRingIn))
+                return kIOReturnBadArgument;
+            if (!args->structureOutput || args->structureOutputSize < sizeof(XECreateRingOut))
+                return kIOReturnMessageTooLarge;
+            {
+                // The consumer caches the ring geometry at attach; no resizing after that.
+                if (fRingMapped) return kIOReturnBusy;
+
+                const XECreateRingIn* in = reinterpret_cast<const XECreateRingIn*>(args->structureInput);
+                uint32_t cap = xe_ring_round(in->ringBytes);
+                if (fSharedHdr && fSharedHdr->capacity != cap) {
+                    IOReturn ret = allocRing(cap);
+                    if (ret != kIOReturnSuccess) return ret;
+                }
+
+                XECreateRingOut out{};
+                out.capacity = fSharedHdr->capacity;
+                out.mapBytes = (uint32_t)fSharedMem->getLength();
+                bcopy(&out, args->structureOutput, sizeof(out));
+                args->structureOutputSize = sizeof(out);
+                return kIOReturnSuccess;
+            }
+        case kAccelSel_GetStats:
+            // Clients built before cmdsRejected get everything up to it
+            if (!args || !args->structureOutput ||
+                args->structureOutputSize < offsetof(XEAccelStats, cmdsRejected))
+                return kIOReturnMessageTooLarge;
+            {
+                bool reset = args->scalarInput && args->scalarInputCount >= 1 && args->scalarInput[0];
+                XEAccelStats stats{};
+                fOwner->getStats(stats, reset);
+                uint32_t bytes = MIN(args->structureOutputSize, (uint32_t)sizeof(stats));
+                bcopy(&stats, args->structureOutput, bytes);
+                args->structureOutputSize = bytes;
+                return kIOReturnSuccess;
+            }
+        case kAccelSel_BindSurface:
+            if (!args || !args->structureInput || args->structureInputSize < sizeof(XEBindSurfaceIn))
+                return kIOReturnBadArgument;
+            if (!args->structureOutput || args->structureOutputSize < sizeof(XEBindSurfaceOut))
+                return kIOReturnMessageTooLarge;
+            {
+                // Copy first: the client can rewrite its buffer while we work
+                XEBindSurfaceIn in;
+                bcopy(args->structureInput, &in, sizeof(in));
+
+                XEBindSurfaceOut out{};
+                IOReturn ret = fOwner->bindSurface(in.ctxId, in, out, fTask, this);
+                if (ret != kIOReturnSuccess) return ret;
+                bcopy(&out, args->structureOutput, sizeof(out));
+                args->structureOutputSize = sizeof(out);
+                return kIOReturnSuccess;
+            }
         case kAccelSel_DestroyContext:
             if (!args || !args->scalarInput || args->scalarInputCount < 1) return kIOReturnBadArgument;
-            return fOwner->destroyContext(static_cast<uint32_t>(args->scalarInput[0]));
+            return fOwner->destroyContext(static_cast<uint32_t>(args->scalarInput[0]), this)
+                   ? kIOReturnSuccess : kIOReturnNotFound;
+        case kAccelSel_BOCreate:
+            if (!args || !args->scalarInput || args->scalarInputCount < 2 ||
+                !args->scalarOutput || args->scalarOutputCount < 2)
+                return kIOReturnBadArgument;
+            {
+                uint32_t handle = 0;
+                uint64_t size = 0;
+                IOReturn ret = createBO(args->scalarInput[0], static_cast<uint32_t>(args->scalarInput[1]),
+                                        &handle, &size);
+                if (ret != kIOReturnSuccess) return ret;
+                args->scalarOutput[0] = handle;
+                args->scalarOutput[1] = size;
+                args->scalarOutputCount = 2;
+                return kIOReturnSuccess;
+            }
+        case kAccelSel_BOClose:
+            if (!args || !args->scalarInput || args->scalarInputCount < 1) return kIOReturnBadArgument;
+            return closeBO(static_cast<uint32_t>(args->scalarInput[0]));
+        case kAccelSel_BOGetSize:
+            if (!args || !args->scalarInput || args->scalarInputCount < 1 ||
+                !args->scalarOutput || args->scalarOutputCount < 1)
+                return kIOReturnBadArgument;
+            {
+                FakeIrisXEBufferObject* bo = lookupBO(static_cast<uint32_t>(args->scalarInput[0]));
+                if (!bo) return kIOReturnNotFound;
+                args->scalarOutput[0] = bo->getSize();
+                args->scalarOutputCount = 1;
+                bo->release();
+                return kIOReturnSuccess;
+            }
+        case kAccelSel_BindSurfaceBO:
+            if (!args || !args->structureInput || args->structureInputSize < sizeof(XEBindSurfaceBOIn))
+                return kIOReturnBadArgument;
+            if (!args->structureOutput || args->structureOutputSize < sizeof(XEBindSurfaceOut))
+                return kIOReturnMessageTooLarge;
+            {
+                XEBindSurfaceBOIn in;
+                bcopy(args->structureInput, &in, sizeof(in));
+
+                FakeIrisXEBufferObject* bo = lookupBO(in.handle);
+                if (!bo) return kIOReturnNotFound;
+
+                XEBindSurfaceOut out{};
+                IOReturn ret = fOwner->bindSurfaceBO(in.ctxId, bo, in, out, this);
+                bo->release();
+                if (ret != kIOReturnSuccess) return ret;
+                bcopy(&out, args->structureOutput, sizeof(out));
+                args->structureOutputSize = sizeof(out);
+                return kIOReturnSuccess;
+            }
+        case kAccelSel_VMBind:
+            if (!args || !args->scalarInput || args->scalarInputCount < 3 ||
+                !args->scalarOutput || args->scalarOutputCount < 1)
+                return kIOReturnBadArgument;
+            {
+                FakeIrisXEBufferObject* bo = lookupBO(static_cast<uint32_t>(args->scalarInput[1]));
+                if (!bo) return kIOReturnNotFound;
+
+                uint64_t gpuAddr = 0;
+                IOReturn ret = fOwner->vmBind(static_cast<uint32_t>(args->scalarInput[0]), bo,
+                                              args->scalarInput[2], &gpuAddr, this);
+                bo->release();
+                if (ret != kIOReturnSuccess) return ret;
+                args->scalarOutput[0] = gpuAddr;
+                args->scalarOutputCount = 1;
+                return kIOReturnSuccess;
+            }
+        case kAccelSel_VMUnbind:
+            if (!args || !args->scalarInput || args->scalarInputCount < 2) return kIOReturnBadArgument;
+            return fOwner->vmUnbind(static_cast<uint32_t>(args->scalarInput[0]), args->scalarInput[1], this);
      
             
         default:
@@ -139,27 +367,48 @@ IOReturn FakeIrisXEAcceleratorUserClient::externalMethod(uint32_t selector,
     }
 }
 
-// Provide the shared memory descriptor to userspace when they request type==1
 // Provide the shared memory descriptor to userspace when they request type==1
 IOReturn FakeIrisXEAcceleratorUserClient::clientMemoryForType(
         UInt32 type,
         IOOptionBits *options,
         IOMemoryDescriptor **memory )
 {
-    if (type == 1) {
+    if (type == kAccelMem_Ring) {
         *options = kIOMapDefaultCache;
 
         if (!fSharedMem) return kIOReturnNotFound;
 
         *memory = fSharedMem;
         (*memory)->retain();
+        fRingMapped = true;
 
-        // *** IMPORTANT ***
+        // Workloop first: attachShared() swaps the ring on it
+        fOwner->startWorkerLoop();
         fOwner->attachShared( fSharedMem );
-        fOwner->startWorkerLoop();        // <-- FIX
 
         return kIOReturnSuccess;
     }
+    if (type >= kAccelMem_Scanout && type < kAccelMem_Scanout + 16) {
+        // Render target for XE_CMD_FLIP; same buffer the display scans out
+        IOBufferMemoryDescriptor* buf = fOwner->getScanoutMemory(type - kAccelMem_Scanout);
+        if (!buf) return kIOReturnNotFound;
+
+        *options = kIOMapDefaultCache;
+        buf->retain();
+        *memory = buf;
+        return kIOReturnSuccess;
+    }
+    if (type >= kAccelMem_BO) {
+        FakeIrisXEBufferObject* bo = lookupBO(type);
+        if (!bo) return kIOReturnNotFound;
+
+        // The mapping holds the memory; the object itself can go
+        *options = kIOMapDefaultCache;
+        *memory = bo->getMemory();
+        (*memory)->retain();
+        bo->release();
+        return kIOReturnSuccess;
+    }
     return IOUserClient::clientMemoryForType(type, options, memory);
 }
 
@@ -177,33 +426,26 @@ IOReturn FakeIrisXEAcceleratorUserClient::doInjectTest()
 
     uint32_t color = 0xFFFF0000;
 
-    uint32_t head = fOwner->fHdr->head;
-    uint32_t cap  = fOwner->fHdr->capacity;
+    // We act as the producer here, so we own head and only read tail.
+    XEHdr* hdr    = fOwner->fHdr;
+    uint32_t cap  = fOwner->fRingCap;
+    uint32_t head = hdr->head;
+    uint32_t tail = xe_load_acquire(&hdr->tail);
 
     uint32_t total = xe_align(sizeof(XECmd) + cmd.bytes);
+    uint32_t next  = 0;
+    uint32_t off   = xe_ring_reserve(fOwner->fRingBase, cap, head, tail, total, &next);
+    if (off == UINT32_MAX)
+        return kIOReturnNoSpace;
 
-    // write header
-    if (head + sizeof(XECmd) <= cap)
-        memcpy(fOwner->fRingBase + head, &cmd, sizeof(cmd));
-    else {
-        uint32_t first = cap - head;
-        memcpy(fOwner->fRingBase + head, &cmd, first);
-        memcpy(fOwner->fRingBase, ((uint8_t*)&cmd)+first, sizeof(cmd)-first);
-    }
-
-    // write payload
-    uint32_t poff = (head + sizeof(XECmd)) % cap;
-    if (poff + 4 <= cap)
-        memcpy(fOwner->fRingBase + poff, &color, 4);
-    else {
-        uint32_t first = cap - poff;
-        memcpy(fOwner->fRingBase + poff, &color, first);
-        memcpy(fOwner->fRingBase, ((uint8_t*)&color)+first, 4-first);
-    }
+    // records are contiguous, no wrap handling needed
+    memcpy(fOwner->fRingBase + off, &cmd, sizeof(cmd));
+    memcpy(fOwner->fRingBase + off + sizeof(cmd), &color, sizeof(color));
 
-    fOwner->fHdr->head = (head + total) % cap;
-    OSSynchronizeIO();
+    // publish (release: record bytes before the new head)
+    xe_store_release(&hdr->head, next);
+    fOwner->ringDoorbell();
 
-    IOLog("[UC] InjectTest wrote CLEAR (head=%u)\n", fOwner->fHdr->head);
+    IOLog("[UC] InjectTest wrote CLEAR (head=%u)\n", next);
     return kIOReturnSuccess;
 }
@@ -4,8 +4,10 @@
 #include <IOKit/IOUserClient.h>
 #include <IOKit/IOLib.h>
 #include "FakeIrisXEAccelShared.h"
+#include "FakeIrisXEHandleTable.hpp"
 
 class FakeIrisXEAccelerator;
+class FakeIrisXEBufferObject;
 
 class FakeIrisXEAcceleratorUserClient : public IOUserClient {
     OSDeclareDefaultStructors(FakeIrisXEAcceleratorUserClient);
@@ -15,8 +17,23 @@ private:
     FakeIrisXEAccelerator*         fOwner{nullptr};
 
     IOBufferMemoryDescriptor*      fSharedMem{nullptr};   // kernel-owned buffer we hand to userspace (clientMemoryForType)
-    volatile XEHdr*                fSharedHdr{nullptr};   // header inside fSharedMem
+    XEHdr*                         fSharedHdr{nullptr};   // header inside fSharedMem
     uint8_t*                       fRingBase{nullptr};    // pointer to ring payload (after header)
+    bool                           fRingMapped{false};    // set once type 1 is mapped; ring size is then fixed
+
+    // (Re)allocate header + ring; ringBytes must already be xe_ring_round()ed
+    IOReturn allocRing(uint32_t ringBytes);
+
+    // Buffer objects by handle, one reference each. fBOLock covers the
+    // table and fBOBytes; user threads can call in concurrently.
+    XEHandleTable<FakeIrisXEBufferObject, XE_BO_MAX_HANDLES> fBOs;
+    IOLock*                        fBOLock{nullptr};
+    uint64_t                       fBOBytes{0};          // sum of fBOs' sizes
+
+    IOReturn createBO(uint64_t size, uint32_t flags, uint32_t* handle, uint64_t* outSize);
+    IOReturn closeBO(uint32_t handle);
+    FakeIrisXEBufferObject* lookupBO(uint32_t handle);   // retained, or null
+    void releaseAllBOs();
 
 public:
     // Kernel IOKit signature (3 args) — correct for kernel builds
@@ -0,0 +1,102 @@
+#include "FakeIrisXEBlit.hpp"
+
+
+
+#pragma mark - Store helpers
+
+static inline void store64_nt(uint64_t* p, uint64_t v)
+{
+#if defined(__x86_64__)
+    __asm__ volatile("movnti %1, %0" : "=m"(*p) : "r"(v));
+#else
+    *p = v;
+#endif
+}
+
+void xe_stream_fence()
+{
+#if defined(__x86_64__)
+    __asm__ volatile("sfence" ::: "memory");
+#else
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
+}
+
+
+
+#pragma mark - Fill
+
+void xe_fill_row32(uint32_t* dst, uint32_t argb, uint32_t count, bool stream)
+{
+    if (!count) return;
+
+    // head: one pixel to reach 8-byte alignment
+    if ((uintptr_t)dst & 7) {
+        *dst++ = argb;
+        --count;
+    }
+
+    uint64_t  pat = ((uint64_t)argb << 32) | argb;
+    uint64_t* q   = (uint64_t*)dst;
+    uint32_t  n   = count >> 1;   // pixel pairs
+
+    if (stream) {
+        // 64 bytes per iteration = one write-combining line when aligned
+        for (; n >= 8; n -= 8, q += 8) {
+            store64_nt(q + 0, pat); store64_nt(q + 1, pat);
+            store64_nt(q + 2, pat); store64_nt(q + 3, pat);
+            store64_nt(q + 4, pat); store64_nt(q + 5, pat);
+            store64_nt(q + 6, pat); store64_nt(q + 7, pat);
+        }
+        for (; n; --n) store64_nt(q++, pat);
+    } else {
+        for (; n >= 4; n -= 4, q += 4) {
+            q[0] = pat; q[1] = pat; q[2] = pat; q[3] = pat;
+        }
+        for (; n; --n) *q++ = pat;
+    }
+
+    // tail: odd pixel left over
+    if (count & 1) *(uint32_t*)q = argb;
+}
+
+
+
+#pragma mark - Blend
+
+void xe_blend_solid_row32(uint32_t* dst, uint32_t argb, uint32_t count)
+{
+    uint32_t sa = argb >> 24;
+
+    if (sa == 0xFF) {
+        xe_fill_row32(dst, argb, count, false);
+        return;
+    }
+    if (sa == 0x00) return;
+
+    uint32_t inv = 255 - sa;
+    for (uint32_t i = 0; i < count; ++i)
+        dst[i] = xe_blend_px(argb, dst[i], inv);
+}
+
+void xe_blend_row32(uint32_t* dst, const uint32_t* src, uint32_t count)
+{
+    uint32_t i = 0;
+    while (i < count) {
+        uint32_t sa = src[i] >> 24;
+
+        if (sa == 0xFF) {
+            uint32_t j = i + 1;
+            while (j < count && (src[j] >> 24) == 0xFF) ++j;
+            memcpy(dst + i, src + i, (size_t)(j - i) * 4);
+            i = j;
+        } else if (sa == 0x00) {
+            // premultiplied: alpha 0 means the colour channels are 0 too
+            ++i;
+            while (i < count && (src[i] >> 24) == 0x00) ++i;
+        } else {
+            dst[i] = xe_blend_px(src[i], dst[i], 255 - sa);
+            ++i;
+        }
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef FAKE_IRIS_XE_BLIT_HPP
+#define FAKE_IRIS_XE_BLIT_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+//
+// CPU pixel kernels for the 2D opcodes (ARGB8888, byte strides).
+//
+// Kernel code must not touch SSE/AVX state, so these work on 64-bit
+// general-purpose registers: two pixels per store, 8-byte aligned body,
+// scalar head/tail. Large fills into the scanout buffer use movnti
+// (a GPR non-temporal store) so they don't evict the whole cache on
+// their way to memory the CPU is never going to read back.
+//
+
+// Fills at or above this many bytes use non-temporal stores
+static constexpr size_t XE_STREAM_MIN_BYTES = 512 * 1024;
+
+/**
+ * @brief Fills count pixels starting at dst with argb.
+ * @param stream Use non-temporal stores; caller must xe_stream_fence()
+ *               before publishing the result.
+ */
+void xe_fill_row32(uint32_t* dst, uint32_t argb, uint32_t count, bool stream);
+
+/**
+ * @brief Copies count pixels from src to dst; the spans may overlap.
+ */
+static inline void xe_copy_row32(uint32_t* dst, const uint32_t* src, uint32_t count)
+{
+    // libkern's memmove is already wide (rep movsb / 64-bit moves) and picks
+    // the direction for overlapping spans on the same row
+    memmove(dst, src, (size_t)count * 4);
+}
+
+/**
+ * @brief Scalar premultiplied src-over, the reference for the kernels below.
+ * out = src + dst * (255 - srcA) / 255, rounded to nearest, per channel.
+ */
+static inline uint32_t blend_src_over_dst_argb8888(uint32_t src, uint32_t dst)
+{
+    uint32_t sa = src >> 24;
+    if (sa == 0xFF) return src;           // fully opaque
+    if (sa == 0x00) return dst;           // fully transparent
+
+    uint32_t inv = 255 - sa;
+    uint32_t out = 0;
+    for (int sh = 0; sh < 32; sh += 8) {
+        uint32_t c = ((src >> sh) & 0xFF) + (((dst >> sh) & 0xFF) * inv + 127) / 255;
+        out |= (c > 255 ? 255 : c) << sh;
+    }
+    return out;
+}
+
+/**
+ * @brief Same result as blend_src_over_dst_argb8888() without divides:
+ * all four channels ride in 16-bit lanes of one 64-bit register.
+ */
+static inline uint32_t xe_blend_px(uint32_t src, uint32_t dst, uint32_t inv)
+{
+    const uint64_t lanes = 0x00FF00FF00FF00FFull;
+
+    // 0x00AA00GG00RR00BB -> A,G in the high half, R,B in the low half
+    uint64_t d = (uint64_t)(dst & 0x00FF00FF) | ((uint64_t)((dst >> 8) & 0x00FF00FF) << 32);
+    uint64_t s = (uint64_t)(src & 0x00FF00FF) | ((uint64_t)((src >> 8) & 0x00FF00FF) << 32);
+
+    // t / 255 rounded == (t + 128 + ((t + 128) >> 8)) >> 8 for t <= 255*255
+    uint64_t t = d * inv + 0x0080008000800080ull;
+    t = ((t + ((t >> 8) & lanes)) >> 8) & lanes;
+
+    // add source, saturating lanes that overflowed past 255
+    t += s;
+    t |= ((t >> 8) & 0x0001000100010001ull) * 0xFF;
+    t &= lanes;
+
+    return (uint32_t)t | ((uint32_t)(t >> 32) << 8);
+}
+
+/**
+ * @brief Composites a solid premultiplied color over count pixels.
+ */
+void xe_blend_solid_row32(uint32_t* dst, uint32_t argb, uint32_t count);
+
+/**
+ * @brief Composites count premultiplied source pixels over dst.
+ * Runs of opaque source are copied, runs of transparent source skipped.
+ */
+void xe_blend_row32(uint32_t* dst, const uint32_t* src, uint32_t count);
+
+/**
+ * @brief Orders earlier non-temporal stores before later stores
+ * (e.g. the release store that publishes the ring tail).
+ */
+void xe_stream_fence();
+
+#endif // FAKE_IRIS_XE_BLIT_HPP
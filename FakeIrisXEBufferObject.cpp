@@ -0,0 +1,45 @@
+#include "FakeIrisXEBufferObject.hpp"
+#include "FakeIrisXEAccelShared.h"
+
+OSDefineMetaClassAndStructors(FakeIrisXEBufferObject, OSObject)
+
+
+
+FakeIrisXEBufferObject* FakeIrisXEBufferObject::withSize(uint64_t size, uint32_t flags)
+{
+    FakeIrisXEBufferObject* me = new FakeIrisXEBufferObject;
+    if (me && !me->initWithSize(size, flags)) {
+        me->release();
+        return nullptr;
+    }
+    return me;
+}
+
+bool FakeIrisXEBufferObject::initWithSize(uint64_t size, uint32_t flags)
+{
+    if (!OSObject::init()) return false;
+    if (size == 0 || size > XE_BO_MAX_BYTES || flags != 0) return false;
+
+    fSize = (size + XE_PAGE - 1) & ~(uint64_t)(XE_PAGE - 1);
+
+    // Shared with user space like the ring, and wired for its whole life,
+    // so the accelerator and the GGTT can use it from any context
+    fMem = IOBufferMemoryDescriptor::inTaskWithOptions(
+        kernel_task,
+        kIODirectionInOut | kIOMemoryKernelUserShared,
+        fSize,
+        XE_PAGE);
+    if (!fMem) return false;
+
+    fBytes = (uint8_t*)fMem->getBytesNoCopy();
+    bzero(fBytes, fSize);
+    return true;
+}
+
+void FakeIrisXEBufferObject::free()
+{
+    OSSafeReleaseNULL(fMem);
+    fBytes = nullptr;
+
+    OSObject::free();
+}
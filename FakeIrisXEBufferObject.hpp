@@ -0,0 +1,41 @@
+#ifndef FAKE_IRIS_XE_BUFFER_OBJECT_HPP
+#define FAKE_IRIS_XE_BUFFER_OBJECT_HPP
+
+#include <IOKit/IOLib.h>
+#include <IOKit/IOBufferMemoryDescriptor.h>
+
+/**
+ * @class FakeIrisXEBufferObject
+ * @brief A GEM-style buffer object: wired, page-rounded kernel memory
+ * that user space maps by handle and the accelerator uses by reference.
+ *
+ * Lifetime is plain OSObject retain/release. The user client's handle
+ * table holds one reference per handle; anything built on the memory
+ * (a mapping, a bound surface) retains the descriptor itself, so closing
+ * the handle never pulls pages out from under it.
+ */
+class FakeIrisXEBufferObject : public OSObject {
+    OSDeclareDefaultStructors(FakeIrisXEBufferObject)
+
+public:
+    /**
+     * @brief Allocates size bytes, rounded up to pages, zero filled.
+     * @param flags Reserved, 0.
+     */
+    static FakeIrisXEBufferObject* withSize(uint64_t size, uint32_t flags);
+
+    IOBufferMemoryDescriptor* getMemory() const { return fMem; }
+    uint8_t* getBytes() const { return fBytes; }
+    uint64_t getSize() const { return fSize; }
+
+    void free() override;
+
+private:
+    bool initWithSize(uint64_t size, uint32_t flags);
+
+    IOBufferMemoryDescriptor* fMem {nullptr};
+    uint8_t*                  fBytes {nullptr};   // kernel VA of fMem
+    uint64_t                  fSize {0};
+};
+
+#endif // FAKE_IRIS_XE_BUFFER_OBJECT_HPP
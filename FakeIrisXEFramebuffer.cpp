@@ -156,7 +156,7 @@ bool FakeIrisXEFramebuffer::init(OSDictionary* dict) {
     displayPublished = false;
     shuttingDown = false;
     fullyInitialized = false;  // ADD THIS
-    return true;
+    return interruptSlab.init(sizeof(InterruptInfo), "interrupts");
 }
 
 
@@ -365,6 +365,22 @@ bool FakeIrisXEFramebuffer::initPowerManagement() {
 
 
 //start
+// Scanout memory is plain wired pages, anywhere in RAM: the plane reads
+// it through the GGTT page by page, so it needn't be contiguous or low,
+// and a 4K or triple-buffered setup still fits on a fragmented system
+static IOBufferMemoryDescriptor* allocScanoutBuffer(vm_size_t bytes)
+{
+    IOBufferMemoryDescriptor* buf = IOBufferMemoryDescriptor::inTaskWithOptions(
+        kernel_task,
+        kIODirectionInOut | kIOMemoryKernelUserShared,
+        bytes,
+        PAGE_SIZE);
+
+    if (buf && buf->prepare() != kIOReturnSuccess) OSSafeReleaseNULL(buf);
+    if (buf) bzero(buf->getBytesNoCopy(), buf->getLength());
+    return buf;
+}
+
 bool FakeIrisXEFramebuffer::start(IOService* provider) {
     IOLog("FakeIrisXEFramebuffer::start() - Entered\n");
 
@@ -603,94 +619,78 @@ bool FakeIrisXEFramebuffer::start(IOService* provider) {
     const uint32_t bpp    = 4;
 
     uint32_t rawSize     = width * height * bpp;
-    uint32_t alignedSize = (rawSize + 0xFFFF) & ~0xFFFF; // 64KB aligned
-
-    IOLog("🧠 Allocating framebuffer memory: %ux%u = %u bytes (aligned to 0x%X)\n",
-          width, height, rawSize, alignedSize);
-
-    int retries = 3;
-
-    while (retries-- > 0) {
-
-        framebufferMemory = IOBufferMemoryDescriptor::inTaskWithPhysicalMask(
-            kernel_task,
-            kIODirectionInOut | kIOMemoryKernelUserShared,
-            alignedSize,
-            0x000000003FFFF000ULL   // BELOW 1GB, 4KB aligned, macOS-friendly
-        );
+    uint32_t alignedSize = (rawSize + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    // Global GTT binder: maps GTTMMADR once, owns the GGTT address space.
+    // Created once the GPU is known to be awake; every failure from here
+    // on drops it again (releaseGGTT()).
+    ggtt = FakeIrisXEGGTT::withDevice(pciDevice, mmioMap);
+    if (!ggtt) {
+        IOLog("❌ GGTT binder unavailable\n");
+        OSSafeReleaseNULL(mmioMap);
+        return false;
+    }
 
+    // GMADR (BAR2): the CPU's window onto the start of the GGTT. The
+    // scanout buffers are scattered in RAM; this is where they're linear.
+    gmadr = pciDevice->getDeviceMemoryWithIndex(1);
+    if (gmadr) {
+        gmadr->retain();
+        IOLog("GMADR at 0x%llX (len: 0x%llX)\n",
+              (unsigned long long)gmadr->getPhysicalAddress(), (unsigned long long)gmadr->getLength());
+    } else {
+        IOLog("⚠️ no GMADR, the framebuffer has no CPU aperture\n");
+    }
 
-        if (!framebufferMemory) {
-            IOLog("❌ Failed to allocate framebuffer descriptor (retry %d)\n", retries);
-            continue;
-        }
-        
-        if (framebufferMemory->prepare() != kIOReturnSuccess) {
-            IOLog("❌ framebufferMemory->prepare() failed\n");
-            framebufferMemory->release();
-            framebufferMemory = nullptr;
-            continue;
-        }
+    IOLog("🧠 Allocating framebuffer memory: %ux%u = %u bytes (%u pages)\n",
+          width, height, rawSize, alignedSize / PAGE_SIZE);
 
-        break;
+    framebufferMemory = allocScanoutBuffer(alignedSize);
+    if (!framebufferMemory) {
+        IOLog("❌ Failed to allocate framebuffer memory\n");
+        releaseGGTT();
+        return false;
     }
 
-    
-    
+    // Scatter-gather: this is the first page only
     IOPhysicalAddress fbPhys = framebufferMemory->getPhysicalAddress();
 
-    if ((fbPhys & 0xFFFF) != 0) {
-        IOLog(" FB not 64KB aligned, but OK — GGTT mapping handles alignment\n");
-    }
-    else
-    { IOLog("64 KB Aligned");
-        
-    }
-    
-    
     void* fbAddr = framebufferMemory->getBytesNoCopy();
-    if (fbAddr) bzero(fbAddr, rawSize);
-
-    //IOPhysicalAddress fbPhys = framebufferMemory->getPhysicalAddress();
     size_t fbLen = framebufferMemory->getLength();
 
     this->kernelFBPtr  = fbAddr;
     this->kernelFBSize = fbLen;
     this->kernelFBPhys = fbPhys;
 
-    IOLog("📦 Final FB physical address: 0x%08llX\n", fbPhys);
+    IOLog("📦 FB first page at physical 0x%08llX\n", (unsigned long long)fbPhys);
     IOLog("📏 Final FB length: 0x%08zX\n", fbLen);
 
-    
-    
-    
-    
-    
-    
-    
-    
-    
-    
-    
-    
-    
-    
-    
-    
-    
-    
     // Optional surface descriptor (for later IOSurface/Metal integration)
-    framebufferSurface = IOMemoryDescriptor::withAddressRange(
-        fbPhys,
-        fbLen,
-        kIODirectionInOut,
-        kernel_task
-    );
+    framebufferSurface = framebufferMemory;
+    framebufferSurface->retain();
+
+    // Back buffers for page flipping. Buffer 0 is the one above; if we can't
+    // get the others we just run single-buffered.
+    scanoutMemory[0] = framebufferMemory;
+    framebufferMemory->retain();
+    scanoutCount = 1;
+
+    for (uint32_t i = 1; i < kMaxScanout; ++i) {
+        IOBufferMemoryDescriptor* buf = allocScanoutBuffer(alignedSize);
+        if (!buf) {
+            IOLog("⚠️ scanout buffer %u unavailable, flipping with %u\n", i, scanoutCount);
+            break;
+        }
+        scanoutMemory[scanoutCount++] = buf;
+    }
+    IOLog("✅ %u scanout buffer(s)\n", scanoutCount);
 
-    if (framebufferSurface) {
-        IOLog("✅ Framebuffer surface registered\n");
-    } else {
-        IOLog("❌ Failed to create framebuffer surface\n");
+    // Bound now, not at the first modeset: getApertureRange() hands out
+    // the CPU view of buffer 0 through GMADR, which is its GGTT offset
+    if (!mapFramebufferIntoGGTT()) {
+        IOLog("❌ scanout buffers don't fit in the GGTT\n");
+        releaseGGTT();
+        return false;
     }
     
     
@@ -819,6 +819,7 @@ bool FakeIrisXEFramebuffer::start(IOService* provider) {
     timerLock = IOLockAlloc();
     if (!timerLock) {
         IOLog("❌ Failed to allocate timerLock\n");
+        releaseGGTT();
         return false;
     }
 
@@ -1037,6 +1038,12 @@ void FakeIrisXEFramebuffer::performSafeStop()
     PMstop();
 
     // Release GPU resources and memory descriptors (these touch IOGraphics/IOBuffer objects)
+    releaseGGTT();
+    for (uint32_t i = 0; i < kMaxScanout; ++i) {
+        if (scanoutMemory[i]) scanoutMemory[i]->complete();
+        OSSafeReleaseNULL(scanoutMemory[i]);
+    }
+    scanoutCount = 0;
     OSSafeReleaseNULL(framebufferMemory);
     OSSafeReleaseNULL(framebufferSurface);
     OSSafeReleaseNULL(cursorMemory);
@@ -1061,10 +1068,7 @@ void FakeIrisXEFramebuffer::performSafeStop()
         powerLock = nullptr;
     }
 
-    if (interruptList) {
-        interruptList->release();
-        interruptList = nullptr;
-    }
+    freeInterruptList();
 
     // Close PCI device and release provider only after gated cleanup
     if (pciDevice) {
@@ -1124,17 +1128,8 @@ void FakeIrisXEFramebuffer::free() {
         gammaTableSize = 0;
     }
     
-    if (interruptList) {
-        // Cleanup all interrupt registrations
-        for (unsigned int i = 0; i < interruptList->getCount(); i++) {
-            OSData* data = OSDynamicCast(OSData, interruptList->getObject(i));
-            if (data) {
-                IOFree((void*)data->getBytesNoCopy(), sizeof(InterruptInfo));
-            }
-        }
-        interruptList->release();
-        interruptList = nullptr;
-    }
+    freeInterruptList();
+    interruptSlab.destroy();
     
     if (powerLock) {
         IOLockFree(powerLock);
@@ -1401,8 +1396,6 @@ IOReturn FakeIrisXEFramebuffer::enableController() {
 
     const uint32_t width  = H_ACTIVE;   // 1920
     const uint32_t height = V_ACTIVE;   // 1080
-    const IOPhysicalAddress phys = framebufferMemory->getPhysicalAddress();
-
     IOLog("DEBUG[V38]: reading initial state…\n");
     IOLog("  PLANE_CTL_1_A (before):   0x%08X\n", rd(PLANE_CTL_1_A));
     IOLog("  PLANE_SURF_1_A (before):  0x%08X\n", rd(PLANE_SURF_1_A));
@@ -1676,111 +1669,88 @@ void FakeIrisXEFramebuffer::waitVBlank() {
 
 bool FakeIrisXEFramebuffer::mapFramebufferIntoGGTT()
 {
-    // -----------------------------
-    // 1) Read BAR1 = GTTMMADR
-    // -----------------------------
-    uint64_t bar1Lo = pciDevice->configRead32(0x18) & ~0xF;
-    uint64_t bar1Hi = pciDevice->configRead32(0x1C);
-    uint64_t gttPhys = (bar1Hi << 32) | bar1Lo;
-
-    IOLog("🟢 BAR1 (GTTMMADR) = 0x%llX\n", gttPhys);
-
-    // Map full 16MB GGTT aperture
-    IOMemoryDescriptor* gttDesc =
-        IOMemoryDescriptor::withPhysicalAddress(gttPhys, 0x1000000, kIODirectionInOut);
-
-    if (!gttDesc) {
-        IOLog("❌ Failed to create GGTT descriptor\n");
-        return false;
-    }
-
-    IOMemoryMap* gttMap = gttDesc->map();
-    if (!gttMap) {
-        IOLog("❌ Failed to map GTTMMADR\n");
-        gttDesc->release();
+    if (!ggtt || !framebufferMemory) {
+        IOLog("❌ GGTT map: no GGTT binder or framebufferMemory\n");
         return false;
     }
 
-    gttVa = reinterpret_cast<void*>(gttMap->getVirtualAddress());
-    IOLog("🟢 GTTMMADR mapped at VA=%p\n", gttVa);
-
-
-    if (!gttVa || !framebufferMemory) {
-        IOLog("❌ GGTT map: missing gttVa or framebufferMemory\n");
-        return false;
+    // Called again on a modeset. The buffers are the same, and the
+    // aperture handed out points at their offsets, so they stay put.
+    //
+    // Offsets are the binder's choice. 256 KB alignment is what
+    // PLANE_SURF wants for linear surfaces; the guard page keeps the
+    // display's prefetch off the next buffer.
+    for (uint32_t i = scanoutBound; i < scanoutCount; ++i) {
+        uint64_t off = 0;
+        if (ggtt->bind(scanoutMemory[i], FakeIrisXEGGTT::kScanoutAlign, &off,
+                       FakeIrisXEGGTT::kScanoutGuard) != kIOReturnSuccess) {
+            if (i == 0) return false;
+            IOLog("⚠️ GGTT: dropping scanout buffers from %u on\n", i);
+            scanoutCount = i;
+            break;
+        }
+        scanoutGGTT[i] = (uint32_t)off;
+        scanoutBound = i + 1;
     }
 
-    volatile uint64_t* ggtt = reinterpret_cast<volatile uint64_t*>(gttVa);
-
-    const uint32_t kPageSize = 4096;
-    const uint64_t kPteFlags = 0x0000000000000003ULL; // Present + writable
-
-
-    // -----------------------------------------
-    // 2) Final, correct GGTT offset for FB
-    // -----------------------------------------
-    // Your framebuffer will appear at GPU VA = 0x08000000
-    // SAFE region: 128MB–144MB is unused by GuC / engines
-    fbGGTTOffset = 0x00000800;
-
-    uint32_t ggttBaseIndex = fbGGTTOffset >> 12;
-
-    IOLog("🟢 GGTT mapping: fbGGTTOffset=0x%08X index=%u\n",
-          fbGGTTOffset, ggttBaseIndex);
-
-
-    // -----------------------
-    // 3) Walk physical pages
-    // -----------------------
-    IOByteCount fbSize = framebufferMemory->getLength();
-    IOByteCount offset = 0;
-
-    uint32_t page = 0;
+    fbGGTTOffset = scanoutGGTT[0];
+    planeSurf = fbGGTTOffset;
+    return true;
+}
 
-    while (offset < fbSize)
-    {
-        IOByteCount segLen = 0;
-        IOPhysicalAddress segPhys =
-            framebufferMemory->getPhysicalSegment(offset, &segLen);
+void FakeIrisXEFramebuffer::unmapScanoutFromGGTT()
+{
+    for (uint32_t i = 0; ggtt && i < scanoutBound; ++i)
+        ggtt->unbind(scanoutGGTT[i]);
+    scanoutBound = 0;
+}
 
-        if (!segPhys || segLen == 0) {
-            IOLog("❌ GGTT map: getPhysicalSegment failed at offset 0x%llX\n",
-                  (uint64_t)offset);
-            return false;
-        }
+void FakeIrisXEFramebuffer::releaseGGTT()
+{
+    unmapScanoutFromGGTT();
+    OSSafeReleaseNULL(ggtt);
+    OSSafeReleaseNULL(gmadr);
+}
 
-        // Page-align
-        segLen &= ~(kPageSize - 1);
-        if (segLen == 0) {
-            IOLog("❌ GGTT map: segment < 4KB\n");
-            return false;
-        }
 
-        IOLog("Physical segment: phys=0x%llX len=0x%llX\n",
-              (uint64_t)segPhys, (uint64_t)segLen);
 
+#define PLANE_SURFLIVE_1_A  0x701AC
 
-        for (IOByteCount segOff = 0;
-             segOff < segLen && offset < fbSize;
-             segOff += kPageSize, offset += kPageSize, ++page)
-        {
-            uint64_t phys = (uint64_t)(segPhys + segOff);
+// PLANE_SURF is double-buffered by the hardware: the write arms the
+// change and the plane picks it up at the next vblank, so this never waits.
+IOReturn FakeIrisXEFramebuffer::flipTo(uint32_t index)
+{
+    if (index >= scanoutCount) return kIOReturnBadArgument;
 
-            uint32_t ggttIndex = ggttBaseIndex + page;
+    IOReturn ret = flipToGGTT(scanoutGGTT[index]);
+    if (ret == kIOReturnSuccess) scanoutFront = index;
+    return ret;
+}
 
-            uint64_t pte = (phys & ~0xFFFULL) | kPteFlags;
-            ggtt[ggttIndex] = pte;
+IOReturn FakeIrisXEFramebuffer::flipToGGTT(uint32_t ggttOffset)
+{
+    if (!mmioBase) return kIOReturnNotReady;
 
-            uint64_t verify = ggtt[ggttIndex];
+    safeMMIOWrite(PLANE_SURF_1_A, ggttOffset);
+    planeSurf = ggttOffset;
+    return kIOReturnSuccess;
+}
 
-            IOLog("   GGTT[%u] = 0x%016llX (verify=0x%016llX)\n",
-                  ggttIndex, pte, verify);
-        }
-    }
+// True until the plane is actually scanning out the last flip target
+bool FakeIrisXEFramebuffer::flipPending()
+{
+    if (!mmioBase) return false;
+    return (safeMMIORead(PLANE_SURFLIVE_1_A) & ~0xFFFu) != (planeSurf & ~0xFFFu);
+}
 
-    IOLog("🟢 GGTT mapping complete (%u pages)\n", page);
+void* FakeIrisXEFramebuffer::getScanoutKernelPtr(uint32_t index) const
+{
+    return (index < scanoutCount && scanoutMemory[index]) ? scanoutMemory[index]->getBytesNoCopy() : nullptr;
+}
 
-    return true;
+IOBufferMemoryDescriptor* FakeIrisXEFramebuffer::getScanoutMemory(uint32_t index) const
+{
+    return index < scanoutCount ? scanoutMemory[index] : nullptr;
 }
 
 
@@ -1907,23 +1877,17 @@ IOReturn FakeIrisXEFramebuffer::registerForInterruptType(IOSelect interruptType,
         return kIOReturnBadArgument;
     }
     
-    InterruptInfo* info = (InterruptInfo*)IOMalloc(sizeof(InterruptInfo));
+    InterruptInfo* info = (InterruptInfo*)interruptSlab.alloc();
     if (!info) return kIOReturnNoMemory;
     
     info->type = interruptType;
     info->proc = proc;
     info->ref = ref;
     
-    // Add to interrupt list
-    if (!interruptList) {
-        interruptList = OSArray::withCapacity(4);
-    }
-    
-    OSData* infoData = OSData::withBytes(info, sizeof(InterruptInfo));
-    if (infoData) {
-        interruptList->setObject(infoData);
-        infoData->release();
-    }
+    // The record itself goes on the list, so unregisterInterrupt() finds
+    // it by the pointer we hand back
+    info->next = interruptList;
+    interruptList = info;
     
     *interruptRef = info;
     
@@ -1940,11 +1904,11 @@ IOReturn FakeIrisXEFramebuffer::unregisterInterrupt(void* interruptRef) {
     }
     
     // Find and remove from interrupt list
-    for (unsigned int i = 0; i < interruptList->getCount(); i++) {
-        OSData* data = OSDynamicCast(OSData, interruptList->getObject(i));
-        if (data && data->getBytesNoCopy() == interruptRef) {
-            interruptList->removeObject(i);
-            IOFree(interruptRef, sizeof(InterruptInfo));
+    for (InterruptInfo** link = &interruptList; *link; link = &(*link)->next) {
+        if (*link == interruptRef) {
+            InterruptInfo* info = *link;
+            *link = info->next;
+            interruptSlab.free(info);
             IOLog("✅ Interrupt unregistered\n");
             return kIOReturnSuccess;
         }
@@ -1953,6 +1917,14 @@ IOReturn FakeIrisXEFramebuffer::unregisterInterrupt(void* interruptRef) {
     return kIOReturnNotFound;
 }
 
+void FakeIrisXEFramebuffer::freeInterruptList() {
+    while (interruptList) {
+        InterruptInfo* info = interruptList;
+        interruptList = info->next;
+        interruptSlab.free(info);
+    }
+}
+
 
 
 /*
@@ -2316,18 +2288,16 @@ IOReturn FakeIrisXEFramebuffer::getApertureRange(IOSelect aperture,
     if (!phys || !length || !framebufferMemory)
         return kIOReturnBadArgument;
 
-    IOByteCount segLen = 0;
-    IOPhysicalAddress firstPhys =
-        framebufferMemory->getPhysicalSegment(0, &segLen);
-
-    if (!firstPhys)
-        return kIOReturnError;
+    // Buffer 0 as the CPU sees it linearly, through GMADR
+    IOByteCount len = framebufferMemory->getLength();
+    if (!gmadr || !scanoutBound || fbGGTTOffset + len > gmadr->getLength())
+        return kIOReturnNotReady;
 
-    *phys = firstPhys;
-    *length = framebufferMemory->getLength();
+    *phys = gmadr->getPhysicalAddress() + fbGGTTOffset;
+    *length = len;
 
-    IOLog(" → phys=0x%llx len=0x%llx segLen=0x%llx\n",
-          (uint64_t)*phys, (uint64_t)*length, (uint64_t)segLen);
+    IOLog(" → phys=0x%llx len=0x%llx (GGTT 0x%x)\n",
+          (uint64_t)*phys, (uint64_t)*length, fbGGTTOffset);
 
     return kIOReturnSuccess;
 }
@@ -2344,8 +2314,12 @@ IODeviceMemory* FakeIrisXEFramebuffer::getApertureRange(IOPixelAperture aperture
         return nullptr;
     }
 
-    IOPhysicalAddress phys = framebufferMemory->getPhysicalAddress();
+    // Buffer 0 is scattered in RAM; GMADR shows it linearly at its GGTT offset
     IOByteCount len = framebufferMemory->getLength();
+    if (!gmadr || !scanoutBound || fbGGTTOffset + len > gmadr->getLength()) {
+        IOLog("❌ framebuffer not reachable through GMADR\n");
+        return nullptr;
+    }
 
     // FIXED: Return shared memory for ALL apertures (WS FB 2 needs VRAM/cursor)
     if (aperture == kIOFBVRAMMemory || aperture == 1) {  // VRAM = 1
@@ -2357,14 +2331,14 @@ IODeviceMemory* FakeIrisXEFramebuffer::getApertureRange(IOPixelAperture aperture
     }
 
     // Create and return new IODeviceMemory (WS expects fresh each call)
-    IODeviceMemory *mem = IODeviceMemory::withRange(phys, len);
+    IODeviceMemory *mem = IODeviceMemory::withSubRange(gmadr, fbGGTTOffset, len);
     if (!mem) {
-        IOLog("getApertureRange: withRange failed\n");
+        IOLog("getApertureRange: withSubRange failed\n");
         return nullptr;
     }
 
     IOLog("getApertureRange: phys=0x%llx len=0x%llx for aperture %d\n",
-          (unsigned long long)phys, (unsigned long long)len, aperture);
+          (unsigned long long)mem->getPhysicalAddress(), (unsigned long long)len, aperture);
     return mem;
 }
 
@@ -15,6 +15,9 @@
 // OR (for newer versions)
 #include <os/atomic.h>
 
+#include "FakeIrisXEGGTT.hpp"
+#include "FakeIrisXESlab.hpp"
+
 extern "C" void OSMemoryBarrier(void);
 #define OSMemoryBarrier() __asm__ volatile("" ::: "memory")
 
@@ -45,13 +48,18 @@ private:
     void* gammaTable;
     size_t gammaTableSize;
     
-    // Interrupt handling
+    // Interrupt handling. Records come from interruptSlab; the record's
+    // address is the interruptRef handed back to IOFramebuffer.
     struct InterruptInfo {
         IOSelect type;
         IOFBInterruptProc proc;
         void* ref;
+        InterruptInfo* next;
     };
-    OSArray* interruptList;
+    InterruptInfo* interruptList = nullptr;
+    XESlabCache interruptSlab;
+
+    void freeInterruptList();
     
     void activatePowerAndController();
     
@@ -157,6 +165,31 @@ protected:
         
     
     bool mapFramebufferIntoGGTT();
+    void unmapScanoutFromGGTT();
+    void releaseGGTT();                            // unmap, then drop ggtt and gmadr
+
+    FakeIrisXEGGTT* ggtt = nullptr;                // created in start(), all GGTT mappings go through it
+    FakeIrisXEGGTT* getGGTT() const { return ggtt; }
+    IODeviceMemory* gmadr = nullptr;               // BAR2, CPU aperture onto the GGTT
+
+    // --- Page flipping ---
+    // Scanout buffers; [0] is framebufferMemory. Each is mapped into the
+    // GGTT by mapFramebufferIntoGGTT() and shown by writing its offset to
+    // PLANE_SURF_1_A. Client surfaces can be shown too (flipToGGTT()).
+    static constexpr uint32_t kMaxScanout = 3;
+    IOBufferMemoryDescriptor* scanoutMemory[kMaxScanout] = {};
+    uint32_t scanoutGGTT[kMaxScanout] = {};
+    uint32_t scanoutCount = 0;
+    uint32_t scanoutBound = 0;                     // [0, scanoutBound) have GGTT ranges
+    volatile uint32_t scanoutFront = 0;
+    volatile uint32_t planeSurf = 0;               // GGTT offset last written to PLANE_SURF_1_A
+
+    IOReturn flipTo(uint32_t index);               // arm PLANE_SURF, takes effect at vblank
+    IOReturn flipToGGTT(uint32_t ggttOffset);      // same, for any mapped surface
+    bool     flipPending();                        // last flip not latched yet
+    uint32_t getScanoutCount() const { return scanoutCount; }
+    void*    getScanoutKernelPtr(uint32_t index) const;
+    IOBufferMemoryDescriptor* getScanoutMemory(uint32_t index) const;
 
     
     static constexpr uint32_t H_ACTIVE = 1920;
@@ -403,8 +436,6 @@ protected:
         void performSafeStop(); // actual cleanup executed on workloop/gated thread
 
     
-    IOMemoryDescriptor* gttMemoryDescriptor;
-      IOMemoryMap* gttMemoryMap;
       IOMemoryMap* ggttMemoryMap;
     
 
@@ -429,7 +460,6 @@ protected:
     
 private:
    
-    void* gttVa = nullptr;
      IOVirtualAddress gttVA = 0;
      volatile uint64_t* ggttMMIO = nullptr;
     
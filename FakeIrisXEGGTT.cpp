@@ -0,0 +1,192 @@
+#include "FakeIrisXEGGTT.hpp"
+#include "FakeIrisXEBlit.hpp"
+
+OSDefineMetaClassAndStructors(FakeIrisXEGGTT, OSObject)
+
+#define LOG(fmt, ...) IOLog("(FakeIrisXEFramebuffer) [GGTT] " fmt "\n", ##__VA_ARGS__)
+
+#define GTT_MIN_BYTES       0x100000    // 1 MB of PTEs: 512 MB of GGTT
+#define GGTT_MAX_BYTES      (4ULL << 30)
+#define GFX_FLSH_CNTL_GEN6  0x101008    // write EN: invalidate the GGTT TLBs
+#define GFX_FLSH_CNTL_EN    0x1
+#define PTE_FLAGS           0x3ULL      // present + writable
+
+
+
+#pragma mark - Lifetime
+
+FakeIrisXEGGTT* FakeIrisXEGGTT::withDevice(IOPCIDevice* pci, IOMemoryMap* mmio)
+{
+    FakeIrisXEGGTT* me = new FakeIrisXEGGTT;
+    if (me && !me->initWithDevice(pci, mmio)) {
+        me->release();
+        return nullptr;
+    }
+    return me;
+}
+
+bool FakeIrisXEGGTT::initWithDevice(IOPCIDevice* pci, IOMemoryMap* mmio)
+{
+    if (!OSObject::init() || !pci || !mmio) return false;
+
+    fLock = IOLockAlloc();
+    if (!fLock) return false;
+
+    fMMIO = mmio;
+    fMMIO->retain();
+
+    // GTTMMADR is BAR0: registers in the lower half, the GGTT's PTEs in
+    // the upper half (BAR2, at config 0x18, is GMADR, the CPU aperture)
+    uint64_t gttPhys = fMMIO->getPhysicalAddress() + fMMIO->getLength() / 2;
+    uint64_t gttBytes = fMMIO->getLength() / 2;
+    if (gttBytes < GTT_MIN_BYTES) {
+        LOG("❌ GTTMMADR too small (0x%llX)", (unsigned long long)fMMIO->getLength());
+        return false;
+    }
+
+    fGTTDesc = IOMemoryDescriptor::withPhysicalAddress(gttPhys, gttBytes, kIODirectionInOut);
+    if (!fGTTDesc) {
+        LOG("❌ no descriptor for GTTMMADR 0x%llX", (unsigned long long)gttPhys);
+        return false;
+    }
+
+    // Write-combined: PTE updates are streams of posted writes, see commit()
+    fGTTMap = fGTTDesc->map(kIOMapWriteCombineCache);
+    if (!fGTTMap) {
+        LOG("❌ failed to map GTTMMADR 0x%llX", (unsigned long long)gttPhys);
+        return false;
+    }
+
+    fPTEs = reinterpret_cast<volatile uint64_t*>(fGTTMap->getVirtualAddress());
+    fNumPTEs = (uint32_t)MIN(fGTTMap->getLength() / sizeof(uint64_t), GGTT_MAX_BYTES / kPageSize);
+    if (!fSpace.init(getSize(), kPageSize)) return false;
+
+    LOG("🟢 GTTMMADR 0x%llX mapped at %p, %u PTEs", (unsigned long long)gttPhys, fPTEs, fNumPTEs);
+    return true;
+}
+
+void FakeIrisXEGGTT::free()
+{
+    fSpace.reset();
+    if (fLock) {
+        IOLockFree(fLock);
+        fLock = nullptr;
+    }
+
+    OSSafeReleaseNULL(fGTTMap);
+    OSSafeReleaseNULL(fGTTDesc);
+    OSSafeReleaseNULL(fMMIO);
+    fPTEs = nullptr;
+
+    OSObject::free();
+}
+
+
+
+#pragma mark - Bind / unbind
+
+IOReturn FakeIrisXEGGTT::bind(IOMemoryDescriptor* md, uint64_t align, uint64_t* offset, uint64_t guard)
+{
+    if (!md || !offset || align < kPageSize || (align & (align - 1))) return kIOReturnBadArgument;
+
+    uint64_t size = ((uint64_t)md->getLength() + kPageSize - 1) & ~(uint64_t)(kPageSize - 1);
+    if (size == 0) return kIOReturnBadArgument;
+
+    guard = (guard + kPageSize - 1) & ~(uint64_t)(kPageSize - 1);
+
+    // Start where the first run's largest page can be used. A no-op
+    // while kPageSizes is 4 KiB only.
+    uint64_t phys, run;
+    if (xe_gtt_md_run(md, 0, &phys, &run))
+        align = MAX(align, xe_gtt_run_align(phys, run, kPageSizes));
+
+    uint64_t start;
+    IOLockLock(fLock);
+    bool ok = fSpace.alloc(size, align, guard, &start);
+    IOLockUnlock(fLock);
+    if (!ok) {
+        LOG("❌ out of space for %llu KB", (unsigned long long)(size >> 10));
+        return kIOReturnNoSpace;
+    }
+
+    // The guard may still point at whatever its last owner mapped there
+    uint32_t first = (uint32_t)(start / kPageSize);
+    clearPTEs(first + (uint32_t)(size / kPageSize), (uint32_t)(guard / kPageSize));
+
+    uint32_t pages = writePTEs(md, first);
+    if (pages == 0) {
+        unbind(start);
+        return kIOReturnVMError;
+    }
+
+    LOG("🟢 bound %u pages at 0x%llX", pages, (unsigned long long)start);
+    *offset = start;
+    return kIOReturnSuccess;
+}
+
+IOReturn FakeIrisXEGGTT::unbind(uint64_t offset)
+{
+    uint64_t size;
+
+    // Not-present PTEs, so a stray access can't reach pages the owner may
+    // reuse once they're unwired. Cleared under the lock: the moment the
+    // range is free, a bind may be writing its own PTEs there.
+    IOLockLock(fLock);
+    bool found = fSpace.free(offset, &size);
+    if (found) clearPTEs((uint32_t)(offset / kPageSize), (uint32_t)(size / kPageSize));
+    IOLockUnlock(fLock);
+
+    return found ? kIOReturnSuccess : kIOReturnNotFound;
+}
+
+
+
+#pragma mark - PTE writes
+
+uint32_t FakeIrisXEGGTT::writePTEs(IOMemoryDescriptor* md, uint32_t firstIndex)
+{
+    uint64_t length = md->getLength();
+    uint64_t offset = 0;
+    uint32_t idx = firstIndex;
+    bool ok = true;
+
+    while (offset < length) {
+        uint64_t phys, run;
+        if (!xe_gtt_md_run(md, offset, &phys, &run)) {
+            LOG("❌ no usable segment at offset 0x%llX", (unsigned long long)offset);
+            ok = false;
+            break;
+        }
+
+        // One PTE per 4 KiB page, the last one partial if md ends mid-page
+        run = MIN(run, length - offset);
+        uint64_t pte = phys | PTE_FLAGS;
+        for (uint64_t runOff = 0; runOff < run; runOff += kPageSize, pte += kPageSize)
+            fPTEs[idx++] = pte;
+        offset += run;
+    }
+
+    if (idx != firstIndex) commit(idx - 1);
+    return ok ? idx - firstIndex : 0;
+}
+
+void FakeIrisXEGGTT::clearPTEs(uint32_t firstIndex, uint32_t count)
+{
+    if (count == 0) return;
+
+    for (uint32_t i = 0; i < count; ++i)
+        fPTEs[firstIndex + i] = 0;
+    commit(firstIndex + count - 1);
+}
+
+// PTEs go out back to back through the write-combined mapping; one
+// fence, one posting read and one TLB flush at the end cover the whole
+// range, instead of a readback per page.
+void FakeIrisXEGGTT::commit(uint32_t lastIndex)
+{
+    xe_stream_fence();           // drain the WC buffers
+    (void)fPTEs[lastIndex];      // and make sure the writes reached the GTT
+
+    if (fMMIO->getLength() > GFX_FLSH_CNTL_GEN6)
+        *(volatile uint32_t*)(fMMIO->getVirtualAddress() + GFX_FLSH_CNTL_GEN6) = GFX_FLSH_CNTL_EN;
+}
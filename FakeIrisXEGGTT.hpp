@@ -0,0 +1,90 @@
+#ifndef FAKE_IRIS_XE_GGTT_HPP
+#define FAKE_IRIS_XE_GGTT_HPP
+
+#include <IOKit/IOLib.h>
+#include <IOKit/IOMemoryDescriptor.h>
+#include <IOKit/pci/IOPCIDevice.h>
+
+#include "FakeIrisXERangeAllocator.hpp"
+#include "FakeIrisXEGTTPages.hpp"
+
+/**
+ * @class FakeIrisXEGGTT
+ * @brief Owns the global GTT: the GTTMMADR mapping, the PTE writes and
+ * the address space. Created once at framebuffer start.
+ *
+ * Callers hand in a page list (a prepared IOMemoryDescriptor) and get
+ * back the GGTT offset it was mapped at; unbind() takes that offset.
+ * Every GGTT user goes through here, so nothing else needs to know
+ * where anything lives. Placement is an XERangeAllocator.
+ *
+ * @note Thread-safe. The address space is guarded by a lock. bind()
+ * writes PTEs outside it, since its range is already reserved; unbind()
+ * clears them under it, before the range can be handed out again.
+ */
+class FakeIrisXEGGTT : public OSObject {
+    OSDeclareDefaultStructors(FakeIrisXEGGTT)
+
+public:
+    static constexpr uint32_t kPageSize = 4096;
+
+    // Entry sizes the GGTT can map. Gen12's GGTT PTEs are 4 KiB only;
+    // 64 KiB and 2 MiB entries exist in the PPGTT, not here.
+    static constexpr uint64_t kPageSizes = XE_GTT_4K;
+    static constexpr uint64_t kScanoutAlign = 256 * 1024;   // PLANE_SURF, linear surfaces
+    static constexpr uint64_t kScanoutGuard = kPageSize;    // display prefetches past the end
+
+    /**
+     * @brief Maps the GTT half of mmio, pci's GTTMMADR (BAR0). mmio is
+     * also used for the TLB flush register, and retained.
+     */
+    static FakeIrisXEGGTT* withDevice(IOPCIDevice* pci, IOMemoryMap* mmio);
+
+    /**
+     * @brief Maps md's pages at a free, align-aligned range.
+     * @param md Prepared (wired) memory; its length is rounded up to pages.
+     * @param align Power of two, at least kPageSize.
+     * @param offset Out: GGTT offset of the first page.
+     * @param guard Bytes after the range kept unmapped and never handed out.
+     */
+    IOReturn bind(IOMemoryDescriptor* md, uint64_t align, uint64_t* offset, uint64_t guard = 0);
+
+    /**
+     * @brief Points the range bound at offset to nothing and frees it.
+     */
+    IOReturn unbind(uint64_t offset);
+
+    uint64_t getSize() const { return (uint64_t)fNumPTEs * kPageSize; }
+
+    void free() override;
+
+private:
+    bool initWithDevice(IOPCIDevice* pci, IOMemoryMap* mmio);
+
+    /**
+     * @brief Writes PTEs for md from firstIndex on, one physically
+     * contiguous run at a time, then commits them.
+     * @return Pages written, or 0 if md has a hole.
+     */
+    uint32_t writePTEs(IOMemoryDescriptor* md, uint32_t firstIndex);
+
+    void clearPTEs(uint32_t firstIndex, uint32_t count);
+
+    /**
+     * @brief Makes a batch of PTE writes visible: fence, posting read of
+     * the last one, GGTT TLB flush.
+     */
+    void commit(uint32_t lastIndex);
+
+    IOMemoryDescriptor* fGTTDesc {nullptr};
+    IOMemoryMap*        fGTTMap {nullptr};
+    volatile uint64_t*  fPTEs {nullptr};
+    uint32_t            fNumPTEs {0};
+
+    IOMemoryMap*        fMMIO {nullptr};
+
+    IOLock*             fLock {nullptr};
+    XERangeAllocator    fSpace;            // under fLock
+};
+
+#endif // FAKE_IRIS_XE_GGTT_HPP
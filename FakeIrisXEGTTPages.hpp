@@ -0,0 +1,71 @@
+#ifndef FAKE_IRIS_XE_GTT_PAGES_HPP
+#define FAKE_IRIS_XE_GTT_PAGES_HPP
+
+#include <stdint.h>
+#include <IOKit/IOMemoryDescriptor.h>
+
+//
+// Page-size selection for GTT mappings.
+//
+// A GTT level that can map more than 4 KiB with one entry (64 KiB or
+// 2 MiB on the PPGTT) can only use it where the GTT address and the
+// physical address are both aligned to that size and the physically
+// contiguous run covers the whole page. Callers walk their runs and ask
+// for the largest page size that works at each step.
+//
+
+// Page sizes, as a mask of the sizes themselves
+enum : uint64_t {
+    XE_GTT_4K  = 1ull << 12,
+    XE_GTT_64K = 1ull << 16,
+    XE_GTT_2M  = 1ull << 21,
+};
+
+/**
+ * @brief Largest page in sizes that maps len contiguous bytes at GTT
+ * address gtt from physical address phys. 4 KiB is always allowed.
+ */
+static inline uint64_t xe_gtt_page_size(uint64_t gtt, uint64_t phys, uint64_t len, uint64_t sizes)
+{
+    for (uint64_t pg = XE_GTT_2M; pg > XE_GTT_4K; pg >>= 1) {
+        if ((sizes & pg) && len >= pg && !((gtt | phys) & (pg - 1)))
+            return pg;
+    }
+    return XE_GTT_4K;
+}
+
+/**
+ * @brief GTT alignment that lets a run starting at phys use its largest
+ * page: aligning the range any less would force 4 KiB entries from the
+ * first page on.
+ */
+static inline uint64_t xe_gtt_run_align(uint64_t phys, uint64_t len, uint64_t sizes)
+{
+    return xe_gtt_page_size(0, phys, len, sizes);
+}
+
+/**
+ * @brief The physically contiguous run of md at offset, as long as the
+ * descriptor allows, merging segments it happens to report separately.
+ * @return false if there is no page-aligned segment at offset.
+ */
+static inline bool xe_gtt_md_run(IOMemoryDescriptor* md, uint64_t offset, uint64_t* phys, uint64_t* len)
+{
+    IOByteCount segLen = 0;
+    uint64_t p = md->getPhysicalSegment(offset, &segLen);
+    if (!p || !segLen || (p & (XE_GTT_4K - 1))) return false;
+
+    uint64_t n = segLen;
+    for (;;) {
+        IOByteCount nextLen = 0;
+        uint64_t next = md->getPhysicalSegment(offset + n, &nextLen);
+        if (!next || !nextLen || next != p + n) break;
+        n += nextLen;
+    }
+
+    *phys = p;
+    *len = n;
+    return true;
+}
+
+#endif // FAKE_IRIS_XE_GTT_PAGES_HPP
@@ -0,0 +1,210 @@
+#ifndef FAKE_IRIS_XE_HANDLE_TABLE_HPP
+#define FAKE_IRIS_XE_HANDLE_TABLE_HPP
+
+#include <IOKit/IOLib.h>
+#include <stdint.h>
+
+/**
+ * @class XEHandleTable
+ * @brief Maps 32-bit handles to objects in O(1).
+ *
+ * A handle is (generation << kIndexBits) | slot index. Removing an object
+ * bumps its slot's generation, so a stale handle for a reused slot no
+ * longer matches. Freed slots are reused oldest-first, and a slot whose
+ * generation would wrap is retired instead: it only comes back, at
+ * generation 1, after kRetireGrace more removes, when no free slot is
+ * left. A stale handle would have to outlive all of them to alias a new
+ * one.
+ *
+ * Slots live in 64-entry chunks hanging off a fixed directory, so
+ * neither ever moves. The table stores pointers and does not own the
+ * objects.
+ *
+ * @note Writers (insert/remove/reset) must be serialised by the caller.
+ * lookup() takes no lock and may race with writers: it returns either
+ * null or an object that was live under that handle at some point during
+ * the call. Keeping a removed object's memory valid until such readers
+ * are done is the caller's job.
+ */
+template <typename T, uint32_t MaxSlots = (1u << 16)>
+class XEHandleTable {
+public:
+    static constexpr uint32_t kIndexBits = 20;                      // 1M slots max
+    static constexpr uint32_t kIndexMask = (1u << kIndexBits) - 1;
+    static constexpr uint32_t kGenMax    = (1u << (32 - kIndexBits)) - 1;
+    static constexpr uint32_t kChunkShift = 6;                      // 64 slots per chunk
+    static constexpr uint32_t kChunkSlots = 1u << kChunkShift;
+    static constexpr uint32_t kMaxChunks  = MaxSlots / kChunkSlots;
+
+    static_assert(MaxSlots % kChunkSlots == 0 && MaxSlots <= kIndexMask + 1u,
+                  "MaxSlots must be a multiple of the chunk size and fit the index bits");
+
+    static constexpr uint32_t kInvalid = 0;                         // never a valid handle
+    static constexpr uint32_t kRetireGrace = 1u << 16;              // removes before a retired slot is reused
+
+    XEHandleTable() = default;
+    ~XEHandleTable() { reset(); }
+
+    /**
+     * @brief Adds obj and returns its handle, or kInvalid if out of memory/slots.
+     */
+    uint32_t insert(T* obj)
+    {
+        if (!obj) return kInvalid;
+
+        uint32_t idx = popFree();
+        if (idx == kNone) idx = popRetired();
+        if (idx == kNone) {
+            if (fUsed == fNumChunks * kChunkSlots && !grow()) return kInvalid;
+            idx = fUsed;
+            __atomic_store_n(&fUsed, idx + 1, __ATOMIC_RELEASE);   // publishes the chunk too
+        }
+
+        Slot& s = slot(idx);
+        __atomic_store_n(&s.obj, obj, __ATOMIC_RELEASE);
+        ++fLive;
+        return (s.gen << kIndexBits) | idx;
+    }
+
+    /**
+     * @brief Returns the object for handle h, or null if h is stale or bogus.
+     */
+    T* lookup(uint32_t h) const
+    {
+        uint32_t idx = h & kIndexMask;
+        if (h == kInvalid || idx >= __atomic_load_n(&fUsed, __ATOMIC_ACQUIRE)) return nullptr;
+
+        // obj before gen: an object stored after a remove() carries that
+        // remove's generation bump with it, so a stale handle can't match it
+        const Slot& s = slot(idx);
+        T*       obj = __atomic_load_n(&s.obj, __ATOMIC_ACQUIRE);
+        uint32_t gen = __atomic_load_n(&s.gen, __ATOMIC_ACQUIRE);
+        return (obj && gen == (h >> kIndexBits)) ? obj : nullptr;
+    }
+
+    /**
+     * @brief Invalidates h and returns the object it referred to (or null).
+     */
+    T* remove(uint32_t h)
+    {
+        T* obj = lookup(h);
+        if (!obj) return nullptr;
+
+        uint32_t idx = h & kIndexMask;
+        Slot& s = slot(idx);
+        __atomic_store_n(&s.obj, (T*)nullptr, __ATOMIC_RELEASE);
+        --fLive;
+        ++fRemoves;
+
+        if (s.gen < kGenMax) {
+            __atomic_store_n(&s.gen, s.gen + 1, __ATOMIC_RELEASE);
+            pushFree(idx);
+        } else {
+            s.retiredAt = fRemoves;
+            pushList(idx, fRetiredHead, fRetiredTail);
+        }
+        return obj;
+    }
+
+    /**
+     * @brief Calls fn(handle, obj) for each live entry.
+     */
+    template <typename F>
+    void forEach(F fn) const
+    {
+        for (uint32_t i = 0; i < fUsed; ++i) {
+            const Slot& s = slot(i);
+            if (s.obj) fn((s.gen << kIndexBits) | i, s.obj);
+        }
+    }
+
+    uint32_t count() const { return fLive; }
+
+    /**
+     * @brief Drops every entry and frees the table's storage (not the objects).
+     */
+    void reset()
+    {
+        fUsed = 0;
+        for (uint32_t c = 0; c < fNumChunks; ++c) {
+            IOFree(fChunks[c], sizeof(Slot) * kChunkSlots);
+            fChunks[c] = nullptr;
+        }
+
+        fNumChunks = 0;
+        fLive = 0;
+        fFreeHead = fFreeTail = kNone;
+        fRetiredHead = fRetiredTail = kNone;
+        fRemoves = 0;
+    }
+
+private:
+    static constexpr uint32_t kNone = UINT32_MAX;
+
+    struct Slot {
+        T*       obj;
+        uint32_t gen;        // 1..kGenMax, so a handle is never 0
+        uint32_t nextFree;   // free or retired list link
+        uint32_t retiredAt;  // fRemoves when the slot retired
+    };
+
+    Slot&       slot(uint32_t idx)       { return fChunks[idx >> kChunkShift][idx & (kChunkSlots - 1)]; }
+    const Slot& slot(uint32_t idx) const { return fChunks[idx >> kChunkShift][idx & (kChunkSlots - 1)]; }
+
+    // FIFO lists: the longest-freed slot is reused first
+    uint32_t popList(uint32_t& head, uint32_t& tail)
+    {
+        uint32_t idx = head;
+        if (idx == kNone) return kNone;
+        head = slot(idx).nextFree;
+        if (head == kNone) tail = kNone;
+        return idx;
+    }
+
+    void pushList(uint32_t idx, uint32_t& head, uint32_t& tail)
+    {
+        slot(idx).nextFree = kNone;
+        if (tail == kNone) head = idx;
+        else               slot(tail).nextFree = idx;
+        tail = idx;
+    }
+
+    uint32_t popFree()             { return popList(fFreeHead, fFreeTail); }
+    void     pushFree(uint32_t idx) { pushList(idx, fFreeHead, fFreeTail); }
+
+    // The oldest retired slot, back at generation 1, once kRetireGrace
+    // removes have gone by since it retired
+    uint32_t popRetired()
+    {
+        if (fRetiredHead == kNone || fRemoves - slot(fRetiredHead).retiredAt < kRetireGrace)
+            return kNone;
+
+        uint32_t idx = popList(fRetiredHead, fRetiredTail);
+        __atomic_store_n(&slot(idx).gen, 1u, __ATOMIC_RELEASE);
+        return idx;
+    }
+
+    bool grow()
+    {
+        if (fNumChunks == kMaxChunks) return false;
+
+        Slot* chunk = (Slot*)IOMallocZero(sizeof(Slot) * kChunkSlots);
+        if (!chunk) return false;
+        for (uint32_t i = 0; i < kChunkSlots; ++i) chunk[i].gen = 1;
+
+        fChunks[fNumChunks++] = chunk;
+        return true;
+    }
+
+    Slot*    fChunks[kMaxChunks] {};  // fixed, so lock-free readers never chase a freed directory
+    uint32_t fNumChunks {0};
+    uint32_t fUsed      {0};          // slots ever handed out (high-water index)
+    uint32_t fLive      {0};
+    uint32_t fFreeHead  {kNone};
+    uint32_t fFreeTail  {kNone};
+    uint32_t fRetiredHead {kNone};
+    uint32_t fRetiredTail {kNone};
+    uint32_t fRemoves   {0};          // wraps; only differences are used
+};
+
+#endif // FAKE_IRIS_XE_HANDLE_TABLE_HPP
@@ -0,0 +1,458 @@
+#include "FakeIrisXEPPGTT.hpp"
+#include "FakeIrisXEBlit.hpp"
+
+OSDefineMetaClassAndStructors(FakeIrisXEPPGTT, OSObject)
+
+#define LOG(fmt, ...) IOLog("(FakeIrisXEFramebuffer) [PPGTT] " fmt "\n", ##__VA_ARGS__)
+
+#define PPGTT_FLAGS         0x3ULL                  // present + writable, every level
+#define PPGTT_PRESENT       0x1ULL
+#define PPGTT_ADDR_MASK     0x0000FFFFFFFFF000ULL   // bits 47:12
+#define PDE_PS_2M           (1ULL << 7)             // PDE maps a 2 MiB page itself
+#define PDE_IPS_64K         (1ULL << 11)            // PT below is read as 32 64 KiB entries
+
+
+
+// Every group of 16 PTEs maps one aligned, contiguous 64 KiB page, so
+// the GPU may read only the first of each
+static bool pt_is_64k(const uint64_t* pte)
+{
+    for (uint32_t g = 0; g < 512; g += 16) {
+        uint64_t first = pte[g];
+        if (!(first & PPGTT_PRESENT) || (first & PPGTT_ADDR_MASK & (XE_GTT_64K - 1))) return false;
+        for (uint32_t k = 1; k < 16; ++k) {
+            if (pte[g + k] != first + (uint64_t)k * XE_GTT_4K) return false;
+        }
+    }
+    return true;
+}
+
+
+
+#pragma mark - Lifetime
+
+FakeIrisXEPPGTT* FakeIrisXEPPGTT::withSize(uint64_t vaBytes)
+{
+    FakeIrisXEPPGTT* me = new FakeIrisXEPPGTT;
+    if (me && !me->initWithSize(vaBytes)) {
+        me->release();
+        return nullptr;
+    }
+    return me;
+}
+
+bool FakeIrisXEPPGTT::initWithSize(uint64_t vaBytes)
+{
+    if (!OSObject::init()) return false;
+    if (vaBytes <= XE_GTT_2M || vaBytes > kMaxBytes || (vaBytes & (XE_GTT_2M - 1))) return false;
+
+    fLock = IOLockAlloc();
+    if (!fLock) return false;
+
+    fSize = vaBytes;
+    if (!fSpace.init(vaBytes, kPageSize)) return false;
+
+    // Reserve the bottom, so no bind ever gets address 0
+    uint64_t zero;
+    if (!fSpace.alloc(XE_GTT_2M, XE_GTT_2M, 0, &zero)) return false;
+
+    fRoot = newTable(0);
+    return fRoot != nullptr;
+}
+
+void FakeIrisXEPPGTT::free()
+{
+    // Whatever is still bound holds its memory
+    fSpace.forEach([](uint64_t, uint64_t, void* data) {
+        if (data) ((IOMemoryDescriptor*)data)->release();
+    });
+    fSpace.reset();
+
+    if (fRoot) freeTree(fRoot, 0);
+    fRoot = nullptr;
+    if (fLock) retireTLB(fTLBGen);   // nothing can walk the tables any more
+
+    while (fChunks) {
+        Chunk* c = fChunks;
+        fChunks = c->next;
+        OSSafeReleaseNULL(c->md);
+        IOFree(c, sizeof(Chunk));
+    }
+    fFreePages = nullptr;
+
+    if (fLock) {
+        IOLockFree(fLock);
+        fLock = nullptr;
+    }
+
+    OSObject::free();
+}
+
+
+
+#pragma mark - Bind / unbind
+
+IOReturn FakeIrisXEPPGTT::bind(IOMemoryDescriptor* md, uint64_t align, uint64_t* gpuAddr)
+{
+    if (!md || !gpuAddr || align < kPageSize || (align & (align - 1))) return kIOReturnBadArgument;
+
+    uint64_t size = ((uint64_t)md->getLength() + kPageSize - 1) & ~(uint64_t)(kPageSize - 1);
+    if (size == 0) return kIOReturnBadArgument;
+
+    // Start where the first run's largest page can be used
+    uint64_t phys, run;
+    if (xe_gtt_md_run(md, 0, &phys, &run))
+        align = MAX(align, xe_gtt_run_align(phys, run, kPageSizes));
+
+    uint64_t start;
+    IOReturn ret = kIOReturnSuccess;
+
+    IOLockLock(fLock);
+    uint32_t tables = fTables;
+    if (!fSpace.alloc(size, align, 0, &start, md)) {
+        ret = kIOReturnNoSpace;
+    } else if ((ret = writeRange(md, start)) != kIOReturnSuccess) {
+        clearRange(start, start + size);
+        __atomic_store_n(&fTLBGen, fTLBGen + 1, __ATOMIC_RELEASE);   // for the tables it held
+        fSpace.free(start);
+    } else {
+        md->retain();
+    }
+    tables = fTables - tables;
+    IOLockUnlock(fLock);
+
+    if (ret != kIOReturnSuccess) {
+        LOG("❌ bind of %llu KB failed (0x%x)", (unsigned long long)(size >> 10), ret);
+        return ret;
+    }
+
+    commit();
+
+    LOG("🟢 bound %llu KB at 0x%llX, %u new tables", (unsigned long long)(size >> 10),
+        (unsigned long long)start, tables);
+    *gpuAddr = start;
+    return kIOReturnSuccess;
+}
+
+IOReturn FakeIrisXEPPGTT::unbind(uint64_t gpuAddr)
+{
+    if (gpuAddr == 0) return kIOReturnNotFound;   // the reserved bottom
+
+    uint64_t size;
+    void* md = nullptr;
+
+    IOLockLock(fLock);
+    bool found = fSpace.free(gpuAddr, &size, &md);
+    if (found) {
+        clearRange(gpuAddr, gpuAddr + size);
+        commit();
+        // Under the lock, so the pages clearRange() held are tagged with
+        // the generation that frees them
+        __atomic_store_n(&fTLBGen, fTLBGen + 1, __ATOMIC_RELEASE);
+    }
+    IOLockUnlock(fLock);
+
+    if (!found) return kIOReturnNotFound;
+
+    if (md) ((IOMemoryDescriptor*)md)->release();
+    return kIOReturnSuccess;
+}
+
+void FakeIrisXEPPGTT::retireTLB(uint32_t gen)
+{
+    IOLockLock(fLock);
+
+    // Newest first: once one table is retired, so is everything after it
+    Table** link = &fRetiring;
+    while (*link && (int32_t)((*link)->gen - gen) > 0) link = &(*link)->next;
+
+    while (Table* t = *link) {
+        *link = t->next;
+        freeTable(t, t->child ? 0 : kLevels - 1);   // only a PT's size differs
+    }
+    IOLockUnlock(fLock);
+}
+
+bool FakeIrisXEPPGTT::translate(uint64_t gpuAddr, uint64_t* phys, uint64_t* pageSize)
+{
+    if (!phys || gpuAddr >= fSize) return false;
+
+    uint64_t pa = 0, pg = 0;
+
+    IOLockLock(fLock);
+    const Table* t = fRoot;
+    for (uint32_t d = 0; d < kLevels; ++d) {
+        uint64_t e = t->entries[index(gpuAddr, d)];
+        if (!(e & PPGTT_PRESENT)) break;
+
+        if (d == kLevels - 1) {
+            pg = XE_GTT_4K;
+        } else if (d == 2 && (e & PDE_PS_2M)) {
+            pg = XE_GTT_2M;
+        } else {
+            const Table* c = t->child[index(gpuAddr, d)];
+            if (!c || (e & PPGTT_ADDR_MASK) != c->phys) {
+                LOG("❌ entry 0x%llX at level %u doesn't point at its table", (unsigned long long)e, d);
+                break;
+            }
+            if (d == 2 && (e & PDE_IPS_64K)) {
+                // As the GPU reads it: the group's first PTE maps all 64 KiB
+                e = c->entries[index(gpuAddr, 3) & ~15u];
+                if (e & PPGTT_PRESENT) pg = XE_GTT_64K;
+            } else {
+                t = c;
+                continue;
+            }
+        }
+
+        if (pg) pa = (e & PPGTT_ADDR_MASK & ~(pg - 1)) | (gpuAddr & (pg - 1));
+        break;
+    }
+    IOLockUnlock(fLock);
+
+    if (!pg) return false;
+    *phys = pa;
+    if (pageSize) *pageSize = pg;
+    return true;
+}
+
+
+
+#pragma mark - Entry writes
+
+IOReturn FakeIrisXEPPGTT::writeRange(IOMemoryDescriptor* md, uint64_t start)
+{
+    uint64_t length = md->getLength();
+    uint64_t offset = 0;
+    Table*   pt = nullptr;      // PT being filled, covering [ptVA, ptVA + 2 MiB)
+    uint64_t ptVA = 0;
+    IOReturn ret = kIOReturnSuccess;
+
+    while (offset < length && ret == kIOReturnSuccess) {
+        uint64_t phys, run;
+        if (!xe_gtt_md_run(md, offset, &phys, &run)) {
+            LOG("❌ no usable segment at offset 0x%llX", (unsigned long long)offset);
+            ret = kIOReturnVMError;
+            break;
+        }
+
+        // The largest leaf that fits at each step, the last page partial
+        // if md ends mid-page
+        run = MIN(run, length - offset);
+        while (run) {
+            uint64_t va = start + offset;
+            uint64_t pg = xe_gtt_page_size(va, phys, run, kPageSizes);
+
+            if (pg == XE_GTT_2M) {
+                Table* pd = walk(va, 2);
+                uint32_t i = index(va, 2);
+                if (!pd || pd->child[i] || (pd->entries[i] & PPGTT_PRESENT)) {
+                    ret = pd ? kIOReturnError : kIOReturnNoMemory;
+                    break;
+                }
+                pd->entries[i] = phys | PDE_PS_2M | PPGTT_FLAGS;
+                ++pd->used;
+            } else {
+                if (!pt || (va & ~(XE_GTT_2M - 1)) != ptVA) {
+                    if (pt) setPDE(ptVA);
+                    ptVA = va & ~(XE_GTT_2M - 1);
+                    if (!(pt = walk(va, 3))) {
+                        ret = kIOReturnNoMemory;
+                        break;
+                    }
+                }
+                uint64_t* pte = pt->entries + index(va, 3);
+                for (uint64_t o = 0; o < pg; o += kPageSize)
+                    *pte++ = (phys + o) | PPGTT_FLAGS;
+                pt->used += (uint32_t)(pg / kPageSize);
+            }
+
+            uint64_t step = MIN(pg, run);
+            offset += step;
+            phys   += step;
+            run    -= step;
+        }
+    }
+
+    if (pt) setPDE(ptVA);
+    return ret;
+}
+
+void FakeIrisXEPPGTT::clearRange(uint64_t start, uint64_t end)
+{
+    uint64_t va = start;
+
+    while (va < end) {
+        // Down as far as there are tables
+        Table* path[kLevels] = { fRoot };
+        uint32_t d = 0;
+        while (d < kLevels - 1 && path[d]->child[index(va, d)]) {
+            path[d + 1] = path[d]->child[index(va, d)];
+            ++d;
+        }
+
+        uint64_t at = va;
+        uint32_t i = index(va, d);
+        uint64_t* e = path[d]->entries + i;
+
+        if (d == kLevels - 1) {
+            // A PT: clear up to its end in one go
+            uint32_t n = (uint32_t)MIN((end - va) / kPageSize, (uint64_t)(kEntries - i));
+            for (uint32_t k = 0; k < n; ++k, ++e) {
+                if (*e & PPGTT_PRESENT) {
+                    *e = 0;
+                    --path[d]->used;
+                }
+            }
+            va += (uint64_t)n * kPageSize;
+
+            // No longer full, so no longer 64 KiB
+            if (path[d]->used)
+                path[d - 1]->entries[index(at, d - 1)] = path[d]->phys | PPGTT_FLAGS;
+        } else {
+            // A 2 MiB leaf, or nothing mapped under this entry at all
+            if (*e & PPGTT_PRESENT) {
+                *e = 0;
+                --path[d]->used;
+            }
+            uint64_t span = 1ULL << shift(d);
+            va = (va & ~(span - 1)) + span;
+        }
+
+        // Free the tables this emptied, bottom up; the PML4 stays
+        for (; d > 0 && path[d]->used == 0; --d) {
+            uint32_t pi = index(at, d - 1);
+            path[d - 1]->entries[pi] = 0;
+            path[d - 1]->child[pi] = nullptr;
+            --path[d - 1]->used;
+            retireTable(path[d]);
+        }
+    }
+}
+
+void FakeIrisXEPPGTT::setPDE(uint64_t va)
+{
+    Table* pd = walk(va, 2);   // exists: there's a PT under it
+    uint32_t i = index(va, 2);
+    Table* pt = pd ? pd->child[i] : nullptr;
+    if (!pt) return;
+
+    uint64_t pde = pt->phys | PPGTT_FLAGS;
+    if (pt->used == kEntries && pt_is_64k(pt->entries)) pde |= PDE_IPS_64K;
+    pd->entries[i] = pde;
+}
+
+// The tables are write-back and the GPU walks them through the LLC, so
+// there is nothing to flush: one fence orders a whole batch of entry
+// stores before whatever hands the addresses to the GPU.
+void FakeIrisXEPPGTT::commit()
+{
+    xe_stream_fence();
+}
+
+
+
+#pragma mark - Tables
+
+FakeIrisXEPPGTT::Table* FakeIrisXEPPGTT::walk(uint64_t va, uint32_t depth)
+{
+    Table* t = fRoot;
+    for (uint32_t d = 0; d < depth; ++d) {
+        uint32_t i = index(va, d);
+        Table* c = t->child[i];
+        if (!c) {
+            if (t->entries[i] & PPGTT_PRESENT) return nullptr;   // a 2 MiB leaf
+            if (!(c = newTable(d + 1))) return nullptr;
+            t->child[i] = c;
+            t->entries[i] = c->phys | PPGTT_FLAGS;
+            ++t->used;
+        }
+        t = c;
+    }
+    return t;
+}
+
+FakeIrisXEPPGTT::Table* FakeIrisXEPPGTT::newTable(uint32_t depth)
+{
+    Table* t = (Table*)IOMalloc(tableBytes(depth));
+    if (!t) return nullptr;
+    bzero(t, tableBytes(depth));
+
+    if (!allocPage(&t->entries, &t->phys)) {
+        IOFree(t, tableBytes(depth));
+        return nullptr;
+    }
+    if (depth < kLevels - 1) t->child = (Table**)(t + 1);
+
+    ++fTables;
+    return t;
+}
+
+void FakeIrisXEPPGTT::freeTable(Table* t, uint32_t depth)
+{
+    freePage(t->entries, t->phys);
+    IOFree(t, tableBytes(depth));
+    --fTables;
+}
+
+// The page keeps its cleared entries and stays out of the pool: a stale
+// translation may still lead the GPU here until the generation retires
+void FakeIrisXEPPGTT::retireTable(Table* t)
+{
+    t->gen  = fTLBGen + 1;
+    t->next = fRetiring;
+    fRetiring = t;
+}
+
+void FakeIrisXEPPGTT::freeTree(Table* t, uint32_t depth)
+{
+    if (t->child) {
+        for (uint32_t i = 0; i < kEntries; ++i) {
+            if (t->child[i]) freeTree(t->child[i], depth + 1);
+        }
+    }
+    freeTable(t, depth);
+}
+
+bool FakeIrisXEPPGTT::allocPage(uint64_t** va, uint64_t* phys)
+{
+    if (!fFreePages) {
+        // A chunk of wired pages at a time; they come back to fFreePages,
+        // and to the kernel only when the space goes
+        uint32_t pages = fChunks ? kChunkPages : kFirstChunkPages;
+        Chunk* c = (Chunk*)IOMalloc(sizeof(Chunk));
+        if (!c) return false;
+
+        c->md = IOBufferMemoryDescriptor::inTaskWithOptions(
+            kernel_task, kIODirectionInOut, pages * kPageSize, kPageSize);
+        if (!c->md) {
+            IOFree(c, sizeof(Chunk));
+            return false;
+        }
+        c->next = fChunks;
+        fChunks = c;
+
+        uint8_t* base = (uint8_t*)c->md->getBytesNoCopy();
+        for (uint32_t i = 0; i < pages; ++i) {
+            IOByteCount len = 0;
+            uint64_t p = c->md->getPhysicalSegment((IOByteCount)i * kPageSize, &len);
+            if (p && len >= kPageSize) freePage((uint64_t*)(base + (size_t)i * kPageSize), p);
+        }
+        if (!fFreePages) return false;
+    }
+
+    FreePage* p = fFreePages;
+    fFreePages = p->next;
+    *phys = p->phys;
+    *va = (uint64_t*)p;
+    bzero(p, kPageSize);   // all entries not present
+    return true;
+}
+
+void FakeIrisXEPPGTT::freePage(uint64_t* va, uint64_t phys)
+{
+    FreePage* p = (FreePage*)va;
+    p->phys = phys;
+    p->next = fFreePages;
+    fFreePages = p;
+}
@@ -0,0 +1,189 @@
+#ifndef FAKE_IRIS_XE_PPGTT_HPP
+#define FAKE_IRIS_XE_PPGTT_HPP
+
+#include <IOKit/IOLib.h>
+#include <IOKit/IOBufferMemoryDescriptor.h>
+
+#include "FakeIrisXERangeAllocator.hpp"
+#include "FakeIrisXEGTTPages.hpp"
+
+/**
+ * @class FakeIrisXEPPGTT
+ * @brief One context's private GPU address space: a Gen12 4-level
+ * PPGTT (PML4, PDP, PD, PT; 512 eight-byte entries per level, 48-bit
+ * addresses) and its placement.
+ *
+ * Only the PML4 exists up front. The tables under it are allocated as
+ * bind() first reaches them and freed by unbind() once nothing in them
+ * is mapped. Table pages come from wired chunks kept by the space, so a
+ * bind doesn't make one kernel allocation per table. The first chunk
+ * only holds the PML4 and one table per level below it, enough for a
+ * small space; later ones are larger.
+ *
+ * Leaves are the largest page each run allows (see xe_gtt_page_size()):
+ * - 2 MiB: a PDE with PS set, no PT under it;
+ * - 64 KiB: 16 PTEs, all written. Gen12 reads every 16th one only when
+ *   the PDE's IPS bit is set, which needs the whole PT to be 64 KiB
+ *   pages; the PT is valid either way, IPS just gets the GPU 64 KiB TLB
+ *   entries. See setPDE();
+ * - 4 KiB: one PTE.
+ *
+ * Table pages an unbind frees wait for the TLB generation it bumps to
+ * be retired (see retireTLB()) before another bind can reuse them.
+ *
+ * The tables are write-back memory: on Gen12 the GPU walks them through
+ * the LLC it shares with the CPU, so a bind is a stream of plain stores
+ * and one fence at the end, however many entries it wrote.
+ *
+ * @note Thread-safe, one lock for the tables and the placement. Blocks
+ * (allocation), so not for primary interrupt context.
+ */
+class FakeIrisXEPPGTT : public OSObject {
+    OSDeclareDefaultStructors(FakeIrisXEPPGTT)
+
+public:
+    static constexpr uint32_t kPageSize  = 4096;
+    static constexpr uint64_t kPageSizes = XE_GTT_4K | XE_GTT_64K | XE_GTT_2M;
+    static constexpr uint64_t kMaxBytes  = 1ull << 48;
+
+    /**
+     * @brief An empty space of vaBytes (a multiple of 2 MiB, at most
+     * kMaxBytes). The first 2 MiB are never handed out, so a GPU address
+     * of 0 always means none.
+     */
+    static FakeIrisXEPPGTT* withSize(uint64_t vaBytes);
+
+    /**
+     * @brief Maps md's pages at a free, align-aligned address, and keeps a
+     * reference to md until unbind().
+     * @param md Prepared (wired) memory; its length is rounded up to pages.
+     * @param align Power of two, at least kPageSize. Raised to the first
+     * run's largest page, so big runs get big leaves.
+     * @param gpuAddr Out: address of the first page.
+     */
+    IOReturn bind(IOMemoryDescriptor* md, uint64_t align, uint64_t* gpuAddr);
+
+    /**
+     * @brief Unmaps the range bound at gpuAddr, frees the tables it leaves
+     * empty and drops the reference to its memory.
+     */
+    IOReturn unbind(uint64_t gpuAddr);
+
+    /**
+     * @brief Software page walk: what the GPU would read for gpuAddr,
+     * decoding the entries themselves (PS, IPS, addresses) rather than
+     * trusting the bookkeeping. For checking the tables.
+     * @param phys Out: physical address gpuAddr translates to.
+     * @param pageSize Out (optional): size of the leaf that maps it.
+     * @return false if gpuAddr isn't mapped, or an entry is inconsistent.
+     */
+    bool translate(uint64_t gpuAddr, uint64_t* phys, uint64_t* pageSize = nullptr);
+
+    // PML4 physical address, for the context descriptor
+    uint64_t getRootPhys() const { return fRoot ? fRoot->phys : 0; }
+
+    // Bumped by every unbind. Submission must invalidate the context's
+    // TLBs if it changed since the context last ran, then retireTLB();
+    // binds only fill entries that were not present, so they never need to.
+    uint32_t getTLBGeneration() const { return __atomic_load_n(&fTLBGen, __ATOMIC_ACQUIRE); }
+
+    /**
+     * @brief The context's TLBs no longer hold anything from before
+     * generation gen: table pages unbinds freed up to then may be reused.
+     * Until this is called they stay out of the pool, as the GPU could
+     * still walk them through translations it cached before the unbind.
+     */
+    void retireTLB(uint32_t gen);
+
+    uint64_t getSize() const { return fSize; }
+
+    void free() override;
+
+private:
+    static constexpr uint32_t kEntries    = 512;
+    static constexpr uint32_t kLevels     = 4;     // 0 is the PML4, 3 the PTs
+    static constexpr uint32_t kFirstChunkPages = kLevels;   // PML4 and one path down to a PT
+    static constexpr uint32_t kChunkPages = 16;             // table pages per later chunk
+
+    /**
+     * @struct Table
+     * @brief One page of entries and, above the PTs, the tables those
+     * entries point to (allocated right after the Table).
+     */
+    struct Table {
+        uint64_t* entries;    // kernel VA of the page
+        uint64_t  phys;
+        Table**   child;      // kEntries, or null for a PT
+        uint32_t  used;       // present entries
+        uint32_t  gen;        // on fRetiring: the TLB generation that frees it
+        Table*    next;       // on fRetiring
+    };
+
+    // A table page on the free list, linked through the page itself
+    struct FreePage {
+        FreePage* next;
+        uint64_t  phys;
+    };
+
+    struct Chunk {
+        IOBufferMemoryDescriptor* md;
+        Chunk*                    next;
+    };
+
+    // Entries of a level-depth table cover 1 << shift(depth) bytes each
+    static uint32_t shift(uint32_t depth) { return 39 - 9 * depth; }
+    static uint32_t index(uint64_t va, uint32_t depth) { return (uint32_t)(va >> shift(depth)) & (kEntries - 1); }
+    static size_t   tableBytes(uint32_t depth) { return sizeof(Table) + (depth < kLevels - 1 ? kEntries * sizeof(Table*) : 0); }
+
+    bool initWithSize(uint64_t vaBytes);
+
+    // --- Tables, fLock held ---
+    Table* newTable(uint32_t depth);
+    void   freeTable(Table* t, uint32_t depth);
+    void   retireTable(Table* t);   // onto fRetiring, entries untouched
+    bool   allocPage(uint64_t** va, uint64_t* phys);
+    void   freePage(uint64_t* va, uint64_t phys);
+    void   freeTree(Table* t, uint32_t depth);
+
+    /**
+     * @brief The level-depth table covering va, creating the tables on the
+     * way down. Null if out of memory, or if a 2 MiB leaf is in the way.
+     */
+    Table* walk(uint64_t va, uint32_t depth);
+
+    /**
+     * @brief Writes md's leaves from start on, one physically contiguous
+     * run at a time. Tables that fail to allocate leave the range
+     * partly written; the caller clears it.
+     */
+    IOReturn writeRange(IOMemoryDescriptor* md, uint64_t start);
+
+    /**
+     * @brief Clears every leaf in [start, end) and frees emptied tables,
+     * their pages held until the next TLB generation retires. The caller
+     * bumps fTLBGen.
+     */
+    void clearRange(uint64_t start, uint64_t end);
+
+    /**
+     * @brief Rewrites the PDE over the PT at va, with IPS set if the PT
+     * is all 64 KiB pages.
+     */
+    void setPDE(uint64_t va);
+
+    // Entry stores done: make them visible before the address is used
+    void commit();
+
+    IOLock*          fLock {nullptr};
+    Table*           fRoot {nullptr};        // under fLock, from here down
+    XERangeAllocator fSpace;                 // data: the bound IOMemoryDescriptor
+    uint64_t         fSize {0};
+    uint32_t         fTLBGen {0};
+
+    Chunk*    fChunks {nullptr};
+    FreePage* fFreePages {nullptr};
+    Table*    fRetiring {nullptr};           // emptied tables, newest first; see retireTLB()
+    uint32_t  fTables {0};
+};
+
+#endif // FAKE_IRIS_XE_PPGTT_HPP
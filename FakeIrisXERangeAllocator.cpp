@@ -0,0 +1,294 @@
+#include "FakeIrisXERangeAllocator.hpp"
+
+
+
+#pragma mark - Public
+
+bool XERangeAllocator::init(uint64_t size, uint64_t granule)
+{
+    reset();
+    if (granule == 0 || (granule & (granule - 1))) return false;
+
+    size &= ~(granule - 1);
+    if (size == 0) return false;
+
+    fGranule = granule;
+    fGranuleShift = __builtin_ctzll(granule);
+    fRoot = newNode(0, size, false);
+    return fRoot != nullptr;
+}
+
+void XERangeAllocator::reset()
+{
+    freeTree(fRoot);
+    fRoot = nullptr;
+    fGranule = 0;
+    fGranuleShift = 0;
+    fAllocated = 0;
+}
+
+bool XERangeAllocator::alloc(uint64_t size, uint64_t align, uint64_t guard, uint64_t* start, void* data)
+{
+    if (!fRoot || !start || size == 0 || (align & (align - 1))) return false;
+
+    uint64_t mask = fGranule - 1;
+    size  = (size + mask) & ~mask;
+    guard = (guard + mask) & ~mask;
+    if (align < fGranule) align = fGranule;
+
+    uint64_t total = size + guard;
+    if (size == 0 || total < size) return false;
+
+    uint32_t cls = __builtin_ctzll(align) - fGranuleShift;
+    if (cls >= kAlignClasses) cls = kAlignClasses - 1;
+
+    uint64_t at = 0;
+    Node* hole = firstFit(fRoot, cls, total, align, &at);
+    if (!hole) return false;
+
+    // Carve [at, at + total) out of the hole; what's left on either side
+    // stays free. Allocate first so failing leaves the tree untouched.
+    uint64_t holeStart = hole->start;
+    uint64_t holeEnd   = hole->start + hole->size;
+    Node* front = nullptr;
+    Node* back  = nullptr;
+
+    if (at > holeStart && !(front = newNode(holeStart, at - holeStart, false)))
+        return false;
+    if (at + total < holeEnd && !(back = newNode(at + total, holeEnd - at - total, false))) {
+        if (front) IOFree(front, sizeof(Node));
+        return false;
+    }
+
+    // The hole keeps its place in the order, so it's reused where it is
+    hole->start = at;
+    hole->size  = total;
+    hole->used  = true;
+    hole->data  = data;
+    refresh(at);
+
+    if (front) fRoot = insert(fRoot, front);
+    if (back)  fRoot = insert(fRoot, back);
+
+    ++fAllocated;
+    *start = at;
+    return true;
+}
+
+bool XERangeAllocator::free(uint64_t start, uint64_t* span, void** data)
+{
+    Node* n = find(start);
+    if (!n || !n->used) return false;
+
+    if (span) *span = n->size;
+    if (data) *data = n->data;
+
+    uint64_t s = n->start;
+    uint64_t e = n->start + n->size;
+    Node* prev = findEndingAt(s);
+    Node* next = find(e);
+
+    // Merge with free neighbours into one hole, reusing n where it is
+    if (prev && !prev->used) {
+        s = prev->start;
+        fRoot = remove(fRoot, prev->start);
+        IOFree(prev, sizeof(Node));
+    }
+    if (next && !next->used) {
+        e = next->start + next->size;
+        fRoot = remove(fRoot, next->start);
+        IOFree(next, sizeof(Node));
+    }
+
+    n->start = s;
+    n->size  = e - s;
+    n->used  = false;
+    n->data  = nullptr;
+    refresh(s);
+
+    --fAllocated;
+    return true;
+}
+
+
+
+#pragma mark - Nodes
+
+XERangeAllocator::Node* XERangeAllocator::newNode(uint64_t start, uint64_t size, bool used)
+{
+    Node* n = (Node*)IOMalloc(sizeof(Node));
+    if (!n) return nullptr;
+
+    n->start = start;
+    n->size  = size;
+    n->used  = used;
+    n->data  = nullptr;
+    n->left  = n->right = nullptr;
+    update(n);
+    return n;
+}
+
+void XERangeAllocator::freeTree(Node* n)
+{
+    while (n) {
+        freeTree(n->left);
+        Node* right = n->right;
+        IOFree(n, sizeof(Node));
+        n = right;
+    }
+}
+
+
+
+#pragma mark - AVL tree
+
+void XERangeAllocator::update(Node* n)
+{
+    int32_t hl = height(n->left), hr = height(n->right);
+    n->height = 1 + (hl > hr ? hl : hr);
+
+    for (uint32_t c = 0; c < kAlignClasses; ++c) {
+        uint64_t m = 0;
+        if (!n->used) {
+            uint64_t a = fGranule << c;
+            uint64_t skip = ((n->start + a - 1) & ~(a - 1)) - n->start;
+            m = skip < n->size ? n->size - skip : 0;
+        }
+        if (n->left  && n->left->fit[c]  > m) m = n->left->fit[c];
+        if (n->right && n->right->fit[c] > m) m = n->right->fit[c];
+        n->fit[c] = m;
+    }
+}
+
+XERangeAllocator::Node* XERangeAllocator::rotateLeft(Node* n)
+{
+    Node* r = n->right;
+    n->right = r->left;
+    r->left = n;
+    update(n);
+    update(r);
+    return r;
+}
+
+XERangeAllocator::Node* XERangeAllocator::rotateRight(Node* n)
+{
+    Node* l = n->left;
+    n->left = l->right;
+    l->right = n;
+    update(n);
+    update(l);
+    return l;
+}
+
+XERangeAllocator::Node* XERangeAllocator::rebalance(Node* n)
+{
+    update(n);
+    int32_t bf = height(n->left) - height(n->right);
+
+    if (bf > 1) {
+        if (height(n->left->left) < height(n->left->right))
+            n->left = rotateLeft(n->left);
+        return rotateRight(n);
+    }
+    if (bf < -1) {
+        if (height(n->right->right) < height(n->right->left))
+            n->right = rotateRight(n->right);
+        return rotateLeft(n);
+    }
+    return n;
+}
+
+XERangeAllocator::Node* XERangeAllocator::insert(Node* root, Node* n)
+{
+    if (!root) return n;
+
+    if (n->start < root->start) root->left  = insert(root->left, n);
+    else                        root->right = insert(root->right, n);
+    return rebalance(root);
+}
+
+// Unlinks the node at start; the caller still owns it
+XERangeAllocator::Node* XERangeAllocator::remove(Node* root, uint64_t start)
+{
+    if (!root) return nullptr;
+
+    if (start < root->start) {
+        root->left = remove(root->left, start);
+    } else if (start > root->start) {
+        root->right = remove(root->right, start);
+    } else {
+        Node* left = root->left;
+        Node* right = root->right;
+        if (!right) return left;
+
+        Node* min;
+        right = removeMin(right, &min);
+        min->left = left;
+        min->right = right;
+        return rebalance(min);
+    }
+    return rebalance(root);
+}
+
+XERangeAllocator::Node* XERangeAllocator::removeMin(Node* root, Node** min)
+{
+    if (!root->left) {
+        *min = root;
+        return root->right;
+    }
+    root->left = removeMin(root->left, min);
+    return rebalance(root);
+}
+
+void XERangeAllocator::refresh(uint64_t start)
+{
+    // An AVL tree of 2^36 nodes is under 52 deep
+    Node* path[64];
+    uint32_t depth = 0;
+
+    for (Node* n = fRoot; n; n = start < n->start ? n->left : n->right) {
+        path[depth++] = n;
+        if (n->start == start) break;
+    }
+    while (depth) update(path[--depth]);
+}
+
+XERangeAllocator::Node* XERangeAllocator::find(uint64_t start) const
+{
+    Node* n = fRoot;
+    while (n && n->start != start)
+        n = start < n->start ? n->left : n->right;
+    return n;
+}
+
+// The nodes tile the space, so this is just the last node starting below end
+XERangeAllocator::Node* XERangeAllocator::findEndingAt(uint64_t end) const
+{
+    Node* best = nullptr;
+    for (Node* n = fRoot; n; ) {
+        if (n->start < end) { best = n; n = n->right; }
+        else                n = n->left;
+    }
+    return (best && best->start + best->size == end) ? best : nullptr;
+}
+
+XERangeAllocator::Node* XERangeAllocator::firstFit(Node* n, uint32_t cls, uint64_t total,
+                                                   uint64_t align, uint64_t* at)
+{
+    // Exact for alignments with a class of their own: a subtree is only
+    // entered if it holds a fit, so this is one path down. Larger ones
+    // may enter subtrees whose holes then turn out to fall short.
+    while (n && n->fit[cls] >= total) {
+        if (Node* r = firstFit(n->left, cls, total, align, at)) return r;
+
+        if (!n->used) {
+            uint64_t s = (n->start + align - 1) & ~(align - 1);
+            if (s - n->start < n->size && n->size - (s - n->start) >= total) {
+                *at = s;
+                return n;
+            }
+        }
+        n = n->right;
+    }
+    return nullptr;
+}
@@ -0,0 +1,135 @@
+#ifndef FAKE_IRIS_XE_RANGE_ALLOCATOR_HPP
+#define FAKE_IRIS_XE_RANGE_ALLOCATOR_HPP
+
+#include <IOKit/IOLib.h>
+#include <stdint.h>
+
+/**
+ * @class XERangeAllocator
+ * @brief Hands out aligned ranges of a linear address space (the GGTT),
+ * drm_mm style, in O(log n).
+ *
+ * The space is tiled by nodes, allocated or free, kept in one AVL tree
+ * ordered by address. Each node also records, for every alignment from
+ * the granule up to kAlignClasses - 1 doublings of it, the most bytes a
+ * hole in its subtree offers from an address with that alignment. The
+ * lowest-addressed hole that takes a request is then found by a single
+ * descent, however fragmented the space. Larger alignments use the
+ * largest class to skip subtrees and check the holes it lets through.
+ * Freeing merges a node with free neighbours, so holes never sit next
+ * to each other.
+ *
+ * A range can carry guard bytes after it: they are reserved along with
+ * the range, and nothing else is ever placed there. It can also carry a
+ * caller's pointer (what is mapped there), handed back by free().
+ *
+ * @note Not thread-safe; callers serialise every call.
+ */
+class XERangeAllocator {
+public:
+    // granule << 9: 2 MiB, the largest GTT page, with 4 KiB granules
+    static constexpr uint32_t kAlignClasses = 10;
+
+    XERangeAllocator() = default;
+    ~XERangeAllocator() { reset(); }
+
+    /**
+     * @brief Starts over with [0, size) as a single hole.
+     * @param granule Every start, size and alignment is a multiple of this
+     * (a power of two, normally the page size).
+     */
+    bool init(uint64_t size, uint64_t granule);
+
+    /**
+     * @brief Frees every node. The allocator is empty until the next init().
+     */
+    void reset();
+
+    /**
+     * @brief Reserves size + guard bytes at the lowest address where the
+     * range starts align-aligned.
+     * @param size Rounded up to the granule.
+     * @param align Power of two; anything under the granule means the granule.
+     * @param guard Rounded up to the granule; reserved right after the range.
+     * @param start Out: start of the range.
+     * @param data Kept with the range, see free() and forEach().
+     */
+    bool alloc(uint64_t size, uint64_t align, uint64_t guard, uint64_t* start, void* data = nullptr);
+
+    /**
+     * @brief Releases the range that starts at start.
+     * @param span Out (optional): bytes released, guard included.
+     * @param data Out (optional): the range's alloc() data.
+     * @return false if no range starts there.
+     */
+    bool free(uint64_t start, uint64_t* span = nullptr, void** data = nullptr);
+
+    /**
+     * @brief Calls fn(start, span, data) for every allocated range, lowest
+     * address first. fn must not call back into the allocator.
+     */
+    template <typename F>
+    void forEach(F fn) const { forEach(fRoot, fn); }
+
+    uint32_t count() const { return fAllocated; }
+    uint64_t largestHole() const { return fRoot ? fRoot->fit[0] : 0; }
+
+private:
+    struct Node {
+        uint64_t start;
+        uint64_t size;       // guard included
+        Node*    left;
+        Node*    right;
+        void*    data;       // alloc()'s, while used
+        int32_t  height;
+        bool     used;
+
+        // Last, so a lookup's descent reads one cache line per node.
+        // Class c: the most bytes a free node in this subtree has from
+        // a (granule << c)-aligned address.
+        uint64_t fit[kAlignClasses];
+    };
+
+    template <typename F>
+    static void forEach(const Node* n, F& fn)
+    {
+        for (; n; n = n->right) {
+            forEach(n->left, fn);
+            if (n->used) fn(n->start, n->size, n->data);
+        }
+    }
+
+    Node* newNode(uint64_t start, uint64_t size, bool used);
+    static void freeTree(Node* n);
+
+    static int32_t height(const Node* n) { return n ? n->height : 0; }
+    void    update(Node* n);
+    Node*   rotateLeft(Node* n);
+    Node*   rotateRight(Node* n);
+    Node*   rebalance(Node* n);
+
+    Node*   insert(Node* root, Node* n);
+    Node*   remove(Node* root, uint64_t start);
+    Node*   removeMin(Node* root, Node** min);
+
+    // Recomputes fit on the path down to the node at start, after it
+    // changed in place
+    void    refresh(uint64_t start);
+
+    Node* find(uint64_t start) const;
+    Node* findEndingAt(uint64_t end) const;
+
+    /**
+     * @brief Lowest-addressed free node where total bytes fit at an
+     * align-aligned start, which goes in *at. cls indexes Node::fit:
+     * align's class, or the largest one for larger alignments.
+     */
+    static Node* firstFit(Node* n, uint32_t cls, uint64_t total, uint64_t align, uint64_t* at);
+
+    Node*    fRoot {nullptr};
+    uint64_t fGranule {0};
+    uint32_t fGranuleShift {0};
+    uint32_t fAllocated {0};
+};
+
+#endif // FAKE_IRIS_XE_RANGE_ALLOCATOR_HPP
@@ -66,7 +66,7 @@ IOReturn FakeIrisXESharedUserClient::externalMethod(uint32_t selector,
             if (!args || !args->structureOutput) return kIOReturnBadArgument;
             if (args->structureOutputSize < sizeof(XEAccelCaps)) return kIOReturnMessageTooLarge;
             XEAccelCaps caps{};
-            caps.version = 1;
+            caps.version = XE_VERSION;
             caps.metalSupported = 0; // keep 0 for now; we’ll flip when ready
             bcopy(&caps, args->structureOutput, sizeof(caps));
             args->structureOutputSize = sizeof(caps);
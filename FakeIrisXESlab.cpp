@@ -0,0 +1,264 @@
+#include "FakeIrisXESlab.hpp"
+
+#define LOG(fmt, ...) IOLog("(FakeIrisXEFramebuffer) [Slab] " fmt "\n", ##__VA_ARGS__)
+
+#define SLAB_OBJ_ALIGN 16
+
+
+
+#pragma mark - Lifetime
+
+bool XESlabCache::init(uint32_t objSize, const char* name)
+{
+    destroy();
+
+    uint32_t hdr = (sizeof(Slab) + SLAB_OBJ_ALIGN - 1) & ~(SLAB_OBJ_ALIGN - 1);
+    objSize = (objSize + SLAB_OBJ_ALIGN - 1) & ~(SLAB_OBJ_ALIGN - 1);
+    if (objSize == 0 || objSize > kSlabBytes - hdr) return false;
+
+    fObjSize = objSize;
+    fName = name ? name : "";
+
+    // kalloc only guarantees 16 bytes: alignas on Magazine isn't enough
+    // to keep each one on its own line
+    fMags = (Magazine*)IOMallocAligned(sizeof(Magazine) * kMagazines, alignof(Magazine));
+    fDepotLock = IOLockAlloc();
+    bool ok = fMags && fDepotLock;
+    if (fMags) bzero(fMags, sizeof(Magazine) * kMagazines);
+    for (uint32_t i = 0; ok && i < kMagazines; ++i) {
+        fMags[i].lock = IOSimpleLockAlloc();
+        ok = fMags[i].lock != nullptr;
+    }
+    if (!ok) destroy();
+    return ok;
+}
+
+void XESlabCache::destroy()
+{
+    if (fDepotLock) {
+        IOLockLock(fDepotLock);
+        for (uint32_t i = 0; i < kMagazines; ++i)
+            while (fMags[i].count)
+                putObject(fMags[i].objs[--fMags[i].count]);
+
+        // Everything back in the depot is on fPartial; whatever isn't
+        // there is still allocated, and its slab can't be freed safely
+        while (fPartial) {
+            Slab* s = fPartial;
+            unlinkPartial(s);
+            if (s->inUse == 0) {
+                IOFreeAligned(s, kSlabBytes);
+                --fSlabs;
+            }
+        }
+        IOLockUnlock(fDepotLock);
+
+        if (inUse() || fSlabs)
+            LOG("⚠️ %s: destroyed with %u objects in use, leaking %u slabs", fName, inUse(), fSlabs);
+
+        IOLockFree(fDepotLock);
+        fDepotLock = nullptr;
+    }
+
+    if (fMags) {
+        for (uint32_t i = 0; i < kMagazines; ++i)
+            if (fMags[i].lock) IOSimpleLockFree(fMags[i].lock);
+        IOFreeAligned(fMags, sizeof(Magazine) * kMagazines);
+        fMags = nullptr;
+    }
+
+    fPartial = nullptr;
+    fEmpty = 0;
+    fSlabs = 0;
+}
+
+uint32_t XESlabCache::inUse() const
+{
+    if (!fMags) return 0;
+
+    // An object freed through another magazine than it came from counts
+    // up on one and down on the other; only the sum means anything
+    int32_t n = 0;
+    for (uint32_t i = 0; i < kMagazines; ++i)
+        n += __atomic_load_n(&fMags[i].inUse, __ATOMIC_RELAXED);
+    return n > 0 ? (uint32_t)n : 0;
+}
+
+
+
+#pragma mark - Alloc / free
+
+XESlabCache::Magazine& XESlabCache::magazine()
+{
+    uint64_t t = (uint64_t)(uintptr_t)IOThreadSelf();
+    return fMags[(uint32_t)(((t >> 4) * 0x9E3779B97F4A7C15ULL) >> 32) % kMagazines];
+}
+
+// The fast paths hold the magazine's spin lock for one push or pop. The
+// counters are only written under it; the relaxed stores are for inUse().
+void* XESlabCache::alloc()
+{
+    if (!fDepotLock) return nullptr;
+
+    Magazine& m = magazine();
+    IOSimpleLockLock(m.lock);
+    void* obj = nullptr;
+    if (m.count) {
+        obj = m.objs[--m.count];
+        __atomic_store_n(&m.inUse, m.inUse + 1, __ATOMIC_RELAXED);
+    }
+    IOSimpleLockUnlock(m.lock);
+
+    if (!obj && !(obj = allocSlow(m))) return nullptr;
+    bzero(obj, fObjSize);
+    return obj;
+}
+
+void XESlabCache::free(void* obj)
+{
+    if (!obj) return;
+
+    Slab* s = (Slab*)((uintptr_t)obj & ~(uintptr_t)(kSlabBytes - 1));
+    if (s->cache != this) {
+        LOG("❌ %s: %p isn't ours", fName, obj);
+        return;
+    }
+
+    Magazine& m = magazine();
+    IOSimpleLockLock(m.lock);
+    bool room = m.count < kMagazineSize;
+    if (room) {
+        m.objs[m.count++] = obj;
+        __atomic_store_n(&m.inUse, m.inUse - 1, __ATOMIC_RELAXED);
+    }
+    IOSimpleLockUnlock(m.lock);
+
+    if (!room) freeSlow(m, obj);
+}
+
+// Half a magazine from the depot: one for the caller, the rest so the next
+// few allocs stay local. No spin lock is held while the depot may block.
+void* XESlabCache::allocSlow(Magazine& m)
+{
+    void* batch[kMagazineSize / 2];
+
+    IOLockLock(fDepotLock);
+    uint32_t n = take(batch, kMagazineSize / 2);
+    IOLockUnlock(fDepotLock);
+    if (n == 0) return nullptr;
+
+    // Others on this magazine may have refilled it meanwhile
+    IOSimpleLockLock(m.lock);
+    uint32_t keep = 1;
+    while (keep < n && m.count < kMagazineSize)
+        m.objs[m.count++] = batch[keep++];
+    __atomic_store_n(&m.inUse, m.inUse + 1, __ATOMIC_RELAXED);
+    IOSimpleLockUnlock(m.lock);
+
+    if (keep < n) {
+        IOLockLock(fDepotLock);
+        while (keep < n) putObject(batch[keep++]);
+        IOLockUnlock(fDepotLock);
+    }
+    return batch[0];
+}
+
+// Full: half the magazine, and obj, go back to the depot
+void XESlabCache::freeSlow(Magazine& m, void* obj)
+{
+    void* batch[kMagazineSize / 2 + 1];
+    uint32_t n = 0;
+
+    IOSimpleLockLock(m.lock);
+    while (m.count > kMagazineSize / 2)
+        batch[n++] = m.objs[--m.count];
+    __atomic_store_n(&m.inUse, m.inUse - 1, __ATOMIC_RELAXED);
+    IOSimpleLockUnlock(m.lock);
+    batch[n++] = obj;
+
+    IOLockLock(fDepotLock);
+    while (n) putObject(batch[--n]);
+    IOLockUnlock(fDepotLock);
+}
+
+
+
+#pragma mark - Depot
+
+// Up to n free objects off the partial slabs, allocating slabs as needed
+uint32_t XESlabCache::take(void** objs, uint32_t n)
+{
+    uint32_t got = 0;
+    while (got < n) {
+        Slab* s = fPartial;
+        if (!s && !(s = newSlab())) break;
+
+        void* obj = s->freeList;
+        s->freeList = *(void**)obj;
+        if (s->inUse++ == 0) --fEmpty;
+        if (!s->freeList) unlinkPartial(s);
+
+        objs[got++] = obj;
+    }
+    return got;
+}
+
+XESlabCache::Slab* XESlabCache::newSlab()
+{
+    Slab* s = (Slab*)IOMallocAligned(kSlabBytes, kSlabBytes);
+    if (!s) return nullptr;
+
+    uint32_t hdr = (sizeof(Slab) + SLAB_OBJ_ALIGN - 1) & ~(SLAB_OBJ_ALIGN - 1);
+    s->cache    = this;
+    s->prev     = nullptr;
+    s->inUse    = 0;
+    s->capacity = (kSlabBytes - hdr) / fObjSize;
+
+    // Thread the free list low to high, so a fresh slab hands out in order
+    uint8_t* base = (uint8_t*)s + hdr;
+    s->freeList = base;
+    for (uint32_t i = 0; i < s->capacity; ++i)
+        *(void**)(base + (size_t)i * fObjSize) = (i + 1 < s->capacity) ? base + (size_t)(i + 1) * fObjSize : nullptr;
+
+    s->next = fPartial;
+    if (fPartial) fPartial->prev = s;
+    fPartial = s;
+
+    ++fSlabs;
+    ++fEmpty;
+    return s;
+}
+
+void XESlabCache::putObject(void* obj)
+{
+    Slab* s = (Slab*)((uintptr_t)obj & ~(uintptr_t)(kSlabBytes - 1));
+
+    bool wasFull = s->freeList == nullptr;
+    *(void**)obj = s->freeList;
+    s->freeList = obj;
+
+    if (wasFull) {
+        s->prev = nullptr;
+        s->next = fPartial;
+        if (fPartial) fPartial->prev = s;
+        fPartial = s;
+    }
+
+    if (--s->inUse == 0) {
+        if (fEmpty == 0) {
+            ++fEmpty;
+        } else {
+            unlinkPartial(s);
+            IOFreeAligned(s, kSlabBytes);
+            --fSlabs;
+        }
+    }
+}
+
+void XESlabCache::unlinkPartial(Slab* s)
+{
+    if (s->prev) s->prev->next = s->next;
+    else         fPartial = s->next;
+    if (s->next) s->next->prev = s->prev;
+    s->prev = s->next = nullptr;
+}
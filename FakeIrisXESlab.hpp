@@ -0,0 +1,111 @@
+#ifndef FAKE_IRIS_XE_SLAB_HPP
+#define FAKE_IRIS_XE_SLAB_HPP
+
+#include <IOKit/IOLib.h>
+#include <IOKit/IOLocks.h>
+#include <stdint.h>
+
+/**
+ * @class XESlabCache
+ * @brief Fixed-size object cache for the driver's small, churny objects
+ * (contexts, surfaces, interrupt records), so creating and destroying them
+ * stays off the general kernel allocator.
+ *
+ * Objects are carved out of page-aligned slabs; the slab header sits at
+ * the start of the page, so free() finds it by masking. In front of the
+ * slabs sit magazines, small stacks of free objects that alloc() and
+ * free() work from, each under its own spin lock, held for a push or a
+ * pop and nothing else. Only when a magazine runs empty or full does it
+ * trade half its objects with the slab layer (the depot), under the
+ * depot lock, with the magazine's lock dropped.
+ *
+ * A kext can't pin itself to a CPU, so magazines are picked by hashing
+ * the calling thread instead of by CPU number: a thread keeps hitting
+ * the same magazine and threads spread across them, which is what the
+ * per-CPU layout is for.
+ *
+ * One entirely free slab is kept for the next refill; any more go
+ * back to the kernel.
+ *
+ * @note Thread-safe. Refills block (a mutex, allocation), so not for
+ * primary interrupt context.
+ */
+class XESlabCache {
+public:
+    static constexpr uint32_t kSlabBytes    = 4096;
+    static constexpr uint32_t kMagazines    = 8;
+    static constexpr uint32_t kMagazineSize = 16;
+
+    XESlabCache() = default;
+    ~XESlabCache() { destroy(); }
+
+    /**
+     * @brief Sets up an empty cache of objSize-byte objects. No memory
+     * is taken until the first alloc().
+     * @param name Used in log lines only.
+     */
+    bool init(uint32_t objSize, const char* name);
+
+    /**
+     * @brief Returns every slab to the kernel. Objects still allocated
+     * are reported and their slabs leaked.
+     */
+    void destroy();
+
+    /**
+     * @brief Returns a zeroed object, or null if out of memory.
+     */
+    void* alloc();
+
+    /**
+     * @brief Returns obj, which must have come from this cache, to it. Null is ignored.
+     */
+    void free(void* obj);
+
+    /**
+     * @brief Objects allocated and not yet freed. Exact only while no
+     * other thread is allocating or freeing.
+     */
+    uint32_t inUse() const;
+
+private:
+    struct Slab {
+        XESlabCache* cache;
+        Slab*        prev;     // on fPartial while it has free objects
+        Slab*        next;
+        void*        freeList; // objects link through their first word
+        uint32_t     inUse;
+        uint32_t     capacity;
+    };
+
+    // One per cache line, so threads on different magazines don't share
+    // one; fMags is IOMallocAligned for that.
+    struct alignas(64) Magazine {
+        IOSimpleLock* lock;
+        uint32_t count;
+        int32_t  inUse;        // allocs minus frees through this magazine
+        void*    objs[kMagazineSize];
+    };
+
+    Magazine& magazine();
+
+    // Magazine empty or full: trade with the depot
+    void* allocSlow(Magazine& m);
+    void  freeSlow(Magazine& m, void* obj);
+
+    // Depot, fDepotLock held
+    uint32_t take(void** objs, uint32_t n);
+    Slab* newSlab();
+    void  putObject(void* obj);
+    void  unlinkPartial(Slab* s);
+
+    Magazine*   fMags {nullptr};      // kMagazines of them
+    IOLock*     fDepotLock {nullptr};
+    Slab*       fPartial {nullptr};   // slabs with at least one free object
+    uint32_t    fEmpty {0};           // slabs on fPartial with nothing allocated
+    uint32_t    fObjSize {0};
+    uint32_t    fSlabs {0};
+    const char* fName {""};
+};
+
+#endif // FAKE_IRIS_XE_SLAB_HPP
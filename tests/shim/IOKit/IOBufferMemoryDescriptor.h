@@ -0,0 +1,43 @@
+#ifndef XE_SHIM_IOBUFFERMEMORYDESCRIPTOR_H
+#define XE_SHIM_IOBUFFERMEMORYDESCRIPTOR_H
+
+//
+// Host stand-in for <IOKit/IOBufferMemoryDescriptor.h>: heap memory that
+// reports its own virtual address as the physical one, so a test can
+// follow "physical" pointers the way the GPU would.
+//
+
+#include <IOKit/IOMemoryDescriptor.h>
+
+class IOBufferMemoryDescriptor : public IOMemoryDescriptor {
+public:
+    static IOBufferMemoryDescriptor* inTaskWithOptions(task_t task, IOOptionBits options,
+                                                       vm_size_t capacity, vm_offset_t alignment = 1)
+    {
+        if (alignment < sizeof(void*)) alignment = sizeof(void*);
+        void* p = IOMallocAligned(capacity, alignment);
+        if (!p) return nullptr;
+
+        IOBufferMemoryDescriptor* md = new IOBufferMemoryDescriptor;
+        md->init();
+        md->fBytes = p;
+        md->fCapacity = capacity;
+        md->setSegments({ { (uint64_t)(uintptr_t)p, capacity } });
+        return md;
+    }
+
+    void* getBytesNoCopy() { return fBytes; }
+
+protected:
+    void free() override
+    {
+        IOFreeAligned(fBytes, fCapacity);
+        IOMemoryDescriptor::free();
+    }
+
+private:
+    void*     fBytes {nullptr};
+    vm_size_t fCapacity {0};
+};
+
+#endif // XE_SHIM_IOBUFFERMEMORYDESCRIPTOR_H
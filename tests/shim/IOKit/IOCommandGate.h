@@ -0,0 +1,14 @@
+#ifndef XE_SHIM_IOCOMMANDGATE_H
+#define XE_SHIM_IOCOMMANDGATE_H
+
+//
+// Host stand-in for <IOKit/IOCommandGate.h>: the framebuffer header only
+// holds a pointer to one.
+//
+
+#include <IOKit/IOEventSource.h>
+
+class IOCommandGate : public IOEventSource {
+};
+
+#endif // XE_SHIM_IOCOMMANDGATE_H
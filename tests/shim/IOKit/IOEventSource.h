@@ -0,0 +1,41 @@
+#ifndef XE_SHIM_IOEVENTSOURCE_H
+#define XE_SHIM_IOEVENTSOURCE_H
+
+//
+// Host stand-in for <IOKit/IOEventSource.h>: a source that an IOWorkLoop
+// polls with checkForWork() while it holds the gate.
+//
+
+#include <libkern/c++/OSObject.h>
+
+class IOWorkLoop;
+
+class IOEventSource : public OSObject {
+public:
+    typedef void (*Action)(OSObject* owner, ...);
+
+    virtual void enable()  { __atomic_store_n(&fEnabled, true, __ATOMIC_RELEASE); }
+    virtual void disable() { __atomic_store_n(&fEnabled, false, __ATOMIC_RELEASE); }
+    bool isEnabled() const { return __atomic_load_n(&fEnabled, __ATOMIC_ACQUIRE); }
+
+protected:
+    friend class IOWorkLoop;
+
+    bool init(OSObject* owner, void* action)
+    {
+        if (!OSObject::init()) return false;
+        fOwner = owner;
+        fAction = action;
+        return true;
+    }
+
+    // Runs the action if there is work for it; called with the gate held
+    virtual void checkForWork() {}
+
+    OSObject*   fOwner {nullptr};
+    void*       fAction {nullptr};
+    IOWorkLoop* fWorkLoop {nullptr};
+    bool        fEnabled {false};
+};
+
+#endif // XE_SHIM_IOEVENTSOURCE_H
@@ -0,0 +1,43 @@
+#ifndef XE_SHIM_IOINTERRUPTEVENTSOURCE_H
+#define XE_SHIM_IOINTERRUPTEVENTSOURCE_H
+
+//
+// Host stand-in for <IOKit/IOInterruptEventSource.h>: interruptOccurred()
+// counts and signals the workloop, which calls the action with the count.
+//
+
+#include <IOKit/IOWorkLoop.h>
+
+class IOService;
+
+class IOInterruptEventSource : public IOEventSource {
+public:
+    typedef void (*Action)(OSObject* owner, IOInterruptEventSource* sender, int count);
+
+    static IOInterruptEventSource* interruptEventSource(OSObject* owner, Action action,
+                                                        IOService* provider = nullptr, int intIndex = 0)
+    {
+        IOInterruptEventSource* s = new IOInterruptEventSource;
+        s->init(owner, (void*)action);
+        return s;
+    }
+
+    void interruptOccurred(void* refcon, IOService* nub, int source)
+    {
+        __atomic_add_fetch(&fCount, 1, __ATOMIC_RELEASE);
+        if (IOWorkLoop* wl = __atomic_load_n(&fWorkLoop, __ATOMIC_ACQUIRE))
+            wl->signalWorkAvailable();
+    }
+
+protected:
+    void checkForWork() override
+    {
+        int n = __atomic_exchange_n(&fCount, 0, __ATOMIC_ACQUIRE);
+        if (n) ((Action)fAction)(fOwner, this, n);
+    }
+
+private:
+    int fCount {0};
+};
+
+#endif // XE_SHIM_IOINTERRUPTEVENTSOURCE_H
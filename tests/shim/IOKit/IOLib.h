@@ -0,0 +1,92 @@
+#ifndef XE_SHIM_IOLIB_H
+#define XE_SHIM_IOLIB_H
+
+//
+// Host stand-in for <IOKit/IOLib.h>: just what the kext sources under
+// test use, on top of libc.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <IOKit/IOLocks.h>     // as the real IOLib.h does
+
+typedef int      IOReturn;
+typedef uint64_t IOByteCount;
+typedef uint64_t IOPhysicalAddress;
+typedef uint64_t IOVirtualAddress;
+typedef uint32_t IOItemCount;
+
+// <libkern/OSTypes.h>
+typedef uint8_t  UInt8;
+typedef uint16_t UInt16;
+typedef uint32_t UInt32;
+typedef uint64_t UInt64;
+typedef int32_t  SInt32;
+
+typedef int       kern_return_t;
+typedef uint64_t  mach_vm_address_t;
+static constexpr kern_return_t KERN_SUCCESS = 0;
+static constexpr kern_return_t KERN_FAILURE = 5;
+
+static constexpr IOReturn kIOReturnSuccess         = 0;
+static constexpr IOReturn kIOReturnError           = (IOReturn)0xe00002bc;
+static constexpr IOReturn kIOReturnNoMemory        = (IOReturn)0xe00002bd;
+static constexpr IOReturn kIOReturnNoResources     = (IOReturn)0xe00002be;
+static constexpr IOReturn kIOReturnBadArgument     = (IOReturn)0xe00002c2;
+static constexpr IOReturn kIOReturnUnsupported     = (IOReturn)0xe00002c7;
+static constexpr IOReturn kIOReturnVMError         = (IOReturn)0xe00002c8;
+static constexpr IOReturn kIOReturnBusy            = (IOReturn)0xe00002d5;
+static constexpr IOReturn kIOReturnNotReady        = (IOReturn)0xe00002d8;
+static constexpr IOReturn kIOReturnNoSpace         = (IOReturn)0xe00002db;
+static constexpr IOReturn kIOReturnMessageTooLarge = (IOReturn)0xe00002e1;
+static constexpr IOReturn kIOReturnNotFound        = (IOReturn)0xe00002f0;
+
+#ifndef MIN
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+static inline void* IOMalloc(size_t size)         { return malloc(size); }
+static inline void* IOMallocZero(size_t size)     { return calloc(1, size); }
+static inline void  IOFree(void* p, size_t size)  { free(p); }
+
+// Bytes currently held through IOMallocAligned, for footprint numbers
+inline size_t xe_shim_aligned_bytes = 0;
+
+static inline void* IOMallocAligned(size_t size, size_t align)
+{
+    void* p = aligned_alloc(align, (size + align - 1) & ~(align - 1));
+    if (p) __atomic_add_fetch(&xe_shim_aligned_bytes, size, __ATOMIC_RELAXED);
+    return p;
+}
+
+static inline void IOFreeAligned(void* p, size_t size)
+{
+    if (!p) return;
+    __atomic_sub_fetch(&xe_shim_aligned_bytes, size, __ATOMIC_RELAXED);
+    free(p);
+}
+
+static inline void IOSleep(unsigned ms)     { usleep(ms * 1000); }
+static inline void IODelay(unsigned us)     { usleep(us); }
+
+// <mach/vm_param.h>
+#define trunc_page_64(x) ((uint64_t)(x) & ~4095ull)
+#define round_page_64(x) (((uint64_t)(x) + 4095) & ~4095ull)
+
+typedef pthread_t IOThread;
+static inline IOThread IOThreadSelf() { return pthread_self(); }
+
+// Quiet unless XE_TEST_VERBOSE is set: the tests drive failure paths on purpose
+#define IOLog(...) do { if (getenv("XE_TEST_VERBOSE")) fprintf(stderr, __VA_ARGS__); } while (0)
+
+#endif // XE_SHIM_IOLIB_H
@@ -0,0 +1,54 @@
+#ifndef XE_SHIM_IOLOCKS_H
+#define XE_SHIM_IOLOCKS_H
+
+//
+// Host stand-in for <IOKit/IOLocks.h>: IOLock on a pthread mutex,
+// IOSimpleLock a test-and-set spin lock. The kernel's disables preemption
+// while held; a host thread can be preempted holding one, so waiters
+// yield instead of burning the holder's time slice.
+//
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+
+typedef pthread_mutex_t IOLock;
+
+static inline IOLock* IOLockAlloc()
+{
+    IOLock* l = (IOLock*)malloc(sizeof(IOLock));
+    if (l) pthread_mutex_init(l, nullptr);
+    return l;
+}
+
+static inline void IOLockFree(IOLock* l)
+{
+    pthread_mutex_destroy(l);
+    free(l);
+}
+
+static inline void IOLockLock(IOLock* l)    { pthread_mutex_lock(l); }
+static inline void IOLockUnlock(IOLock* l)  { pthread_mutex_unlock(l); }
+static inline bool IOLockTryLock(IOLock* l) { return pthread_mutex_trylock(l) == 0; }
+
+typedef struct { bool held; } IOSimpleLock;
+
+static inline IOSimpleLock* IOSimpleLockAlloc() { return (IOSimpleLock*)calloc(1, sizeof(IOSimpleLock)); }
+static inline void IOSimpleLockFree(IOSimpleLock* l) { free(l); }
+
+static inline bool IOSimpleLockTryLock(IOSimpleLock* l)
+{
+    return !__atomic_exchange_n(&l->held, true, __ATOMIC_ACQUIRE);
+}
+
+static inline void IOSimpleLockLock(IOSimpleLock* l)
+{
+    for (int spins = 0; !IOSimpleLockTryLock(l); ++spins) {
+        while (__atomic_load_n(&l->held, __ATOMIC_RELAXED))
+            if (++spins > 64) sched_yield();
+    }
+}
+
+static inline void IOSimpleLockUnlock(IOSimpleLock* l) { __atomic_store_n(&l->held, false, __ATOMIC_RELEASE); }
+
+#endif // XE_SHIM_IOLOCKS_H
@@ -0,0 +1,160 @@
+#ifndef XE_SHIM_IOMEMORYDESCRIPTOR_H
+#define XE_SHIM_IOMEMORYDESCRIPTOR_H
+
+//
+// Host stand-in for <IOKit/IOMemoryDescriptor.h>. A descriptor is a list
+// of physical segments; tests build them with xe_shim_md(). Mapping one
+// that covers "physical" host memory (withPhysicalAddress()) gives it
+// back at the same address, the convention IOBufferMemoryDescriptor's
+// shim follows too.
+//
+
+#include <IOKit/IOLib.h>
+#include <libkern/c++/OSObject.h>
+#include <algorithm>
+#include <vector>
+
+typedef uint32_t IOOptionBits;
+
+typedef void*     task_t;
+typedef uintptr_t vm_size_t;
+typedef uintptr_t vm_offset_t;
+
+// Host memory is every task's memory
+inline task_t kernel_task = nullptr;
+
+enum {
+    kIODirectionNone  = 0,
+    kIODirectionIn    = 1,
+    kIODirectionOut   = 2,
+    kIODirectionInOut = kIODirectionIn | kIODirectionOut,
+};
+
+enum {
+    kIOMapDefaultCache      = 0x0000,
+    kIOMapInhibitCache      = 0x0100,
+    kIOMapWriteThruCache    = 0x0200,
+    kIOMapCopybackCache     = 0x0300,
+    kIOMapWriteCombineCache = 0x0400,
+    kIOMapAnywhere          = 0x0001,
+};
+
+enum {
+    kIOMemoryKernelUserShared = 0x00000200,
+};
+
+class IOMemoryMap;
+
+struct XEShimSegment {
+    uint64_t phys;
+    uint64_t len;
+};
+
+class IOMemoryDescriptor : public OSObject {
+public:
+    IOByteCount getLength() const { return fLength; }
+
+    /**
+     * The segment containing offset, from offset on. Segments are reported
+     * as listed, even when physically adjacent.
+     */
+    virtual IOPhysicalAddress getPhysicalSegment(IOByteCount offset, IOByteCount* length,
+                                                 IOOptionBits options = 0)
+    {
+        // fEnds[i] is the offset just past segment i
+        auto it = std::upper_bound(fEnds.begin(), fEnds.end(), offset);
+        if (it == fEnds.end()) {
+            if (length) *length = 0;
+            return 0;
+        }
+        size_t i = it - fEnds.begin();
+        uint64_t into = offset - (*it - fSegs[i].len);
+        if (length) *length = fSegs[i].len - into;
+        return fSegs[i].phys + into;
+    }
+
+    static IOMemoryDescriptor* withPhysicalAddress(IOPhysicalAddress address, IOByteCount length,
+                                                   IOOptionBits direction)
+    {
+        IOMemoryDescriptor* md = new IOMemoryDescriptor;
+        md->init();
+        md->setSegments({ { address, length } });
+        return md;
+    }
+
+    // A task's range is host memory, so its "physical" address is its own
+    static IOMemoryDescriptor* withAddressRange(mach_vm_address_t address, IOByteCount length,
+                                                IOOptionBits options, task_t task)
+    {
+        return withPhysicalAddress(address, length, options);
+    }
+
+    IOPhysicalAddress getPhysicalAddress() { return fSegs.empty() ? 0 : fSegs[0].phys; }
+
+    // The first segment, at its own address; defined below
+    IOMemoryMap* map(IOOptionBits options = 0);
+
+    IOMemoryMap* createMappingInTask(task_t task, mach_vm_address_t atAddress, IOOptionBits options)
+    {
+        return map(options);
+    }
+
+    IOReturn prepare(IOOptionBits direction = 0)  { return kIOReturnSuccess; }
+    IOReturn complete(IOOptionBits direction = 0) { return kIOReturnSuccess; }
+
+    void setSegments(const std::vector<XEShimSegment>& segs)
+    {
+        fSegs = segs;
+        fEnds.clear();
+        fLength = 0;
+        for (const XEShimSegment& s : segs) fEnds.push_back(fLength += s.len);
+    }
+
+protected:
+    std::vector<XEShimSegment> fSegs;
+    std::vector<uint64_t>      fEnds;
+    IOByteCount                fLength {0};
+};
+
+class IOMemoryMap : public OSObject {
+public:
+    IOVirtualAddress  getVirtualAddress()  { return fAddress; }
+    IOPhysicalAddress getPhysicalAddress() { return fAddress; }
+    IOByteCount       getLength()          { return fLength; }
+
+private:
+    friend class IOMemoryDescriptor;
+
+    void free() override
+    {
+        OSSafeReleaseNULL(fMemory);
+        OSObject::free();
+    }
+
+    IOMemoryDescriptor* fMemory {nullptr};   // retained, as the real map does
+    uint64_t            fAddress {0};
+    IOByteCount         fLength {0};
+};
+
+inline IOMemoryMap* IOMemoryDescriptor::map(IOOptionBits options)
+{
+    if (fSegs.empty()) return nullptr;
+
+    IOMemoryMap* m = new IOMemoryMap;
+    m->init();
+    retain();
+    m->fMemory = this;
+    m->fAddress = fSegs[0].phys;
+    m->fLength = fSegs[0].len;
+    return m;
+}
+
+static inline IOMemoryDescriptor* xe_shim_md(const std::vector<XEShimSegment>& segs)
+{
+    IOMemoryDescriptor* md = new IOMemoryDescriptor;
+    md->init();
+    md->setSegments(segs);
+    return md;
+}
+
+#endif // XE_SHIM_IOMEMORYDESCRIPTOR_H
@@ -0,0 +1,62 @@
+#ifndef XE_SHIM_IOSERVICE_H
+#define XE_SHIM_IOSERVICE_H
+
+//
+// Host stand-in for <IOKit/IOService.h>. No registry and no matching: a
+// test makes the objects and calls init()/start()/stop() itself. The
+// virtuals are the ones the kext's services override.
+//
+
+#include <IOKit/IOLib.h>
+#include <IOKit/IOMemoryDescriptor.h>
+#include <IOKit/IOWorkLoop.h>
+#include <libkern/c++/OSObject.h>
+
+class IOUserClient;
+
+class IOService : public OSObject {
+public:
+    virtual bool init(OSDictionary* dictionary = nullptr) { return OSObject::init(); }
+    virtual IOService* probe(IOService* provider, SInt32* score) { return this; }
+    virtual bool start(IOService* provider) { return true; }
+    virtual void stop(IOService* provider) {}
+    virtual void close(IOService* client, IOOptionBits options = 0) {}
+
+    // Each service has its own, as if its provider had handed one out;
+    // not retained for the caller
+    virtual IOWorkLoop* getWorkLoop() const
+    {
+        if (!fWorkLoop) fWorkLoop = IOWorkLoop::workLoop();
+        return fWorkLoop;
+    }
+
+    virtual IOReturn setPowerState(unsigned long powerStateOrdinal, IOService* whatDevice)
+    {
+        return kIOReturnSuccess;
+    }
+
+    virtual IOReturn setProperties(OSObject* properties) { return kIOReturnUnsupported; }
+
+    virtual IOReturn newUserClient(task_t owningTask, void* securityID, UInt32 type,
+                                   OSDictionary* properties, IOUserClient** handler)
+    {
+        return kIOReturnUnsupported;
+    }
+
+    bool setProperty(const char* key, bool value)        { return true; }
+    bool setProperty(const char* key, const char* value) { return true; }
+
+    void registerService(IOOptionBits options = 0) {}
+
+protected:
+    void free() override
+    {
+        OSSafeReleaseNULL(fWorkLoop);
+        OSObject::free();
+    }
+
+private:
+    mutable IOWorkLoop* fWorkLoop {nullptr};
+};
+
+#endif // XE_SHIM_IOSERVICE_H
@@ -0,0 +1,32 @@
+#ifndef XE_SHIM_IOTIMEREVENTSOURCE_H
+#define XE_SHIM_IOTIMEREVENTSOURCE_H
+
+//
+// Host stand-in for <IOKit/IOTimerEventSource.h>. Timeouts are recorded
+// but never fire: the tests drive everything through doorbells, and a
+// timer going off between two checks would only make them flaky.
+//
+
+#include <IOKit/IOWorkLoop.h>
+
+class IOTimerEventSource : public IOEventSource {
+public:
+    typedef void (*Action)(OSObject* owner, IOTimerEventSource* sender);
+
+    static IOTimerEventSource* timerEventSource(OSObject* owner, Action action)
+    {
+        IOTimerEventSource* s = new IOTimerEventSource;
+        s->init(owner, (void*)action);
+        s->enable();
+        return s;
+    }
+
+    IOReturn setTimeoutMS(uint32_t ms) { fTimeoutUS = (uint64_t)ms * 1000; return kIOReturnSuccess; }
+    IOReturn setTimeoutUS(uint32_t us) { fTimeoutUS = us; return kIOReturnSuccess; }
+    void cancelTimeout() { fTimeoutUS = 0; }
+
+private:
+    uint64_t fTimeoutUS {0};
+};
+
+#endif // XE_SHIM_IOTIMEREVENTSOURCE_H
@@ -0,0 +1,50 @@
+#ifndef XE_SHIM_IOUSERCLIENT_H
+#define XE_SHIM_IOUSERCLIENT_H
+
+//
+// Host stand-in for <IOKit/IOUserClient.h>. A test plays the client
+// process: it calls externalMethod() with the arguments IOConnectCall*
+// would have built, and clientMemoryForType() where it would map.
+//
+
+#include <IOKit/IOService.h>
+#include <IOKit/IOBufferMemoryDescriptor.h>
+
+// The fields the kext reads; the real one also carries async and
+// descriptor arguments
+struct IOExternalMethodArguments {
+    const uint64_t* scalarInput;
+    uint32_t        scalarInputCount;
+    const void*     structureInput;
+    uint32_t        structureInputSize;
+
+    uint64_t*       scalarOutput;
+    uint32_t        scalarOutputCount;
+    void*           structureOutput;
+    uint32_t        structureOutputSize;
+};
+
+struct IOExternalMethodDispatch;
+
+class IOUserClient : public IOService {
+public:
+    virtual bool initWithTask(task_t owningTask, void* securityID, UInt32 type)
+    {
+        return IOService::init();
+    }
+
+    virtual IOReturn clientClose() { return kIOReturnUnsupported; }
+
+    virtual IOReturn externalMethod(uint32_t selector, IOExternalMethodArguments* args,
+                                    IOExternalMethodDispatch* dispatch, OSObject* target, void* reference)
+    {
+        return kIOReturnUnsupported;
+    }
+
+    virtual IOReturn clientMemoryForType(UInt32 type, IOOptionBits* options, IOMemoryDescriptor** memory)
+    {
+        return kIOReturnUnsupported;
+    }
+};
+
+#endif // XE_SHIM_IOUSERCLIENT_H
@@ -0,0 +1,128 @@
+#ifndef XE_SHIM_IOWORKLOOP_H
+#define XE_SHIM_IOWORKLOOP_H
+
+//
+// Host stand-in for <IOKit/IOWorkLoop.h>. There is no workloop thread:
+// signalled work runs on the signalling thread, as soon as it can take
+// the gate. One thread at a time holds the gate, as on the real
+// workloop; work signalled from inside it, or while another thread
+// holds it, is picked up before the holder lets go. So a submit that
+// rings a doorbell returns with the ring drained, unless a drain on
+// another thread took it over.
+//
+
+#include <IOKit/IOEventSource.h>
+#include <vector>
+
+class IOWorkLoop : public OSObject {
+public:
+    typedef IOReturn (*Action)(OSObject* target, void* arg0, void* arg1, void* arg2, void* arg3);
+
+    static IOWorkLoop* workLoop()
+    {
+        IOWorkLoop* wl = new IOWorkLoop;
+        wl->init();
+        return wl;
+    }
+
+    IOReturn addEventSource(IOEventSource* source)
+    {
+        closeGate();
+        source->retain();
+        source->fWorkLoop = this;
+        fSources.push_back(source);
+        openGate();
+        return kIOReturnSuccess;
+    }
+
+    IOReturn removeEventSource(IOEventSource* source)
+    {
+        closeGate();
+        for (size_t i = 0; i < fSources.size(); ++i) {
+            if (fSources[i] != source) continue;
+            fSources.erase(fSources.begin() + i);
+            source->fWorkLoop = nullptr;
+            source->release();
+            break;
+        }
+        openGate();
+        return kIOReturnSuccess;
+    }
+
+    IOReturn runAction(Action action, OSObject* target, void* arg0 = nullptr, void* arg1 = nullptr,
+                       void* arg2 = nullptr, void* arg3 = nullptr)
+    {
+        if (inGate()) return action(target, arg0, arg1, arg2, arg3);
+        closeGate();
+        IOReturn ret = action(target, arg0, arg1, arg2, arg3);
+        openGate();
+        return ret;
+    }
+
+    bool inGate() const { return tHolder == this; }
+
+    void closeGate()
+    {
+        if (inGate()) { ++fDepth; return; }
+        pthread_mutex_lock(&fGate);
+        tHolder = this;
+    }
+
+    void openGate()
+    {
+        if (fDepth) { --fDepth; return; }
+        runSources();
+        tHolder = nullptr;
+        pthread_mutex_unlock(&fGate);
+        drain();
+    }
+
+    void signalWorkAvailable()
+    {
+        __atomic_store_n(&fPending, true, __ATOMIC_SEQ_CST);
+        if (!inGate()) drain();
+    }
+
+private:
+    bool init() override
+    {
+        pthread_mutex_init(&fGate, nullptr);
+        return OSObject::init();
+    }
+
+    void free() override
+    {
+        for (IOEventSource* s : fSources) s->release();
+        pthread_mutex_destroy(&fGate);
+        OSObject::free();
+    }
+
+    // With the gate held: until no source has anything left
+    void runSources()
+    {
+        while (__atomic_exchange_n(&fPending, false, __ATOMIC_SEQ_CST))
+            for (size_t i = 0; i < fSources.size(); ++i)
+                if (fSources[i]->isEnabled()) fSources[i]->checkForWork();
+    }
+
+    // Work signalled while another thread held the gate: that thread
+    // saw it, unless it let go in between, in which case it's ours
+    void drain()
+    {
+        while (__atomic_load_n(&fPending, __ATOMIC_SEQ_CST) && pthread_mutex_trylock(&fGate) == 0) {
+            tHolder = this;
+            runSources();
+            tHolder = nullptr;
+            pthread_mutex_unlock(&fGate);
+        }
+    }
+
+    static inline thread_local const IOWorkLoop* tHolder = nullptr;
+
+    pthread_mutex_t             fGate;
+    uint32_t                    fDepth {0};
+    bool                        fPending {false};
+    std::vector<IOEventSource*> fSources;
+};
+
+#endif // XE_SHIM_IOWORKLOOP_H
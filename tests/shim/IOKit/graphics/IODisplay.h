@@ -0,0 +1,10 @@
+#ifndef XE_SHIM_IODISPLAY_H
+#define XE_SHIM_IODISPLAY_H
+
+//
+// Host stand-in for <IOKit/graphics/IODisplay.h>; nothing the tests reach.
+//
+
+#include <IOKit/graphics/IOGraphicsTypes.h>
+
+#endif // XE_SHIM_IODISPLAY_H
@@ -0,0 +1,53 @@
+#ifndef XE_SHIM_IOFRAMEBUFFER_H
+#define XE_SHIM_IOFRAMEBUFFER_H
+
+//
+// Host stand-in for <IOKit/graphics/IOFramebuffer.h>. Declares the
+// virtuals FakeIrisXEFramebuffer overrides so its header compiles; the
+// tests reach the framebuffer only through the non-virtual calls the
+// accelerator makes, which they define themselves.
+//
+
+#include <IOKit/IOService.h>
+#include <IOKit/IOBufferMemoryDescriptor.h>
+#include <IOKit/graphics/IOGraphicsTypes.h>
+
+class IOInterruptEventSource;
+class IOTimerEventSource;
+class IOWorkLoop;
+
+typedef IOMemoryDescriptor IODeviceMemory;
+
+struct IOPMPowerState;
+
+class IOFramebuffer : public IOService {
+public:
+    virtual const char* getPixelFormats() = 0;
+    virtual UInt64 getPixelFormatsForDisplayMode(IODisplayModeID displayMode, IOIndex depth) = 0;
+    virtual IOReturn setDisplayMode(IODisplayModeID displayMode, IOIndex depth) = 0;
+    virtual UInt32 getConnectionCount() = 0;
+    virtual IOReturn getStartupDisplayMode(IODisplayModeID* displayMode, IOIndex* depth) = 0;
+    virtual IOReturn getAttributeForConnection(IOIndex connectIndex, IOSelect attribute, uintptr_t* value) = 0;
+    virtual IOReturn setAttributeForConnection(IOIndex connectIndex, IOSelect attribute, uintptr_t value) = 0;
+    virtual IODeviceMemory* getVRAMRange() = 0;
+    virtual IODeviceMemory* getApertureRange(IOPixelAperture aperture) = 0;
+    virtual IOReturn getDisplayModes(IODisplayModeID* allDisplayModes) = 0;
+    virtual IOItemCount getDisplayModeCount() = 0;
+    virtual IOReturn getInformationForDisplayMode(IODisplayModeID mode, IODisplayModeInformation* info) = 0;
+    virtual IOReturn enableController() = 0;
+    virtual IOReturn getPixelInformation(IODisplayModeID displayMode, IOIndex depth,
+                                         IOPixelAperture aperture, IOPixelInformation* info) = 0;
+    virtual IOReturn getCurrentDisplayMode(IODisplayModeID* displayMode, IOIndex* depth) = 0;
+    virtual IOReturn getAttribute(IOSelect attribute, uintptr_t* value) = 0;
+    virtual IOReturn setAttribute(IOSelect attribute, uintptr_t value) = 0;
+    virtual IOReturn unregisterInterrupt(void* interruptRef) = 0;
+    virtual IOReturn setInterruptState(void* interruptRef, UInt32 state) = 0;
+    virtual IOReturn setCursorImage(void* cursorImage) = 0;
+    virtual IOReturn setCursorState(SInt32 x, SInt32 y, bool visible) = 0;
+    virtual IOReturn getTimingInfoForDisplayMode(IODisplayModeID mode, IOTimingInformation* info) = 0;
+    virtual IOReturn setCLUTWithEntries(IOColorEntry* colors, UInt32 firstIndex, UInt32 numEntries,
+                                        IOOptionBits options) = 0;
+    virtual IOReturn setGammaTable(UInt32 channelCount, UInt32 dataCount, UInt32 dataWidth, void* data) = 0;
+};
+
+#endif // XE_SHIM_IOFRAMEBUFFER_H
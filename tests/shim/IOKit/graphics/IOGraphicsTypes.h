@@ -0,0 +1,27 @@
+#ifndef XE_SHIM_IOGRAPHICSTYPES_H
+#define XE_SHIM_IOGRAPHICSTYPES_H
+
+//
+// Host stand-in for <IOKit/graphics/IOGraphicsTypes.h>: the types the
+// framebuffer's declarations name. Tests never build a framebuffer, so
+// the structs are only declared.
+//
+
+#include <IOKit/IOLib.h>
+
+typedef int32_t  IOIndex;
+typedef uint32_t IOSelect;
+typedef int32_t  IODisplayModeID;
+typedef int32_t  IOPixelAperture;
+typedef uint32_t mach_port_t;
+
+typedef void (*IOFBInterruptProc)(void* target, void* ref);
+
+struct IOColorEntry;
+struct IODisplayModeInformation;
+struct IOPixelInformation;
+struct IOTimingInformation;
+struct IOGBounds;
+struct IOGPoint;
+
+#endif // XE_SHIM_IOGRAPHICSTYPES_H
@@ -0,0 +1,14 @@
+#ifndef XE_SHIM_IOPCIDEVICE_H
+#define XE_SHIM_IOPCIDEVICE_H
+
+//
+// Host stand-in for <IOKit/pci/IOPCIDevice.h>: only passed around, the
+// code under test reaches the device through an IOMemoryMap of its BAR.
+//
+
+#include <IOKit/IOMemoryDescriptor.h>
+
+class IOPCIDevice : public OSObject {
+};
+
+#endif // XE_SHIM_IOPCIDEVICE_H
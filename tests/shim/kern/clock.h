@@ -0,0 +1,46 @@
+#ifndef XE_SHIM_CLOCK_H
+#define XE_SHIM_CLOCK_H
+
+//
+// Host stand-in for <kern/clock.h>: absolute time is CLOCK_MONOTONIC in
+// nanoseconds, times xe_shim_time_scale. A test raises the scale to make
+// every interval the code asks for that many times shorter, e.g. a
+// drain's per-tick budget; change it only while nothing is waiting on a
+// deadline.
+//
+
+#include <stdint.h>
+#include <time.h>
+
+inline uint32_t xe_shim_time_scale = 1;
+
+enum {
+    kNanosecondScale  = 1,
+    kMicrosecondScale = 1000,
+    kMillisecondScale = 1000 * 1000,
+    kSecondScale      = 1000 * 1000 * 1000,
+};
+
+static inline uint64_t mach_absolute_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec) * xe_shim_time_scale;
+}
+
+static inline void clock_interval_to_deadline(uint32_t interval, uint32_t scaleFactor, uint64_t* result)
+{
+    *result = mach_absolute_time() + (uint64_t)interval * scaleFactor;
+}
+
+static inline void absolutetime_to_nanoseconds(uint64_t abstime, uint64_t* result)
+{
+    *result = abstime / xe_shim_time_scale;
+}
+
+static inline void nanoseconds_to_absolutetime(uint64_t nanosecs, uint64_t* result)
+{
+    *result = nanosecs * xe_shim_time_scale;
+}
+
+#endif // XE_SHIM_CLOCK_H
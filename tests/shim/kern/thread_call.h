@@ -0,0 +1,71 @@
+#ifndef XE_SHIM_THREAD_CALL_H
+#define XE_SHIM_THREAD_CALL_H
+
+//
+// Host stand-in for <kern/thread_call.h>: each enter runs the call on a
+// thread of its own. thread_call_cancel_wait() waits for it to return.
+//
+
+#include <pthread.h>
+#include <stdlib.h>
+
+typedef void* thread_call_param_t;
+typedef void (*thread_call_func_t)(thread_call_param_t param0, thread_call_param_t param1);
+
+typedef enum {
+    THREAD_CALL_PRIORITY_HIGH   = 0,
+    THREAD_CALL_PRIORITY_KERNEL = 1,
+    THREAD_CALL_PRIORITY_USER   = 2,
+    THREAD_CALL_PRIORITY_LOW    = 3,
+} thread_call_priority_t;
+
+struct xe_shim_thread_call {
+    thread_call_func_t  func;
+    thread_call_param_t param0;
+    pthread_t           thread;
+    bool                running;
+};
+typedef xe_shim_thread_call* thread_call_t;
+
+static inline thread_call_t thread_call_allocate_with_priority(thread_call_func_t func, thread_call_param_t param0,
+                                                               thread_call_priority_t priority)
+{
+    thread_call_t call = (thread_call_t)calloc(1, sizeof(*call));
+    if (call) {
+        call->func = func;
+        call->param0 = param0;
+    }
+    return call;
+}
+
+static inline void* xe_shim_thread_call_entry(void* arg)
+{
+    thread_call_t call = (thread_call_t)arg;
+    call->func(call->param0, nullptr);
+    return nullptr;
+}
+
+static inline bool thread_call_cancel_wait(thread_call_t call)
+{
+    if (call->running) pthread_join(call->thread, nullptr);
+    call->running = false;
+    return false;
+}
+
+// The kext never enters a call that may still be running
+static inline bool thread_call_enter(thread_call_t call)
+{
+    thread_call_cancel_wait(call);
+    call->running = pthread_create(&call->thread, nullptr, xe_shim_thread_call_entry, call) == 0;
+    if (!call->running) call->func(call->param0, nullptr);
+    return false;
+}
+
+static inline bool thread_call_free(thread_call_t call)
+{
+    thread_call_cancel_wait(call);
+    free(call);
+    return true;
+}
+
+#endif // XE_SHIM_THREAD_CALL_H
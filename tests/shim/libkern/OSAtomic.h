@@ -0,0 +1,15 @@
+#ifndef XE_SHIM_OSATOMIC_H
+#define XE_SHIM_OSATOMIC_H
+
+//
+// Host stand-in for <libkern/OSAtomic.h>.
+//
+
+#include <stdint.h>
+
+static inline bool OSCompareAndSwap(uint32_t oldValue, uint32_t newValue, volatile uint32_t* address)
+{
+    return __atomic_compare_exchange_n(address, &oldValue, newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+#endif // XE_SHIM_OSATOMIC_H
@@ -0,0 +1,85 @@
+#ifndef XE_SHIM_OSOBJECT_H
+#define XE_SHIM_OSOBJECT_H
+
+//
+// Host stand-in for <libkern/c++/OSObject.h>: reference counting and the
+// init()/free() lifecycle, no metaclasses. The structors macros only
+// supply what the kext classes' factories call, and a tag per class for
+// OSDynamicCast(). That matches the exact class only, which is all the
+// kext's casts need, and needs no RTTI for classes whose vtables live
+// in sources the tests don't build.
+//
+
+#include <IOKit/IOLib.h>
+#include <string.h>
+
+class OSDictionary;
+
+// Objects alive right now, to catch leaks and double frees
+inline int xe_shim_live_objects = 0;
+
+class OSObject {
+public:
+    virtual bool init()
+    {
+        fRefs = 1;
+        ++xe_shim_live_objects;
+        return true;
+    }
+
+    void retain() const { __atomic_add_fetch(&fRefs, 1, __ATOMIC_RELAXED); }
+
+    void release() const
+    {
+        if (__atomic_sub_fetch(&fRefs, 1, __ATOMIC_ACQ_REL) == 0)
+            const_cast<OSObject*>(this)->free();
+    }
+
+    int getRetainCount() const { return __atomic_load_n(&fRefs, __ATOMIC_RELAXED); }
+
+    virtual const void* xeShimClass() const { return nullptr; }
+
+protected:
+    OSObject() = default;
+    virtual ~OSObject() = default;
+
+    virtual void free()
+    {
+        --xe_shim_live_objects;
+        delete this;
+    }
+
+private:
+    mutable int fRefs {0};
+};
+
+#define OSDeclareDefaultStructors(className)                \
+    public:                                                 \
+        className() = default;                              \
+        static inline const char xeShimTag = 0;             \
+        const void* xeShimClass() const override { return &xeShimTag; } \
+    protected:                                              \
+        virtual ~className() = default;                     \
+    private:
+
+#define OSDefineMetaClassAndStructors(className, superName)
+
+#define OSDynamicCast(type, inst) \
+    ((inst) && (inst)->xeShimClass() == &type::xeShimTag ? static_cast<type*>(inst) : nullptr)
+
+// The kext only casts non-virtual members, whose pointer is the function
+// itself (Itanium C++ ABI); the object goes in as the first argument.
+template <typename F, typename M>
+static inline F xe_shim_member_cast(M member)
+{
+    struct { uintptr_t ptr, adj; } pmf;
+    static_assert(sizeof(member) == sizeof(pmf), "not a member function pointer");
+    memcpy(&pmf, &member, sizeof(pmf));
+    return (F)pmf.ptr;
+}
+
+#define OSMemberFunctionCast(cptrtype, self, func) xe_shim_member_cast<cptrtype>(func)
+
+#define OSSafeReleaseNULL(obj) do { if (obj) { (obj)->release(); (obj) = nullptr; } } while (0)
+
+#endif // XE_SHIM_OSOBJECT_H
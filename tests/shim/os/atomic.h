@@ -0,0 +1,9 @@
+#ifndef XE_SHIM_OS_ATOMIC_H
+#define XE_SHIM_OS_ATOMIC_H
+
+//
+// Host stand-in for <os/atomic.h>: the kext uses the compiler's
+// __atomic builtins directly.
+//
+
+#endif // XE_SHIM_OS_ATOMIC_H
@@ -0,0 +1,238 @@
+#ifndef XE_SHIM_XE_FB_H
+#define XE_SHIM_XE_FB_H
+
+//
+// Host stand-in for FakeIrisXEFramebuffer.cpp, so a test can start the
+// accelerator on a framebuffer. What the accelerator reaches is real
+// enough: three heap scanout buffers bound into a FakeIrisXEGGTT over a
+// heap BAR0, and the plane registers in a heap register file. Nothing
+// scans out, so the plane latches PLANE_SURF only when the test calls
+// XEFBTest::vblank(). The display-side virtuals are stubs; they are here
+// because the class needs its vtable. Include it in one translation unit.
+//
+
+#include "FakeIrisXEFramebuffer.hpp"
+
+#define PLANE_SURF_1_A      0x7019C
+#define PLANE_SURFLIVE_1_A  0x701AC
+
+static const uint64_t kXEFBRegBytes = 1 << 20;
+static const uint64_t kXEFBBarBytes = 16 << 20;        // 8 MiB of registers, 8 MiB of PTEs
+
+static IOMemoryMap* xeFBHeapMap(uint64_t bytes)
+{
+    void* mem = IOMallocAligned(bytes, 4096);
+    bzero(mem, bytes);
+    IOMemoryDescriptor* md = IOMemoryDescriptor::withPhysicalAddress(
+        (IOPhysicalAddress)(uintptr_t)mem, bytes, kIODirectionInOut);
+    IOMemoryMap* map = md->map();
+    md->release();          // the map keeps it
+    return map;
+}
+
+static void xeFBHeapUnmap(IOMemoryMap*& map)
+{
+    if (!map) return;
+    void* mem = (void*)map->getVirtualAddress();
+    uint64_t bytes = map->getLength();
+    map->release();
+    IOFreeAligned(mem, bytes);
+    map = nullptr;
+}
+
+bool FakeIrisXEFramebuffer::start(IOService* provider)
+{
+    if (!IOService::start(provider)) return false;
+
+    pciDevice = new IOPCIDevice;
+    pciDevice->init();
+    mmioMap = xeFBHeapMap(kXEFBRegBytes);
+    mmioBase = (volatile UInt8*)mmioMap->getVirtualAddress();
+    ggttMemoryMap = xeFBHeapMap(kXEFBBarBytes);
+    ggtt = FakeIrisXEGGTT::withDevice(pciDevice, ggttMemoryMap);
+
+    const vm_size_t bytes = (vm_size_t)getStride() * getHeight();
+    for (scanoutCount = 0; scanoutCount < kMaxScanout; ++scanoutCount) {
+        scanoutMemory[scanoutCount] = IOBufferMemoryDescriptor::inTaskWithOptions(
+            kernel_task, kIODirectionInOut | kIOMemoryKernelUserShared, bytes, 4096);
+        bzero(scanoutMemory[scanoutCount]->getBytesNoCopy(), bytes);
+    }
+    framebufferMemory = scanoutMemory[0];
+    kernelFBPtr = framebufferMemory->getBytesNoCopy();
+    kernelFBSize = bytes;
+
+    // Buffer 0 on screen, as start() leaves it
+    if (!mapFramebufferIntoGGTT()) return false;
+    *(volatile uint32_t*)(mmioBase + PLANE_SURF_1_A) = planeSurf;
+    *(volatile uint32_t*)(mmioBase + PLANE_SURFLIVE_1_A) = planeSurf;
+    return true;
+}
+
+void FakeIrisXEFramebuffer::stop(IOService* provider)
+{
+    unmapScanoutFromGGTT();
+    OSSafeReleaseNULL(ggtt);
+    for (uint32_t i = 0; i < scanoutCount; ++i) OSSafeReleaseNULL(scanoutMemory[i]);
+    scanoutCount = 0;
+    framebufferMemory = nullptr;
+    kernelFBPtr = nullptr;
+    xeFBHeapUnmap(ggttMemoryMap);
+    xeFBHeapUnmap(mmioMap);
+    mmioBase = nullptr;
+    OSSafeReleaseNULL(pciDevice);
+    IOService::stop(provider);
+}
+
+// As FakeIrisXEFramebuffer.cpp has them
+bool FakeIrisXEFramebuffer::mapFramebufferIntoGGTT()
+{
+    if (!ggtt || !framebufferMemory) return false;
+    for (uint32_t i = scanoutBound; i < scanoutCount; ++i) {
+        uint64_t off = 0;
+        if (ggtt->bind(scanoutMemory[i], FakeIrisXEGGTT::kScanoutAlign, &off,
+                       FakeIrisXEGGTT::kScanoutGuard) != kIOReturnSuccess) {
+            if (i == 0) return false;
+            scanoutCount = i;
+            break;
+        }
+        scanoutGGTT[i] = (uint32_t)off;
+        scanoutBound = i + 1;
+    }
+    fbGGTTOffset = scanoutGGTT[0];
+    planeSurf = fbGGTTOffset;
+    return true;
+}
+
+void FakeIrisXEFramebuffer::unmapScanoutFromGGTT()
+{
+    for (uint32_t i = 0; ggtt && i < scanoutBound; ++i)
+        ggtt->unbind(scanoutGGTT[i]);
+    scanoutBound = 0;
+}
+
+IOReturn FakeIrisXEFramebuffer::flipTo(uint32_t index)
+{
+    if (index >= scanoutCount) return kIOReturnBadArgument;
+
+    IOReturn ret = flipToGGTT(scanoutGGTT[index]);
+    if (ret == kIOReturnSuccess) scanoutFront = index;
+    return ret;
+}
+
+IOReturn FakeIrisXEFramebuffer::flipToGGTT(uint32_t ggttOffset)
+{
+    if (!mmioBase) return kIOReturnNotReady;
+
+    safeMMIOWrite(PLANE_SURF_1_A, ggttOffset);
+    planeSurf = ggttOffset;
+    return kIOReturnSuccess;
+}
+
+bool FakeIrisXEFramebuffer::flipPending()
+{
+    if (!mmioBase) return false;
+    return (safeMMIORead(PLANE_SURFLIVE_1_A) & ~0xFFFu) != (planeSurf & ~0xFFFu);
+}
+
+void* FakeIrisXEFramebuffer::getScanoutKernelPtr(uint32_t index) const
+{
+    return (index < scanoutCount && scanoutMemory[index]) ? scanoutMemory[index]->getBytesNoCopy() : nullptr;
+}
+
+IOBufferMemoryDescriptor* FakeIrisXEFramebuffer::getScanoutMemory(uint32_t index) const
+{
+    return index < scanoutCount ? scanoutMemory[index] : nullptr;
+}
+
+void* FakeIrisXEFramebuffer::getFramebufferKernelPtr() const
+{
+    return framebufferMemory ? framebufferMemory->getBytesNoCopy() : nullptr;
+}
+
+IOReturn FakeIrisXEFramebuffer::flushDisplay() { return kIOReturnSuccess; }
+
+// The rest of the vtable
+bool FakeIrisXEFramebuffer::init(OSDictionary* dict) { return IOService::init(dict); }
+void FakeIrisXEFramebuffer::free() { IOService::free(); }
+bool FakeIrisXEFramebuffer::isConsoleDevice() const { return false; }
+void FakeIrisXEFramebuffer::startIOFB() {}
+IOWorkLoop* FakeIrisXEFramebuffer::getWorkLoop() const { return IOService::getWorkLoop(); }
+IOService* FakeIrisXEFramebuffer::probe(IOService* provider, SInt32* score) { return this; }
+IOReturn FakeIrisXEFramebuffer::setPowerState(unsigned long, IOService*) { return kIOReturnSuccess; }
+IOReturn FakeIrisXEFramebuffer::setAbltFramebuffer(void*) { return kIOReturnUnsupported; }
+const char* FakeIrisXEFramebuffer::getPixelFormats() { return nullptr; }
+UInt64 FakeIrisXEFramebuffer::getPixelFormatsForDisplayMode(IODisplayModeID, IOIndex) { return 0; }
+IOReturn FakeIrisXEFramebuffer::setDisplayMode(IODisplayModeID, IOIndex) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::flushFramebuffer() { return kIOReturnSuccess; }
+UInt32 FakeIrisXEFramebuffer::getConnectionCount() { return 1; }
+IOReturn FakeIrisXEFramebuffer::getStartupDisplayMode(IODisplayModeID*, IOIndex*) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::getAttributeForConnection(IOIndex, IOSelect, uintptr_t*) { return kIOReturnUnsupported; }
+IODeviceMemory* FakeIrisXEFramebuffer::getVRAMRange() { return nullptr; }
+IOReturn FakeIrisXEFramebuffer::createSharedCursor(IOIndex, int) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::setBounds(IOIndex, IOGBounds*) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::getDisplayModes(IODisplayModeID*) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::getInformationForDisplayMode(IODisplayModeID, IODisplayModeInformation*) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::getFramebufferOffsetForX_Y(IOPixelAperture, SInt32, SInt32, UInt32*) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::clientMemoryForType(UInt32, UInt32*, IOMemoryDescriptor**) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::enableController() { return kIOReturnSuccess; }
+IOReturn FakeIrisXEFramebuffer::getPixelInformation(IODisplayModeID, IOIndex, IOPixelAperture, IOPixelInformation*) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::getCurrentDisplayMode(IODisplayModeID*, IOIndex*) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::setAttributeForConnection(IOIndex, IOSelect, uintptr_t) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::setNumberOfDisplays(UInt32) { return kIOReturnUnsupported; }
+IODeviceMemory* FakeIrisXEFramebuffer::getApertureRange(IOPixelAperture) { return nullptr; }
+IOIndex FakeIrisXEFramebuffer::getAperture() const { return 0; }
+IOItemCount FakeIrisXEFramebuffer::getDisplayModeCount() { return 0; }
+IOReturn FakeIrisXEFramebuffer::getAttribute(IOSelect, uintptr_t*) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::setAttribute(IOSelect, uintptr_t) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::registerForInterruptType(IOSelect, IOFBInterruptProc, void*, void**) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::unregisterInterrupt(void*) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::setCursorImage(void*) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::setCursorState(SInt32, SInt32, bool) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::getTimingInfoForDisplayMode(IODisplayModeID, IOTimingInformation*) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::setCLUTWithEntries(IOColorEntry*, UInt32, UInt32, IOOptionBits) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::setGammaTable(UInt32, UInt32, UInt32, void*) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::createAccelTask(mach_port_t*) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::setOnline(bool) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::getConnectionFlags(IOIndex, UInt32*) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::notifyServer(IOSelect, void*, size_t) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::getGammaTable(UInt32, UInt32*, UInt32*, void**) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::setMode(IODisplayModeID, IOOptionBits, UInt32) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::getOnlineState(IOIndex, bool*) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::setOnlineState(IOIndex, bool) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::getAttributeForIndex(IOSelect, UInt32, UInt32*) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::setProperties(OSObject*) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::validateDetailedTiming(void*, UInt32*) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::setDetailedTimings(OSObject*) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::setInterruptState(void*, UInt32) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::handleEvent(IOFramebuffer*, void*, UInt32, void*) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::doControl(UInt32, void*, UInt32) { return kIOReturnUnsupported; }
+IOReturn FakeIrisXEFramebuffer::extControl(OSObject*) { return kIOReturnUnsupported; }
+void FakeIrisXEFramebuffer::transformLocation(IOGPoint*, IOOptionBits) {}
+IOReturn FakeIrisXEFramebuffer::newUserClient(task_t, void*, UInt32, OSDictionary*, IOUserClient**) { return kIOReturnUnsupported; }
+void FakeIrisXEFramebuffer::close(IOService* client, IOOptionBits opts) { IOService::close(client, opts); }
+IOIndex FakeIrisXEFramebuffer::getStartupDepth() { return 0; }
+
+// The test's side of the display
+struct XEFBTest : FakeIrisXEFramebuffer {
+    static volatile uint32_t& reg(FakeIrisXEFramebuffer* fb, uint32_t offset)
+    {
+        return *(volatile uint32_t*)(fb->*(&XEFBTest::mmioBase) + offset);
+    }
+
+    // The plane picks up what PLANE_SURF holds, as it would at vblank
+    static void vblank(FakeIrisXEFramebuffer* fb)
+    {
+        reg(fb, PLANE_SURFLIVE_1_A) = reg(fb, PLANE_SURF_1_A);
+    }
+
+    // GGTT offset the plane is scanning out
+    static uint32_t live(FakeIrisXEFramebuffer* fb) { return reg(fb, PLANE_SURFLIVE_1_A); }
+
+    // PTE for the page at a GGTT offset
+    static uint64_t pte(FakeIrisXEFramebuffer* fb, uint64_t offset)
+    {
+        return ((uint64_t*)(fb->ggttMemoryMap->getVirtualAddress() + kXEFBBarBytes / 2))[offset / 4096];
+    }
+};
+
+#endif // XE_SHIM_XE_FB_H
@@ -0,0 +1,48 @@
+#ifndef XE_TEST_H
+#define XE_TEST_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+//
+// Checks and timing for the host tests. A failed check is reported and
+// counted, and the test carries on; main() returns xe_test_result().
+//
+
+static int xe_test_failures = 0;
+
+#define XE_CHECK(cond) do {                                                   \
+    if (!(cond)) {                                                            \
+        ++xe_test_failures;                                                   \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+    }                                                                         \
+} while (0)
+
+#define XE_CHECK_EQ(a, b) do {                                                \
+    unsigned long long xa_ = (unsigned long long)(a), xb_ = (unsigned long long)(b); \
+    if (xa_ != xb_) {                                                         \
+        ++xe_test_failures;                                                   \
+        fprintf(stderr, "%s:%d: check failed: %s == %s (0x%llx vs 0x%llx)\n", \
+                __FILE__, __LINE__, #a, #b, xa_, xb_);                        \
+    }                                                                         \
+} while (0)
+
+static inline double xe_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static inline int xe_test_result(const char* name)
+{
+    if (xe_test_failures) {
+        fprintf(stderr, "%s: %d check(s) failed\n", name, xe_test_failures);
+        return 1;
+    }
+    printf("%s: ok\n", name);
+    return 0;
+}
+
+#endif // XE_TEST_H
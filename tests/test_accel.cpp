@@ -0,0 +1,1676 @@
+//
+// FakeIrisXEAccelerator and its user client, driven the way a client
+// process drives them: externalMethod() calls, the ring mapped through
+// clientMemoryForType(), records written with xe_ring_reserve() and a
+// kAccelSel_Submit doorbell. The workloop shim runs the drain on the
+// submitting thread, so a submit returns with its commands retired.
+// There is no framebuffer; the accelerator draws into a heap buffer.
+//
+//   checkSubmit        the doorbell drains what was queued, including
+//                      after a draw has asked for a flush
+//   checkCreateRing    ring sizes negotiated before the ring is mapped,
+//                      and not after
+//   checkLargeRecords  payloads of up to half the ring, decoded in place
+//   checkStats         kAccelSel_GetStats counts what ran; a reset zeroes it
+//   checkLargeJobs     full-screen commands resume across ticks, with the
+//                      shim clock sped up to shorten the tick budget
+//   checkCopy          COPY with overlaps and clipping, against a model
+//   checkRectList      RECT_LIST entries clipped and painted in order
+//   checkDamage        PRESENT copies the damage, merged into few boxes
+//   checkBands         large PRESENTs copied in row bands on thread calls
+//   checkFlip          FLIP on the stand-in framebuffer: the plane, the
+//                      draw buffer, catching up and waiting for vblank
+//   checkScanout       full-screen client surfaces scanned out from the GGTT
+//   checkRejected      malformed commands of every opcode are dropped and
+//                      counted in cmdsRejected
+//   checkBO            buffer objects by handle, within their budgets
+//   stressContexts     lock-free context and surface lookups racing
+//                      create, rebind and destroy
+//
+// Then what a submit costs, doorbell to retired, for a small RECT;
+// sustained throughput by ring size; what the opcode table costs per
+// command; full-screen throughput per tick budget; scrolling; RECTs
+// against a RECT_LIST; damage against full-frame presents; band workers
+// at 1080p and 4K; FLIP against a full-frame copy;
+// client surfaces scanned out against copied; and buffer object churn.
+//
+
+#include "FakeIrisXEAccelerator.hpp"
+#include "xe_fb.h"
+#include "xe_test.h"
+
+#include <kern/clock.h>
+
+#include <algorithm>
+#include <sched.h>
+#include <thread>
+#include <vector>
+
+static const uint32_t kW = 1920, kH = 1080;
+static const uint32_t kTickBudgetUS = 2000;     // TICK_BUDGET_US
+
+// What start() would take from the framebuffer
+struct XEAccelTest {
+    static void setTarget(FakeIrisXEAccelerator* acc, uint32_t* pixels, uint32_t w = kW, uint32_t h = kH)
+    {
+        acc->fPixels = pixels;
+        acc->fW = w;
+        acc->fH = h;
+        acc->fStride = w * 4;
+    }
+
+    // n of them, as start() allocates them; stop() frees them
+    static void startBands(FakeIrisXEAccelerator* acc, uint32_t n)
+    {
+        acc->freeBandWorkers();
+        for (uint32_t i = 0; i < n && i < FakeIrisXEAccelerator::kMaxBandWorkers; ++i) {
+            acc->fBands[i].owner = acc;
+            acc->fBands[i].call = thread_call_allocate_with_priority(&FakeIrisXEAccelerator::bandEntry,
+                                                                     &acc->fBands[i], THREAD_CALL_PRIORITY_KERNEL);
+            ++acc->fNumBandWorkers;
+        }
+    }
+
+    // Looks ctxId up the way PRESENT does: the surface's width and first
+    // pixel, or false if there's no context or no surface
+    static bool peek(FakeIrisXEAccelerator* acc, uint32_t ctxId, uint32_t* width, uint32_t* px)
+    {
+        FakeIrisXEAccelerator::XEContext* ctx = acc->acquireContext(ctxId);
+        FakeIrisXEAccelerator::XESurface* surf = acc->acquireSurface(ctx);
+        acc->releaseContext(ctx);
+        if (!surf) return false;
+
+        *width = surf->width;
+        *px = *(const uint32_t*)surf->cpu;
+        acc->releaseSurface(surf);
+        return true;
+    }
+
+    // A reader that takes no reference and gets preempted inside its read
+    // section: what it saw must stay alive and unchanged until it leaves.
+    // On one CPU the window in acquireContext() is too narrow to hit.
+    static bool peekSlowly(FakeIrisXEAccelerator* acc, uint32_t ctxId)
+    {
+        uint32_t e = acc->ctxReadLock();
+        FakeIrisXEAccelerator::XEContext* ctx = acc->fContexts.lookup(ctxId);
+        FakeIrisXEAccelerator::XESurface* surf = ctx ? __atomic_load_n(&ctx->surface, __ATOMIC_ACQUIRE) : nullptr;
+        uint32_t width = surf ? surf->width : 0;
+        sched_yield();
+        bool ok = !ctx || (__atomic_load_n(&ctx->refs, __ATOMIC_RELAXED) != 0 &&
+                           (!surf || (__atomic_load_n(&surf->refs, __ATOMIC_RELAXED) != 0 &&
+                                      surf->width == width && surf->md)));
+        acc->ctxReadUnlock(e);
+        return ok;
+    }
+};
+
+// One connection: the accelerator, its user client, the mapped ring and
+// the producer's head
+struct Client {
+    FakeIrisXEFramebuffer*           fb = nullptr;
+    FakeIrisXEAccelerator*           acc;
+    FakeIrisXEAcceleratorUserClient* uc;
+    IOMemoryMap*                     ringMap;
+    XEHdr*                           hdr;
+    uint8_t*                         ring;
+    uint32_t                         head;
+    std::vector<uint32_t>            pixels;
+
+    IOReturn call(uint32_t selector, std::vector<uint64_t> in, uint64_t* out = nullptr, uint32_t outCount = 0,
+                  const void* sin = nullptr, uint32_t sinBytes = 0, void* sout = nullptr, uint32_t soutBytes = 0)
+    {
+        IOExternalMethodArguments args {};
+        args.scalarInput = in.data();
+        args.scalarInputCount = (uint32_t)in.size();
+        args.scalarOutput = out;
+        args.scalarOutputCount = outCount;
+        args.structureInput = sin;
+        args.structureInputSize = sinBytes;
+        args.structureOutput = sout;
+        args.structureOutputSize = soutBytes;
+        return uc->externalMethod(selector, &args, nullptr, nullptr, nullptr);
+    }
+
+    // Queues one record of bytes payload bytes, whose header says claimed
+    // (bytes unless given); false if the ring is full
+    bool put(uint32_t opcode, uint32_t ctxId, const void* payload, uint32_t bytes, uint32_t claimed = UINT32_MAX)
+    {
+        uint32_t total = xe_align(sizeof(XECmd) + bytes), next;
+        uint32_t off = xe_ring_reserve(ring, hdr->capacity, head, xe_load_acquire(&hdr->tail), total, &next);
+        if (off == UINT32_MAX) return false;
+
+        XECmd cmd = { opcode, claimed == UINT32_MAX ? bytes : claimed, ctxId, 0 };
+        memcpy(ring + off, &cmd, sizeof(cmd));
+        if (bytes) memcpy(ring + off + sizeof(cmd), payload, bytes);
+        head = next;
+        xe_store_release(&hdr->head, head);
+        return true;
+    }
+
+    IOReturn submit() { return call(kAccelSel_Submit, {}); }
+
+    XEAccelStats stats(bool reset = false)
+    {
+        XEAccelStats st {};
+        XE_CHECK_EQ(call(kAccelSel_GetStats, { reset }, nullptr, 0, nullptr, 0, &st, sizeof(st)), kIOReturnSuccess);
+        return st;
+    }
+
+    // 0 on failure, like the handle table's kInvalid
+    uint32_t createBO(uint64_t size, uint64_t* outSize = nullptr, IOReturn* ret = nullptr, uint32_t flags = 0)
+    {
+        uint64_t out[2] = {};
+        IOReturn r = call(kAccelSel_BOCreate, { size, flags }, out, 2);
+        if (ret) *ret = r;
+        if (outSize) *outSize = out[1];
+        return r == kIOReturnSuccess ? (uint32_t)out[0] : 0;
+    }
+
+    IOMemoryMap* mapBO(uint32_t handle)
+    {
+        IOOptionBits opts = 0;
+        IOMemoryDescriptor* md = nullptr;
+        if (uc->clientMemoryForType(handle, &opts, &md) != kIOReturnSuccess) return nullptr;
+        IOMemoryMap* map = md->map();
+        md->release();
+        return map;
+    }
+
+    uint32_t createContext()
+    {
+        XECreateCtxIn in {};
+        XECreateCtxOut out {};
+        XE_CHECK_EQ(call(kAccelSel_CreateContext, {}, nullptr, 0, &in, sizeof(in), &out, sizeof(out)),
+                    kIOReturnSuccess);
+        return out.ctxId;
+    }
+
+    // A w x h surface on ctxId, packed rows from the start of the object
+    IOReturn bindSurface(uint32_t ctxId, uint32_t handle, uint32_t w, uint32_t h, uint64_t* gpuAddr = nullptr)
+    {
+        XEBindSurfaceBOIn in = { ctxId, handle, w, h, w * 4, XE_SURF_FORMAT_SCANOUT, 0 };
+        XEBindSurfaceOut out {};
+        IOReturn ret = call(kAccelSel_BindSurfaceBO, {}, nullptr, 0, &in, sizeof(in), &out, sizeof(out));
+        if (gpuAddr) *gpuAddr = out.gpuAddr;
+        return ret;
+    }
+
+    bool drained() const { return xe_load_acquire(&hdr->tail) == head; }
+
+    uint32_t px(uint32_t x, uint32_t y) const { return pixels[(size_t)y * kW + x]; }
+};
+
+// The accelerator and its user client, ring not mapped yet. Started on
+// fb when given; otherwise it draws into pixels and has no display.
+static Client* open(FakeIrisXEFramebuffer* fb = nullptr)
+{
+    Client* c = new Client;
+    c->pixels.assign((size_t)kW * kH, 0);
+
+    c->acc = new FakeIrisXEAccelerator;
+    c->acc->init();
+    if (fb) {
+        c->fb = fb;
+        XE_CHECK(c->acc->start(fb));
+    } else {
+        XEAccelTest::setTarget(c->acc, c->pixels.data());
+    }
+
+    c->uc = new FakeIrisXEAcceleratorUserClient;
+    c->uc->initWithTask(kernel_task, nullptr, 0);
+    XE_CHECK(c->uc->start(c->acc));
+    return c;
+}
+
+// Mapping the ring attaches it and starts the doorbell
+static void mapRing(Client* c)
+{
+    IOOptionBits opts = 0;
+    IOMemoryDescriptor* md = nullptr;
+    XE_CHECK_EQ(c->uc->clientMemoryForType(kAccelMem_Ring, &opts, &md), kIOReturnSuccess);
+    c->ringMap = md->map();
+    md->release();
+    c->hdr = (XEHdr*)c->ringMap->getVirtualAddress();
+    c->ring = (uint8_t*)c->hdr + sizeof(XEHdr);
+    c->head = c->hdr->head;
+}
+
+static Client* connect(uint32_t ringBytes = 0)
+{
+    Client* c = open();
+    if (ringBytes) {
+        XECreateRingIn in = { ringBytes, 0 };
+        XECreateRingOut out {};
+        XE_CHECK_EQ(c->call(kAccelSel_CreateRing, {}, nullptr, 0, &in, sizeof(in), &out, sizeof(out)),
+                    kIOReturnSuccess);
+    }
+    mapRing(c);
+    return c;
+}
+
+// On the stand-in framebuffer: its scanout buffers, GGTT and plane
+static Client* connectFB()
+{
+    FakeIrisXEFramebuffer* fb = new FakeIrisXEFramebuffer();
+    fb->init(nullptr);
+    XE_CHECK(fb->start(nullptr));
+    Client* c = open(fb);
+    mapRing(c);
+    return c;
+}
+
+static void disconnect(Client* c)
+{
+    c->uc->clientClose();
+    c->uc->stop(c->acc);
+    c->uc->release();
+    c->ringMap->release();
+    c->acc->stop(nullptr);
+    c->acc->release();
+    if (c->fb) {
+        c->fb->stop(nullptr);
+        c->fb->release();
+    }
+    delete c;
+}
+
+static void checkSubmit()
+{
+    Client* c = connect();
+
+    // Queued without a doorbell: nothing runs (the idle timer never fires here)
+    XEClearPayload clear = { 0xFF102030 };
+    XE_CHECK(c->put(XE_CMD_CLEAR, 0, &clear, sizeof(clear)));
+    XE_CHECK(!c->drained());
+    XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+    XE_CHECK(c->drained());
+    XE_CHECK_EQ(c->px(0, 0), 0xFF102030);
+    XE_CHECK_EQ(c->px(kW - 1, kH - 1), 0xFF102030);
+
+    // The CLEAR left a flush pending; the next submit still drains
+    XERectPayload r = { 10, 20, 30, 40, 0xFFABCDEF };
+    XE_CHECK(c->put(XE_CMD_RECT, 0, &r, sizeof(r)));
+    XE_CHECK(c->put(XE_CMD_FLUSH, 0, nullptr, 0));
+    XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+    XE_CHECK(c->drained());
+    XE_CHECK_EQ(c->px(10, 20), 0xFFABCDEF);
+    XE_CHECK_EQ(c->px(39, 59), 0xFFABCDEF);
+    XE_CHECK_EQ(c->px(40, 59), 0xFF102030);
+    XE_CHECK_EQ(c->px(39, 60), 0xFF102030);
+
+    disconnect(c);
+}
+
+// kAccelSel_CreateRing: sizes rounded up to a power of two within
+// [XE_RING_MIN_BYTES, XE_RING_MAX_BYTES], as often as the client likes
+// until the ring is mapped, and what is mapped is what was negotiated
+static void checkCreateRing()
+{
+    Client* c = open();
+    auto create = [&](uint32_t bytes, XECreateRingOut* out, uint32_t outBytes = sizeof(XECreateRingOut)) {
+        XECreateRingIn in = { bytes, 0 };
+        *out = {};
+        return c->call(kAccelSel_CreateRing, {}, nullptr, 0, &in, sizeof(in), out, outBytes);
+    };
+
+    const struct { uint32_t ask, cap; } sizes[] = {
+        { 0,                     XE_RING_DEFAULT_BYTES },
+        { 1000,                  XE_RING_MIN_BYTES },
+        { XE_RING_MIN_BYTES + 1, XE_RING_MIN_BYTES * 2 },
+        { 3u << 20,              4u << 20 },
+        { 64u << 20,             XE_RING_MAX_BYTES },
+        { 1u << 20,              1u << 20 },
+    };
+    XECreateRingOut out;
+    XE_CHECK_EQ(create(1u << 20, &out, sizeof(out) - 1), kIOReturnMessageTooLarge);
+    for (const auto& sz : sizes) {
+        XE_CHECK_EQ(create(sz.ask, &out), kIOReturnSuccess);
+        XE_CHECK_EQ(out.capacity, sz.cap);
+        XE_CHECK_EQ(out.mapBytes, round_page_64(sizeof(XEHdr) + sz.cap));
+    }
+
+    // The last size stands; the whole ring is usable, and resizing ends here
+    mapRing(c);
+    XE_CHECK_EQ(c->hdr->capacity, 1u << 20);
+    XE_CHECK_EQ(c->ringMap->getLength(), out.mapBytes);
+    XE_CHECK_EQ(create(2u << 20, &out), kIOReturnBusy);
+
+    uint32_t queued = 0;
+    while (c->put(XE_CMD_NOP, 0, nullptr, 0)) ++queued;
+    XE_CHECK_EQ(queued, (1u << 20) / sizeof(XECmd));
+    XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+    XE_CHECK(c->drained());
+    XE_CHECK_EQ(c->stats().cmdsRetired, queued);
+
+    disconnect(c);
+}
+
+// Records far past the old 256-byte payload limit, decoded in place: the
+// largest RECT_LIST the ring takes runs every entry, and one entry more
+// is refused by the producer side before it reaches the ring
+static void checkLargeRecords()
+{
+    Client* c = connect();
+    uint32_t limit = xe_ring_max_record(c->hdr->capacity);
+    uint32_t count = (limit - sizeof(XECmd) - sizeof(XERectListHeader)) / sizeof(XERectPayload);
+
+    std::vector<uint8_t> list(sizeof(XERectListHeader) + (count + 1) * sizeof(XERectPayload));
+    XERectListHeader lh = { count, 0 };
+    memcpy(list.data(), &lh, sizeof(lh));
+    for (uint32_t i = 0; i <= count; ++i) {
+        XERectPayload r = { i % kW, i / kW, 1, 1, 0xFF000000 | (i + 1) };
+        memcpy(list.data() + sizeof(lh) + i * sizeof(r), &r, sizeof(r));
+    }
+
+    // Twice; a KiB of NOPs in between leaves the second one too little
+    // room before the end of the ring, so it goes behind a WRAP record
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int i = 0; pass && i < 64; ++i) XE_CHECK(c->put(XE_CMD_NOP, 0, nullptr, 0));
+        uint32_t before = c->head;
+        std::fill(c->pixels.begin(), c->pixels.end(), 0);
+        XE_CHECK(c->put(XE_CMD_RECT_LIST, 0, list.data(), (uint32_t)(list.size() - sizeof(XERectPayload))));
+        XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+        XE_CHECK(c->drained());
+        bool ok = true;
+        for (uint32_t i = 0; i < count; ++i) ok &= c->px(i % kW, i / kW) == (0xFF000000 | (i + 1));
+        XE_CHECK(ok);
+        XE_CHECK_EQ(c->px(count % kW, count / kW), 0);
+        XE_CHECK_EQ(xe_ring_off(before, c->hdr->capacity) + limit > c->hdr->capacity, pass == 1);
+    }
+
+    lh.count = count + 1;
+    memcpy(list.data(), &lh, sizeof(lh));
+    XE_CHECK(!c->put(XE_CMD_RECT_LIST, 0, list.data(), (uint32_t)list.size()));
+    XE_CHECK_EQ(c->stats().cmdsRejected, 0);
+
+    disconnect(c);
+}
+
+// What a COPY should leave: the clipped source as it was before the
+// copy, wherever it overlaps the destination
+static void copyModel(std::vector<uint32_t>& px, const XECopyPayload& p)
+{
+    if (p.sx >= kW || p.dx >= kW || p.sy >= kH || p.dy >= kH) return;
+    uint32_t w = std::min(p.w, std::min(kW - p.sx, kW - p.dx));
+    uint32_t h = std::min(p.h, std::min(kH - p.sy, kH - p.dy));
+
+    std::vector<uint32_t> src((size_t)w * h);
+    for (uint32_t y = 0; y < h; ++y)
+        memcpy(&src[(size_t)y * w], &px[(size_t)(p.sy + y) * kW + p.sx], w * 4);
+    for (uint32_t y = 0; y < h; ++y)
+        memcpy(&px[(size_t)(p.dy + y) * kW + p.dx], &src[(size_t)y * w], w * 4);
+}
+
+// XE_CMD_COPY against copyModel(): scrolls both ways, sideways moves
+// within the same rows, copies clipped at every edge, and random ones,
+// with the tick budget shortened so the long ones resume mid-copy
+static void checkCopy()
+{
+    Client* c = connect();
+    xe_shim_time_scale = 100;
+    for (size_t i = 0; i < c->pixels.size(); ++i) c->pixels[i] = 0xFF000000 | (uint32_t)(i * 2654435761u >> 8);
+    std::vector<uint32_t> want = c->pixels;
+
+    std::vector<XECopyPayload> copies = {
+        { 0, 16, 0, 0, kW, kH - 16 },               // scroll up
+        { 0, 0, 0, 16, kW, kH - 16 },               // scroll down, over itself
+        { 0, 100, 7, 100, 800, 300 },               // right, same rows
+        { 7, 100, 0, 100, 800, 300 },               // left, same rows
+        { 10, 10, 13, 11, 500, 500 },               // down and right, overlapping
+        { kW - 10, 0, 0, 0, 100, 5 },               // source past the right edge
+        { 0, 0, kW - 3, kH - 2, 100, 100 },         // destination past the corner
+        { 0, 0, 1, 1, 0xFFFFFFFF, 0xFFFFFFFF },     // sizes that overflow
+        { kW, 0, 0, 0, 10, 10 },                    // nothing on screen
+        { 0, 0, 0, kH, 10, 10 },
+        { 5, 5, 50, 50, 0, 10 },                    // empty
+    };
+    uint64_t rng = 0x2545F4914F6CDD1Dull;
+    for (int i = 0; i < 40; ++i) {
+        rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+        uint32_t sx = rng % kW, sy = (rng >> 11) % kH, w = 1 + (rng >> 22) % 900, h = 1 + (rng >> 32) % 700;
+        int32_t ox = (int32_t)((rng >> 42) % 65) - 32, oy = (int32_t)((rng >> 50) % 65) - 32;
+        copies.push_back({ sx, sy, (uint32_t)std::max<int32_t>(0, (int32_t)sx + ox),
+                           (uint32_t)std::max<int32_t>(0, (int32_t)sy + oy), w, h });
+    }
+
+    for (const XECopyPayload& p : copies) {
+        copyModel(want, p);
+        XE_CHECK(c->put(XE_CMD_COPY, 0, &p, sizeof(p)));
+        XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+        XE_CHECK(c->drained());
+        if (c->pixels != want) {
+            fprintf(stderr, "  COPY %u,%u -> %u,%u %ux%u\n", p.sx, p.sy, p.dx, p.dy, p.w, p.h);
+            XE_CHECK(false);
+            want = c->pixels;
+        }
+    }
+    XEAccelStats st = c->stats();
+    XE_CHECK_EQ(st.op[XE_CMD_COPY].count, copies.size());
+    XE_CHECK(st.ticksWork > copies.size());
+
+    xe_shim_time_scale = 1;
+    disconnect(c);
+}
+
+static void fillModel(std::vector<uint32_t>& px, const XERectPayload& r)
+{
+    uint32_t x1 = (uint32_t)std::min<uint64_t>((uint64_t)r.x + r.w, kW);
+    uint32_t y1 = (uint32_t)std::min<uint64_t>((uint64_t)r.y + r.h, kH);
+    for (uint32_t y = r.y; y < y1; ++y)
+        for (uint32_t x = r.x; x < x1; ++x) px[(size_t)y * kW + x] = r.colorARGB;
+}
+
+static std::vector<uint8_t> rectList(const std::vector<XERectPayload>& rects)
+{
+    std::vector<uint8_t> list(sizeof(XERectListHeader) + rects.size() * sizeof(XERectPayload));
+    XERectListHeader lh = { (uint32_t)rects.size(), 0 };
+    memcpy(list.data(), &lh, sizeof(lh));
+    if (!rects.empty()) memcpy(list.data() + sizeof(lh), rects.data(), rects.size() * sizeof(XERectPayload));
+    return list;
+}
+
+// XE_CMD_RECT_LIST against a fill model, in list order: entries clipped
+// at every edge, empty, off screen and overflowing, later ones painting
+// over earlier ones, with a tick budget short enough that the list
+// resumes part way through
+static void checkRectList()
+{
+    Client* c = connect();
+    std::vector<uint32_t> want = c->pixels;
+
+    std::vector<XERectPayload> rects = {
+        { 0, 0, kW, kH, 0xFF101010 },
+        { kW - 5, kH - 5, 100, 100, 0xFF202020 },
+        { 0xFFFFFFF0u, 10, 0x20, 10, 0xFF303030 },
+        { 10, 0xFFFFFFF0u, 10, 0x20, 0xFF404040 },
+        { 100, 100, 0, 50, 0xFF505050 },
+        { 100, 100, 50, 0, 0xFF606060 },
+        { kW, 0, 10, 10, 0xFF707070 },
+        { 3, 7, 0xFFFFFFFFu, 0xFFFFFFFFu, 0xFF808080 },
+    };
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+    for (int i = 0; i < 400; ++i) {
+        rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+        rects.push_back({ (uint32_t)(rng % (kW + 64)), (uint32_t)((rng >> 12) % (kH + 64)),
+                          (uint32_t)((rng >> 24) % 300), (uint32_t)((rng >> 36) % 200),
+                          0xFF000000 | (uint32_t)(rng >> 40) });
+    }
+    for (const XERectPayload& r : rects) fillModel(want, r);
+
+    xe_shim_time_scale = 1000;
+    std::vector<uint8_t> list = rectList(rects);
+    XE_CHECK(c->put(XE_CMD_RECT_LIST, 0, list.data(), (uint32_t)list.size()));
+    XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+    XE_CHECK(c->drained());
+    XE_CHECK(c->pixels == want);
+    XEAccelStats st = c->stats(true);
+    XE_CHECK_EQ(st.op[XE_CMD_RECT_LIST].count, 1);
+    XE_CHECK(st.ticksWork > 1);
+    xe_shim_time_scale = 1;
+
+    // An empty list is a no-op; a count past the payload is rejected whole
+    list = rectList({});
+    XE_CHECK(c->put(XE_CMD_RECT_LIST, 0, list.data(), (uint32_t)list.size()));
+    list = rectList({ { 0, 0, 10, 10, 0xFFFFFFFF }, { 0, 0, 20, 20, 0xFFFFFFFF } });
+    XERectListHeader lh = { 3, 0 };
+    memcpy(list.data(), &lh, sizeof(lh));
+    XE_CHECK(c->put(XE_CMD_RECT_LIST, 0, list.data(), (uint32_t)list.size()));
+    XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+    XE_CHECK(c->drained());
+    XE_CHECK(c->pixels == want);
+    st = c->stats();
+    XE_CHECK_EQ(st.op[XE_CMD_RECT_LIST].count, 2);
+    XE_CHECK_EQ(st.cmdsRejected, 1);
+
+    disconnect(c);
+}
+
+// A full-screen surface on a fresh context, every pixel distinct
+struct Surface {
+    uint32_t     ctx, bo;
+    IOMemoryMap* map;
+    uint32_t*    px;
+    uint64_t     ggtt;          // where it is scanned out from, if it can be
+
+    void release(Client* c)
+    {
+        map->release();
+        c->call(kAccelSel_BOClose, { bo });
+        c->call(kAccelSel_DestroyContext, { ctx });
+    }
+};
+
+static Surface fullScreenSurface(Client* c, uint32_t w = kW, uint32_t h = kH)
+{
+    Surface s;
+    s.ctx = c->createContext();
+    s.bo = c->createBO((uint64_t)w * h * 4);
+    s.map = c->mapBO(s.bo);
+    s.px = (uint32_t*)s.map->getVirtualAddress();
+    for (uint32_t i = 0; i < w * h; ++i) s.px[i] = 0xFF000000 | i;
+    XE_CHECK_EQ(c->bindSurface(s.ctx, s.bo, w, h, &s.ggtt), kIOReturnSuccess);
+    return s;
+}
+
+// PRESENT with damage: (x, y, w, h) first, then the rest
+static bool putPresent(Client* c, uint32_t ctx, const std::vector<XEDamageRect>& damage)
+{
+    std::vector<uint8_t> payload(sizeof(XEPresentPayload) + (damage.size() - 1) * sizeof(XEDamageRect));
+    XEPresentPayload p = { 0, damage[0].x, damage[0].y, damage[0].w, damage[0].h, (uint32_t)damage.size() - 1 };
+    memcpy(payload.data(), &p, sizeof(p));
+    if (damage.size() > 1)
+        memcpy(payload.data() + sizeof(p), &damage[1], (damage.size() - 1) * sizeof(XEDamageRect));
+    return c->put(XE_CMD_PRESENT, ctx, payload.data(), (uint32_t)payload.size());
+}
+
+// Damage-only PRESENTs: every damaged pixel is copied, nearby boxes are
+// merged into one copy, distant ones aren't, no more than
+// XE_PRESENT_MAX_RECTS copies are made, and nothing far from the damage
+// is touched
+static void checkDamage()
+{
+    Client* c = connect();
+    Surface surf = fullScreenSurface(c);
+
+    auto present = [&](const std::vector<XEDamageRect>& damage, uint64_t* bytes, uint64_t* rects) {
+        std::fill(c->pixels.begin(), c->pixels.end(), 0);
+        c->stats(true);
+        XE_CHECK(putPresent(c, surf.ctx, damage));
+        XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+        XE_CHECK(c->drained());
+        XEAccelStats st = c->stats();
+        *bytes = st.presentBytes;
+        *rects = st.presentRects;
+
+        // Damaged pixels copied; copies only where a box is within
+        // reach of some damage
+        bool ok = true;
+        uint64_t copied = 0;
+        for (uint32_t y = 0; y < kH; ++y)
+            for (uint32_t x = 0; x < kW; ++x) {
+                bool inside = false;
+                for (const XEDamageRect& d : damage)
+                    inside |= x >= d.x && (uint64_t)x < (uint64_t)d.x + d.w && y >= d.y && (uint64_t)y < (uint64_t)d.y + d.h;
+                uint32_t got = c->px(x, y);
+                if (got) ++copied;
+                if (inside) ok &= got == surf.px[(size_t)y * kW + x];
+                else        ok &= got == 0 || got == surf.px[(size_t)y * kW + x];
+            }
+        XE_CHECK(ok);
+        XE_CHECK_EQ(copied * 4, *bytes);
+    };
+    uint64_t bytes, rects;
+
+    // A cursor
+    present({ { 100, 200, 32, 32 } }, &bytes, &rects);
+    XE_CHECK_EQ(bytes, 32 * 32 * 4);
+    XE_CHECK_EQ(rects, 1);
+
+    // A line of 40 glyphs, one box each: one copy of the line
+    std::vector<XEDamageRect> line;
+    for (uint32_t i = 0; i < 40; ++i) line.push_back({ 300 + i * 8, 500, 8, 16 });
+    present(line, &bytes, &rects);
+    XE_CHECK_EQ(bytes, 320 * 16 * 4);
+    XE_CHECK_EQ(rects, 1);
+
+    // Two cursors far apart, and one overlapping the first
+    present({ { 10, 10, 32, 32 }, { 1800, 1000, 32, 32 }, { 20, 20, 32, 32 } }, &bytes, &rects);
+    XE_CHECK_EQ(rects, 2);
+    XE_CHECK_EQ(bytes, (42 * 42 + 32 * 32) * 4);
+
+    // Scattered specks: capped at XE_PRESENT_MAX_RECTS copies
+    std::vector<XEDamageRect> specks;
+    for (uint32_t i = 0; i < 40; ++i) specks.push_back({ (i * 431) % (kW - 4), (i * 277) % (kH - 4), 4, 4 });
+    present(specks, &bytes, &rects);
+    XE_CHECK(rects <= XE_PRESENT_MAX_RECTS);
+    XE_CHECK(bytes >= 40 * 4 * 4 * 4);
+
+    // Clipped to the screen; nothing on screen is nothing to copy
+    present({ { kW - 10, kH - 10, 100, 100 } }, &bytes, &rects);
+    XE_CHECK_EQ(bytes, 10 * 10 * 4);
+    present({ { kW, 0, 10, 10 } }, &bytes, &rects);
+    XE_CHECK_EQ(bytes, 0);
+    XE_CHECK_EQ(rects, 0);
+
+    // An empty first rect means the whole frame
+    present({ { 5, 5, 0, 0 } }, &bytes, &rects);
+    XE_CHECK_EQ(bytes, (uint64_t)kW * kH * 4);
+    XE_CHECK(memcmp(c->pixels.data(), surf.px, (size_t)kW * kH * 4) == 0);
+
+    surf.release(c);
+    disconnect(c);
+}
+
+// Waits out band workers: the last one to finish rings the doorbell,
+// which drains the rest of the ring on its own thread
+static bool waitDrained(Client* c)
+{
+    double end = xe_now_ns() + 10e9;
+    while (!c->drained() && xe_now_ns() < end) sched_yield();
+    return c->drained();
+}
+
+// Full-frame PRESENTs split into row bands on thread calls: each frame
+// lands whole, for every number of workers, and a RECT queued behind a
+// PRESENT only draws once every band of it is done
+static void checkBands()
+{
+    Client* c = connect();
+    Surface surf = fullScreenSurface(c);
+    xe_shim_time_scale = 100;
+
+    for (uint32_t workers = 0; workers <= 3; ++workers) {
+        XEAccelTest::startBands(c->acc, workers);
+        for (uint32_t frame = 0; frame < 3; ++frame) {
+            for (uint32_t i = 0; i < kW * kH; ++i) surf.px[i] = 0xFF000000 | (i * 7 + workers * 3 + frame);
+            std::fill(c->pixels.begin(), c->pixels.end(), 0);
+
+            XERectPayload mark = { 0, kH - 1, 1, 1, 0xFFFFFFFF };
+            XE_CHECK(c->put(XE_CMD_PRESENT, surf.ctx, nullptr, 0));
+            XE_CHECK(c->put(XE_CMD_RECT, 0, &mark, sizeof(mark)));
+            XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+            XE_CHECK(waitDrained(c));
+
+            XE_CHECK_EQ(c->px(0, kH - 1), 0xFFFFFFFF);
+            c->pixels[(size_t)(kH - 1) * kW] = surf.px[(size_t)(kH - 1) * kW];
+            XE_CHECK(memcmp(c->pixels.data(), surf.px, (size_t)kW * kH * 4) == 0);
+        }
+    }
+
+    xe_shim_time_scale = 1;
+    surf.release(c);
+    disconnect(c);
+}
+
+static uint32_t* scanout(Client* c, uint32_t index)
+{
+    return (uint32_t*)c->fb->getScanoutKernelPtr(index);
+}
+
+static void putFlip(Client* c, uint32_t buffer)
+{
+    XEFlipPayload p = { buffer, 0 };
+    XE_CHECK(c->put(XE_CMD_FLIP, 0, &p, sizeof(p)));
+}
+
+static void putRect(Client* c, uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t color)
+{
+    XERectPayload r = { x, y, w, h, color };
+    XE_CHECK(c->put(XE_CMD_RECT, 0, &r, sizeof(r)));
+}
+
+// FLIP across the stand-in's three scanout buffers: the plane gets the
+// buffer's GGTT offset, later draws land in the next buffer, which first
+// catches up with the new front, copying only what was drawn since it
+// was last shown. A flip whose next buffer is still on screen waits for
+// the vblank; the others don't.
+static void checkFlip()
+{
+    Client* c = connectFB();
+    FakeIrisXEFramebuffer* fb = c->fb;
+    const size_t kFrameBytes = (size_t)kW * kH * 4;
+    const uint32_t kBg = 0xFF102030, kRed = 0xFFFF0000, kGreen = 0xFF00FF00, kBlue = 0xFF0000FF;
+    XE_CHECK_EQ(fb->getScanoutCount(), 3);
+
+    // Before the first FLIP, buffer 0 is on screen and drawn into
+    XEClearPayload clear = { kBg };
+    XE_CHECK(c->put(XE_CMD_CLEAR, 0, &clear, sizeof(clear)));
+    putRect(c, 10, 10, 100, 100, kRed);
+    XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+    XE_CHECK(c->drained());
+    XE_CHECK_EQ(scanout(c, 0)[0], kBg);
+    XE_CHECK_EQ(scanout(c, 0)[10 * kW + 10], kRed);
+    XE_CHECK_EQ(scanout(c, 1)[0], 0);
+
+    // Showing it again: nothing to wait for, and buffer 1 catches up
+    putFlip(c, 0);
+    XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+    XE_CHECK(waitDrained(c));
+    XE_CHECK_EQ(fb->planeSurf, fb->scanoutGGTT[0]);
+    XE_CHECK(memcmp(scanout(c, 1), scanout(c, 0), kFrameBytes) == 0);
+
+    // To 1 while 0 is still live: buffer 2 is off screen, so no waiting
+    putRect(c, 200, 200, 50, 50, kBlue);
+    putFlip(c, 1);
+    XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+    XE_CHECK(waitDrained(c));
+    XE_CHECK_EQ(fb->planeSurf, fb->scanoutGGTT[1]);
+    XE_CHECK_EQ(XEFBTest::live(fb), fb->scanoutGGTT[0]);
+    XE_CHECK(memcmp(scanout(c, 2), scanout(c, 1), kFrameBytes) == 0);
+    XE_CHECK_EQ(scanout(c, 0)[200 * kW + 200], kBg);
+
+    // To 2: buffer 0 comes next and is still live, so the flip and the
+    // RECT behind it wait for the vblank
+    putRect(c, 400, 300, 20, 20, kGreen);
+    putFlip(c, 2);
+    putRect(c, 0, 0, 4, 4, kRed);
+    XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+    XE_CHECK(!c->drained());
+    XE_CHECK_EQ(fb->planeSurf, fb->scanoutGGTT[1]);
+    XE_CHECK_EQ(scanout(c, 2)[300 * kW + 400], kGreen);
+
+    // Buffer 0 missed the blue and the green boxes, and only their
+    // bounding box is copied: a pixel outside it keeps what it had
+    const size_t corner = (size_t)kH * kW - 1;
+    scanout(c, 0)[corner] = 0xFFABCDEF;
+    XEFBTest::vblank(fb);
+    XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+    XE_CHECK(waitDrained(c));
+    XE_CHECK_EQ(fb->planeSurf, fb->scanoutGGTT[2]);
+
+    std::vector<uint32_t> want(scanout(c, 2), scanout(c, 2) + (size_t)kW * kH);
+    for (uint32_t y = 0; y < 4; ++y)
+        for (uint32_t x = 0; x < 4; ++x) want[(size_t)y * kW + x] = kRed;
+    want[corner] = 0xFFABCDEF;
+    XE_CHECK(memcmp(scanout(c, 0), want.data(), kFrameBytes) == 0);
+
+    // No such buffer: dropped, nothing moves
+    putFlip(c, 3);
+    XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+    XE_CHECK(c->drained());
+    XE_CHECK_EQ(fb->planeSurf, fb->scanoutGGTT[2]);
+
+    disconnect(c);
+}
+
+// every page of the surface has its PTE at ggtt
+static bool scannedOut(Client* c, const Surface& s)
+{
+    const uint64_t phys = (uint64_t)(uintptr_t)s.px;
+    for (uint64_t off = 0; off < (uint64_t)kW * kH * 4; off += 4096)
+        if (XEFBTest::pte(c->fb, s.ggtt + off) != ((phys + off) | 0x3)) return false;
+    return true;
+}
+
+// Client surfaces on the plane: a full-screen one in the plane's format
+// is bound into the GGTT and PRESENTed by pointing PLANE_SURF at it, with
+// no copy. Once on screen it stays bound, even with its context gone,
+// until the display has moved on to the next surface or back to the draw
+// buffer, which a copy PRESENT puts back up.
+static void checkScanout()
+{
+    Client* c = connectFB();
+    FakeIrisXEFramebuffer* fb = c->fb;
+
+    Surface a = fullScreenSurface(c);
+    Surface b = fullScreenSurface(c);
+    Surface small = fullScreenSurface(c, 64, 64);
+    XE_CHECK(a.ggtt != 0 && b.ggtt != 0 && a.ggtt != b.ggtt);
+    XE_CHECK(scannedOut(c, a) && scannedOut(c, b));
+    XE_CHECK_EQ(small.ggtt, 0);
+
+    // Leaving our own buffer needn't wait for the vblank
+    XE_CHECK(c->put(XE_CMD_PRESENT, a.ctx, nullptr, 0));
+    XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+    XE_CHECK(c->drained());
+    XE_CHECK_EQ(fb->planeSurf, a.ggtt);
+    XE_CHECK_EQ(scanout(c, 0)[0], 0);
+    XE_CHECK_EQ(c->stats().presentBytes, 0);
+    XEFBTest::vblank(fb);
+
+    // Its context and handle gone, the plane still holds it
+    a.release(c);
+    XE_CHECK(scannedOut(c, a));
+
+    // Leaving a client surface does wait, and lets go of it after
+    XE_CHECK(c->put(XE_CMD_PRESENT, b.ctx, nullptr, 0));
+    XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+    XE_CHECK(!c->drained());
+    XE_CHECK_EQ(fb->planeSurf, b.ggtt);
+    XE_CHECK(scannedOut(c, a));
+    XEFBTest::vblank(fb);
+    XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+    XE_CHECK(waitDrained(c));
+    XE_CHECK_EQ(XEFBTest::pte(fb, a.ggtt), 0);
+
+    // A copy PRESENT lands in the draw buffer, which goes back on the
+    // plane; until that latches the client surface stays bound
+    b.release(c);
+    XE_CHECK(c->put(XE_CMD_PRESENT, small.ctx, nullptr, 0));
+    XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+    XE_CHECK(!c->drained());
+    XE_CHECK_EQ(fb->planeSurf, fb->scanoutGGTT[0]);
+    XE_CHECK_EQ(scanout(c, 0)[0], small.px[0]);
+    XE_CHECK_EQ(scanout(c, 0)[63 * kW + 63], small.px[63 * 64 + 63]);
+    XE_CHECK(scannedOut(c, b));
+
+    XEFBTest::vblank(fb);
+    XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+    XE_CHECK(waitDrained(c));
+    XE_CHECK_EQ(XEFBTest::pte(fb, b.ggtt), 0);
+
+    small.release(c);
+    disconnect(c);
+}
+
+// kAccelSel_GetStats after a known mix of commands; a reset reports the
+// counters and zeroes them, and loses nothing to a drain running beside it
+static void checkStats()
+{
+    Client* c = connect();
+
+    XEAccelStats st = c->stats();
+    XE_CHECK_EQ(st.numOpcodes, XE_STATS_OPCODES);
+    XE_CHECK_EQ(st.numBuckets, XE_STATS_BUCKETS);
+    XE_CHECK_EQ(st.cmdsRetired, 0);
+    uint64_t idle = st.ticksIdle;       // mapping the ring drains it once
+
+    // One submit: 3 small RECTs, 2 NOPs and a large RECT, all in one
+    // drain (well inside a tick, even on a loaded machine)
+    XERectPayload r = { 0, 0, 64, 64, 0xFF0000FF };
+    XERectPayload large = { 0, 0, 512, 512, 0xFF000000 };
+    for (int i = 0; i < 3; ++i) XE_CHECK(c->put(XE_CMD_RECT, 0, &r, sizeof(r)));
+    for (int i = 0; i < 2; ++i) XE_CHECK(c->put(XE_CMD_NOP, 0, nullptr, 0));
+    XE_CHECK(c->put(XE_CMD_RECT, 0, &large, sizeof(large)));
+    uint32_t queued = c->head;
+    XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+    XE_CHECK(c->drained());
+
+    // And one with nothing queued
+    XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+
+    st = c->stats();
+    XE_CHECK_EQ(st.cmdsRetired, 6);
+    XE_CHECK_EQ(st.ticksWork, 1);
+    XE_CHECK_EQ(st.ticksIdle, idle + 1);
+    XE_CHECK_EQ(st.maxCmdsPerTick, 6);
+    XE_CHECK_EQ(st.ringHighWater, queued);
+    XE_CHECK_EQ(st.op[XE_CMD_RECT].count, 4);
+    XE_CHECK_EQ(st.op[XE_CMD_NOP].count, 2);
+    XE_CHECK_EQ(st.op[XE_CMD_CLEAR].count, 0);
+    XE_CHECK_EQ(st.cmdsRejected, 0);
+
+    for (uint32_t i = 0; i < XE_STATS_OPCODES; ++i) {
+        const XEOpStats& op = st.op[i];
+        uint64_t inHist = 0;
+        for (uint32_t b = 0; b < XE_STATS_BUCKETS; ++b) inHist += op.hist[b];
+        XE_CHECK_EQ(inHist, op.count);
+        XE_CHECK(op.maxNs <= op.totalNs);
+    }
+    // A quarter million pixels take a while, past the first (1 us) bucket
+    XE_CHECK(st.op[XE_CMD_RECT].maxNs >= 1000);
+    XE_CHECK(st.op[XE_CMD_RECT].hist[0] < 4);
+
+    // Reset: this read reports them, the next one finds them gone
+    XEAccelStats before = c->stats(true);
+    XE_CHECK_EQ(before.cmdsRetired, 6);
+    XE_CHECK_EQ(before.op[XE_CMD_RECT].maxNs, st.op[XE_CMD_RECT].maxNs);
+    st = c->stats();
+    XE_CHECK_EQ(st.numOpcodes, XE_STATS_OPCODES);
+    const uint64_t* w = &st.ticksWork;
+    bool zero = true;
+    for (size_t i = 0; i < (sizeof(st) - offsetof(XEAccelStats, ticksWork)) / 8; ++i) zero &= w[i] == 0;
+    XE_CHECK(zero);
+
+    // A client built before cmdsRejected gets what fits; shorter is refused
+    uint8_t buf[sizeof(XEAccelStats)];
+    uint32_t oldSize = offsetof(XEAccelStats, cmdsRejected);
+    XE_CHECK_EQ(c->call(kAccelSel_GetStats, { 0 }, nullptr, 0, nullptr, 0, buf, oldSize), kIOReturnSuccess);
+    XE_CHECK_EQ(c->call(kAccelSel_GetStats, { 0 }, nullptr, 0, nullptr, 0, buf, oldSize - 8),
+                kIOReturnMessageTooLarge);
+
+    // Resets racing the drain: what they report adds up to what ran
+    const int kCmds = 200000;
+    bool done = false;
+    uint64_t seen = 0, maxSeen = 0;
+    std::thread reader([&] {
+        while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+            XEAccelStats s = c->stats(true);
+            seen += s.cmdsRetired;
+            if (s.maxCmdsPerTick > maxSeen) maxSeen = s.maxCmdsPerTick;
+            sched_yield();
+        }
+    });
+    for (int n = 0; n < kCmds; ) {
+        while (n < kCmds && c->put(XE_CMD_NOP, 0, nullptr, 0)) ++n;
+        c->submit();
+    }
+    __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+    reader.join();
+    seen += c->stats(true).cmdsRetired;
+    XE_CHECK_EQ(seen, kCmds);
+    XE_CHECK(maxSeen > 0 && maxSeen <= c->hdr->capacity / sizeof(XECmd));
+
+    disconnect(c);
+}
+
+// kAccelSel_BOCreate/BOGetSize/BOClose and mapping by handle: sizes and
+// flags checked, the per-connection byte and handle budgets enforced, and
+// a mapping outliving the handle it came from
+static void checkBO()
+{
+    Client* c = connect();
+    IOReturn ret;
+    uint64_t size, got[1];
+
+    // Rounded to pages, zero filled, and numbered clear of the fixed types
+    uint32_t h = c->createBO(5000, &size);
+    XE_CHECK(h >= kAccelMem_BO);
+    XE_CHECK_EQ(size, 2 * XE_PAGE);
+    XE_CHECK_EQ(c->call(kAccelSel_BOGetSize, { h }, got, 1), kIOReturnSuccess);
+    XE_CHECK_EQ(got[0], size);
+
+    IOMemoryMap* map = c->mapBO(h);
+    XE_CHECK(map != nullptr);
+    XE_CHECK_EQ(map->getLength(), size);
+    uint8_t* bytes = (uint8_t*)map->getVirtualAddress();
+    bool zero = true;
+    for (uint64_t i = 0; i < size; ++i) zero &= bytes[i] == 0;
+    XE_CHECK(zero);
+
+    // Closing the handle leaves the mapping usable; the handle is gone
+    // and isn't handed back for the next object
+    XE_CHECK_EQ(c->call(kAccelSel_BOClose, { h }), kIOReturnSuccess);
+    memset(bytes, 0xA5, size);
+    map->release();
+    XE_CHECK_EQ(c->call(kAccelSel_BOClose, { h }), kIOReturnNotFound);
+    XE_CHECK_EQ(c->call(kAccelSel_BOGetSize, { h }, got, 1), kIOReturnNotFound);
+    XE_CHECK(c->mapBO(h) == nullptr);
+    uint32_t h2 = c->createBO(4096);
+    XE_CHECK(h2 != 0 && h2 != h);
+    XE_CHECK_EQ(c->call(kAccelSel_BOClose, { h2 }), kIOReturnSuccess);
+
+    // Bad sizes, reserved flags, handles never issued
+    XE_CHECK_EQ(c->createBO(0, nullptr, &ret), 0);
+    XE_CHECK_EQ(ret, kIOReturnBadArgument);
+    XE_CHECK_EQ(c->createBO(XE_BO_MAX_BYTES + 1, nullptr, &ret), 0);
+    XE_CHECK_EQ(ret, kIOReturnBadArgument);
+    XE_CHECK_EQ(c->createBO(4096, nullptr, &ret, 1), 0);
+    XE_CHECK_EQ(ret, kIOReturnBadArgument);
+    XE_CHECK_EQ(c->call(kAccelSel_BOClose, { 0 }), kIOReturnNotFound);
+    XE_CHECK_EQ(c->call(kAccelSel_BOClose, { kAccelMem_Ring }), kIOReturnNotFound);
+    XE_CHECK_EQ(c->call(kAccelSel_BOClose, { kAccelMem_BO + 12345 }), kIOReturnNotFound);
+    XE_CHECK_EQ(c->call(kAccelSel_BOCreate, { 4096 }, got, 1), kIOReturnBadArgument);
+
+    // The byte budget: four of the largest fill it, a page more doesn't
+    // fit, and closing one makes room again
+    std::vector<uint32_t> big;
+    for (uint64_t n = 0; n < XE_BO_CLIENT_MAX_BYTES / XE_BO_MAX_BYTES; ++n) {
+        big.push_back(c->createBO(XE_BO_MAX_BYTES));
+        XE_CHECK(big.back() != 0);
+    }
+    XE_CHECK_EQ(c->createBO(4096, nullptr, &ret), 0);
+    XE_CHECK_EQ(ret, kIOReturnNoResources);
+    XE_CHECK_EQ(c->call(kAccelSel_BOClose, { big.back() }), kIOReturnSuccess);
+    big.back() = c->createBO(XE_BO_MAX_BYTES);
+    XE_CHECK(big.back() != 0);
+    for (uint32_t b : big) XE_CHECK_EQ(c->call(kAccelSel_BOClose, { b }), kIOReturnSuccess);
+
+    // The handle budget, with objects left open for clientClose() to drop
+    std::vector<uint32_t> small;
+    for (uint32_t n = 0; n < XE_BO_MAX_HANDLES; ++n) {
+        uint32_t s = c->createBO(4096);
+        if (!s) break;
+        small.push_back(s);
+    }
+    XE_CHECK_EQ(small.size(), XE_BO_MAX_HANDLES);
+    XE_CHECK_EQ(c->createBO(4096, nullptr, &ret), 0);
+    XE_CHECK_EQ(ret, kIOReturnNoResources);
+    std::sort(small.begin(), small.end());
+    XE_CHECK(std::unique(small.begin(), small.end()) == small.end());
+    XE_CHECK(small.front() >= kAccelMem_BO);
+
+    disconnect(c);
+}
+
+// Full-screen CLEAR, RECT and PRESENT with a per-tick budget a hundredth
+// of the real one: each runs over many ticks, the ring tail stays on it
+// until its last row is done, and the commands queued behind it wait
+static void checkLargeJobs()
+{
+    Client* c = connect();
+    xe_shim_time_scale = 100;
+
+    auto all = [&](uint32_t y0, uint32_t y1, uint32_t color) {
+        for (uint32_t y = y0; y < y1; ++y)
+            for (uint32_t x = 0; x < kW; ++x)
+                if (c->px(x, y) != color) {
+                    fprintf(stderr, "  pixel %u,%u: 0x%08x, want 0x%08x\n", x, y, c->px(x, y), color);
+                    return false;
+                }
+        return true;
+    };
+
+    // One drain pass with a budget of a couple of microseconds: some
+    // rows done, the CLEAR still at the tail, the RECT behind it untouched
+    xe_shim_time_scale = 1000;
+    XEClearPayload clear = { 0xFF112233 };
+    XERectPayload top = { 0, 0, kW, kH / 2, 0xFF445566 };
+    uint32_t tail = c->head;
+    XE_CHECK(c->put(XE_CMD_CLEAR, 0, &clear, sizeof(clear)));
+    XE_CHECK(c->put(XE_CMD_RECT, 0, &top, sizeof(top)));
+    XE_CHECK(c->acc->drainRing());
+    XE_CHECK_EQ(xe_load_acquire(&c->hdr->tail), tail);
+    XE_CHECK_EQ(c->px(0, 0), 0xFF112233);
+    XE_CHECK_EQ(c->px(kW - 1, kH - 1), 0);
+
+    // The doorbell carries both to the end, in order
+    xe_shim_time_scale = 100;
+    c->stats(true);
+    XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+    XE_CHECK(c->drained());
+    XE_CHECK(all(0, kH / 2, 0xFF445566));
+    XE_CHECK(all(kH / 2, kH, 0xFF112233));
+    XEAccelStats st = c->stats(true);
+    XE_CHECK(st.ticksWork > 1);
+    XE_CHECK_EQ(st.cmdsRetired, 2);
+
+    // A full-screen RECT on its own
+    XERectPayload full = { 0, 0, kW, kH, 0xFF778899 };
+    XE_CHECK(c->put(XE_CMD_RECT, 0, &full, sizeof(full)));
+    XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+    XE_CHECK(c->drained());
+    XE_CHECK(all(0, kH, 0xFF778899));
+    st = c->stats(true);
+    XE_CHECK(st.ticksWork > 1);
+    XE_CHECK_EQ(st.op[XE_CMD_RECT].count, 1);
+
+    // A full-frame PRESENT from a buffer object, every pixel distinct
+    uint32_t ctx = c->createContext();
+    uint32_t bo = c->createBO((uint64_t)kW * kH * 4);
+    IOMemoryMap* map = c->mapBO(bo);
+    uint32_t* src = (uint32_t*)map->getVirtualAddress();
+    for (uint32_t i = 0; i < kW * kH; ++i) src[i] = 0xFF000000 | i;
+    XE_CHECK_EQ(c->bindSurface(ctx, bo, kW, kH), kIOReturnSuccess);
+
+    XE_CHECK(c->put(XE_CMD_PRESENT, ctx, nullptr, 0));
+    XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+    XE_CHECK(c->drained());
+    XE_CHECK(memcmp(c->pixels.data(), src, (size_t)kW * kH * 4) == 0);
+    st = c->stats(true);
+    XE_CHECK(st.ticksWork > 1);
+    XE_CHECK_EQ(st.presentBytes, (uint64_t)kW * kH * 4);
+    XE_CHECK_EQ(st.op[XE_CMD_PRESENT].count, 1);
+
+    xe_shim_time_scale = 1;
+    map->release();
+    disconnect(c);
+}
+
+// Context lookups racing their destruction. Two threads cycle contexts
+// through a handful of slots: create, bind a surface, publish, rebind,
+// destroy the slot's previous one. Meanwhile one thread PRESENTs from
+// whatever the slots hold and another looks them up directly, some of
+// the time yielding inside the read section. Every surface is width w
+// over a buffer filled with 0xFF000000 | w, so a lookup that reaches
+// freed or reused memory shows as a mismatch.
+static void stressContexts()
+{
+    Client* c = connect();
+    const uint32_t kVariants = 8, kSlots = 8, kWriters = 2;
+    const double kRunNs = 1e9;
+    const uint32_t kSurfH = 64;
+
+    uint32_t bos[kVariants];
+    for (uint32_t k = 0; k < kVariants; ++k) {
+        uint32_t w = 32 + k;
+        bos[k] = c->createBO((uint64_t)w * 4 * kSurfH);
+        IOMemoryMap* map = c->mapBO(bos[k]);
+        uint32_t* px = (uint32_t*)map->getVirtualAddress();
+        for (uint32_t i = 0; i < w * kSurfH; ++i) px[i] = 0xFF000000 | w;
+        map->release();
+    }
+
+    // Every slot holds a context from the start, so readers never idle
+    uint32_t slots[kWriters * kSlots];
+    for (uint32_t i = 0; i < kWriters * kSlots; ++i) {
+        slots[i] = c->createContext();
+        XE_CHECK_EQ(c->bindSurface(slots[i], bos[i % kVariants], 32 + i % kVariants, kSurfH), kIOReturnSuccess);
+    }
+    bool done = false;
+    uint64_t bad = 0, writeErrors = 0, seen = 0, presents = 0, rounds = 0;
+
+    auto writer = [&](uint32_t first) {
+        uint64_t rng = 0x9E3779B97F4A7C15ull * (first + 1);
+        double end = xe_now_ns() + kRunNs;
+        for (uint32_t i = 0; xe_now_ns() < end; ++i) {
+            __atomic_fetch_add(&rounds, 1, __ATOMIC_RELAXED);
+            rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+            uint32_t k = rng % kVariants, k2 = (k + 1 + (rng >> 8) % (kVariants - 1)) % kVariants;
+
+            XECreateCtxIn in {};
+            XECreateCtxOut out {};
+            if (c->call(kAccelSel_CreateContext, {}, nullptr, 0, &in, sizeof(in), &out, sizeof(out)) ||
+                c->bindSurface(out.ctxId, bos[k], 32 + k, kSurfH)) {
+                __atomic_fetch_add(&writeErrors, 1, __ATOMIC_RELAXED);
+                continue;
+            }
+            uint32_t old = __atomic_exchange_n(&slots[first + i % kSlots], out.ctxId, __ATOMIC_ACQ_REL);
+            if (c->bindSurface(out.ctxId, bos[k2], 32 + k2, kSurfH))
+                __atomic_fetch_add(&writeErrors, 1, __ATOMIC_RELAXED);
+            if (c->call(kAccelSel_DestroyContext, { old }))
+                __atomic_fetch_add(&writeErrors, 1, __ATOMIC_RELAXED);
+        }
+    };
+
+    std::thread peeker([&] {
+        for (uint32_t i = 0; !__atomic_load_n(&done, __ATOMIC_ACQUIRE); ++i) {
+            uint32_t id = __atomic_load_n(&slots[i % (kWriters * kSlots)], __ATOMIC_ACQUIRE);
+            if ((i & 15) == 0) {
+                if (!XEAccelTest::peekSlowly(c->acc, id)) ++bad;
+                continue;
+            }
+            uint32_t w, px;
+            if (!XEAccelTest::peek(c->acc, id, &w, &px)) continue;
+            ++seen;
+            if (w < 32 || w >= 32 + kVariants || px != (0xFF000000 | w)) ++bad;
+        }
+    });
+    std::thread presenter([&] {
+        for (uint32_t i = 0; !__atomic_load_n(&done, __ATOMIC_ACQUIRE); ++i) {
+            uint32_t id = __atomic_load_n(&slots[i % (kWriters * kSlots)], __ATOMIC_ACQUIRE);
+            XEPresentPayload p = { 0, 0, 0, 32, kSurfH, 0 };
+            if (c->put(XE_CMD_PRESENT, id, &p, sizeof(p))) ++presents;
+            c->submit();
+        }
+    });
+
+    std::vector<std::thread> writers;
+    for (uint32_t w = 0; w < kWriters; ++w) writers.emplace_back(writer, w * kSlots);
+    for (std::thread& t : writers) t.join();
+    __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+    peeker.join();
+    presenter.join();
+
+    XE_CHECK_EQ(writeErrors, 0);
+    XE_CHECK_EQ(bad, 0);
+    XE_CHECK(rounds > 100 && seen > 100 && presents > 100);
+    XE_CHECK(c->drained());
+
+    // What the PRESENTs left on screen came from some surface, whole
+    for (uint32_t y = 0; y < kSurfH; ++y) {
+        uint32_t w = c->px(0, y) & 0xFFFF;
+        XE_CHECK(c->px(0, y) == 0 || (w >= 32 && w < 32 + kVariants && c->px(31, y) == c->px(0, y)));
+    }
+    XEAccelStats st = c->stats();
+    XE_CHECK_EQ(st.op[XE_CMD_PRESENT].count, presents);
+    XE_CHECK_EQ(st.cmdsRejected, 0);
+
+    // The slots' last contexts go with the connection
+    for (uint32_t b : bos) XE_CHECK_EQ(c->call(kAccelSel_BOClose, { b }), kIOReturnSuccess);
+    printf("  contexts: %llu created and destroyed, beside %llu lookups and %llu PRESENTs\n",
+           (unsigned long long)rounds, (unsigned long long)seen, (unsigned long long)presents);
+    disconnect(c);
+}
+
+// Every opcode, with a payload too short and too long for it, and with a
+// header claiming more bytes than its record holds: none may draw, each
+// is counted, and the ring carries on
+static void checkRejected()
+{
+    Client* c = connect();
+    const uint32_t kSentinel = 0xFF5A5A5A;
+    std::fill(c->pixels.begin(), c->pixels.end(), kSentinel);
+
+    struct {
+        uint32_t opcode;
+        uint32_t minBytes, maxBytes;    // what the opcode accepts
+    } ops[] = {
+        { XE_CMD_NOP,       0, 0 },
+        { XE_CMD_CLEAR,     sizeof(XEClearPayload), sizeof(XEClearPayload) },
+        { XE_CMD_RECT,      sizeof(XERectPayload),  sizeof(XERectPayload) },
+        { XE_CMD_COPY,      sizeof(XECopyPayload),  sizeof(XECopyPayload) },
+        { XE_CMD_FLUSH,     0, 0 },
+        { XE_CMD_PRESENT,   0, UINT32_MAX },
+        { XE_CMD_BLEND,     sizeof(XEBlendPayload), sizeof(XEBlendPayload) },
+        { XE_CMD_RECT_LIST, sizeof(XERectListHeader), UINT32_MAX },
+        { XE_CMD_FLIP,      sizeof(XEFlipPayload),  sizeof(XEFlipPayload) },
+    };
+    // A CLEAR to 0, or a full-screen RECT or BLEND, if they ran
+    uint32_t payload[64] = { 0, 0, 4096, 4096, 0xFF000000 };
+
+    uint64_t want = 0;
+    auto rejected = [&](uint32_t opcode, uint32_t bytes, uint32_t claimed) {
+        XE_CHECK(c->put(opcode, 0, payload, bytes, claimed));
+        XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+        XE_CHECK(c->drained());
+        if (c->stats().cmdsRejected != ++want) {
+            fprintf(stderr, "  opcode %u, %u bytes (header %u): not counted\n", opcode, bytes, claimed);
+            XE_CHECK_EQ(c->stats().cmdsRejected, want);
+            want = c->stats().cmdsRejected;
+        }
+    };
+
+    for (const auto& op : ops) {
+        if (op.minBytes) {
+            rejected(op.opcode, op.minBytes - 1, op.minBytes - 1);
+            rejected(op.opcode, 0, 0);
+        }
+        if (op.maxBytes != UINT32_MAX)
+            rejected(op.opcode, op.maxBytes + 4, op.maxBytes + 4);
+
+        // More than the record holds: the rest of the queue goes too
+        uint32_t bytes = op.minBytes;
+        rejected(op.opcode, bytes, xe_align(sizeof(XECmd) + bytes) - sizeof(XECmd) + 16);
+        rejected(op.opcode, bytes, 0xFFFFFFF0u);
+    }
+
+    // Unknown opcodes
+    rejected(XE_CMD_FLIP + 1, 0, 0);
+    rejected(0x100, sizeof(XERectPayload), sizeof(XERectPayload));
+
+    // Variable payloads whose counts run past their bytes
+    XEPresentPayload pp = { 0, 0, 0, 0, 0, 2 };
+    memcpy(payload, &pp, sizeof(pp));
+    rejected(XE_CMD_PRESENT, sizeof(pp) + sizeof(XEDamageRect), sizeof(pp) + sizeof(XEDamageRect));
+    XERectListHeader lh = { 3, 0 };
+    memcpy(payload, &lh, sizeof(lh));
+    rejected(XE_CMD_RECT_LIST, sizeof(lh) + 2 * sizeof(XERectPayload), sizeof(lh) + 2 * sizeof(XERectPayload));
+
+    // A record past a bad one is dropped with the rest of the queue
+    XERectPayload r = { 0, 0, kW, kH, 0xFF000000 };
+    XE_CHECK(c->put(XE_CMD_RECT, 0, &r, sizeof(r), 0x1000));
+    XE_CHECK(c->put(XE_CMD_RECT, 0, &r, sizeof(r)));
+    XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+    XE_CHECK(c->drained());
+    XE_CHECK_EQ(c->stats().cmdsRejected, ++want);
+
+    bool untouched = true;
+    for (uint32_t p : c->pixels) untouched &= p == kSentinel;
+    XE_CHECK(untouched);
+
+    // Nothing stuck: a good command still runs, and isn't counted
+    r = { 5, 5, 1, 1, 0xFF123456 };
+    XE_CHECK(c->put(XE_CMD_RECT, 0, &r, sizeof(r)));
+    XE_CHECK_EQ(c->submit(), kIOReturnSuccess);
+    XE_CHECK_EQ(c->px(5, 5), 0xFF123456);
+    XE_CHECK_EQ(c->stats().cmdsRejected, want);
+
+    disconnect(c);
+}
+
+// Per command, through the table: the handler-less NOP, a 1x1 RECT, and
+// a rejected RECT, a ring's worth per submit
+static void benchDispatch()
+{
+    Client* c = connect();
+    const int kIters = 200000;
+    XERectPayload r = { 7, 7, 1, 1, 0xFF00FF00 };
+
+    auto run = [&](uint32_t opcode, uint32_t bytes, uint32_t claimed) {
+        int n = 0;
+        double t0 = xe_now_ns();
+        while (n < kIters) {
+            while (n < kIters && c->put(opcode, 0, &r, bytes, claimed)) ++n;
+            c->submit();
+        }
+        XE_CHECK(c->drained());
+        return (xe_now_ns() - t0) / n;
+    };
+
+    double nop = run(XE_CMD_NOP, 0, 0);
+    double rect = run(XE_CMD_RECT, sizeof(r), sizeof(r));
+    double bad = run(XE_CMD_RECT, sizeof(r) - 4, sizeof(r) - 4);
+    XE_CHECK_EQ(c->stats().cmdsRejected, kIters);
+
+    printf("  dispatch, submit to retired: NOP %.0f ns, 1x1 RECT %.0f ns, rejected RECT %.0f ns\n",
+           nop, rect, bad);
+    disconnect(c);
+}
+
+// One small RECT per submit, and a ring's worth per submit
+// A terminal scrolling: 1920x1064 moved by 16 rows, up and down, as one
+// COPY doorbell to retired, against the row loop it replaced (memmove
+// per row, top-down, which is only right for scrolling up)
+static void benchScroll()
+{
+    Client* c = connect();
+    const int kIters = 100;
+    const XECopyPayload up = { 0, 16, 0, 0, kW, kH - 16 }, down = { 0, 0, 0, 16, kW, kH - 16 };
+
+    double ns[2];
+    for (int d = 0; d < 2; ++d) {
+        double t0 = xe_now_ns();
+        for (int i = 0; i < kIters; ++i) {
+            c->put(XE_CMD_COPY, 0, d ? &down : &up, sizeof(up));
+            c->submit();
+        }
+        ns[d] = (xe_now_ns() - t0) / kIters;
+        XE_CHECK(c->drained());
+    }
+
+    uint8_t* base = (uint8_t*)c->pixels.data();
+    double t0 = xe_now_ns();
+    for (int i = 0; i < kIters; ++i)
+        for (uint32_t y = 0; y < up.h; ++y)
+            memmove(base + (size_t)y * kW * 4, base + (size_t)(y + 16) * kW * 4, (size_t)kW * 4);
+    double loop = (xe_now_ns() - t0) / kIters;
+
+    printf("  scroll 1920x1064 by 16 rows: COPY up %.0f us, down %.0f us; row loop %.0f us\n",
+           ns[0] / 1e3, ns[1] / 1e3, loop / 1e3);
+    disconnect(c);
+}
+
+// A frame of UI: 1000 small rects as 1000 RECTs or one RECT_LIST, both
+// queued at once and timed doorbell to retired
+static void benchRectList()
+{
+    Client* c = connect();
+    const int kFrames = 200;
+    const uint32_t kRects = 1000;
+
+    for (uint32_t size : { 2u, 16u }) {
+        std::vector<XERectPayload> rects;
+        for (uint32_t i = 0; i < kRects; ++i)
+            rects.push_back({ (i * 37) % (kW - size), (i * 53) % (kH - size), size, size, 0xFF000000 | i });
+        std::vector<uint8_t> list = rectList(rects);
+
+        double t0 = xe_now_ns();
+        for (int f = 0; f < kFrames; ++f) {
+            for (const XERectPayload& r : rects) XE_CHECK(c->put(XE_CMD_RECT, 0, &r, sizeof(r)));
+            c->submit();
+        }
+        double one = (xe_now_ns() - t0) / kFrames;
+
+        t0 = xe_now_ns();
+        for (int f = 0; f < kFrames; ++f) {
+            XE_CHECK(c->put(XE_CMD_RECT_LIST, 0, list.data(), (uint32_t)list.size()));
+            c->submit();
+        }
+        double batched = (xe_now_ns() - t0) / kFrames;
+        XE_CHECK(c->drained());
+
+        printf("  1000 %2ux%-2u rects: %4.0f us as RECTs (%u ring bytes), %4.0f us as a RECT_LIST (%u)\n",
+               size, size, one / 1e3, kRects * xe_align(sizeof(XECmd) + sizeof(XERectPayload)),
+               batched / 1e3, xe_align(sizeof(XECmd) + (uint32_t)list.size()));
+    }
+    disconnect(c);
+}
+
+// What a cursor or a line of text costs against a full frame, per present
+// and per second of presenting at 60 and 120 Hz
+static void benchDamage()
+{
+    Client* c = connect();
+    Surface surf = fullScreenSurface(c);
+    const int kFrames = 200;
+
+    std::vector<XEDamageRect> line;
+    for (uint32_t i = 0; i < 80; ++i) line.push_back({ 200 + i * 8, 600, 8, 16 });
+    const struct { const char* name; std::vector<XEDamageRect> damage; } cases[] = {
+        { "cursor 32x32",     { { 900, 500, 32, 32 } } },
+        { "text line 640x16", line },
+        { "full frame",       { { 0, 0, 0, 0 } } },
+    };
+
+    for (const auto& k : cases) {
+        c->stats(true);
+        double t0 = xe_now_ns();
+        for (int f = 0; f < kFrames; ++f) {
+            putPresent(c, surf.ctx, k.damage);
+            c->submit();
+        }
+        double us = (xe_now_ns() - t0) / kFrames / 1e3;
+        XE_CHECK(c->drained());
+        XEAccelStats st = c->stats();
+
+        double kib = st.presentBytes / kFrames / 1024.0;
+        printf("  PRESENT %-16s %8.0f KiB, %7.1f us; at 60 Hz %6.1f MiB/s, %5.2f%% CPU, at 120 Hz %5.2f%%\n",
+               k.name, kib, us, kib * 60 / 1024, us * 60 / 1e4, us * 120 / 1e4);
+    }
+
+    surf.release(c);
+    disconnect(c);
+}
+
+// Full-frame PRESENT, doorbell to retired, with 0 to 3 band workers
+// beside the workloop, at 1080p and 4K
+static void benchBands()
+{
+    const struct { uint32_t w, h; } sizes[] = { { 1920, 1080 }, { 3840, 2160 } };
+    const int kFrames = 40;
+
+    for (const auto& sz : sizes) {
+        Client* c = connect();
+        std::vector<uint32_t> target((size_t)sz.w * sz.h);
+        XEAccelTest::setTarget(c->acc, target.data(), sz.w, sz.h);
+        Surface surf = fullScreenSurface(c, sz.w, sz.h);
+
+        printf("  PRESENT %ux%u, %u CPUs:", sz.w, sz.h, std::thread::hardware_concurrency());
+        for (uint32_t workers = 0; workers <= 3; ++workers) {
+            XEAccelTest::startBands(c->acc, workers);
+            double t0 = xe_now_ns();
+            for (int f = 0; f < kFrames; ++f) {
+                c->put(XE_CMD_PRESENT, surf.ctx, nullptr, 0);
+                c->submit();
+                waitDrained(c);
+            }
+            printf(" %u bands %.2f ms%s", workers + 1, (xe_now_ns() - t0) / kFrames / 1e6, workers < 3 ? "," : "\n");
+        }
+
+        surf.release(c);
+        disconnect(c);
+    }
+}
+
+// A 64x64 draw and a FLIP, doorbell to retired, with the vblank already
+// past: the price of the flip is bringing the next buffer up to date.
+// Against presenting the frame by copying all of it.
+static void benchFlip()
+{
+    const int kFrames = 200;
+    Client* c = connectFB();
+
+    double t0 = xe_now_ns();
+    for (int f = 0; f < kFrames; ++f) {
+        putRect(c, (f * 64) % (kW - 64), (f * 16) % (kH - 64), 64, 64, 0xFF000000 | f);
+        putFlip(c, f % 3);
+        XEFBTest::vblank(c->fb);
+        c->submit();
+        waitDrained(c);
+    }
+    double flipNs = (xe_now_ns() - t0) / kFrames;
+    disconnect(c);
+
+    c = connect();
+    Surface surf = fullScreenSurface(c);
+    t0 = xe_now_ns();
+    for (int f = 0; f < kFrames / 10; ++f) {
+        c->put(XE_CMD_PRESENT, surf.ctx, nullptr, 0);
+        c->submit();
+        waitDrained(c);
+    }
+    double copyNs = (xe_now_ns() - t0) / (kFrames / 10);
+    surf.release(c);
+    disconnect(c);
+
+    printf("  frame after a 64x64 draw: FLIP %.1f us, full-frame PRESENT copy %.1f us\n",
+           flipNs / 1e3, copyNs / 1e3);
+}
+
+// Full-frame PRESENT of a client surface, doorbell to retired: scanned
+// out from where it is, against copied into the draw buffer
+static void benchScanout()
+{
+    const int kFrames = 200;
+    Client* c = connectFB();
+    Surface a = fullScreenSurface(c);
+    Surface b = fullScreenSurface(c);
+
+    double t0 = xe_now_ns();
+    for (int f = 0; f < kFrames; ++f) {
+        c->put(XE_CMD_PRESENT, (f & 1) ? b.ctx : a.ctx, nullptr, 0);
+        c->submit();
+        XEFBTest::vblank(c->fb);
+        c->submit();
+        waitDrained(c);
+    }
+    double directNs = (xe_now_ns() - t0) / kFrames;
+    a.release(c);
+    b.release(c);
+    disconnect(c);
+
+    c = connect();
+    a = fullScreenSurface(c);
+    t0 = xe_now_ns();
+    for (int f = 0; f < kFrames / 10; ++f) {
+        c->put(XE_CMD_PRESENT, a.ctx, nullptr, 0);
+        c->submit();
+        waitDrained(c);
+    }
+    double copyNs = (xe_now_ns() - t0) / (kFrames / 10);
+    a.release(c);
+    disconnect(c);
+
+    printf("  client surface PRESENT %ux%u: direct scanout %.1f us, copy %.1f us\n",
+           kW, kH, directNs / 1e3, copyNs / 1e3);
+}
+
+// Sustained small-RECT throughput by ring size. The workloop is played
+// by a thread of its own that keeps ringing the doorbell, so the producer
+// runs beside it and only waits when it finds the ring full.
+static void benchRingSize()
+{
+    const uint32_t kSizes[] = { XE_RING_MIN_BYTES, 512u << 10, XE_RING_MAX_BYTES };
+    const uint32_t kCmds = 500000;
+    XERectPayload r = { 0, 0, 8, 8, 0xFF336699 };
+
+    for (uint32_t bytes : kSizes) {
+        Client* c = connect(bytes);
+        bool done = false;
+        std::thread consumer([&] {
+            while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+                c->submit();
+                if (xe_load_acquire(&c->hdr->tail) == xe_load_acquire(&c->hdr->head)) sched_yield();
+            }
+        });
+
+        uint32_t stalls = 0;
+        double t0 = xe_now_ns();
+        for (uint32_t n = 0; n < kCmds; ) {
+            if (c->put(XE_CMD_RECT, 0, &r, sizeof(r))) {
+                r.x = n++ % 1024;
+            } else {
+                ++stalls;
+                sched_yield();
+            }
+        }
+        while (!c->drained()) sched_yield();
+        double ns = xe_now_ns() - t0;
+        __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+        consumer.join();
+
+        printf("  ring %5u KiB: %5.2f Mcmd/s 8x8 RECT, producer stalled %u times\n",
+               bytes >> 10, kCmds / ns * 1e3, stalls);
+        disconnect(c);
+    }
+}
+
+// Full-screen CLEAR and PRESENT throughput, doorbell to retired, with
+// the real per-tick budget and shorter ones
+static void benchLargeJobs()
+{
+    Client* c = connect();
+    uint32_t ctx = c->createContext();
+    uint32_t bo = c->createBO((uint64_t)kW * kH * 4);
+    XE_CHECK_EQ(c->bindSurface(ctx, bo, kW, kH), kIOReturnSuccess);
+    const uint32_t kScales[] = { 1, 10, 100 };
+    const int kFrames = 30;
+
+    for (uint32_t scale : kScales) {
+        xe_shim_time_scale = scale;
+        for (uint32_t op : { XE_CMD_CLEAR, XE_CMD_PRESENT }) {
+            XEClearPayload clear = { 0xFF000000 };
+            c->stats(true);
+            double t0 = xe_now_ns();
+            for (int i = 0; i < kFrames; ++i) {
+                clear.color = 0xFF000000 | i;
+                if (op == XE_CMD_CLEAR) c->put(op, 0, &clear, sizeof(clear));
+                else                    c->put(op, ctx, nullptr, 0);
+                c->submit();
+            }
+            double ns = xe_now_ns() - t0;
+            XE_CHECK(c->drained());
+            XEAccelStats st = c->stats(true);
+
+            printf("  %-7s 1920x1080, %4u us ticks: %6.0f Mpx/s, %3.0f ticks a frame\n",
+                   op == XE_CMD_CLEAR ? "CLEAR" : "PRESENT", kTickBudgetUS / scale,
+                   (double)kW * kH * kFrames / ns * 1e3, (double)st.ticksWork / kFrames);
+        }
+    }
+
+    xe_shim_time_scale = 1;
+    disconnect(c);
+}
+
+// A client's scratch buffers: create, map, write, unmap, close
+static void benchBO()
+{
+    Client* c = connect();
+    const uint64_t kSizes[] = { 4096, 64 << 10, 8 << 20 };
+
+    for (uint64_t size : kSizes) {
+        const int kIters = size > (1 << 20) ? 200 : 20000;
+        double t0 = xe_now_ns();
+        for (int i = 0; i < kIters; ++i) {
+            uint32_t h = c->createBO(size);
+            IOMemoryMap* map = c->mapBO(h);
+            ((uint8_t*)map->getVirtualAddress())[size - 1] = 1;
+            map->release();
+            c->call(kAccelSel_BOClose, { h });
+        }
+        printf("  BO %6llu KiB: create+map+close %.2f us\n",
+               (unsigned long long)(size >> 10), (xe_now_ns() - t0) / kIters / 1e3);
+    }
+    disconnect(c);
+}
+
+static void benchSubmit()
+{
+    Client* c = connect();
+    const int kIters = 20000;
+    XERectPayload r = { 100, 100, 16, 16, 0xFF00FF00 };
+
+    double t0 = xe_now_ns();
+    for (int i = 0; i < kIters; ++i) {
+        r.x = i % 1000;
+        c->put(XE_CMD_RECT, 0, &r, sizeof(r));
+        c->submit();
+    }
+    double one = (xe_now_ns() - t0) / kIters;
+    XE_CHECK(c->drained());
+
+    int batched = 0;
+    t0 = xe_now_ns();
+    for (int i = 0; i < kIters; ) {
+        while (i < kIters && c->put(XE_CMD_RECT, 0, &r, sizeof(r))) ++i, ++batched;
+        c->submit();
+    }
+    double batch = (xe_now_ns() - t0) / batched;
+    XE_CHECK(c->drained());
+
+    printf("  16x16 RECT, submit to retired: %.0f ns one per submit, %.0f ns batched\n", one, batch);
+    disconnect(c);
+}
+
+int main()
+{
+    checkSubmit();
+    checkCreateRing();
+    checkLargeRecords();
+    checkStats();
+    checkLargeJobs();
+    checkCopy();
+    checkRectList();
+    checkDamage();
+    checkBands();
+    checkFlip();
+    checkScanout();
+    checkRejected();
+    checkBO();
+    stressContexts();
+    benchSubmit();
+    benchRingSize();
+    benchDispatch();
+    benchLargeJobs();
+    benchScroll();
+    benchRectList();
+    benchDamage();
+    benchBands();
+    benchFlip();
+    benchScanout();
+    benchBO();
+    XE_CHECK_EQ(xe_shim_live_objects, 0);
+    XE_CHECK_EQ(xe_shim_aligned_bytes, 0);
+    return xe_test_result("test_accel");
+}
@@ -0,0 +1,327 @@
+//
+// FakeIrisXEGGTT against a heap-backed BAR0: registers in the lower half,
+// the PTE array in the upper half, as on the device. The PTEs start out
+// holding junk, the way a previous owner could have left them. Checks
+// every PTE a bind writes, that the guard pages after it are cleared and
+// the PTEs past them are left alone, that unbind zeroes the whole range,
+// that a rebind at the same offset writes fresh PTEs, and the TLB flush;
+// and three scanout buffers made of scattered pages, as the framebuffer
+// binds them.
+// Then bind/unbind cost for a scanout-sized buffer, against writing and
+// reading back one PTE at a time, and for one scattered page by page.
+//
+
+#include "FakeIrisXEGGTT.hpp"
+#include "xe_test.h"
+
+#include <algorithm>
+#include <vector>
+
+typedef std::vector<XEShimSegment> Segs;
+
+static const uint64_t kBarBytes   = 16 << 20;          // 8 MiB of registers, 8 MiB of PTEs
+static const uint64_t kFlushReg   = 0x101008;          // GFX_FLSH_CNTL_GEN6
+static const uint64_t kPTEFlags   = 0x3;               // present + writable
+static const uint64_t kJunk       = 0xBAD0000000000001ull;
+
+static uint64_t rngState = 0x9E3779B97F4A7C15ull;
+
+static inline uint64_t rnd()
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return rngState;
+}
+
+struct Bar {
+    uint8_t*     mem;
+    IOMemoryMap* map;
+
+    uint64_t* ptes() const { return (uint64_t*)(mem + kBarBytes / 2); }
+    uint32_t& flush() const { return *(uint32_t*)(mem + kFlushReg); }
+};
+
+static Bar newBar(uint64_t bytes)
+{
+    Bar b;
+    b.mem = (uint8_t*)IOMallocAligned(bytes, 4096);
+    memset(b.mem, 0, bytes / 2);
+    for (uint64_t i = 0; i < bytes / 2 / 8; ++i) ((uint64_t*)(b.mem + bytes / 2))[i] = kJunk;
+
+    IOMemoryDescriptor* md = IOMemoryDescriptor::withPhysicalAddress(
+        (IOPhysicalAddress)(uintptr_t)b.mem, bytes, kIODirectionInOut);
+    b.map = md->map();
+    md->release();          // the map keeps it
+    return b;
+}
+
+static void freeBar(Bar& b, uint64_t bytes)
+{
+    b.map->release();
+    IOFreeAligned(b.mem, bytes);
+}
+
+// segs' pages, bound at offset, have one PTE each
+static bool mapped(const Bar& b, uint64_t offset, const Segs& segs)
+{
+    uint32_t idx = (uint32_t)(offset / 4096);
+    for (const XEShimSegment& s : segs) {
+        for (uint64_t o = 0; o < s.len; o += 4096) {
+            if (b.ptes()[idx] != ((s.phys + o) | kPTEFlags)) {
+                fprintf(stderr, "  PTE %u: 0x%llx, want 0x%llx\n", idx,
+                        (unsigned long long)b.ptes()[idx], (unsigned long long)((s.phys + o) | kPTEFlags));
+                return false;
+            }
+            ++idx;
+        }
+    }
+    return true;
+}
+
+static bool allEqual(const Bar& b, uint64_t offset, uint64_t bytes, uint64_t value)
+{
+    for (uint64_t i = offset / 4096; i < (offset + bytes) / 4096; ++i)
+        if (b.ptes()[i] != value) return false;
+    return true;
+}
+
+// pages 4K pages, scattered, the last one partial
+static Segs scattered(uint32_t pages)
+{
+    Segs segs;
+    uint64_t phys = 1ull << 32;
+    for (uint32_t i = 0; i < pages; ++i) {
+        phys += (1 + rnd() % 64) * 4096;
+        segs.push_back({ phys, 4096 });
+        phys += 4096;
+    }
+    segs.back().len = 100;
+    return segs;
+}
+
+// A scanout buffer as the framebuffer allocates one: pages single 4K
+// pages in no particular order, none next to another
+static Segs scanoutPages(uint32_t pages)
+{
+    std::vector<uint32_t> slot(pages);
+    for (uint32_t i = 0; i < pages; ++i) slot[i] = i;
+    for (uint32_t i = pages - 1; i > 0; --i) std::swap(slot[i], slot[rnd() % (i + 1)]);
+
+    Segs segs;
+    for (uint32_t i = 0; i < pages; ++i) segs.push_back({ (1ull << 33) + slot[i] * 2ull * 4096, 4096 });
+    return segs;
+}
+
+static void checkInit()
+{
+    Bar b = newBar(kBarBytes);
+    IOPCIDevice* pci = new IOPCIDevice;
+    pci->init();
+
+    XE_CHECK(!FakeIrisXEGGTT::withDevice(nullptr, b.map));
+    XE_CHECK(!FakeIrisXEGGTT::withDevice(pci, nullptr));
+
+    // 8 MiB of PTEs map 4 GiB, the most the GGTT covers
+    FakeIrisXEGGTT* gtt = FakeIrisXEGGTT::withDevice(pci, b.map);
+    XE_CHECK(gtt != nullptr);
+    XE_CHECK_EQ(gtt->getSize(), 4ull << 30);
+    XE_CHECK_EQ(b.map->getRetainCount(), 2);
+    gtt->release();
+    XE_CHECK_EQ(b.map->getRetainCount(), 1);
+
+    // Under 1 MiB of PTEs
+    Bar small = newBar(1 << 20);
+    XE_CHECK(!FakeIrisXEGGTT::withDevice(pci, small.map));
+    freeBar(small, 1 << 20);
+
+    pci->release();
+    freeBar(b, kBarBytes);
+}
+
+static void checkBind()
+{
+    Bar b = newBar(kBarBytes);
+    IOPCIDevice* pci = new IOPCIDevice;
+    pci->init();
+    FakeIrisXEGGTT* gtt = FakeIrisXEGGTT::withDevice(pci, b.map);
+    const uint64_t G = FakeIrisXEGGTT::kPageSize;
+
+    // Scattered pages and a guard: each page its PTE, the guard cleared
+    // of the junk it held, the PTE after the guard untouched
+    Segs a = scattered(37);
+    IOMemoryDescriptor* mdA = xe_shim_md(a);
+    uint64_t offA = 0;
+    b.flush() = 0;
+    XE_CHECK_EQ(gtt->bind(mdA, G, &offA, 2 * G), kIOReturnSuccess);
+    XE_CHECK(mapped(b, offA, a));
+    XE_CHECK(allEqual(b, offA + 37 * G, 2 * G, 0));
+    XE_CHECK_EQ(b.ptes()[offA / G + 39], kJunk);
+    XE_CHECK_EQ(b.flush(), 1);
+
+    // The guard is never handed out: the next bind starts after it
+    Segs c = { { 0x80000000, 64 * G } };
+    IOMemoryDescriptor* mdC = xe_shim_md(c);
+    uint64_t offC = 0;
+    XE_CHECK_EQ(gtt->bind(mdC, FakeIrisXEGGTT::kScanoutAlign, &offC, FakeIrisXEGGTT::kScanoutGuard), kIOReturnSuccess);
+    XE_CHECK_EQ(offC & (FakeIrisXEGGTT::kScanoutAlign - 1), 0);
+    XE_CHECK(offC >= offA + 39 * G);
+    XE_CHECK(mapped(b, offC, c));
+    XE_CHECK_EQ(b.ptes()[offC / G + 64], 0);
+
+    // Unbind zeroes the range and its guard, and only that
+    b.flush() = 0;
+    XE_CHECK_EQ(gtt->unbind(offA), kIOReturnSuccess);
+    XE_CHECK(allEqual(b, offA, 39 * G, 0));
+    XE_CHECK_EQ(b.flush(), 1);
+    XE_CHECK(mapped(b, offC, c));
+    XE_CHECK_EQ(gtt->unbind(offA), kIOReturnNotFound);
+    XE_CHECK_EQ(gtt->unbind(offA + G), kIOReturnNotFound);
+
+    // A rebind lands at the same, lowest, offset: fresh PTEs throughout,
+    // its own guard cleared again
+    memset(b.ptes() + offA / G, 0xEE, 39 * 8);
+    Segs d = scattered(30);
+    IOMemoryDescriptor* mdD = xe_shim_md(d);
+    uint64_t offD = 1;
+    XE_CHECK_EQ(gtt->bind(mdD, G, &offD, G), kIOReturnSuccess);
+    XE_CHECK_EQ(offD, offA);
+    XE_CHECK(mapped(b, offD, d));
+    XE_CHECK_EQ(b.ptes()[offD / G + 30], 0);
+
+    // A page list with a hole: nothing stays bound, and the space is free
+    // for the next bind
+    IOMemoryDescriptor* mdBad = xe_shim_md({ { 0x1000, 4096 }, { 0x3800, 4096 } });
+    uint64_t offBad = 0;
+    XE_CHECK_EQ(gtt->bind(mdBad, G, &offBad), kIOReturnVMError);
+    uint64_t offE = 0;
+    XE_CHECK_EQ(gtt->bind(mdA, G, &offE), kIOReturnSuccess);
+    XE_CHECK(mapped(b, offE, a));
+    XE_CHECK_EQ(gtt->unbind(offE), kIOReturnSuccess);
+    XE_CHECK(allEqual(b, offE, 37 * G, 0));
+
+    // Bad arguments
+    XE_CHECK_EQ(gtt->bind(nullptr, G, &offE), kIOReturnBadArgument);
+    XE_CHECK_EQ(gtt->bind(mdA, 3000, &offE), kIOReturnBadArgument);
+    XE_CHECK_EQ(gtt->bind(mdA, G, nullptr), kIOReturnBadArgument);
+
+    XE_CHECK_EQ(gtt->unbind(offC), kIOReturnSuccess);
+    XE_CHECK_EQ(gtt->unbind(offD), kIOReturnSuccess);
+    XE_CHECK(allEqual(b, offC, 65 * G, 0) && allEqual(b, offD, 31 * G, 0));
+
+    gtt->release();
+    for (IOMemoryDescriptor* md : { mdA, mdC, mdD, mdBad }) md->release();
+    pci->release();
+    freeBar(b, kBarBytes);
+}
+
+// Three 1920x1080 scanout buffers, scattered, bound once each the way
+// the framebuffer's start does: aligned for the plane, every page its
+// PTE, each one's guard cleared, none overlapping another's guard
+static void checkScanout()
+{
+    Bar b = newBar(kBarBytes);
+    IOPCIDevice* pci = new IOPCIDevice;
+    pci->init();
+    FakeIrisXEGGTT* gtt = FakeIrisXEGGTT::withDevice(pci, b.map);
+    const uint64_t G = FakeIrisXEGGTT::kPageSize;
+    const uint32_t kPages = 1920 * 1080 * 4 / 4096;
+
+    Segs segs[3];
+    IOMemoryDescriptor* md[3];
+    uint64_t off[3];
+    for (int i = 0; i < 3; ++i) {
+        segs[i] = scanoutPages(kPages);
+        md[i] = xe_shim_md(segs[i]);
+        XE_CHECK_EQ(gtt->bind(md[i], FakeIrisXEGGTT::kScanoutAlign, &off[i], FakeIrisXEGGTT::kScanoutGuard),
+                    kIOReturnSuccess);
+        XE_CHECK_EQ(off[i] & (FakeIrisXEGGTT::kScanoutAlign - 1), 0);
+        XE_CHECK(allEqual(b, off[i] + kPages * G, FakeIrisXEGGTT::kScanoutGuard, 0));
+        if (i) XE_CHECK(off[i] >= off[i - 1] + kPages * G + FakeIrisXEGGTT::kScanoutGuard);
+    }
+    for (int i = 0; i < 3; ++i) XE_CHECK(mapped(b, off[i], segs[i]));
+
+    for (int i = 0; i < 3; ++i) {
+        XE_CHECK_EQ(gtt->unbind(off[i]), kIOReturnSuccess);
+        md[i]->release();
+    }
+    gtt->release();
+    pci->release();
+    freeBar(b, kBarBytes);
+}
+
+// What binding used to do: each PTE written, read back and logged. The
+// log line is dropped here, and a read of heap memory is a cache hit
+// where one of GTTMMADR is an uncached round trip, so this flatters it.
+static void bindPerPTE(const Bar& b, uint32_t first, const Segs& segs)
+{
+    volatile uint64_t* ptes = b.ptes();
+    uint32_t idx = first;
+    for (const XEShimSegment& s : segs) {
+        for (uint64_t o = 0; o < s.len; o += 4096, ++idx) {
+            ptes[idx] = (s.phys + o) | kPTEFlags;
+            uint64_t verify = ptes[idx];
+            (void)verify;
+        }
+    }
+}
+
+// A 1920x1080 scanout, as the framebuffer binds it, and the same PTEs
+// written the way they were before binds were batched
+static void bench()
+{
+    Bar b = newBar(kBarBytes);
+    IOPCIDevice* pci = new IOPCIDevice;
+    pci->init();
+    FakeIrisXEGGTT* gtt = FakeIrisXEGGTT::withDevice(pci, b.map);
+
+    const uint64_t kBytes = (1920ull * 1080 * 4 + 0xFFFF) & ~0xFFFFull;
+    const Segs segs = { { 0x80000000, kBytes } };
+    IOMemoryDescriptor* md = xe_shim_md(segs);
+    const int kIters = 200;
+    IOMemoryDescriptor* scattered = xe_shim_md(scanoutPages((uint32_t)(kBytes / 4096)));
+    double bindNs = 0, unbindNs = 0, perPTENs = 0, scatteredNs = 0;
+
+    for (int i = 0; i < kIters; ++i) {
+        uint64_t off;
+        double t0 = xe_now_ns();
+        XE_CHECK_EQ(gtt->bind(md, FakeIrisXEGGTT::kScanoutAlign, &off, FakeIrisXEGGTT::kScanoutGuard),
+                    kIOReturnSuccess);
+        double t1 = xe_now_ns();
+        XE_CHECK_EQ(gtt->unbind(off), kIOReturnSuccess);
+        bindNs += t1 - t0;
+        unbindNs += xe_now_ns() - t1;
+
+        double t2 = xe_now_ns();
+        bindPerPTE(b, (uint32_t)(off / 4096), segs);
+        perPTENs += xe_now_ns() - t2;
+
+        double t3 = xe_now_ns();
+        XE_CHECK_EQ(gtt->bind(scattered, FakeIrisXEGGTT::kScanoutAlign, &off, FakeIrisXEGGTT::kScanoutGuard),
+                    kIOReturnSuccess);
+        scatteredNs += xe_now_ns() - t3;
+        XE_CHECK_EQ(gtt->unbind(off), kIOReturnSuccess);
+    }
+
+    printf("  %llu KiB scanout, %llu PTEs: bind %.1f us, unbind %.1f us; per-PTE read-back %.1f us\n",
+           (unsigned long long)(kBytes >> 10), (unsigned long long)(kBytes / 4096),
+           bindNs / kIters / 1e3, unbindNs / kIters / 1e3, perPTENs / kIters / 1e3);
+    printf("  the same, one 4K page per segment: bind %.1f us\n", scatteredNs / kIters / 1e3);
+
+    gtt->release();
+    md->release();
+    scattered->release();
+    pci->release();
+    freeBar(b, kBarBytes);
+}
+
+int main()
+{
+    checkInit();
+    checkBind();
+    checkScanout();
+    bench();
+    XE_CHECK_EQ(xe_shim_live_objects, 0);
+    XE_CHECK_EQ(xe_shim_aligned_bytes, 0);
+    return xe_test_result("test_ggtt");
+}
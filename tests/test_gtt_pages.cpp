@@ -0,0 +1,215 @@
+//
+// GTT page-size selection (FakeIrisXEGTTPages.hpp) on synthetic segment
+// lists: the leaves a binder writes, walking runs the way
+// FakeIrisXEPPGTT::writeRange() and FakeIrisXEGGTT::writePTEs() do.
+// Fixed layouts check the entry counts; random ones check every leaf is
+// aligned on both sides, inside its run, and the largest that fits.
+//
+
+#include "FakeIrisXEGTTPages.hpp"
+#include "xe_test.h"
+
+static const uint64_t kPPGTTSizes = XE_GTT_4K | XE_GTT_64K | XE_GTT_2M;
+static const uint64_t kGGTTSizes  = XE_GTT_4K;
+
+static uint64_t rngState = 0xD1B54A32D192ED03ull;
+
+static inline uint64_t rnd()
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return rngState;
+}
+
+struct Leaves {
+    uint32_t n4k, n64k, n2m;
+    uint32_t bad;       // leaves that broke a rule
+    bool     ok;        // every offset had a usable run
+
+    uint32_t total() const { return n4k + n64k + n2m; }
+};
+
+// Every leaf for md mapped at gtt
+static Leaves plan(IOMemoryDescriptor* md, uint64_t gtt, uint64_t sizes)
+{
+    Leaves l = {};
+    uint64_t length = md->getLength(), offset = 0;
+
+    l.ok = true;
+    while (offset < length) {
+        uint64_t phys, run;
+        if (!xe_gtt_md_run(md, offset, &phys, &run)) {
+            l.ok = false;
+            break;
+        }
+        run = MIN(run, length - offset);
+
+        while (run) {
+            uint64_t va = gtt + offset;
+            uint64_t pg = xe_gtt_page_size(va, phys, run, sizes);
+
+            // Aligned, inside the run (bar a partial last 4K page) and no
+            // allowed larger size would have fit
+            bool good = !((va | phys) & (pg - 1)) && (pg <= run || pg == XE_GTT_4K) && (sizes & pg);
+            for (uint64_t big = pg << 1; big <= XE_GTT_2M; big <<= 1)
+                if ((sizes & big) && run >= big && !((va | phys) & (big - 1))) good = false;
+            l.bad += !good;
+
+            if (pg == XE_GTT_2M) ++l.n2m;
+            else if (pg == XE_GTT_64K) ++l.n64k;
+            else ++l.n4k;
+
+            uint64_t step = MIN(pg, run);
+            offset += step;
+            phys += step;
+            run -= step;
+        }
+    }
+    return l;
+}
+
+static Leaves planList(const std::vector<XEShimSegment>& segs, uint64_t gtt, uint64_t sizes)
+{
+    IOMemoryDescriptor* md = xe_shim_md(segs);
+    Leaves l = plan(md, gtt, sizes);
+    md->release();
+    return l;
+}
+
+static void checkPageSize()
+{
+    XE_CHECK_EQ(xe_gtt_page_size(0, 0, 4 << 20, kPPGTTSizes), XE_GTT_2M);
+    XE_CHECK_EQ(xe_gtt_page_size(0, 0, 4 << 20, kGGTTSizes), XE_GTT_4K);
+    XE_CHECK_EQ(xe_gtt_page_size(0, 0, 4 << 20, XE_GTT_4K | XE_GTT_64K), XE_GTT_64K);
+    XE_CHECK_EQ(xe_gtt_page_size(0, 0, (2 << 20) - 4096, kPPGTTSizes), XE_GTT_64K);
+    XE_CHECK_EQ(xe_gtt_page_size(0, 0, 0xF000, kPPGTTSizes), XE_GTT_4K);
+    XE_CHECK_EQ(xe_gtt_page_size(0x10000, 0x210000, 4 << 20, kPPGTTSizes), XE_GTT_64K);   // 2M misaligned both
+    XE_CHECK_EQ(xe_gtt_page_size(0x200000, 0x210000, 4 << 20, kPPGTTSizes), XE_GTT_64K); // phys only 64K
+    XE_CHECK_EQ(xe_gtt_page_size(0x201000, 0x200000, 4 << 20, kPPGTTSizes), XE_GTT_4K);  // GTT only 4K
+    XE_CHECK_EQ(xe_gtt_page_size(0, 0, 100, kPPGTTSizes), XE_GTT_4K);
+
+    XE_CHECK_EQ(xe_gtt_run_align(0x40000000, 8 << 20, kPPGTTSizes), XE_GTT_2M);
+    XE_CHECK_EQ(xe_gtt_run_align(0x40010000, 8 << 20, kPPGTTSizes), XE_GTT_64K);
+    XE_CHECK_EQ(xe_gtt_run_align(0x40000000, 0x8000, kPPGTTSizes), XE_GTT_4K);
+    XE_CHECK_EQ(xe_gtt_run_align(0x40000000, 8 << 20, kGGTTSizes), XE_GTT_4K);
+}
+
+static void checkMdRun()
+{
+    // Adjacent segments listed separately merge; a gap ends the run
+    IOMemoryDescriptor* md = xe_shim_md({ { 0x100000, 0x3000 }, { 0x103000, 0x5000 },
+                                          { 0x200000, 0x1000 } });
+    uint64_t phys = 0, len = 0;
+    XE_CHECK(xe_gtt_md_run(md, 0, &phys, &len));
+    XE_CHECK_EQ(phys, 0x100000);
+    XE_CHECK_EQ(len, 0x8000);
+    XE_CHECK(xe_gtt_md_run(md, 0x4000, &phys, &len));
+    XE_CHECK_EQ(phys, 0x104000);
+    XE_CHECK_EQ(len, 0x4000);
+    XE_CHECK(xe_gtt_md_run(md, 0x8000, &phys, &len));
+    XE_CHECK_EQ(phys, 0x200000);
+    XE_CHECK_EQ(len, 0x1000);
+    XE_CHECK(!xe_gtt_md_run(md, 0x9000, &phys, &len));
+    md->release();
+
+    // Not page aligned
+    md = xe_shim_md({ { 0x100800, 0x2000 } });
+    XE_CHECK(!xe_gtt_md_run(md, 0, &phys, &len));
+    md->release();
+}
+
+static void checkLayouts()
+{
+    // 8 MiB, 2M-aligned and contiguous: four 2M leaves, or 2048 GGTT PTEs
+    Leaves l = planList({ { 0x40000000, 8 << 20 } }, 0, kPPGTTSizes);
+    XE_CHECK(l.ok && !l.bad && l.n2m == 4 && l.total() == 4);
+    l = planList({ { 0x40000000, 8 << 20 } }, 0, kGGTTSizes);
+    XE_CHECK(l.ok && !l.bad && l.n4k == 2048 && l.total() == 2048);
+
+    // Same memory as 4K segments: merged back into 2M leaves
+    std::vector<XEShimSegment> pages;
+    for (uint64_t o = 0; o < (8 << 20); o += 4096) pages.push_back({ 0x40000000 + o, 4096 });
+    l = planList(pages, 0, kPPGTTSizes);
+    XE_CHECK(l.ok && !l.bad && l.n2m == 4 && l.total() == 4);
+
+    // 2M at a 64K-aligned address: thirty-two 64K leaves
+    l = planList({ { 0x40010000, 2 << 20 } }, 0x10000, kPPGTTSizes);
+    XE_CHECK(l.ok && !l.bad && l.n64k == 32 && l.total() == 32);
+
+    // GTT and phys disagree past 4K: 4K all the way
+    l = planList({ { 0x40001000, 2 << 20 } }, 0, kPPGTTSizes);
+    XE_CHECK(l.ok && !l.bad && l.n4k == 512 && l.total() == 512);
+
+    // 4K head up to 64K alignment, 64K body, 4K tail
+    l = planList({ { 0x40001000, 0x100000 } }, 0x1000, kPPGTTSizes);
+    XE_CHECK(l.ok && !l.bad && l.n4k == 15 + 1 && l.n64k == 15);
+
+    // The 64 KiB-aligned framebuffer: 1920x1080x4 rounded up to 64K
+    uint64_t fb = ((1920ull * 1080 * 4) + 0xFFFF) & ~0xFFFFull;
+    l = planList({ { 0x80000000, fb } }, 0, kPPGTTSizes);
+    XE_CHECK(l.ok && !l.bad && l.n2m == 3 && l.n64k == (fb - (6 << 20)) / 0x10000 && l.n4k == 0);
+    l = planList({ { 0x80000000, fb } }, 0, kGGTTSizes);
+    XE_CHECK(l.ok && l.total() == fb / 4096);
+
+    // Partial last page still gets an entry
+    l = planList({ { 0x40000000, 0x10000 }, { 0x50000000, 100 } }, 0, kPPGTTSizes);
+    XE_CHECK(l.ok && !l.bad && l.n64k == 1 && l.n4k == 1);
+
+    // A hole in the list stops the walk
+    IOMemoryDescriptor* md = xe_shim_md({ { 0x40000000, 0x1000 }, { 0x40000800, 0x1000 } });
+    XE_CHECK(!plan(md, 0, kPPGTTSizes).ok);
+    md->release();
+}
+
+// Random segment lists, some runs contiguous for megabytes, some scattered
+static void checkRandom()
+{
+    uint32_t bad = 0, saved = 0, pages = 0;
+
+    for (int iter = 0; iter < 2000; ++iter) {
+        std::vector<XEShimSegment> segs;
+        uint64_t phys = (rnd() % 4096) << 21;
+        uint32_t nSegs = 1 + rnd() % 24;
+
+        for (uint32_t i = 0; i < nSegs; ++i) {
+            switch (rnd() % 4) {
+            case 0:  phys += (rnd() % 16) << 12; break;     // 4K-aligned jump
+            case 1:  phys = (phys + 0xFFFF) & ~0xFFFFull; break;
+            case 2:  break;                                 // contiguous with the last
+            default: phys = ((phys >> 21) + 1 + rnd() % 8) << 21; break;
+            }
+            uint64_t len = (1 + rnd() % ((rnd() & 1) ? 16 : 1024)) << 12;
+            segs.push_back({ phys, len });
+            phys += len;
+        }
+
+        uint64_t align = xe_gtt_run_align(segs[0].phys, segs[0].len, kPPGTTSizes);
+        uint64_t gtt = ((rnd() % 1024) << 21) + align * (rnd() % 4);
+
+        Leaves pp = planList(segs, gtt, kPPGTTSizes);
+        Leaves gg = planList(segs, gtt, kGGTTSizes);
+        XE_CHECK(pp.ok && gg.ok);
+        bad += pp.bad + gg.bad;
+        XE_CHECK_EQ(gg.total(), gg.n4k);
+
+        // Same bytes covered either way
+        XE_CHECK_EQ((uint64_t)pp.n4k + pp.n64k * 16ull + pp.n2m * 512ull, gg.n4k);
+        pages += gg.n4k;
+        saved += gg.n4k - pp.total();
+    }
+
+    XE_CHECK_EQ(bad, 0);
+    printf("  random layouts: %u pages, %.1f%% fewer entries with 64K/2M leaves\n",
+           pages, 100.0 * saved / pages);
+}
+
+int main()
+{
+    checkPageSize();
+    checkMdRun();
+    checkLayouts();
+    checkRandom();
+    XE_CHECK_EQ(xe_shim_live_objects, 0);
+    return xe_test_result("test_gtt_pages");
+}
@@ -0,0 +1,172 @@
+//
+// XEHandleTable: lookups against a model under random insert/remove,
+// stale handles never resolving, the generation wrap (a handle is not
+// handed out again until kRetireGrace removes later), and the slot limit.
+// Then lookup and create/destroy cost with 1, 64 and 4096 live entries,
+// next to the linear scan the context list used to do.
+//
+
+#include "FakeIrisXEHandleTable.hpp"
+#include "xe_test.h"
+
+#include <unordered_map>
+#include <vector>
+
+struct Obj { uint32_t id; };
+
+typedef XEHandleTable<Obj, 4096> Table;
+
+static uint32_t rngState = 0x9E3779B9;
+
+static inline uint32_t rnd()
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+static void checkModel()
+{
+    Table t;
+    std::vector<Obj> objs(4096);
+    std::vector<uint32_t> live, dead;
+
+    XE_CHECK(t.lookup(Table::kInvalid) == nullptr);
+    XE_CHECK(t.insert(nullptr) == Table::kInvalid);
+
+    for (int op = 0; op < 200000; ++op) {
+        bool add = live.empty() || (live.size() < 3000 && (rnd() & 1));
+        if (add) {
+            Obj* o = &objs[rnd() % objs.size()];
+            uint32_t h = t.insert(o);
+            XE_CHECK(h != Table::kInvalid);
+            XE_CHECK(t.lookup(h) == o);
+            live.push_back(h);
+        } else {
+            uint32_t i = rnd() % live.size();
+            uint32_t h = live[i];
+            Obj* o = t.lookup(h);
+            XE_CHECK(o && t.remove(h) == o);
+            XE_CHECK(t.lookup(h) == nullptr && t.remove(h) == nullptr);
+            live[i] = live.back();
+            live.pop_back();
+            dead.push_back(h);
+        }
+        XE_CHECK_EQ(t.count(), live.size());
+    }
+
+    // Every handle removed along the way stays dead
+    uint32_t stale = 0;
+    for (uint32_t h : dead) stale += t.lookup(h) != nullptr;
+    XE_CHECK_EQ(stale, 0);
+
+    uint32_t seen = 0;
+    t.forEach([&](uint32_t h, Obj* o) { seen += t.lookup(h) == o; });
+    XE_CHECK_EQ(seen, live.size());
+
+    t.reset();
+    XE_CHECK_EQ(t.count(), 0);
+    for (uint32_t h : live) XE_CHECK(t.lookup(h) == nullptr);
+}
+
+// One live entry churned through a small table, long enough to wrap every
+// slot's generation several times over
+static void checkWrap()
+{
+    XEHandleTable<Obj, 64> t;
+    Obj o;
+    std::unordered_map<uint32_t, uint32_t> removedAt;   // handle -> remove count
+    uint32_t removes = 0, early = 0, reissued = 0;
+
+    for (uint32_t i = 0; i < (1u << 21); ++i) {
+        uint32_t h = t.insert(&o);
+        if (h == Table::kInvalid) {
+            XE_CHECK(h != Table::kInvalid);
+            return;
+        }
+        auto it = removedAt.find(h);
+        if (it != removedAt.end()) {
+            ++reissued;
+            early += removes - it->second < Table::kRetireGrace;
+        }
+
+        XE_CHECK(t.remove(h) == &o);
+        removedAt[h] = ++removes;
+    }
+
+    XE_CHECK_EQ(early, 0);
+    XE_CHECK(reissued > 0);      // the wrap path actually ran
+}
+
+static void checkFull()
+{
+    XEHandleTable<Obj, 128> t;
+    Obj o;
+    std::vector<uint32_t> hs;
+    for (uint32_t i = 0; i < 128; ++i) hs.push_back(t.insert(&o));
+    for (uint32_t h : hs) XE_CHECK(h != Table::kInvalid);
+    XE_CHECK_EQ(t.insert(&o), Table::kInvalid);
+
+    t.remove(hs[5]);
+    uint32_t h = t.insert(&o);
+    XE_CHECK(h != Table::kInvalid && h != hs[5]);
+    XE_CHECK_EQ(h & Table::kIndexMask, hs[5] & Table::kIndexMask);
+}
+
+static volatile uintptr_t sink;
+
+static void bench(uint32_t nLive)
+{
+    const uint32_t kLookups = 2000000, kChurn = 500000;
+
+    Table t;
+    std::vector<Obj> objs(nLive + 1);
+    std::vector<uint32_t> hs(nLive);
+    std::vector<std::pair<uint32_t, Obj*>> list(nLive);    // the old linear list
+    for (uint32_t i = 0; i < nLive; ++i) {
+        objs[i].id = i + 1;
+        hs[i] = t.insert(&objs[i]);
+        list[i] = { i + 1, &objs[i] };
+    }
+
+    std::vector<uint32_t> order(kLookups);
+    for (auto& i : order) i = rnd() % nLive;
+
+    uintptr_t acc = 0;
+    double t0 = xe_now_ns();
+    for (uint32_t i : order) acc += (uintptr_t)t.lookup(hs[i]);
+    double table = xe_now_ns() - t0;
+
+    uint32_t linearN = nLive > 64 ? kLookups / 64 : kLookups;    // it's slow
+    t0 = xe_now_ns();
+    for (uint32_t k = 0; k < linearN; ++k) {
+        uint32_t id = order[k] + 1;
+        for (auto& e : list)
+            if (e.first == id) { acc += (uintptr_t)e.second; break; }
+    }
+    double linear = (xe_now_ns() - t0) / linearN * kLookups;
+
+    // Create and destroy one entry with the rest live
+    t0 = xe_now_ns();
+    for (uint32_t i = 0; i < kChurn; ++i) {
+        uint32_t h = t.insert(&objs[nLive]);
+        acc += (uintptr_t)t.remove(h);
+    }
+    double churn = xe_now_ns() - t0;
+    sink = acc;
+
+    printf("  %4u live: lookup %5.1f ns (linear scan %7.1f ns), create+destroy %5.1f ns\n",
+           nLive, table / kLookups, linear / kLookups, churn / kChurn);
+}
+
+int main()
+{
+    checkModel();
+    checkWrap();
+    checkFull();
+    bench(1);
+    bench(64);
+    bench(4096);
+    return xe_test_result("test_handles");
+}
@@ -0,0 +1,324 @@
+//
+// FakeIrisXEPPGTT on host memory. The shim's buffers report their virtual
+// address as physical, so besides the kext's own translate() the test
+// walks the tables the way the GPU does, following each entry's address.
+// Checks every page of every bind against its segment list, the leaf
+// sizes picked, unbind clearing and freeing, freed tables held until
+// their TLB generation retires, failure cleanup, and a random
+// bind/unbind churn. Then bind/unbind cost for a large scattered
+// object.
+//
+
+#include "FakeIrisXEPPGTT.hpp"
+#include "xe_test.h"
+
+#include <vector>
+
+typedef std::vector<XEShimSegment> Segs;
+
+// Gen12 PPGTT entry bits, as the hardware defines them
+static const uint64_t kPresent = 1ull << 0;
+static const uint64_t kPS2M    = 1ull << 7;
+static const uint64_t kIPS64K  = 1ull << 11;
+static const uint64_t kAddr    = 0x0000FFFFFFFFF000ull;
+
+static uint64_t rngState = 0x8BADF00DDEADBEEFull;
+
+static inline uint64_t rnd()
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return rngState;
+}
+
+/**
+ * The GPU's walk from the PML4 at root: 0 if va isn't mapped. Table
+ * addresses are host pointers here.
+ */
+static uint64_t gpuWalk(uint64_t root, uint64_t va, uint64_t* pageSize)
+{
+    const uint64_t* table = (const uint64_t*)(uintptr_t)root;
+    for (uint32_t d = 0; d < 4; ++d) {
+        uint32_t shift = 39 - 9 * d;
+        uint64_t e = table[(va >> shift) & 511];
+        if (!(e & kPresent)) return 0;
+
+        if (d == 2 && (e & kPS2M)) {
+            *pageSize = XE_GTT_2M;
+            return (e & kAddr & ~(XE_GTT_2M - 1)) | (va & (XE_GTT_2M - 1));
+        }
+        if (d == 2 && (e & kIPS64K)) {
+            // Only every 16th PTE is read
+            const uint64_t* pt = (const uint64_t*)(uintptr_t)(e & kAddr);
+            uint64_t pte = pt[((va >> 12) & 511) & ~15u];
+            if (!(pte & kPresent)) return 0;
+            *pageSize = XE_GTT_64K;
+            return (pte & kAddr & ~(XE_GTT_64K - 1)) | (va & (XE_GTT_64K - 1));
+        }
+        if (d == 3) {
+            *pageSize = XE_GTT_4K;
+            return (e & kAddr) | (va & (XE_GTT_4K - 1));
+        }
+        table = (const uint64_t*)(uintptr_t)(e & kAddr);
+    }
+    return 0;
+}
+
+struct Leaves { uint32_t n4k, n64k, n2m; };
+
+// Every page of segs, bound at va, maps where it should by both walks
+static bool verify(FakeIrisXEPPGTT* vm, uint64_t va, const Segs& segs, Leaves* leaves = nullptr)
+{
+    for (const XEShimSegment& s : segs) {
+        uint64_t len = (s.len + 4095) & ~4095ull;
+        for (uint64_t o = 0; o < len; o += 4096) {
+            uint64_t pa = 0, pg = 0, gpuPg = 0;
+            bool ok = vm->translate(va + o, &pa, &pg) && pa == s.phys + o &&
+                      gpuWalk(vm->getRootPhys(), va + o, &gpuPg) == s.phys + o && gpuPg == pg;
+            if (!ok) {
+                fprintf(stderr, "  va 0x%llx: got 0x%llx (%llu KiB), want 0x%llx\n",
+                        (unsigned long long)(va + o), (unsigned long long)pa,
+                        (unsigned long long)(pg >> 10), (unsigned long long)(s.phys + o));
+                return false;
+            }
+            if (leaves && !((va + o) & (pg - 1))) {
+                if (pg == XE_GTT_2M) ++leaves->n2m;
+                else if (pg == XE_GTT_64K) ++leaves->n64k;
+                else ++leaves->n4k;
+            }
+        }
+        va += len;
+    }
+    return true;
+}
+
+static bool unmapped(FakeIrisXEPPGTT* vm, uint64_t va, uint64_t len)
+{
+    uint64_t pa, pg;
+    for (uint64_t o = 0; o < len; o += 4096)
+        if (vm->translate(va + o, &pa) || gpuWalk(vm->getRootPhys(), va + o, &pg)) return false;
+    return true;
+}
+
+static uint64_t bytes(const Segs& segs)
+{
+    uint64_t n = 0;
+    for (const XEShimSegment& s : segs) n += (s.len + 4095) & ~4095ull;
+    return n;
+}
+
+// bytes of chunk-sized pieces, chunk-aligned, scattered over 1 TiB
+static Segs scattered(uint64_t total, uint64_t chunk)
+{
+    Segs segs;
+    uint64_t phys = 1ull << 32;
+    for (uint64_t n = 0; n < total; n += chunk) {
+        phys += (1 + rnd() % 64) * chunk;
+        segs.push_back({ phys, chunk });
+        phys += chunk;
+    }
+    return segs;
+}
+
+static void checkBinds()
+{
+    FakeIrisXEPPGTT* vm = FakeIrisXEPPGTT::withSize(FakeIrisXEPPGTT::kMaxBytes);
+    XE_CHECK(vm && vm->getRootPhys());
+    XE_CHECK(!FakeIrisXEPPGTT::withSize(3 << 20));          // not a multiple of 2 MiB
+    uint64_t pa, va;
+
+    // 8 MiB, contiguous and 2M-aligned: four 2M leaves at a 2M address
+    Segs big = { { 0x40000000, 8 << 20 } };
+    IOMemoryDescriptor* mdBig = xe_shim_md(big);
+    XE_CHECK_EQ(vm->bind(mdBig, 4096, &va), kIOReturnSuccess);
+    XE_CHECK(va >= (2 << 20) && !(va & (XE_GTT_2M - 1)));
+    XE_CHECK_EQ(mdBig->getRetainCount(), 2);
+    Leaves l = {};
+    XE_CHECK(verify(vm, va, big, &l));
+    XE_CHECK(l.n2m == 4 && l.n64k == 0 && l.n4k == 0);
+    uint64_t vaBig = va;
+
+    // 2 MiB of scattered 64K pieces: one full PT, read with IPS
+    Segs s64 = scattered(2 << 20, XE_GTT_64K);
+    IOMemoryDescriptor* md64 = xe_shim_md(s64);
+    XE_CHECK_EQ(vm->bind(md64, 4096, &va), kIOReturnSuccess);
+    l = {};
+    XE_CHECK(verify(vm, va, s64, &l));
+    XE_CHECK(l.n64k == 32 && l.n4k == 0);
+
+    // Scattered 4K pages, the last one partial
+    Segs s4 = scattered(300 * 4096, 4096);
+    s4.back().len = 100;
+    IOMemoryDescriptor* md4 = xe_shim_md(s4);
+    XE_CHECK_EQ(vm->bind(md4, 4096, &va), kIOReturnSuccess);
+    XE_CHECK(verify(vm, va, s4));
+    uint64_t va4 = va;
+
+    // Physically 4K off 64K alignment: whatever mix of leaves the address
+    // it lands at allows, covering every page once
+    Segs mix = { { 0x80001000, 1 << 20 } };
+    IOMemoryDescriptor* mdMix = xe_shim_md(mix);
+    XE_CHECK_EQ(vm->bind(mdMix, 4096, &va), kIOReturnSuccess);
+    l = {};
+    XE_CHECK(verify(vm, va, mix, &l));
+    XE_CHECK_EQ(l.n4k + 16 * l.n64k, 256);
+
+    // Unbind clears only its own range and drops its reference
+    XE_CHECK_EQ(vm->unbind(vaBig), kIOReturnSuccess);
+    XE_CHECK_EQ(mdBig->getRetainCount(), 1);
+    XE_CHECK(unmapped(vm, vaBig, 8 << 20));
+    XE_CHECK_EQ(vm->unbind(vaBig), kIOReturnNotFound);
+    XE_CHECK_EQ(vm->unbind(0), kIOReturnNotFound);
+    XE_CHECK(verify(vm, va4, s4));
+    XE_CHECK_EQ(vm->getTLBGeneration(), 1);
+
+    // Bad arguments, and a page list with a hole: nothing left behind
+    XE_CHECK_EQ(vm->bind(nullptr, 4096, &va), kIOReturnBadArgument);
+    XE_CHECK_EQ(vm->bind(md4, 3000, &va), kIOReturnBadArgument);
+    IOMemoryDescriptor* mdBad = xe_shim_md({ { 0x1000, 4096 }, { 0x3800, 4096 } });
+    XE_CHECK_EQ(vm->bind(mdBad, 4096, &va), kIOReturnVMError);
+    XE_CHECK_EQ(mdBad->getRetainCount(), 1);
+    XE_CHECK(!vm->translate(0, &pa));
+
+    vm->release();
+    XE_CHECK_EQ(md64->getRetainCount(), 1);
+    for (IOMemoryDescriptor* md : { mdBig, md64, md4, mdMix, mdBad }) md->release();
+}
+
+// Physical pages of the PDP, PD and PT the GPU walks through for va
+static std::vector<uint64_t> tablePages(FakeIrisXEPPGTT* vm, uint64_t va)
+{
+    std::vector<uint64_t> pages;
+    const uint64_t* table = (const uint64_t*)(uintptr_t)vm->getRootPhys();
+    for (uint32_t d = 0; d < 3; ++d) {
+        uint64_t e = table[(va >> (39 - 9 * d)) & 511];
+        if (!(e & kPresent) || (d == 2 && (e & kPS2M))) break;
+        pages.push_back(e & kAddr);
+        table = (const uint64_t*)(uintptr_t)(e & kAddr);
+    }
+    return pages;
+}
+
+static bool sharesPage(const std::vector<uint64_t>& a, const std::vector<uint64_t>& b)
+{
+    for (uint64_t x : a)
+        for (uint64_t y : b)
+            if (x == y) return true;
+    return false;
+}
+
+// Tables an unbind frees stay cleared and out of reach of binds until
+// their TLB generation is retired
+static void checkRetire()
+{
+    FakeIrisXEPPGTT* vm = FakeIrisXEPPGTT::withSize(FakeIrisXEPPGTT::kMaxBytes);
+    IOMemoryDescriptor* md = xe_shim_md({ { 0x40000000, 4096 } });
+    uint64_t va;
+
+    XE_CHECK_EQ(vm->bind(md, 4096, &va), kIOReturnSuccess);
+    std::vector<uint64_t> first = tablePages(vm, va);
+    XE_CHECK_EQ(first.size(), 3);
+    XE_CHECK_EQ(vm->unbind(va), kIOReturnSuccess);
+    XE_CHECK_EQ(vm->getTLBGeneration(), 1);
+
+    // A stale walk still finds empty tables
+    bool clear = true;
+    for (uint64_t p : first)
+        for (uint32_t i = 0; i < 512; ++i) clear = clear && ((const uint64_t*)(uintptr_t)p)[i] == 0;
+    XE_CHECK(clear);
+
+    XE_CHECK_EQ(vm->bind(md, 4096, &va), kIOReturnSuccess);
+    std::vector<uint64_t> second = tablePages(vm, va);
+    XE_CHECK_EQ(second.size(), 3);
+    XE_CHECK(!sharesPage(first, second));
+    XE_CHECK_EQ(vm->unbind(va), kIOReturnSuccess);
+
+    // An older generation frees nothing; generation 1 frees the first
+    // tables only
+    vm->retireTLB(0);
+    XE_CHECK_EQ(vm->bind(md, 4096, &va), kIOReturnSuccess);
+    std::vector<uint64_t> third = tablePages(vm, va);
+    XE_CHECK(!sharesPage(third, first) && !sharesPage(third, second));
+    XE_CHECK_EQ(vm->unbind(va), kIOReturnSuccess);
+
+    vm->retireTLB(1);
+    XE_CHECK_EQ(vm->bind(md, 4096, &va), kIOReturnSuccess);
+    std::vector<uint64_t> fourth = tablePages(vm, va);
+    XE_CHECK(sharesPage(fourth, first) && !sharesPage(fourth, second));
+    XE_CHECK_EQ(vm->unbind(va), kIOReturnSuccess);
+
+    vm->retireTLB(vm->getTLBGeneration());
+    XE_CHECK_EQ(vm->bind(md, 4096, &va), kIOReturnSuccess);
+    XE_CHECK(verify(vm, va, { { 0x40000000, 4096 } }));
+
+    vm->release();
+    md->release();
+}
+
+// Random binds and unbinds, every live range rechecked as it goes
+static void checkChurn()
+{
+    FakeIrisXEPPGTT* vm = FakeIrisXEPPGTT::withSize(64ull << 30);
+
+    struct Bound { uint64_t va; Segs segs; };
+    std::vector<Bound> live;
+    uint32_t bad = 0;
+
+    for (int i = 0; i < 2000; ++i) {
+        if (live.empty() || rnd() % 3) {
+            uint64_t chunk = (rnd() % 3 == 0) ? XE_GTT_64K : (rnd() % 5 == 0 ? XE_GTT_2M : XE_GTT_4K);
+            Segs segs = scattered(chunk * (1 + rnd() % 40), chunk);
+            IOMemoryDescriptor* md = xe_shim_md(segs);
+            uint64_t va;
+            XE_CHECK_EQ(vm->bind(md, 4096ull << (rnd() % 4), &va), kIOReturnSuccess);
+            md->release();         // the space keeps it
+            live.push_back({ va, segs });
+        } else {
+            size_t k = rnd() % live.size();
+            bad += !verify(vm, live[k].va, live[k].segs);
+            XE_CHECK_EQ(vm->unbind(live[k].va), kIOReturnSuccess);
+            bad += !unmapped(vm, live[k].va, bytes(live[k].segs));
+            if (rnd() % 4 == 0) vm->retireTLB(vm->getTLBGeneration());
+            live[k] = live.back();
+            live.pop_back();
+        }
+    }
+    for (const Bound& b : live) bad += !verify(vm, b.va, b.segs);
+    XE_CHECK_EQ(bad, 0);
+    vm->release();
+}
+
+static void bench()
+{
+    const uint64_t kBytes = 256ull << 20;
+
+    for (uint64_t chunk : { (uint64_t)XE_GTT_4K, (uint64_t)XE_GTT_64K, (uint64_t)XE_GTT_2M }) {
+        FakeIrisXEPPGTT* vm = FakeIrisXEPPGTT::withSize(FakeIrisXEPPGTT::kMaxBytes);
+        IOMemoryDescriptor* md = xe_shim_md(scattered(kBytes, chunk));
+        uint64_t va;
+
+        double t0 = xe_now_ns();
+        XE_CHECK_EQ(vm->bind(md, 4096, &va), kIOReturnSuccess);
+        double t1 = xe_now_ns();
+        XE_CHECK_EQ(vm->unbind(va), kIOReturnSuccess);
+        vm->retireTLB(vm->getTLBGeneration());
+        double t2 = xe_now_ns();
+
+        printf("  256 MiB in %4llu KiB pieces: bind %6.2f ms, unbind %6.2f ms\n",
+               (unsigned long long)(chunk >> 10), (t1 - t0) / 1e6, (t2 - t1) / 1e6);
+        md->release();
+        vm->release();
+    }
+}
+
+int main()
+{
+    checkBinds();
+    checkRetire();
+    checkChurn();
+    bench();
+    XE_CHECK_EQ(xe_shim_live_objects, 0);
+    XE_CHECK_EQ(xe_shim_aligned_bytes, 0);
+    return xe_test_result("test_ppgtt");
+}
@@ -0,0 +1,146 @@
+//
+// XERangeAllocator against a brute-force page bitmap on a small space:
+// an allocation succeeds exactly when some aligned hole fits it (guard
+// included), never overlaps, and is the lowest such hole. Frees merge
+// back to one hole. Then allocate/free cost with tens of thousands of
+// live ranges in a fragmented space: 4 GiB with small alignments, and
+// 64 GiB with alignments up to 2 MiB.
+//
+
+#include "FakeIrisXERangeAllocator.hpp"
+#include "xe_test.h"
+
+#include <map>
+#include <vector>
+
+static uint64_t rngState = 0x2545F4914F6CDD1Dull;
+
+static inline uint32_t rnd()
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return (uint32_t)(rngState >> 32);
+}
+
+static const uint64_t G = 4096;
+
+static void checkModel()
+{
+    const uint64_t kPages = 512;
+    uint32_t notLowest = 0, allocs = 0;
+
+    for (int round = 0; round < 100; ++round) {
+        XERangeAllocator a;
+        XE_CHECK(a.init(kPages * G, G));
+        XE_CHECK_EQ(a.largestHole(), kPages * G);
+
+        std::map<uint64_t, uint64_t> live;      // start -> pages, guard included
+        std::vector<bool> used(kPages, false);
+
+        for (int op = 0; op < 2000; ++op) {
+            if (live.empty() || rnd() % 3) {
+                uint64_t size  = (1 + rnd() % 16) * G - (rnd() % 2 ? 100 : 0);
+                uint64_t align = G << (rnd() % 4 ? rnd() % 5 : rnd() % 12);   // past the last class too
+                uint64_t guard = (rnd() % 3) * G;
+                uint64_t pages = (size + G - 1) / G + guard / G;
+
+                int64_t lowest = -1;
+                for (uint64_t p = 0; p + pages <= kPages && lowest < 0; p += align / G) {
+                    bool fits = true;
+                    for (uint64_t k = 0; k < pages && fits; ++k) fits = !used[p + k];
+                    if (fits) lowest = (int64_t)p;
+                }
+
+                uint64_t start = 0;
+                bool ok = a.alloc(size, align, guard, &start, (void*)(uintptr_t)(op + 1));
+                XE_CHECK_EQ(ok, lowest >= 0);
+                if (!ok) continue;
+
+                ++allocs;
+                notLowest += start != (uint64_t)lowest * G;
+                XE_CHECK_EQ(start & (align - 1), 0);
+                for (uint64_t k = 0; k < pages; ++k) {
+                    XE_CHECK(start / G + k < kPages && !used[start / G + k]);
+                    used[start / G + k] = true;
+                }
+                live[start] = pages;
+            } else {
+                auto it = live.begin();
+                std::advance(it, rnd() % live.size());
+
+                uint64_t span = 0;
+                void* data = nullptr;
+                XE_CHECK(a.free(it->first, &span, &data));
+                XE_CHECK_EQ(span, it->second * G);
+                XE_CHECK(data != nullptr);
+                XE_CHECK(!a.free(it->first));
+                for (uint64_t k = 0; k < it->second; ++k) used[it->first / G + k] = false;
+                live.erase(it);
+            }
+            XE_CHECK_EQ(a.count(), live.size());
+        }
+
+        // forEach walks the same ranges, lowest first
+        auto it = live.begin();
+        bool same = true;
+        a.forEach([&](uint64_t start, uint64_t span, void*) {
+            same = same && it != live.end() && it->first == start && it->second * G == span;
+            ++it;
+        });
+        XE_CHECK(same && it == live.end());
+
+        XE_CHECK(!a.free(G / 2));
+        for (auto& r : live) a.free(r.first);
+        XE_CHECK_EQ(a.count(), 0);
+        XE_CHECK_EQ(a.largestHole(), kPages * G);
+    }
+
+    XE_CHECK_EQ(notLowest, 0);
+    XE_CHECK(allocs > 0);
+}
+
+static void bench(uint32_t alignShifts, uint64_t space)
+{
+    const uint32_t kFill = 50000, kChurn = 300000;
+
+    XERangeAllocator a;
+    a.init(space, G);
+    std::vector<uint64_t> live;
+    live.reserve(kFill + kChurn);
+
+    auto allocOne = [&] {
+        uint64_t start;
+        if (a.alloc((1 + rnd() % 16) * G, G << (rnd() % alignShifts), (rnd() % 2) * G, &start))
+            live.push_back(start);
+    };
+
+    double t0 = xe_now_ns();
+    for (uint32_t i = 0; i < kFill; ++i) allocOne();
+    double fill = xe_now_ns() - t0;
+
+    // Free a random range, allocate a new one: holes of every size pile up
+    t0 = xe_now_ns();
+    for (uint32_t i = 0; i < kChurn; ++i) {
+        size_t k = rnd() % live.size();
+        a.free(live[k]);
+        live[k] = live.back();
+        live.pop_back();
+        allocOne();
+    }
+    double churn = xe_now_ns() - t0;
+
+    printf("  %2llu GiB, align to %4llu KiB: fill %u: %.0f ns/alloc; churn %u: %.0f ns/(free+alloc), "
+           "%zu live, largest hole %llu MiB\n",
+           (unsigned long long)(space >> 30), (unsigned long long)((G << (alignShifts - 1)) >> 10), kFill, fill / kFill,
+           kChurn, churn / kChurn, live.size(),
+           (unsigned long long)(a.largestHole() >> 20));
+}
+
+int main()
+{
+    checkModel();
+    bench(4, 4ull << 30);
+    bench(10, 64ull << 30);
+    return xe_test_result("test_range");
+}
@@ -0,0 +1,292 @@
+//
+// SPSC ring stress test. A producer and a consumer thread run the
+// FakeIrisXEAccelShared.h protocol the way user space and drainRing()
+// do: xe_ring_reserve() with WRAP records, xe_ring_next() to decode,
+// acquire/release indices. The consumer checks every record arrives
+// exactly once, in order, intact, and never straddles the end of the
+// ring; checkDecode() feeds xe_ring_next() records no producer should write.
+// benchDecode() prices decoding in place against copying each record out.
+//
+
+#include "FakeIrisXEAccelShared.h"
+#include "xe_test.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <sched.h>
+
+static constexpr uint32_t kTestOp = 0x100;   // not a real opcode; carries a sequence number
+
+struct Ring {
+    XEHdr    hdr;
+    uint8_t* base;
+    uint32_t cap;
+};
+
+// Payload byte i of record seq
+static inline uint8_t pattern(uint32_t seq, uint32_t i) { return (uint8_t)(seq * 31u + i * 7u); }
+
+static uint32_t payloadBytes(uint32_t seq, uint32_t maxBytes)
+{
+    // Mostly small like real 2D commands, now and then a large one
+    uint32_t r = seq * 2654435761u;
+    return (r >> 28) == 0 ? (r >> 8) % (maxBytes + 1) : (r >> 8) % 65;
+}
+
+static void produce(Ring* ring, uint32_t count, uint32_t maxBytes)
+{
+    uint32_t head = 0;
+    for (uint32_t seq = 0; seq < count; ++seq) {
+        uint32_t bytes = payloadBytes(seq, maxBytes);
+        uint32_t total = xe_align(sizeof(XECmd) + bytes);
+
+        uint32_t off, next;
+        for (int spins = 0;; ++spins) {
+            uint32_t tail = xe_load_acquire(&ring->hdr.tail);
+            off = xe_ring_reserve(ring->base, ring->cap, head, tail, total, &next);
+            if (off != UINT32_MAX) break;
+            if (spins > 64) sched_yield();
+        }
+
+        XECmd cmd = { kTestOp, bytes, seq, 0 };
+        memcpy(ring->base + off, &cmd, sizeof(cmd));
+        for (uint32_t i = 0; i < bytes; ++i)
+            ring->base[off + sizeof(cmd) + i] = pattern(seq, i);
+
+        head = next;
+        xe_store_release(&ring->hdr.head, head);
+    }
+}
+
+// drainRing()'s decode (xe_ring_next), checking every record instead of
+// resyncing
+static uint32_t consume(Ring* ring, uint32_t count)
+{
+    uint32_t tail = 0, seq = 0, bad = 0;
+    int spins = 0;
+
+    while (seq < count && bad < 10) {
+        uint32_t head = xe_load_acquire(&ring->hdr.head);
+        if (head == tail) {
+            if (++spins > 64) sched_yield();
+            continue;
+        }
+        spins = 0;
+
+        while (tail != head && seq < count) {
+            XECmd cmd {};
+            uint32_t total = 0;
+            XERingNext next = xe_ring_next(ring->base, ring->cap, tail, head, &cmd, &total);
+            if (next == XE_RING_WRAP) {
+                tail += total;
+                continue;
+            }
+
+            uint32_t off = xe_ring_off(tail, ring->cap);
+            bool ok = next == XE_RING_RECORD && cmd.opcode == kTestOp && cmd.ctxId == seq;
+            for (uint32_t i = 0; ok && i < cmd.bytes; ++i)
+                ok = ring->base[off + sizeof(cmd) + i] == pattern(seq, i);
+            if (!ok) {
+                fprintf(stderr, "record %u: bad (opcode 0x%x seq %u bytes %u at %u)\n",
+                        seq, cmd.opcode, cmd.ctxId, cmd.bytes, off);
+                ++bad;
+                break;
+            }
+
+            ++seq;
+            tail += total;
+            xe_store_release(&ring->hdr.tail, tail);
+        }
+    }
+    return bad ? UINT32_MAX : seq;
+}
+
+// What a hostile or confused producer can leave at tail
+static void checkDecode()
+{
+    const uint32_t cap = 256;
+    alignas(XE_CMD_ALIGN) uint8_t ring[cap];
+    XECmd cmd;
+    uint32_t adv;
+
+    auto put = [&](uint32_t off, uint32_t opcode, uint32_t bytes) {
+        XECmd c = { opcode, bytes, 0, 0 };
+        memcpy(ring + off, &c, sizeof(c));
+    };
+
+    put(0, kTestOp, 20);
+    XE_CHECK_EQ(xe_ring_next(ring, cap, 0, 48, &cmd, &adv), XE_RING_RECORD);
+    XE_CHECK_EQ(adv, 48);
+    XE_CHECK_EQ(xe_ring_next(ring, cap, 0, 32, &cmd, &adv), XE_RING_BAD);      // past head
+    XE_CHECK_EQ(xe_ring_next(ring, cap, 8, 48, &cmd, &adv), XE_RING_BAD);      // misaligned tail
+
+    put(0, kTestOp, cap);                                                        // past the end
+    XE_CHECK_EQ(xe_ring_next(ring, cap, 0, cap, &cmd, &adv), XE_RING_BAD);
+    put(0, kTestOp, 0xFFFFFFF8u);                                                // total wraps 32 bits
+    XE_CHECK_EQ(xe_ring_next(ring, cap, 0, cap, &cmd, &adv), XE_RING_BAD);
+
+    // WRAP: padding to the end, only if the producer got that far
+    put(cap - 64, XE_CMD_WRAP, 0);
+    XE_CHECK_EQ(xe_ring_next(ring, cap, cap - 64, cap + 16, &cmd, &adv), XE_RING_WRAP);
+    XE_CHECK_EQ(adv, 64);
+    XE_CHECK_EQ(xe_ring_next(ring, cap, cap - 64, cap - 16, &cmd, &adv), XE_RING_BAD);
+
+    // Same offsets once the indices have gone round
+    put(16, kTestOp, 0);
+    XE_CHECK_EQ(xe_ring_next(ring, cap, 5 * cap + 16, 5 * cap + 32, &cmd, &adv), XE_RING_RECORD);
+    XE_CHECK_EQ(adv, 16);
+}
+
+// Records over half the ring are refused, even into an empty ring
+static void checkLimit(uint32_t cap)
+{
+    static uint8_t ring[XE_RING_MIN_BYTES];
+    uint32_t next, limit = xe_ring_max_record(cap);
+    for (uint32_t head = 0; head < cap; head += XE_CMD_ALIGN) {
+        XE_CHECK(xe_ring_reserve(ring, cap, head, head, limit, &next) != UINT32_MAX);
+        XE_CHECK_EQ(xe_ring_reserve(ring, cap, head, head, limit + XE_CMD_ALIGN, &next), UINT32_MAX);
+    }
+}
+
+// Per-command decode cost, in place as drainRing() does it, against the
+// copy-out it replaced: header, then payload, each split at the end of
+// the ring into a 256-byte stack buffer. The payload's first and last
+// words stand in for the handler reading it.
+static void benchDecode()
+{
+    const uint32_t cap = XE_RING_MIN_BYTES;
+    uint8_t* ring = (uint8_t*)aligned_alloc(XE_CACHELINE, cap);
+    const int kPasses = 2000;
+
+    struct Mix { const char* name; uint32_t ops[4]; };
+    const Mix mixes[] = {
+        { "CLEAR",   { XE_CMD_CLEAR, XE_CMD_CLEAR, XE_CMD_CLEAR, XE_CMD_CLEAR } },
+        { "RECT",    { XE_CMD_RECT, XE_CMD_RECT, XE_CMD_RECT, XE_CMD_RECT } },
+        { "PRESENT", { XE_CMD_PRESENT, XE_CMD_PRESENT, XE_CMD_PRESENT, XE_CMD_PRESENT } },
+        { "mixed",   { XE_CMD_RECT, XE_CMD_RECT, XE_CMD_CLEAR, XE_CMD_PRESENT } },
+    };
+    auto bytesOf = [](uint32_t op) -> uint32_t {
+        switch (op) {
+            case XE_CMD_CLEAR: return sizeof(XEClearPayload);
+            case XE_CMD_RECT:  return sizeof(XERectPayload);
+            default:           return sizeof(XEPresentPayload) + 4 * sizeof(XEDamageRect);
+        }
+    };
+
+    for (const Mix& mix : mixes) {
+        // Fill the ring once, WRAP records and all; both decoders then
+        // go round it kPasses times
+        memset(ring, 0, cap);
+        uint32_t head = 0, records = 0;
+        for (uint32_t i = 0; ; ++i) {
+            uint32_t op = mix.ops[i % 4], bytes = bytesOf(op), next;
+            uint32_t off = xe_ring_reserve(ring, cap, head, 0, xe_align(sizeof(XECmd) + bytes), &next);
+            if (off == UINT32_MAX) break;
+            XECmd cmd = { op, bytes, 0, 0 };
+            memcpy(ring + off, &cmd, sizeof(cmd));
+            memset(ring + off + sizeof(cmd), (int)i, bytes);
+            head = next;
+            ++records;
+        }
+
+        volatile uint32_t sink = 0;
+        double t0 = xe_now_ns();
+        for (int p = 0; p < kPasses; ++p) {
+            uint32_t tail = 0, sum = 0;
+            while (tail != head) {
+                XECmd cmd;
+                uint32_t total;
+                XERingNext n = xe_ring_next(ring, cap, tail, head, &cmd, &total);
+                if (n == XE_RING_RECORD) {
+                    const uint8_t* payload = ring + xe_ring_off(tail, cap) + sizeof(XECmd);
+                    uint32_t first, last;
+                    memcpy(&first, payload, 4);
+                    memcpy(&last, payload + cmd.bytes - 4, 4);
+                    sum += cmd.opcode + first + last;
+                } else if (n == XE_RING_BAD) {
+                    break;
+                }
+                tail += total;
+            }
+            sink = sum;
+        }
+        double inPlace = (xe_now_ns() - t0) / ((double)kPasses * records);
+
+        t0 = xe_now_ns();
+        for (int p = 0; p < kPasses; ++p) {
+            uint32_t tail = 0, sum = 0;
+            while (tail != head) {
+                auto copyOut = [&](uint32_t at, void* dst, uint32_t bytes) {
+                    uint32_t off = at % cap, first = bytes < cap - off ? bytes : cap - off;
+                    memcpy(dst, ring + off, first);
+                    if (first < bytes) memcpy((uint8_t*)dst + first, ring, bytes - first);
+                };
+                XECmd cmd;
+                copyOut(tail, &cmd, sizeof(cmd));
+                if (cmd.opcode == XE_CMD_WRAP) {
+                    tail += cap - tail % cap;
+                    continue;
+                }
+                uint8_t payloadBuf[256];
+                if (cmd.bytes > sizeof(payloadBuf)) break;
+                copyOut(tail + sizeof(cmd), payloadBuf, cmd.bytes);
+                uint32_t first, last;
+                memcpy(&first, payloadBuf, 4);
+                memcpy(&last, payloadBuf + cmd.bytes - 4, 4);
+                sum += cmd.opcode + first + last;
+                tail += xe_align(sizeof(cmd) + cmd.bytes);
+            }
+            sink = sum;
+        }
+        double copied = (xe_now_ns() - t0) / ((double)kPasses * records);
+        (void)sink;
+
+        printf("  decode %-7s (%3u B a record): in place %5.2f ns, copied out %5.2f ns\n",
+               mix.name, head / records, inPlace, copied);
+    }
+    free(ring);
+}
+
+static void run(uint32_t cap, uint32_t count, uint32_t maxBytes)
+{
+    if (maxBytes > xe_ring_max_record(cap) - sizeof(XECmd))
+        maxBytes = xe_ring_max_record(cap) - sizeof(XECmd);
+
+    Ring ring;
+    memset(&ring.hdr, 0, sizeof(ring.hdr));
+    ring.hdr.magic = XE_MAGIC;
+    ring.hdr.version = XE_VERSION;
+    ring.hdr.capacity = cap;
+    ring.cap = cap;
+    ring.base = (uint8_t*)aligned_alloc(XE_CACHELINE, cap);
+    memset(ring.base, 0xCC, cap);
+
+    uint32_t got = 0;
+    double t0 = xe_now_ns();
+    std::thread consumer([&] { got = consume(&ring, count); });
+    produce(&ring, count, maxBytes);
+    consumer.join();
+    double ns = xe_now_ns() - t0;
+
+    XE_CHECK_EQ(got, count);
+    XE_CHECK_EQ(xe_load_acquire(&ring.hdr.tail), xe_load_acquire(&ring.hdr.head));
+    printf("  cap %7u B, payload <= %5u B: %8u records, %6.2f Mrec/s\n",
+           cap, maxBytes, count, count / ns * 1e3);
+    free(ring.base);
+}
+
+int main()
+{
+    checkDecode();
+    checkLimit(256);
+    checkLimit(XE_RING_MIN_BYTES);
+
+    // Tiny ring: nearly every record wraps or waits on the consumer
+    run(256, 100000, 128);
+    // The ring sizes kAccelSel_CreateRing hands out
+    run(XE_RING_MIN_BYTES, 300000, 4096);
+    run(XE_RING_MAX_BYTES, 300000, 16384);
+    benchDecode();
+    return xe_test_result("test_ring");
+}
@@ -0,0 +1,201 @@
+//
+// XESlabCache: objects come back zeroed, never handed out twice, freed
+// ones return to their slab, and threads sharing the cache don't trip
+// over each other. Then alloc/free throughput and memory held after a
+// fragmenting workload, against calloc/free.
+//
+
+#include "FakeIrisXESlab.hpp"
+#include "xe_test.h"
+
+#include <set>
+#include <thread>
+#include <vector>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#endif
+
+static const uint32_t kObjSize = 48;      // about an XEContext header
+
+struct Rng {
+    uint32_t s;
+    uint32_t next() { s ^= s << 13; s ^= s >> 17; s ^= s << 5; return s; }
+};
+
+static void checkSingle()
+{
+    XESlabCache c;
+    XE_CHECK(!c.init(0, "zero"));
+    XE_CHECK(!c.init(XESlabCache::kSlabBytes, "huge"));
+    XE_CHECK(c.init(kObjSize, "test"));
+
+    Rng r { 1 };
+    std::vector<void*> live;
+    std::set<void*> seen;
+    uint32_t dirty = 0, dup = 0, misaligned = 0;
+
+    for (int i = 0; i < 200000; ++i) {
+        if (live.empty() || r.next() % 2) {
+            uint8_t* p = (uint8_t*)c.alloc();
+            XE_CHECK(p != nullptr);
+            for (uint32_t k = 0; k < kObjSize; ++k) dirty += p[k] != 0;
+            dup += !seen.insert(p).second;
+            misaligned += ((uintptr_t)p & 15) != 0;
+            memset(p, 0xAB, kObjSize);
+            live.push_back(p);
+        } else {
+            size_t k = r.next() % live.size();
+            seen.erase(live[k]);
+            c.free(live[k]);
+            live[k] = live.back();
+            live.pop_back();
+        }
+        XE_CHECK_EQ(c.inUse(), live.size());
+    }
+    XE_CHECK_EQ(dirty, 0);
+    XE_CHECK_EQ(dup, 0);
+    XE_CHECK_EQ(misaligned, 0);
+
+    // Not ours: ignored
+    static uint8_t stray[XESlabCache::kSlabBytes * 2] __attribute__((aligned(4096)));
+    c.free(stray + 64);
+    c.free(nullptr);
+
+    for (void* p : live) c.free(p);
+    XE_CHECK_EQ(c.inUse(), 0);
+    c.destroy();
+    XE_CHECK_EQ(xe_shim_aligned_bytes, 0);
+}
+
+// Each thread churns its own objects and frees a share of another's
+static void checkThreads()
+{
+    XESlabCache c;
+    c.init(kObjSize, "threads");
+
+    const int kThreads = 4;
+    std::vector<void*> handoff[kThreads];
+    uint32_t bad[kThreads] = {};
+
+    std::vector<std::thread> th;
+    for (int t = 0; t < kThreads; ++t)
+        th.emplace_back([&, t] {
+            Rng r { (uint32_t)t + 1 };
+            std::vector<void*> mine;
+            for (int i = 0; i < 100000; ++i) {
+                if (mine.size() < 256 && (mine.empty() || r.next() % 2)) {
+                    uint32_t* p = (uint32_t*)c.alloc();
+                    bad[t] += p[0] != 0;
+                    p[0] = 0x1000u + t;
+                    mine.push_back(p);
+                } else {
+                    size_t k = r.next() % mine.size();
+                    bad[t] += *(uint32_t*)mine[k] != 0x1000u + t;
+                    c.free(mine[k]);
+                    mine[k] = mine.back();
+                    mine.pop_back();
+                }
+            }
+            handoff[t] = mine;
+        });
+    for (auto& x : th) x.join();
+
+    // Freed by a thread that didn't allocate them
+    std::thread([&] { for (auto& v : handoff) for (void* p : v) c.free(p); }).join();
+
+    for (int t = 0; t < kThreads; ++t) XE_CHECK_EQ(bad[t], 0);
+    XE_CHECK_EQ(c.inUse(), 0);
+}
+
+// Bytes the allocator holds from the system
+static size_t mallocHeld()
+{
+#if defined(__GLIBC__)
+    struct mallinfo2 mi = mallinfo2();
+    return mi.arena + mi.hblkhd;
+#elif defined(__APPLE__)
+    malloc_statistics_t st;
+    malloc_zone_statistics(nullptr, &st);
+    return st.size_allocated;
+#else
+    return 0;
+#endif
+}
+
+static void benchThroughput(bool slab, int threads)
+{
+    const int kOps = 1000000;
+    XESlabCache c;
+    c.init(kObjSize, "bench");
+
+    double t0 = xe_now_ns();
+    std::vector<std::thread> th;
+    for (int t = 0; t < threads; ++t)
+        th.emplace_back([&, t] {
+            Rng r { (uint32_t)t + 7 };
+            std::vector<void*> mine;
+            mine.reserve(512);
+            for (int i = 0; i < kOps; ++i) {
+                if (mine.size() < 512 && (mine.empty() || r.next() % 2)) {
+                    mine.push_back(slab ? c.alloc() : calloc(1, kObjSize));
+                } else {
+                    size_t k = r.next() % mine.size();
+                    if (slab) c.free(mine[k]); else free(mine[k]);
+                    mine[k] = mine.back();
+                    mine.pop_back();
+                }
+            }
+            for (void* p : mine) { if (slab) c.free(p); else free(p); }
+        });
+    for (auto& x : th) x.join();
+    double ns = (xe_now_ns() - t0) / ((double)kOps * threads);
+
+    printf("  %-6s %d thread(s): %5.1f ns/op\n", slab ? "slab" : "calloc", threads, ns);
+}
+
+// Allocate a lot, free a random 90%: how much memory is still held per
+// object that's left
+static void benchFragmentation(bool slab)
+{
+    const uint32_t kObjs = 200000;
+    XESlabCache c;
+    c.init(kObjSize, "frag");
+    Rng r { 99 };
+
+    size_t before = slab ? xe_shim_aligned_bytes : mallocHeld();
+    std::vector<void*> objs(kObjs);
+    for (auto& p : objs) p = slab ? c.alloc() : calloc(1, kObjSize);
+    size_t full = (slab ? xe_shim_aligned_bytes : mallocHeld()) - before;
+
+    uint32_t kept = 0;
+    for (auto& p : objs) {
+        if (r.next() % 10) {
+            if (slab) c.free(p); else free(p);
+            p = nullptr;
+        } else {
+            ++kept;
+        }
+    }
+    size_t after = (slab ? xe_shim_aligned_bytes : mallocHeld()) - before;
+
+    printf("  %-6s %u objects: %5.1f B/object; 10%% kept: %6.1f B/object\n",
+           slab ? "slab" : "calloc", kObjs, (double)full / kObjs, (double)after / kept);
+
+    for (void* p : objs) { if (slab) c.free(p); else free(p); }
+}
+
+int main()
+{
+    checkSingle();
+    checkThreads();
+    for (int t : { 1, 4 }) {
+        benchThroughput(true, t);
+        benchThroughput(false, t);
+    }
+    benchFragmentation(true);
+    benchFragmentation(false);
+    return xe_test_result("test_slab");
+}